@@ -43,10 +43,15 @@ void aica_stop( void );
 void aica_save_state( FILE *f );
 int aica_load_state( FILE *f );
 uint32_t aica_run_slice( uint32_t );
+uint32_t aica_next_deadline( void );
 
 struct dreamcast_module aica_module = { "AICA", aica_init, aica_reset, 
         aica_start, aica_run_slice, aica_stop,
-        aica_save_state, aica_load_state };
+        aica_save_state, aica_load_state, aica_next_deadline };
+
+/* Slice length while the ARM has an interrupt outstanding - it's usually
+ * exchanging data with the SH4 at that point */
+#define AICA_IRQ_TIMESLICE_LENGTH 250000 /* nanoseconds */
 
 struct aica_state_struct {
     uint32_t time_of_day;
@@ -113,6 +118,21 @@ uint32_t aica_run_slice( uint32_t nanosecs )
     return nanosecs;
 }
 
+/**
+ * The ARM only executes at slice boundaries, so keep the slices short enough
+ * to keep it in step with the SH4 while it's running.
+ */
+uint32_t aica_next_deadline( void )
+{
+    if( (MMIO_READ( AICA2, AICA_RESET ) & 1) != 0 ) {
+        return NO_DEADLINE;
+    } else if( aica_state.event_pending != 0 ) {
+        return AICA_IRQ_TIMESLICE_LENGTH;
+    } else {
+        return DEFAULT_TIMESLICE_LENGTH;
+    }
+}
+
 void aica_stop( void )
 {
     audio_stop_driver();
@@ -22,6 +22,7 @@
 #include "clock.h"
 #include "mem.h"
 #include "aica/armcore.h"
+#include "aica/armtrans.h"
 #include "aica/aica.h"
 
 #define STM_R15_OFFSET 12
@@ -53,6 +54,15 @@ uint32_t arm_cpu_period = 1000 / ARM_BASE_RATE;
 
 static struct breakpoint_struct arm_breakpoints[MAX_BREAKPOINTS];
 static int arm_breakpoint_count = 0;
+static gboolean arm_use_translator = FALSE;
+
+void arm_set_translate( gboolean flag )
+{
+    // No-op if the translator was not built
+#ifdef SH4_TRANSLATOR
+    arm_use_translator = flag && arm_translate_init();
+#endif
+}
 
 void arm_set_breakpoint( uint32_t pc, breakpoint_type_t type )
 {
@@ -97,6 +107,13 @@ uint32_t arm_run_slice( uint32_t num_samples )
         return num_samples;
 
     for( i=0; i<num_samples; i++ ) {
+#ifdef SH4_TRANSLATOR
+        /* Breakpoints are only checked by the interpreter */
+        if( arm_use_translator && arm_breakpoint_count == 0 ) {
+            if( !arm_translate_run( CYCLES_PER_SAMPLE ) )
+                return i;
+        } else
+#endif
         for( j=0; j < CYCLES_PER_SAMPLE; j++ ) {
             armr.icount++;
             if( !arm_execute_instruction() )
@@ -96,6 +96,12 @@ void arm_set_breakpoint( uint32_t pc, breakpoint_type_t type );
 gboolean arm_clear_breakpoint( uint32_t pc, breakpoint_type_t type );
 int arm_get_breakpoint( uint32_t pc );
 
+/**
+ * Enable/disable the ARM translator (see armtrans.h). Default is disabled,
+ * and it's only available when the SH4 translator is built.
+ */
+void arm_set_translate( gboolean flag );
+
 /* ARM Memory */
 uint32_t arm_read_long( uint32_t addr );
 uint32_t arm_read_word( uint32_t addr );
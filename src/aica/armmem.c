@@ -22,6 +22,8 @@
 #include "aica.h"
 #include "asic.h"
 #include "armcore.h"
+#include "armtrans.h"
+#include "xlat/xltcache.h"
 
 unsigned char aica_main_ram[2 MB];
 unsigned char aica_scratch_ram[8 KB];
@@ -43,16 +45,19 @@ static int32_t FASTCALL ext_audioram_read_byte( sh4addr_t addr )
 static void FASTCALL ext_audioram_write_long( sh4addr_t addr, uint32_t val )
 {
     *(uint32_t *)(aica_main_ram + (addr&0x001FFFFF)) = val;
+    xlat_invalidate_long(ARM_XLAT_ADDR(addr));
     asic_g2_write_word();
 }
 static void FASTCALL ext_audioram_write_word( sh4addr_t addr, uint32_t val )
 {
     *(uint16_t *)(aica_main_ram + (addr&0x001FFFFF)) = (uint16_t)val;
+    xlat_invalidate_word(ARM_XLAT_ADDR(addr));
     asic_g2_write_word();
 }
 static void FASTCALL ext_audioram_write_byte( sh4addr_t addr, uint32_t val )
 {
     *(uint8_t *)(aica_main_ram + (addr&0x001FFFFF)) = (uint8_t)val;
+    xlat_invalidate_word(ARM_XLAT_ADDR(addr));
     asic_g2_write_word();
 }
 static void FASTCALL ext_audioram_read_burst( unsigned char *dest, sh4addr_t addr )
@@ -62,6 +67,7 @@ static void FASTCALL ext_audioram_read_burst( unsigned char *dest, sh4addr_t add
 static void FASTCALL ext_audioram_write_burst( sh4addr_t addr, unsigned char *src )
 {
     memcpy( aica_main_ram+(addr&0x001FFFFF), src, 32 );
+    xlat_invalidate_block( ARM_XLAT_ADDR(addr), 32 );
 }
 
 struct mem_region_fn mem_region_audioram = { ext_audioram_read_long, ext_audioram_write_long, 
@@ -160,6 +166,7 @@ void arm_write_long( uint32_t addr, uint32_t value )
     if( addr < 0x00200000 ) {
         /* Main sound ram */
         *(uint32_t *)(aica_main_ram + addr) = value;
+        xlat_invalidate_long(ARM_XLAT_ADDR(addr));
     } else {
         switch( addr & 0xFFFFF000 ) {
         case 0x00800000:
@@ -206,6 +213,7 @@ void arm_write_word( uint32_t addr, uint32_t value )
 {
 	if( addr < 0x00200000 ) {
         *(uint16_t *)(aica_main_ram + addr) = (uint16_t)value;
+        xlat_invalidate_word(ARM_XLAT_ADDR(addr));
 	} else {
 		
 	}
@@ -215,6 +223,7 @@ void arm_write_byte( uint32_t addr, uint32_t value )
     if( addr < 0x00200000 ) {
         /* Main sound ram */
         *(uint8_t *)(aica_main_ram + addr) = (uint8_t)value;
+        xlat_invalidate_word(ARM_XLAT_ADDR(addr));
     } else {
         uint32_t tmp;
         switch( addr & 0xFFFFF000 ) {
@@ -283,6 +292,7 @@ size_t arm_write_phys( uint32_t addr, unsigned char *buf, size_t length ) {
             length = sizeof(aica_main_ram) - addr;
         }
         memcpy( &aica_main_ram[addr], buf, length );
+        xlat_invalidate_block( ARM_XLAT_ADDR(addr), length );
         return length;
     } else {
         return 0;
@@ -0,0 +1,800 @@
+/**
+ * $Id$
+ *
+ * ARM translation core. Translates basic blocks of ARM code to x86-64 using
+ * the common xlat cache and x86 emitter. The common data processing, load/
+ * store and branch instructions are translated directly, and everything else
+ * calls back into the interpreter (arm_execute_instruction()) one instruction
+ * at a time, so the translated code behaves exactly as the interpreter does,
+ * just faster. Registers aren't cached across instructions - everything is
+ * loaded from and stored back to armr as it's used.
+ *
+ * Blocks are keyed by the SH4 address of the ARM code (see ARM_XLAT_ADDR), so
+ * they're invalidated along with any SH4 code when the sound RAM is written.
+ *
+ * Copyright (c) 2005 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#define MODULE aica_module
+#include <assert.h>
+#include <stddef.h>
+#include "dream.h"
+#include "aica/aica.h"
+#include "aica/armcore.h"
+#include "aica/armtrans.h"
+#include "sh4/sh4trans.h"
+#include "xlat/xltcache.h"
+#include "xlat/x86/x86op.h"
+
+#if SIZEOF_VOID_P == 8
+
+/** Maximum size of a translated instruction, in bytes (including its exits) */
+#define ARM_MAX_INSTRUCTION_SIZE 256
+
+#define REG_OFFSET(reg) ((int)offsetof(struct arm_registers, reg))
+#define R_OFFSET(n) (REG_OFFSET(r) + ((n)<<2))
+
+/* Instruction fields (as armcore.c) */
+#define COND(ir) (ir>>28)
+#define GRP(ir) ((ir>>26)&0x03)
+#define IFLAG(ir) (ir&0x02000000)
+#define SFLAG(ir) (ir&0x00100000)
+#define PFLAG(ir) (ir&0x01000000)
+#define UFLAG(ir) (ir&0x00800000)
+#define BFLAG(ir) (ir&0x00400000)
+#define WFLAG(ir) (ir&0x00200000)
+#define LFLAG(ir) SFLAG(ir)
+#define RNn(ir) ((ir>>16)&0x0F)
+#define RDn(ir) ((ir>>12)&0x0F)
+#define RMn(ir) (ir&0x0F)
+#define IMM8(ir) (ir&0xFF)
+#define IMM12(ir) (ir&0xFFF)
+#define SHIFTIMM(ir) ((ir>>7)&0x1F)
+#define IMMROT(ir) ((ir>>7)&0x1E)
+#define SHIFT(ir) ((ir>>4)&0x07)
+#define DPOP(ir) ((ir>>21)&0x0F)
+#define SIGNEXT24(n) (((n)&0x00800000) ? ((n)|0xFF000000) : ((n)&0x00FFFFFF))
+
+#define DP_AND 0
+#define DP_EOR 1
+#define DP_SUB 2
+#define DP_RSB 3
+#define DP_ADD 4
+#define DP_ADC 5
+#define DP_SBC 6
+#define DP_RSC 7
+#define DP_TST 8
+#define DP_TEQ 9
+#define DP_CMP 10
+#define DP_CMN 11
+#define DP_ORR 12
+#define DP_MOV 13
+#define DP_BIC 14
+#define DP_MVN 15
+
+/* Logical ops set C from the shifter when the S flag is set */
+#define DP_IS_LOGICAL(op) ((0xF303 >> (op)) & 1)
+/* Test ops don't write Rd */
+#define DP_IS_TEST(op) ((op) >= DP_TST && (op) <= DP_CMN)
+
+/* Source of the shifter carry-out in translated code */
+#define CARRY_SAME 0  /* Unchanged (C flag keeps its current value) */
+#define CARRY_CONST 1 /* Known at translation time */
+#define CARRY_EDX 2   /* Computed into EDX */
+
+/* PC value passed to arm_translate_exit() when armr.r[15] is already set */
+#define PC_DYNAMIC 0xFFFFFFFF
+
+/** Start and end (exclusive) of the block being translated */
+static uint32_t arm_xlat_start, arm_xlat_end;
+
+/** Number of instructions run past the end of the last arm_translate_run() */
+static int32_t arm_xlat_overrun = 0;
+
+gboolean arm_translate_init( void )
+{
+    return TRUE;
+}
+
+static uint32_t arm_translate_fetch( uint32_t pc )
+{
+    return *(uint32_t *)(aica_main_ram + pc);
+}
+
+/**
+ * Emit a forward conditional jump.
+ * @return the mark to pass to arm_translate_target()
+ */
+static uint8_t *arm_translate_jcc( int cc )
+{
+    JCC_cc_rel32( cc, 0 );
+    return xlat_output;
+}
+
+static uint8_t *arm_translate_jmp( void )
+{
+    JMP_rel32( 0 );
+    return xlat_output;
+}
+
+/** Point the forward jump at mark to the current output position */
+static void arm_translate_target( uint8_t *mark )
+{
+    *(((int32_t *)mark)-1) = (int32_t)(xlat_output - mark);
+}
+
+static void arm_translate_call( void *fn )
+{
+    MOVQ_imm64_r64( (uintptr_t)fn, REG_RAX );
+    CALL_r32( REG_RAX );
+}
+
+static void arm_translate_prologue( void )
+{
+    PUSH_r32( REG_RBP );
+    PUSH_r32( REG_RBX );
+    SUBQ_imms_r64( 8, REG_RSP );
+    MOVQ_imm64_r64( (uintptr_t)&armr, REG_RBP );
+}
+
+/**
+ * Leave the block, returning result.
+ * @param pc new value of r15, or PC_DYNAMIC if it's already set
+ * @param icount number of instructions executed in the block
+ */
+static void arm_translate_exit( uint32_t pc, uint32_t icount, gboolean result )
+{
+    if( pc != PC_DYNAMIC ) {
+        MOVL_imm32_rbpdisp( pc, R_OFFSET(15) );
+    }
+    ADDL_imms_rbpdisp( icount, REG_OFFSET(icount) );
+    MOVL_imm32_r32( result, REG_EAX );
+    ADDQ_imms_r64( 8, REG_RSP );
+    POP_r32( REG_RBX );
+    POP_r32( REG_RBP );
+    RET();
+}
+
+/**
+ * Emit the condition test for the instruction, as a list of jumps to be
+ * taken if the condition fails.
+ * @return the number of jumps (0 for AL)
+ */
+static int arm_translate_cond( uint32_t ir, uint8_t **skip )
+{
+    uint8_t *pass;
+    /* Flags are tested the same way as the interpreter, ie as non-zero
+     * values, with N and V compared directly for GE/LT/GT/LE */
+    switch( COND(ir) ) {
+    case 0: /* EQ */
+        CMPL_imms_rbpdisp( 0, REG_OFFSET(z) );
+        skip[0] = arm_translate_jcc( X86_COND_E );
+        return 1;
+    case 1: /* NE */
+        CMPL_imms_rbpdisp( 0, REG_OFFSET(z) );
+        skip[0] = arm_translate_jcc( X86_COND_NE );
+        return 1;
+    case 2: /* CS/HS */
+        CMPL_imms_rbpdisp( 0, REG_OFFSET(c) );
+        skip[0] = arm_translate_jcc( X86_COND_E );
+        return 1;
+    case 3: /* CC/LO */
+        CMPL_imms_rbpdisp( 0, REG_OFFSET(c) );
+        skip[0] = arm_translate_jcc( X86_COND_NE );
+        return 1;
+    case 4: /* MI */
+        CMPL_imms_rbpdisp( 0, REG_OFFSET(n) );
+        skip[0] = arm_translate_jcc( X86_COND_E );
+        return 1;
+    case 5: /* PL */
+        CMPL_imms_rbpdisp( 0, REG_OFFSET(n) );
+        skip[0] = arm_translate_jcc( X86_COND_NE );
+        return 1;
+    case 6: /* VS */
+        CMPL_imms_rbpdisp( 0, REG_OFFSET(v) );
+        skip[0] = arm_translate_jcc( X86_COND_E );
+        return 1;
+    case 7: /* VC */
+        CMPL_imms_rbpdisp( 0, REG_OFFSET(v) );
+        skip[0] = arm_translate_jcc( X86_COND_NE );
+        return 1;
+    case 8: /* HI */
+        CMPL_imms_rbpdisp( 0, REG_OFFSET(c) );
+        skip[0] = arm_translate_jcc( X86_COND_E );
+        CMPL_imms_rbpdisp( 0, REG_OFFSET(z) );
+        skip[1] = arm_translate_jcc( X86_COND_NE );
+        return 2;
+    case 9: /* LS */
+        CMPL_imms_rbpdisp( 0, REG_OFFSET(c) );
+        pass = arm_translate_jcc( X86_COND_E );
+        CMPL_imms_rbpdisp( 0, REG_OFFSET(z) );
+        skip[0] = arm_translate_jcc( X86_COND_E );
+        arm_translate_target( pass );
+        return 1;
+    case 10: /* GE */
+        MOVL_rbpdisp_r32( REG_OFFSET(n), REG_EAX );
+        CMPL_rbpdisp_r32( REG_OFFSET(v), REG_EAX );
+        skip[0] = arm_translate_jcc( X86_COND_NE );
+        return 1;
+    case 11: /* LT */
+        MOVL_rbpdisp_r32( REG_OFFSET(n), REG_EAX );
+        CMPL_rbpdisp_r32( REG_OFFSET(v), REG_EAX );
+        skip[0] = arm_translate_jcc( X86_COND_E );
+        return 1;
+    case 12: /* GT */
+        CMPL_imms_rbpdisp( 0, REG_OFFSET(z) );
+        skip[0] = arm_translate_jcc( X86_COND_NE );
+        MOVL_rbpdisp_r32( REG_OFFSET(n), REG_EAX );
+        CMPL_rbpdisp_r32( REG_OFFSET(v), REG_EAX );
+        skip[1] = arm_translate_jcc( X86_COND_NE );
+        return 2;
+    case 13: /* LE */
+        CMPL_imms_rbpdisp( 0, REG_OFFSET(z) );
+        pass = arm_translate_jcc( X86_COND_NE );
+        MOVL_rbpdisp_r32( REG_OFFSET(n), REG_EAX );
+        CMPL_rbpdisp_r32( REG_OFFSET(v), REG_EAX );
+        skip[0] = arm_translate_jcc( X86_COND_E );
+        arm_translate_target( pass );
+        return 1;
+    default: /* AL */
+        return 0;
+    }
+}
+
+static gboolean arm_translate_is_native( uint32_t ir );
+
+/**
+ * @return TRUE if the instruction (may) write r15 or raise an exception,
+ * and so ends the block. Stores left to the interpreter also end the block,
+ * as only the translated stores check for writes into the block itself.
+ */
+static gboolean arm_translate_ends_block( uint32_t ir )
+{
+    if( COND(ir) == 15 ) {
+        return TRUE; /* Undefined */
+    }
+    switch( GRP(ir) ) {
+    case 0:
+        if( (ir & 0x0FF000F0) == 0x01200010 ) {
+            return TRUE; /* BX */
+        } else if( (ir & 0x0E000090) == 0x00000090 ) {
+            if( ir & 0x60 ) {
+                return !LFLAG(ir); /* STRH */
+            }
+            return (ir & 0x0FB00FF0) == 0x01000090; /* SWP */
+        } else if( (ir & 0x0D900000) == 0x01000000 ) {
+            return FALSE;
+        }
+        return RDn(ir) == 15 && !DP_IS_TEST(DPOP(ir));
+    case 1:
+        if( LFLAG(ir) ) {
+            return RDn(ir) == 15;
+        }
+        return !arm_translate_is_native(ir);
+    case 2:
+        return IFLAG(ir) || !LFLAG(ir) || (ir & 0x8000);
+    default:
+        return TRUE; /* SWI or unimplemented */
+    }
+}
+
+/**
+ * @return TRUE if the instruction is translated directly, or FALSE if it's
+ * left to the interpreter.
+ */
+static gboolean arm_translate_is_native( uint32_t ir )
+{
+    if( COND(ir) == 15 ) {
+        return FALSE;
+    }
+    switch( GRP(ir) ) {
+    case 0:
+        if( (ir & 0x0D900000) == 0x01000000 || (ir & 0x0E000090) == 0x00000090 ) {
+            return FALSE; /* Misc and extension instructions */
+        }
+        if( RDn(ir) == 15 ) {
+            return FALSE;
+        }
+        if( SFLAG(ir) && DPOP(ir) >= DP_ADC && DPOP(ir) <= DP_RSC ) {
+            return FALSE;
+        }
+        if( !IFLAG(ir) && ((ir & 0x10) || SHIFT(ir) == 6) ) {
+            return FALSE; /* Register shift, ROR or RRX */
+        }
+        return TRUE;
+    case 1:
+        if( IFLAG(ir) || RDn(ir) == 15 ) {
+            return FALSE;
+        }
+        if( !PFLAG(ir) && WFLAG(ir) ) {
+            return FALSE; /* LDRT/STRT */
+        }
+        if( RNn(ir) == 15 && (WFLAG(ir) || !PFLAG(ir)) ) {
+            return FALSE;
+        }
+        return TRUE;
+    case 2:
+        return IFLAG(ir) != 0; /* B/BL */
+    default:
+        return FALSE;
+    }
+}
+
+/**
+ * Load the value of register rn (as an operand) into the x86 register. Reads
+ * of r15 give the address of the instruction + 8.
+ */
+static void arm_translate_load_reg( uint32_t pc, int rn, int x86reg )
+{
+    if( rn == 15 ) {
+        MOVL_imm32_r32( pc + 8, x86reg );
+    } else {
+        MOVL_rbpdisp_r32( R_OFFSET(rn), x86reg );
+    }
+}
+
+/**
+ * Emit the checks following a call out of translated code, which leave the
+ * block if the call changed r15 (eg a branch in the interpreter, or the ARM
+ * being reset), or left an interrupt pending. r15 must already hold pc+4.
+ * @return the number of exit jumps added to exits
+ */
+static int arm_translate_call_checks( uint32_t pc, uint8_t **exits )
+{
+    CMPL_imms_rbpdisp( pc + 4, R_OFFSET(15) );
+    exits[0] = arm_translate_jcc( X86_COND_NE );
+    MOVL_rbpdisp_r32( REG_OFFSET(cpsr), REG_EAX );
+    NOTL_r32( REG_EAX );
+    ANDL_rbpdisp_r32( REG_OFFSET(int_pending), REG_EAX );
+    exits[1] = arm_translate_jcc( X86_COND_NE );
+    return 2;
+}
+
+/**
+ * Emit the shared exit for the given list of jumps, continuing with the
+ * block otherwise.
+ */
+static void arm_translate_call_exits( uint8_t **exits, int count, uint32_t icount )
+{
+    int i;
+    uint8_t *cont = arm_translate_jmp();
+    for( i=0; i<count; i++ ) {
+        arm_translate_target( exits[i] );
+    }
+    arm_translate_exit( PC_DYNAMIC, icount, TRUE );
+    arm_translate_target( cont );
+}
+
+/**
+ * Shifter operand for a data processing instruction, into ECX. Matches
+ * arm_get_shift_operand() (or arm_get_shift_operand_s() when setcarry is
+ * TRUE), including the difference between the two for LSR #0.
+ * @return the CARRY_* source of the carry out
+ */
+static int arm_translate_shift_operand( uint32_t pc, uint32_t ir, gboolean setcarry, uint32_t *carry )
+{
+    uint32_t tmp;
+    if( IFLAG(ir) ) {
+        uint32_t rot = IMMROT(ir);
+        uint32_t operand = IMM8(ir);
+        if( rot != 0 ) {
+            operand = (operand >> rot) | (operand << (32-rot));
+        }
+        MOVL_imm32_r32( operand, REG_ECX );
+        *carry = operand >> 31;
+        return rot == 0 ? CARRY_SAME : CARRY_CONST;
+    }
+
+    arm_translate_load_reg( pc, RMn(ir), REG_ECX );
+    tmp = SHIFTIMM(ir);
+    if( !setcarry ) {
+        switch( SHIFT(ir) ) {
+        case 0: /* (Rm << imm) */
+            if( tmp != 0 ) {
+                SHLL_imm_r32( tmp, REG_ECX );
+            }
+            break;
+        case 2: /* (Rm >> imm) */
+            if( tmp != 0 ) {
+                SHRL_imm_r32( tmp, REG_ECX );
+            }
+            break;
+        case 4: /* (Rm >>> imm) */
+            if( tmp == 0 ) {
+                SARL_imm_r32( 31, REG_ECX );
+            } else {
+                SARL_imm_r32( tmp, REG_ECX );
+            }
+            break;
+        }
+        return CARRY_SAME;
+    }
+
+    switch( SHIFT(ir) ) {
+    case 0: /* (Rm << imm) */
+        if( tmp == 0 ) {
+            return CARRY_SAME;
+        }
+        MOVL_r32_r32( REG_ECX, REG_EDX );
+        SHRL_imm_r32( 32-tmp, REG_EDX );
+        ANDL_imms_r32( 1, REG_EDX );
+        SHLL_imm_r32( tmp, REG_ECX );
+        break;
+    case 2: /* (Rm >> imm) */
+        MOVL_r32_r32( REG_ECX, REG_EDX );
+        if( tmp == 0 ) {
+            SHRL_imm_r32( 31, REG_EDX );
+            XORL_r32_r32( REG_ECX, REG_ECX );
+        } else {
+            if( tmp > 1 ) {
+                SHRL_imm_r32( tmp-1, REG_EDX );
+            }
+            ANDL_imms_r32( 1, REG_EDX );
+            SHRL_imm_r32( tmp, REG_ECX );
+        }
+        break;
+    case 4: /* (Rm >>> imm) */
+        MOVL_r32_r32( REG_ECX, REG_EDX );
+        if( tmp == 0 ) {
+            SHRL_imm_r32( 31, REG_EDX );
+            SARL_imm_r32( 31, REG_ECX );
+        } else {
+            if( tmp > 1 ) {
+                SHRL_imm_r32( tmp-1, REG_EDX );
+            }
+            ANDL_imms_r32( 1, REG_EDX );
+            SARL_imm_r32( tmp, REG_ECX );
+        }
+        break;
+    }
+    return CARRY_EDX;
+}
+
+/**
+ * Data processing instruction, with the same flag results as the
+ * interpreter (note in particular its V flag for additions).
+ */
+static void arm_translate_data_processing( uint32_t pc, uint32_t ir )
+{
+    int op = DPOP(ir);
+    gboolean logical_s = SFLAG(ir) && DP_IS_LOGICAL(op);
+    uint32_t carry;
+    int carry_src = arm_translate_shift_operand( pc, ir, logical_s, &carry );
+
+    if( op != DP_MOV && op != DP_MVN ) {
+        arm_translate_load_reg( pc, RNn(ir), REG_EAX );
+    }
+
+    switch( op ) {
+    case DP_AND: case DP_TST:
+        ANDL_r32_r32( REG_ECX, REG_EAX );
+        break;
+    case DP_EOR: case DP_TEQ:
+        XORL_r32_r32( REG_ECX, REG_EAX );
+        break;
+    case DP_SUB: case DP_CMP:
+        SUBL_r32_r32( REG_ECX, REG_EAX );
+        break;
+    case DP_RSB:
+        SUBL_r32_r32( REG_EAX, REG_ECX );
+        break;
+    case DP_ADD: case DP_CMN:
+        if( SFLAG(ir) ) {
+            MOVL_r32_r32( REG_EAX, REG_EBX );
+            ANDL_r32_r32( REG_ECX, REG_EBX );
+            MOVL_r32_r32( REG_EAX, REG_EDX );
+        }
+        ADDL_r32_r32( REG_ECX, REG_EAX );
+        break;
+    case DP_ADC:
+        MOVL_rbpdisp_r32( REG_OFFSET(c), REG_EDX );
+        NEGL_r32( REG_EDX ); /* CF = (c != 0) */
+        ADCL_r32_r32( REG_ECX, REG_EAX );
+        break;
+    case DP_SBC:
+        MOVL_rbpdisp_r32( REG_OFFSET(c), REG_EDX );
+        NEGL_r32( REG_EDX );
+        CMC();
+        SBBL_r32_r32( REG_ECX, REG_EAX );
+        break;
+    case DP_RSC:
+        MOVL_rbpdisp_r32( REG_OFFSET(c), REG_EDX );
+        NEGL_r32( REG_EDX );
+        CMC();
+        SBBL_r32_r32( REG_EAX, REG_ECX );
+        break;
+    case DP_ORR:
+        ORL_r32_r32( REG_ECX, REG_EAX );
+        break;
+    case DP_MOV:
+        break;
+    case DP_BIC:
+        NOTL_r32( REG_ECX );
+        ANDL_r32_r32( REG_ECX, REG_EAX );
+        break;
+    case DP_MVN:
+        NOTL_r32( REG_ECX );
+        break;
+    }
+
+    if( SFLAG(ir) ) {
+        switch( op ) {
+        case DP_SUB: case DP_RSB: case DP_CMP:
+            /* MOV leaves the flags alone */
+            MOVL_imm32_rbpdisp( 0, REG_OFFSET(c) );
+            SETCCB_cc_rbpdisp( X86_COND_AE, REG_OFFSET(c) );
+            MOVL_imm32_rbpdisp( 0, REG_OFFSET(v) );
+            SETCCB_cc_rbpdisp( X86_COND_O, REG_OFFSET(v) );
+            break;
+        case DP_ADD: case DP_CMN:
+            MOVL_imm32_rbpdisp( 0, REG_OFFSET(c) );
+            SETCCB_cc_rbpdisp( X86_COND_C, REG_OFFSET(c) );
+            /* v = ((op1 & op2) & (result ^ op1)) >> 31, where op1 is the
+             * shifter operand for ADDS and Rn for CMN */
+            if( op == DP_ADD ) {
+                MOVL_r32_r32( REG_EAX, REG_EDX );
+                XORL_r32_r32( REG_ECX, REG_EDX );
+            } else {
+                XORL_r32_r32( REG_EAX, REG_EDX );
+            }
+            ANDL_r32_r32( REG_EDX, REG_EBX );
+            SHRL_imm_r32( 31, REG_EBX );
+            MOVL_r32_rbpdisp( REG_EBX, REG_OFFSET(v) );
+            break;
+        default:
+            if( carry_src == CARRY_EDX ) {
+                MOVL_r32_rbpdisp( REG_EDX, REG_OFFSET(c) );
+            } else if( carry_src == CARRY_CONST ) {
+                MOVL_imm32_rbpdisp( carry, REG_OFFSET(c) );
+            }
+            break;
+        }
+    }
+
+    if( op == DP_RSB || op == DP_RSC || op == DP_MOV || op == DP_MVN ) {
+        MOVL_r32_r32( REG_ECX, REG_EAX );
+    }
+    if( !DP_IS_TEST(op) ) {
+        MOVL_r32_rbpdisp( REG_EAX, R_OFFSET(RDn(ir)) );
+    }
+    if( SFLAG(ir) ) {
+        MOVL_r32_r32( REG_EAX, REG_ECX );
+        SHRL_imm_r32( 31, REG_ECX );
+        MOVL_r32_rbpdisp( REG_ECX, REG_OFFSET(n) );
+        MOVL_imm32_rbpdisp( 0, REG_OFFSET(z) );
+        TESTL_r32_r32( REG_EAX, REG_EAX );
+        SETCCB_cc_rbpdisp( X86_COND_E, REG_OFFSET(z) );
+    }
+}
+
+/**
+ * LDR/STR/LDRB/STRB with an immediate offset. The address (and any
+ * writeback) is computed before Rd is read or written, as in the interpreter.
+ * Stores into the block itself end it, so the rest of the block doesn't run
+ * stale code.
+ */
+static void arm_translate_load_store( uint32_t pc, uint32_t ir, uint32_t icount )
+{
+    uint8_t *exits[3];
+    int count;
+    int32_t offset = UFLAG(ir) ? IMM12(ir) : -IMM12(ir);
+
+    arm_translate_load_reg( pc, RNn(ir), REG_EAX );
+    if( PFLAG(ir) ) {
+        if( offset != 0 ) {
+            ADDL_imms_r32( offset, REG_EAX );
+        }
+        if( WFLAG(ir) ) {
+            MOVL_r32_rbpdisp( REG_EAX, R_OFFSET(RNn(ir)) );
+        }
+    } else { /* Post-indexed */
+        LEAL_r32disp_r32( REG_EAX, offset, REG_ECX );
+        MOVL_r32_rbpdisp( REG_ECX, R_OFFSET(RNn(ir)) );
+    }
+    MOVL_imm32_rbpdisp( pc + 4, R_OFFSET(15) );
+    MOVL_r32_r32( REG_EAX, REG_EDI );
+    if( LFLAG(ir) ) {
+        arm_translate_call( BFLAG(ir) ? (void *)arm_read_byte : (void *)arm_read_long );
+        MOVL_r32_rbpdisp( REG_EAX, R_OFFSET(RDn(ir)) );
+        count = arm_translate_call_checks( pc, exits );
+    } else {
+        MOVL_rbpdisp_r32( R_OFFSET(RDn(ir)), REG_ESI );
+        MOVL_r32_r32( REG_EAX, REG_EBX );
+        arm_translate_call( BFLAG(ir) ? (void *)arm_write_byte : (void *)arm_write_long );
+        count = arm_translate_call_checks( pc, exits );
+        SUBL_imms_r32( arm_xlat_start, REG_EBX );
+        CMPL_imms_r32( arm_xlat_end - arm_xlat_start, REG_EBX );
+        exits[count++] = arm_translate_jcc( X86_COND_B );
+    }
+    arm_translate_call_exits( exits, count, icount );
+}
+
+/**
+ * Anything else is run by the interpreter.
+ */
+static void arm_translate_fallback( uint32_t pc, uint32_t icount )
+{
+    uint8_t *exits[2];
+    int count;
+
+    MOVL_imm32_rbpdisp( pc, R_OFFSET(15) );
+    arm_translate_call( (void *)arm_execute_instruction );
+    TESTL_r32_r32( REG_EAX, REG_EAX );
+    uint8_t *ok = arm_translate_jcc( X86_COND_NE );
+    arm_translate_exit( PC_DYNAMIC, icount, FALSE );
+    arm_translate_target( ok );
+    count = arm_translate_call_checks( pc, exits );
+    arm_translate_call_exits( exits, count, icount );
+}
+
+/**
+ * Translate the instruction at pc, the icount'th instruction of the block
+ * (counting from 1).
+ */
+static void arm_translate_instruction( uint32_t pc, uint32_t icount )
+{
+    uint32_t ir = arm_translate_fetch( pc );
+    uint8_t *skip[2];
+    int i, nskip;
+
+    if( !arm_translate_is_native(ir) ) {
+        arm_translate_fallback( pc, icount );
+        return;
+    }
+
+    nskip = arm_translate_cond( ir, skip );
+    switch( GRP(ir) ) {
+    case 0:
+        arm_translate_data_processing( pc, ir );
+        break;
+    case 1:
+        arm_translate_load_store( pc, ir, icount );
+        break;
+    case 2: /* B[L] */
+        if( ir & 0x01000000 ) {
+            MOVL_imm32_rbpdisp( pc + 4, R_OFFSET(14) );
+        }
+        arm_translate_exit( pc + 8 + (SIGNEXT24(ir&0x00FFFFFF) << 2), icount, TRUE );
+        break;
+    }
+    for( i=0; i<nskip; i++ ) {
+        arm_translate_target( skip[i] );
+    }
+}
+
+/**
+ * @return the end of the block starting at start, which stops at the end of
+ * the page (see xlat_flush_code_page), ARM_MAX_BLOCK_INSTRUCTIONS, or after
+ * the first instruction that may branch.
+ */
+static uint32_t arm_translate_get_endpc( uint32_t start )
+{
+    uint32_t pc = start;
+    uint32_t lastpc = MIN( (start & 0xFFFFF000) + 0x1000, start + ARM_MAX_BLOCK_INSTRUCTIONS*4 );
+    do {
+        uint32_t ir = arm_translate_fetch( pc );
+        pc += 4;
+        if( arm_translate_ends_block( ir ) ) {
+            break;
+        }
+    } while( pc < lastpc );
+    return pc;
+}
+
+/**
+ * Translate the block starting at start into the cache.
+ * @return the address of the translated block
+ */
+static void *arm_translate_block( uint32_t start )
+{
+    xlat_cache_block_t block;
+    uint32_t pc, icount = 0, size, fixup_size;
+    uint8_t *eob;
+
+    /* Keep the background SH4 translation (if any) out of the cache */
+    sh4_translate_lock();
+    arm_xlat_start = start;
+    arm_xlat_end = arm_translate_get_endpc( start );
+    block = xlat_start_block( ARM_XLAT_ADDR(start) );
+    xlat_output = block->code;
+    eob = block->code + block->size;
+
+    arm_translate_prologue();
+    for( pc = start; ; pc += 4 ) {
+        if( eob - xlat_output < ARM_MAX_INSTRUCTION_SIZE ) {
+            uint8_t *oldstart = block->code;
+            block = xlat_extend_block( xlat_output - oldstart + ARM_MAX_INSTRUCTION_SIZE );
+            xlat_output = block->code + (xlat_output - oldstart);
+            eob = block->code + block->size;
+        }
+        if( pc == arm_xlat_end ) {
+            break;
+        }
+        arm_translate_instruction( pc, ++icount );
+    }
+    arm_translate_exit( arm_xlat_end, icount, TRUE );
+
+    size = xlat_output - block->code;
+    fixup_size = xlat_get_fixup_table_size();
+    if( block->size < size + fixup_size ) {
+        block = xlat_extend_block( size + fixup_size );
+    }
+    xlat_write_fixup_table( size );
+    block->recover_table_offset = size;
+    block->recover_table_size = 0;
+    block->xlat_sh4_mode = ARM_XLAT_MODE;
+    xlat_commit_block( size + fixup_size, ARM_XLAT_ADDR(start), ARM_XLAT_ADDR(arm_xlat_end) );
+    sh4_translate_unlock();
+    return block->code;
+}
+
+static void *arm_translate_get_code( uint32_t pc )
+{
+    void *code = xlat_get_code( ARM_XLAT_ADDR(pc) );
+    while( code != NULL && XLAT_BLOCK_MODE(code) != ARM_XLAT_MODE ) {
+        code = XLAT_BLOCK_CHAIN(code);
+    }
+    if( code == NULL ) {
+        code = arm_translate_block( pc );
+    }
+    return code;
+}
+
+gboolean arm_translate_run( uint32_t icount )
+{
+    int32_t remaining = (int32_t)icount - arm_xlat_overrun;
+
+    while( remaining > 0 ) {
+        uint32_t start_icount = armr.icount;
+        if( (armr.int_pending & ~armr.cpsr) || (armr.r[15] & 0x03) ||
+            armr.r[15] >= 0x00200000 ) {
+            /* Exception entry (or a misaligned or out-of-RAM pc) is left to
+             * the interpreter, which halts on the latter */
+            armr.icount++;
+            if( !arm_execute_instruction() ) {
+                arm_xlat_overrun = 0;
+                return FALSE;
+            }
+        } else {
+            gboolean (*code)(void) = arm_translate_get_code( armr.r[15] );
+            if( !code() ) {
+                arm_xlat_overrun = 0;
+                return FALSE;
+            }
+            if( armr.r[15] >= 0x00200000 ) {
+                armr.running = FALSE;
+                WARN( "ARM Halted: BRANCH to invalid address %08X", armr.r[15] );
+                arm_xlat_overrun = 0;
+                return FALSE;
+            }
+        }
+        remaining -= (int32_t)(armr.icount - start_icount);
+    }
+    arm_xlat_overrun = -remaining;
+    return TRUE;
+}
+
+#else /* SIZEOF_VOID_P != 8 */
+
+gboolean arm_translate_init( void )
+{
+    WARN( "ARM translator is not supported on this host" );
+    return FALSE;
+}
+
+gboolean arm_translate_run( uint32_t icount )
+{
+    return FALSE;
+}
+
+#endif
@@ -0,0 +1,65 @@
+/**
+ * $Id$
+ *
+ * ARM translation core, generating native code for the ARM into the common
+ * xlat cache (shared with the SH4 translator).
+ *
+ * Copyright (c) 2005 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef lxdream_armtrans_H
+#define lxdream_armtrans_H 1
+
+#include "lxdream.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Address at which the ARM code at the given (sound RAM) address is keyed in
+ * the xlat cache. This is the SH4's own view of the sound RAM, so SH4 writes
+ * and DMA into it invalidate the ARM blocks the same way they would SH4 code.
+ */
+#define ARM_XLAT_ADDR(pc) (0x00800000 + ((pc)&0x001FFFFF))
+
+/**
+ * Mode (see xlat_cache_block.xlat_sh4_mode) of ARM blocks, which never
+ * matches an SH4 mode, so the SH4 can't run an ARM block at the same address
+ * and vice versa.
+ */
+#define ARM_XLAT_MODE 0xFFFFFFFF
+
+/** Maximum number of instructions in a translated block */
+#define ARM_MAX_BLOCK_INSTRUCTIONS 64
+
+/**
+ * Initialize the ARM translator.
+ * @return FALSE if the translator isn't supported on this host.
+ */
+gboolean arm_translate_init( void );
+
+/**
+ * Execute translated code (translating it as needed) for the given number
+ * of instructions. Blocks aren't split, so execution may run past the end
+ * by part of a block, in which case the excess is deducted from the next
+ * call.
+ * @return FALSE if the ARM halted, otherwise TRUE.
+ */
+gboolean arm_translate_run( uint32_t icount );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !lxdream_armtrans_H */
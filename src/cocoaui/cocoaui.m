@@ -37,13 +37,14 @@ void cocoa_gui_update( void );
 void cocoa_gui_start( void );
 void cocoa_gui_stop( void );
 uint32_t cocoa_gui_run_slice( uint32_t nanosecs );
+uint32_t cocoa_gui_next_deadline( void );
 
 struct dreamcast_module cocoa_gui_module = { "gui", NULL,
         cocoa_gui_update, 
         cocoa_gui_start, 
         cocoa_gui_run_slice, 
         cocoa_gui_stop, 
-        NULL, NULL };
+        NULL, NULL, cocoa_gui_next_deadline };
 
 /**
  * Count of running nanoseconds - used to cut back on the GUI runtime
@@ -417,13 +418,22 @@ void gui_update_io_activity( io_activity_type io, gboolean active )
 }
 
 
+uint32_t cocoa_gui_next_deadline( void )
+{
+    if( cocoa_gui_nanos >= GUI_TICK_PERIOD ) {
+        return 0;
+    } else {
+        return GUI_TICK_PERIOD - cocoa_gui_nanos;
+    }
+}
+
 uint32_t cocoa_gui_run_slice( uint32_t nanosecs )
 {
     NSEvent *event;
     NSAutoreleasePool *pool;
 
     cocoa_gui_nanos += nanosecs;
-    if( cocoa_gui_nanos > GUI_TICK_PERIOD ) { /* 10 ms */
+    if( cocoa_gui_nanos >= GUI_TICK_PERIOD ) { /* 10 ms */
         cocoa_gui_nanos -= GUI_TICK_PERIOD;
         cocoa_gui_ticks ++;
         uint32_t current_period = cocoa_gui_ticks * GUI_TICK_PERIOD;
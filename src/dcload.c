@@ -88,6 +88,9 @@ void dcload_syscall( uint32_t syscall_id )
         } else {
             sh4ptr_t buf = mem_get_region( sh4r.r[6] );
             int length = sh4r.r[7];
+            if( buf != NULL && length > 0 ) {
+                mem_prepare_host_write( buf, length );
+            }
             sh4r.r[0] = read( open_fds[fd], buf, length );
         }
         break;
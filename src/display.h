@@ -91,6 +91,8 @@ struct render_buffer {
                        * The render buffer does not own the texture */
     unsigned int buf_id; /* driver-specific buffer id, if applicable */
     gboolean flushed; /* True if the buffer has been flushed to vram */
+    uint32_t *data;   /* Host pixels (RGBA8888, top row first) of a software
+                       * render buffer, or NULL for GL buffers */
 };
 
 /**
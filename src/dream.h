@@ -30,6 +30,8 @@ extern "C" {
 #endif
 
 /************************ Modules ********************************/
+#define NO_DEADLINE 0xFFFFFFFF /* Module has no pending work */
+
 /**
  * Basic module structure defining the common operations across all
  * modules, ie start, stop, reset, etc. 
@@ -71,6 +73,13 @@ typedef struct dreamcast_module {
      * @return 0 on success, nonzero on failure.
      */
     int (*load)(FILE *);
+    /**
+     * Return the number of nanoseconds from the start of the next time slice
+     * until the module next needs run_time_slice to be called, or NO_DEADLINE
+     * if it has nothing pending. The slice runs up to the earliest deadline
+     * across all modules (may be NULL).
+     */
+    uint32_t (*get_next_deadline)();
 } *dreamcast_module_t;
 
 void dreamcast_register_module( dreamcast_module_t );
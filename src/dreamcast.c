@@ -53,13 +53,14 @@ static gboolean dreamcast_has_flash = FALSE;
 static gboolean dreamcast_exit_on_stop = FALSE;
 static gchar *dreamcast_program_name = NULL;
 static sh4addr_t dreamcast_entry_point = 0xA0000000;
-static uint32_t timeslice_length = DEFAULT_TIMESLICE_LENGTH;
 static uint64_t run_time_nanosecs = 0;
 static unsigned int quick_save_state = -1;
 
 #define MAX_MODULES 32
 static int num_modules = 0;
 dreamcast_module_t modules[MAX_MODULES];
+static int num_deadline_modules = 0;
+static dreamcast_module_t deadline_modules[MAX_MODULES];
 
 /**
  * The unknown module is used for logging files without an actual module
@@ -80,7 +81,7 @@ extern struct mem_region_fn mem_region_pvr2yuv;
 extern struct mem_region_fn mem_region_pvr2vdma1;
 extern struct mem_region_fn mem_region_pvr2vdma2;
 
-unsigned char dc_main_ram[16 MB];
+unsigned char *dc_main_ram;
 unsigned char dc_boot_rom[2 MB];
 unsigned char dc_flash_ram[128 KB];
 
@@ -102,6 +103,13 @@ void dreamcast_configure( gboolean use_bootrom )
     /* Register the memory framework */
     dreamcast_register_module( &mem_module );
 
+    /* Main RAM is shared memory so that the SH4 translator can map additional
+     * views of it (see mmu_get_fastmem_base) */
+    dc_main_ram = mem_alloc_shared_pages( (16 MB) / LXDREAM_PAGE_SIZE );
+    if( dc_main_ram == NULL ) {
+        FATAL( "Unable to allocate main RAM" );
+    }
+
     /* Setup standard memory map */
     mem_map_region( dc_boot_rom,     0x00000000, 2 MB,   MEM_REGION_BIOS,         &mem_region_bootrom, MEM_FLAG_ROM, 2 MB, 0 );
     mem_map_region( dc_flash_ram,    0x00200000, 128 KB, MEM_REGION_FLASH,        &mem_region_flashram, MEM_FLAG_RAM, 128 KB, 0 );
@@ -219,6 +227,8 @@ void dreamcast_register_module( dreamcast_module_t module )
 {
     assert( num_modules < MAX_MODULES );
     modules[num_modules++] = module;
+    if( module->get_next_deadline != NULL )
+        deadline_modules[num_deadline_modules++] = module;
     if( module->init != NULL )
         module->init();
 }
@@ -249,6 +259,26 @@ void dreamcast_reset( void )
     }
 }
 
+/**
+ * Determine the length of the next time slice - ie the time until the earliest
+ * deadline declared by any module, clamped to the min/max slice lengths. With
+ * nothing pending the SH4 runs in long slices, as any events it needs to
+ * service are handled within the slice anyway.
+ */
+static uint32_t dreamcast_next_timeslice( void )
+{
+    uint32_t time_to_run = MAX_TIMESLICE_LENGTH;
+    int i;
+    for( i=0; i<num_deadline_modules; i++ ) {
+        uint32_t deadline = deadline_modules[i]->get_next_deadline();
+        if( deadline < time_to_run )
+            time_to_run = deadline;
+    }
+    if( time_to_run < MIN_TIMESLICE_LENGTH )
+        time_to_run = MIN_TIMESLICE_LENGTH;
+    return time_to_run;
+}
+
 void dreamcast_run( void )
 {
     int i;
@@ -273,7 +303,7 @@ void dreamcast_run( void )
 
     if( run_time_nanosecs != 0 ) {
         while( dreamcast_state == STATE_RUNNING ) {
-            uint32_t time_to_run = timeslice_length;
+            uint32_t time_to_run = dreamcast_next_timeslice();
             if( run_time_nanosecs < time_to_run ) {
                 time_to_run = (uint32_t)run_time_nanosecs;
             }
@@ -292,7 +322,7 @@ void dreamcast_run( void )
         }
     } else {
         while( dreamcast_state == STATE_RUNNING ) {
-            int time_to_run = timeslice_length;
+            uint32_t time_to_run = dreamcast_next_timeslice();
             for( i=0; i<num_modules; i++ ) {
                 if( modules[i]->run_time_slice != NULL )
                     time_to_run = modules[i]->run_time_slice( time_to_run );
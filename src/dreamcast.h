@@ -30,11 +30,18 @@ extern "C" {
 #endif
 
 #define DEFAULT_TIMESLICE_LENGTH 1000000 /* nanoseconds */
+#define MIN_TIMESLICE_LENGTH 10000 /* nanoseconds */
+#define MAX_TIMESLICE_LENGTH 10000000 /* nanoseconds */
 
 #define XLAT_NEW_CACHE_SIZE 40 MB
 #define XLAT_TEMP_CACHE_SIZE 2 MB
 #define XLAT_OLD_CACHE_SIZE 8 MB
 
+/* Blocks evicted from the new cache are kept in the temp cache, and promoted
+ * to the old cache if they're used again. Comment out to discard evicted blocks
+ * immediately instead. */
+#define XLAT_GENERATIONAL_CACHE 1
+
 struct lxdream_config_group; // Forward declaration
 
 void dreamcast_configure(gboolean use_bootrom);
@@ -63,7 +70,7 @@ gboolean dreamcast_can_run(void);
 void dreamcast_program_loaded( const gchar *name, sh4addr_t entry_point );
 
 #define DREAMCAST_SAVE_MAGIC "%!-lxDream!Save\0"
-#define DREAMCAST_SAVE_VERSION 0x00010006
+#define DREAMCAST_SAVE_VERSION 0x00010007
 
 int dreamcast_save_state( const gchar *filename );
 int dreamcast_load_state( const gchar *filename );
@@ -91,10 +98,40 @@ gboolean dreamcast_load_fakebios();
 #define SCENE_SAVE_MAGIC "%!-lxDream!Scene"
 #define SCENE_SAVE_VERSION 0x00010000
 
-extern unsigned char dc_main_ram[];
+extern unsigned char *dc_main_ram;
 extern unsigned char dc_boot_rom[];
 extern unsigned char dc_flash_ram[];
 
+/** Main RAM region, exposed so the translator can recognize RAM pages */
+extern struct mem_region_fn mem_region_sdram;
+
+/**
+ * Enable write-protection of main RAM pages containing translated code, so
+ * that writes to code are caught by the host MMU rather than by checking
+ * every write. Pages which are written too often are demoted to checked
+ * pages instead, which are left writable - code translated from them must
+ * verify its source (see sdram_get_code_hash) before running.
+ * @return TRUE if code protection is enabled (ie supported by the host).
+ */
+gboolean sdram_enable_code_protection( void );
+
+/**
+ * Write-protect the main RAM pages containing the physical address range
+ * [start,end), after translating code from it. Other addresses are ignored.
+ */
+void sdram_protect_code( sh4addr_t start, sh4addr_t end );
+
+/**
+ * Test if the given physical address is in a checked main RAM page.
+ */
+gboolean sdram_is_code_checked( sh4addr_t addr );
+
+/**
+ * Compute the hash of the main RAM contents in the physical range [start,end),
+ * used to verify code from checked pages.
+ */
+uint32_t FASTCALL sdram_get_code_hash( sh4addr_t start, sh4addr_t end );
+
 #ifdef __cplusplus
 }
 #endif
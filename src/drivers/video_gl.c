@@ -221,12 +221,6 @@ void gl_display_blank( uint32_t colour )
 }
 
 
-#ifdef HAVE_GLES2
-/* Note: OpenGL ES only officialy supports glReadPixels for the RGBA32 format
- * (and doesn't necessarily support glPixelStore(GL_PACK_ROW_LENGTH) either.
- * As a result, we end up needed to do the format conversion ourselves.
- */
-
 /**
  * Swizzle 32-bit RGBA to specified target format, truncating components where
  * necessary. Target may == source.
@@ -237,7 +231,7 @@ void gl_display_blank( uint32_t colour )
  * @param target_stride Stride of target buffer, in bytes
  * @param colour_format
  */
-static void rgba32_to_target( unsigned char *target, const uint32_t *source, int width, int height, int target_stride, int colour_format )
+void rgba32_to_target( unsigned char *target, const uint32_t *source, int width, int height, int target_stride, int colour_format )
 {
     int x,y;
 
@@ -326,6 +320,12 @@ static void rgba32_to_target( unsigned char *target, const uint32_t *source, int
     }
 }
 
+#ifdef HAVE_GLES2
+/* Note: OpenGL ES only officialy supports glReadPixels for the RGBA32 format
+ * (and doesn't necessarily support glPixelStore(GL_PACK_ROW_LENGTH) either.
+ * As a result, we end up needed to do the format conversion ourselves.
+ */
+
 /**
  * Convert data into an acceptable form for loading into an RGBA texture.
  */
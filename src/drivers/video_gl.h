@@ -70,6 +70,13 @@ void gl_window_to_system_coords( int *x, int *y );
 gboolean gl_read_render_buffer( unsigned char *target, render_buffer_t buffer, 
                                 int rowstride, int colour_format );
 
+/**
+ * Swizzle 32-bit RGBA to specified target format, truncating components where
+ * necessary. Target may == source.
+ */
+void rgba32_to_target( unsigned char *target, const uint32_t *source, int width, int height,
+                       int target_stride, int colour_format );
+
 
 void gl_framebuffer_setup(void);
 void gl_framebuffer_cleanup(void);
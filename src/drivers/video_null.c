@@ -16,18 +16,37 @@
  * GNU General Public License for more details.
  */
 
+#include <stdlib.h>
+#include <string.h>
 #include "display.h"
 #include "drivers/video_gl.h"
+#include "pvr2/pvr2.h"
 
 static gboolean video_null_init( void );
 
+/**
+ * Render buffers are kept in host memory as 32-bit RGBA (top row first), for
+ * the software renderer to draw into. Without the software renderer there are
+ * no render buffers, and nothing is rendered.
+ */
 static render_buffer_t video_null_create_render_buffer( uint32_t hres, uint32_t vres, GLuint tex_id )
 {
-    return NULL;
+    if( !pvr2_scene_get_soft_render() ) {
+        return NULL;
+    }
+    render_buffer_t buffer = calloc( sizeof(struct render_buffer) + hres*vres*4, 1 );
+    if( buffer != NULL ) {
+        buffer->data = (uint32_t *)(buffer+1);
+        buffer->width = hres;
+        buffer->height = vres;
+        buffer->tex_id = tex_id;
+    }
+    return buffer;
 }
 
 static void video_null_destroy_render_buffer( render_buffer_t buffer )
 {
+    free( buffer );
 }
 
 static gboolean video_null_set_render_target( render_buffer_t buffer )
@@ -47,12 +66,67 @@ static gboolean video_null_read_render_buffer( unsigned char *target,
                                                render_buffer_t buffer, 
                                                int rowstride, int format )
 {
+    if( buffer->data == NULL ) {
+        return FALSE;
+    }
+    if( rowstride == 0 ) {
+        rowstride = buffer->width * colour_formats[format].bpp;
+    }
+    if( buffer->inverted ) {
+        /* Match the GL drivers, which return the bottom row first */
+        rgba32_to_target( target + (buffer->height-1)*rowstride, buffer->data,
+                          buffer->width, buffer->height, -rowstride, format );
+    } else {
+        rgba32_to_target( target, buffer->data, buffer->width, buffer->height, rowstride, format );
+    }
     return TRUE;
 }
 
 static void video_null_load_frame_buffer( frame_buffer_t frame, 
                                           render_buffer_t buffer )
 {
+    int x, y;
+
+    if( buffer->data == NULL ) {
+        return;
+    }
+    for( y=0; y<frame->height && y<buffer->height; y++ ) {
+        unsigned char *s = frame->data + y*frame->rowstride;
+        uint32_t *d = buffer->data + (frame->inverted ? buffer->height-1-y : y)*buffer->width;
+        for( x=0; x<frame->width && x<buffer->width; x++ ) {
+            uint32_t v;
+            switch( frame->colour_format ) {
+            case COLFMT_BGRA1555:
+                v = ((uint16_t *)s)[x];
+                d[x] = ((v & 0x7C00) >> 7) | ((v & 0x03E0) << 6) | ((v & 0x001F) << 19) |
+                        ((v & 0x8000) ? 0xFF000000 : 0);
+                break;
+            case COLFMT_RGB565:
+                v = ((uint16_t *)s)[x];
+                d[x] = ((v & 0xF800) >> 8) | ((v & 0x07E0) << 5) | ((v & 0x001F) << 19) | 0xFF000000;
+                break;
+            case COLFMT_BGRA4444:
+                v = ((uint16_t *)s)[x];
+                d[x] = ((v & 0x0F00) >> 4) | ((v & 0x00F0) << 8) | ((v & 0x000F) << 20) |
+                        ((v & 0xF000) << 16);
+                break;
+            case COLFMT_BGR888:
+                d[x] = s[x*3+2] | (s[x*3+1] << 8) | (s[x*3] << 16) | 0xFF000000;
+                break;
+            case COLFMT_RGB888:
+                d[x] = s[x*3] | (s[x*3+1] << 8) | (s[x*3+2] << 16) | 0xFF000000;
+                break;
+            case COLFMT_BGRA8888:
+                v = ((uint32_t *)s)[x];
+                d[x] = (v & 0xFF00FF00) | ((v & 0x00FF0000) >> 16) | ((v & 0x000000FF) << 16);
+                break;
+            default: /* BGR0888 */
+                v = ((uint32_t *)s)[x];
+                d[x] = ((v & 0x00FF0000) >> 16) | (v & 0x0000FF00) | ((v & 0x000000FF) << 16) | 0xFF000000;
+                break;
+            }
+        }
+    }
 }
 
 static void video_null_display_blank( uint32_t colour )
@@ -2,9 +2,11 @@
  * $Id$
  *
  * Simple implementation of one-shot timers. Effectively this allows IO
- * devices to wait until a particular time before completing. We expect 
+ * devices to wait until a particular time before completing. We expect
  * there to be at least half a dozen or so continually scheduled events
- * (TMU and PVR2), peaking around 20+.
+ * (TMU and PVR2), peaking around 20+. Several of these are rescheduled
+ * thousands of times per second, so pending events are kept in a binary
+ * min-heap ordered by absolute (64-bit nanosecond) time.
  *
  * Copyright (c) 2005 Nathan Keynes.
  *
@@ -26,26 +28,30 @@
 #include "asic.h"
 #include "sh4/sh4.h"
 
-#define LONG_SCAN_PERIOD 1000000000 /* 1 second */
+#define EVENT_NOT_SCHEDULED ((uint64_t)-1)
 
 typedef struct event {
     uint32_t id;
-    uint32_t seconds;
-    uint32_t nanosecs;
+    uint32_t seq;     /* Schedule order, to keep events at the same time FIFO */
+    uint64_t time;    /* Absolute time in nanoseconds, or EVENT_NOT_SCHEDULED */
+    int heap_posn;    /* Index in event_heap while scheduled */
     event_func_t func;
-
-    struct event *next;
 } *event_t;
 
 static struct event events[MAX_EVENT_ID];
 
 /**
- * Countdown to the next scan of the long-duration list (greater than 1 second).
+ * Pending events, as a binary min-heap on (time, seq)
  */
-static int long_scan_time_remaining;
+static event_t event_heap[MAX_EVENT_ID];
+static int event_heap_size;
+static uint32_t event_seq;
 
-static event_t event_head;
-static event_t long_event_head;
+/**
+ * Absolute time of the start of the current time slice. The SH4 slice_cycle
+ * is relative to this.
+ */
+static uint64_t event_slice_start;
 
 void event_reset();
 void event_init();
@@ -56,91 +62,119 @@ int event_load_state( FILE * f );
 struct dreamcast_module eventq_module = { "EVENTQ", NULL, event_reset, NULL, event_run_slice,
         NULL, event_save_state, event_load_state };
 
-static void event_update_pending( ) 
+#define EVENT_BEFORE(a,b) ((a)->time < (b)->time || \
+        ((a)->time == (b)->time && (int32_t)((a)->seq - (b)->seq) < 0))
+
+static void event_heap_sift_up( int posn )
+{
+    event_t event = event_heap[posn];
+    while( posn > 0 ) {
+        int parent = (posn-1) >> 1;
+        if( !EVENT_BEFORE( event, event_heap[parent] ) )
+            break;
+        event_heap[posn] = event_heap[parent];
+        event_heap[posn]->heap_posn = posn;
+        posn = parent;
+    }
+    event_heap[posn] = event;
+    event->heap_posn = posn;
+}
+
+static void event_heap_sift_down( int posn )
+{
+    event_t event = event_heap[posn];
+    for(;;) {
+        int child = (posn << 1) + 1;
+        if( child >= event_heap_size )
+            break;
+        if( child+1 < event_heap_size && EVENT_BEFORE( event_heap[child+1], event_heap[child] ) )
+            child++;
+        if( !EVENT_BEFORE( event_heap[child], event ) )
+            break;
+        event_heap[posn] = event_heap[child];
+        event_heap[posn]->heap_posn = posn;
+        posn = child;
+    }
+    event_heap[posn] = event;
+    event->heap_posn = posn;
+}
+
+static void event_heap_insert( event_t event )
+{
+    event->heap_posn = event_heap_size++;
+    event_heap[event->heap_posn] = event;
+    event_heap_sift_up( event->heap_posn );
+}
+
+static void event_heap_remove( event_t event )
+{
+    int posn = event->heap_posn;
+    event_t last = event_heap[--event_heap_size];
+    if( last != event ) {
+        event_heap[posn] = last;
+        last->heap_posn = posn;
+        if( EVENT_BEFORE( last, event ) ) {
+            event_heap_sift_up( posn );
+        } else {
+            event_heap_sift_down( posn );
+        }
+    }
+}
+
+static void event_update_pending( )
 {
-    if( event_head == NULL ) {
+    if( event_heap_size == 0 ) {
         if( !(sh4r.event_types & PENDING_IRQ) ) {
             sh4_set_event_pending(NOT_SCHEDULED);
         }
         sh4r.event_types &= (~PENDING_EVENT);
     } else {
         if( !(sh4r.event_types & PENDING_IRQ) ) {
-            sh4_set_event_pending(event_head->nanosecs);
+            sh4_set_event_pending(event_get_next_time());
         }
         sh4r.event_types |= PENDING_EVENT;
     }
 }
 
-uint32_t event_get_next_time( ) 
+uint32_t event_get_next_time( )
 {
-    if( event_head == NULL ) {
+    if( event_heap_size == 0 ) {
         return NOT_SCHEDULED;
+    } else if( event_heap[0]->time <= event_slice_start ) {
+        return 0; /* Overdue */
+    } else if( event_heap[0]->time - event_slice_start >= NOT_SCHEDULED ) {
+        return NOT_SCHEDULED; /* Not in this slice */
     } else {
-        return event_head->nanosecs;
+        return (uint32_t)(event_heap[0]->time - event_slice_start);
     }
 }
 
 /**
- * Add the event to the short queue.
+ * (Re)schedule the event for the given absolute time.
  */
-static void event_enqueue( event_t event ) 
+static void event_schedule_at( int eventid, uint64_t time )
 {
-    if( event_head == NULL || event->nanosecs < event_head->nanosecs ) {
-        event->next = event_head;
-        event_head = event;
-        event_update_pending();
-    } else {
-        event_t cur = event_head;
-        event_t next = cur->next;
-        while( next != NULL && event->nanosecs >= next->nanosecs ) {
-            cur = next;
-            next = cur->next;
-        }
-        event->next = next;
-        cur->next = event;
-    }
-}
+    event_t event = &events[eventid];
+    event_t head = event_heap_size == 0 ? NULL : event_heap[0];
 
-static void event_dequeue( event_t event )
-{
-    if( event_head == NULL ) {
-        ERROR( "Empty event queue but should contain event %d", event->id );
-    } else if( event_head == event ) {
-        /* removing queue head */
-        event_head = event_head->next;
-        event_update_pending();
+    event->id = eventid;
+    event->seq = event_seq++;
+    if( event->time == EVENT_NOT_SCHEDULED ) {
+        event->time = time;
+        event_heap_insert( event );
     } else {
-        event_t cur = event_head;
-        event_t next = cur->next;
-        while( next != NULL ) {
-            if( next == event ) {
-                cur->next = next->next;
-                break;
-            }
-            cur = next;
-            next = cur->next;
+        /* Event is already scheduled - move it to the new time */
+        uint64_t oldtime = event->time;
+        event->time = time;
+        if( time < oldtime ) {
+            event_heap_sift_up( event->heap_posn );
+        } else {
+            event_heap_sift_down( event->heap_posn );
         }
     }
-}
 
-static void event_dequeue_long( event_t event ) 
-{
-    if( long_event_head == NULL ) {
-        ERROR( "Empty long event queue but should contain event %d", event->id );
-    } else if( long_event_head == event ) {
-        /* removing queue head */
-        long_event_head = long_event_head->next;
-    } else {
-        event_t cur = long_event_head;
-        event_t next = cur->next;
-        while( next != NULL ) {
-            if( next == event ) {
-                cur->next = next->next;
-                break;
-            }
-            cur = next;
-            next = cur->next;
-        }
+    if( event_heap[0] != head || head == event ) {
+        event_update_pending();
     }
 }
 
@@ -151,53 +185,25 @@ void register_event_callback( int eventid, event_func_t func )
 
 void event_schedule( int eventid, uint32_t nanosecs )
 {
-    nanosecs += sh4r.slice_cycle;
-
-    event_t event = &events[eventid];
-
-    if( event->nanosecs != NOT_SCHEDULED ) {
-        /* Event is already scheduled. Remove it from the list first */
-        event_cancel(eventid);
-    }
-
-    event->id = eventid;
-    event->seconds = 0;
-    event->nanosecs = nanosecs;
-
-    event_enqueue( event );
+    event_schedule_at( eventid, event_slice_start + sh4r.slice_cycle + nanosecs );
 }
 
 void event_schedule_long( int eventid, uint32_t seconds, uint32_t nanosecs ) {
-    if( seconds == 0 ) {
-        event_schedule( eventid, nanosecs );
-    } else {
-        event_t event = &events[eventid];
-
-        if( event->nanosecs != NOT_SCHEDULED ) {
-            /* Event is already scheduled. Remove it from the list first */
-            event_cancel(eventid);
-        }
-
-        event->id = eventid;
-        event->seconds = seconds;
-        event->nanosecs = nanosecs + sh4r.slice_cycle + (LONG_SCAN_PERIOD - long_scan_time_remaining);
-        event->next = long_event_head;
-        long_event_head = event;
-    }
-
+    event_schedule_at( eventid, event_slice_start + sh4r.slice_cycle +
+                       ((uint64_t)seconds) * 1000000000 + nanosecs );
 }
 
 void event_cancel( int eventid )
 {
     event_t event = &events[eventid];
-    if( event->nanosecs == NOT_SCHEDULED ) {
+    if( event->time == EVENT_NOT_SCHEDULED ) {
         return; /* not scheduled */
     } else {
-        event->nanosecs = NOT_SCHEDULED;
-        if( event->seconds != 0 ) { /* long term event */
-            event_dequeue_long( event );
-        } else {
-            event_dequeue( event );
+        gboolean was_head = event_heap[0] == event;
+        event_heap_remove( event );
+        event->time = EVENT_NOT_SCHEDULED;
+        if( was_head ) {
+            event_update_pending();
         }
     }
 }
@@ -205,11 +211,12 @@ void event_cancel( int eventid )
 
 void event_execute()
 {
+    uint64_t now = event_slice_start + sh4r.slice_cycle;
     /* Loop in case we missed some or got a couple scheduled for the same time */
-    while( event_head != NULL && event_head->nanosecs <= sh4r.slice_cycle ) {
-        event_t event = event_head;
-        event_head = event->next;
-        event->nanosecs = NOT_SCHEDULED;
+    while( event_heap_size != 0 && event_heap[0]->time <= now ) {
+        event_t event = event_heap[0];
+        event_heap_remove( event );
+        event->time = EVENT_NOT_SCHEDULED;
         // Note: Make sure the internal state is consistent before calling the
         // user function, as it will (quite likely) enqueue another event.
         event->func( event->id );
@@ -228,17 +235,15 @@ void event_init()
     int i;
     for( i=0; i<MAX_EVENT_ID; i++ ) {
         events[i].id = i;
-        events[i].nanosecs = NOT_SCHEDULED;
+        events[i].time = EVENT_NOT_SCHEDULED;
         if( i < 96 ) {
             events[i].func = event_asic_callback;
         } else {
             events[i].func = NULL;
         }
-        events[i].next = NULL;
     }
-    event_head = NULL;
-    long_event_head = NULL;
-    long_scan_time_remaining = LONG_SCAN_PERIOD;
+    event_heap_size = 0;
+    event_slice_start = 0;
 }
 
 
@@ -246,96 +251,47 @@ void event_init()
 void event_reset()
 {
     int i;
-    event_head = NULL;
-    long_event_head = NULL;
-    long_scan_time_remaining = LONG_SCAN_PERIOD;
+    event_heap_size = 0;
+    event_slice_start = 0;
     for( i=0; i<MAX_EVENT_ID; i++ ) {
-        events[i].nanosecs = NOT_SCHEDULED;
+        events[i].time = EVENT_NOT_SCHEDULED;
     }
 }
 
 void event_save_state( FILE *f )
 {
-    int32_t id, i;
-    id = event_head == NULL ? -1 : event_head->id;
-    fwrite( &id, sizeof(id), 1, f );
-    id = long_event_head == NULL ? -1 : long_event_head->id;
-    fwrite( &id, sizeof(id), 1, f );
-    fwrite( &long_scan_time_remaining, sizeof(long_scan_time_remaining), 1, f );
+    int32_t i;
+    fwrite( &event_slice_start, sizeof(event_slice_start), 1, f );
+    fwrite( &event_seq, sizeof(event_seq), 1, f );
     for( i=0; i<MAX_EVENT_ID; i++ ) {
-        fwrite( &events[i].id, sizeof(uint32_t), 3, f ); /* First 3 words from structure */
-        id = events[i].next == NULL ? -1 : events[i].next->id;
-        fwrite( &id, sizeof(id), 1, f );
+        fwrite( &events[i].seq, sizeof(uint32_t), 1, f );
+        fwrite( &events[i].time, sizeof(uint64_t), 1, f );
     }
 }
 
 int event_load_state( FILE *f )
 {
-    int32_t id, i;
-    fread( &id, sizeof(id), 1, f );
-    event_head = id == -1 ? NULL : &events[id];
-    fread( &id, sizeof(id), 1, f );
-    long_event_head = id == -1 ? NULL : &events[id];
-    fread( &long_scan_time_remaining, sizeof(long_scan_time_remaining), 1, f );
+    int32_t i;
+    event_heap_size = 0;
+    fread( &event_slice_start, sizeof(event_slice_start), 1, f );
+    fread( &event_seq, sizeof(event_seq), 1, f );
     for( i=0; i<MAX_EVENT_ID; i++ ) {
-        fread( &events[i].id, sizeof(uint32_t), 3, f );
-        fread( &id, sizeof(id), 1, f );
-        events[i].next = id == -1 ? NULL : &events[id];
-    }
-    return 0;
-}
-
-/**
- * Scan all entries in the long queue, decrementing each by 1 second. Entries
- * that are now < 1 second are moved to the short queue.
- */
-static void event_scan_long()
-{
-    while( long_event_head != NULL && --long_event_head->seconds == 0 ) {
-        event_t event = long_event_head;
-        long_event_head = event->next;
-        event_enqueue(event);
-    }
-
-    if( long_event_head != NULL ) {
-        event_t last = long_event_head;
-        event_t cur = last->next;
-        while( cur != NULL ) {
-            if( --cur->seconds == 0 ) {
-                last->next = cur->next;
-                event_enqueue(cur);
-            } else {
-                last = cur;
-            }
-            cur = last->next;
+        fread( &events[i].seq, sizeof(uint32_t), 1, f );
+        fread( &events[i].time, sizeof(uint64_t), 1, f );
+        if( events[i].time != EVENT_NOT_SCHEDULED ) {
+            event_heap_insert( &events[i] );
         }
     }
+    return 0;
 }
 
 /**
- * Decrement the event time on all pending events by the supplied nanoseconds.
- * It may or may not be faster to wrap around instead, but this has the benefit
- * of simplicity.
+ * Advance the slice base time by the supplied nanoseconds. Event times are
+ * absolute, so nothing in the queue itself needs to change.
  */
 uint32_t event_run_slice( uint32_t nanosecs )
 {
-    event_t event = event_head;
-    while( event != NULL ) {
-        if( event->nanosecs <= nanosecs ) {
-            event->nanosecs = 0;
-        } else {
-            event->nanosecs -= nanosecs;
-        }
-        event = event->next;
-    }
-
-    long_scan_time_remaining -= nanosecs;
-    if( long_scan_time_remaining <= 0 ) {
-        long_scan_time_remaining += LONG_SCAN_PERIOD;
-        event_scan_long();
-    }
-
+    event_slice_start += nanosecs;
     event_update_pending();
     return nanosecs;
 }
-
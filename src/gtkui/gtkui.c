@@ -32,13 +32,14 @@ void gtk_gui_start( void );
 void gtk_gui_stop( void );
 void gtk_gui_alloc_resources ( void );
 uint32_t gtk_gui_run_slice( uint32_t nanosecs );
+uint32_t gtk_gui_next_deadline( void );
 
 struct dreamcast_module gtk_gui_module = { "gui", NULL,
         gtk_gui_update, 
         gtk_gui_start, 
         gtk_gui_run_slice, 
         gtk_gui_stop, 
-        NULL, NULL };
+        NULL, NULL, gtk_gui_next_deadline };
 
 /**
  * Single-instance windows (at most one)
@@ -443,6 +444,18 @@ void gtk_gui_update( void )
     dump_window_update_all();
 }
 
+/**
+ * End the slice on the next GUI tick, so the tick throttling stays regular.
+ */
+uint32_t gtk_gui_next_deadline( void )
+{
+    if( gtk_gui_nanos >= GUI_TICK_PERIOD ) {
+        return 0;
+    } else {
+        return GUI_TICK_PERIOD - gtk_gui_nanos;
+    }
+}
+
 /**
  * Module run-slice. Run the event loop 100 times/second (doesn't really need to be
  * any more often than this), and update the speed display 10 times/second. 
@@ -452,7 +465,7 @@ void gtk_gui_update( void )
 uint32_t gtk_gui_run_slice( uint32_t nanosecs ) 
 {
     gtk_gui_nanos += nanosecs;
-    if( gtk_gui_nanos > GUI_TICK_PERIOD ) { /* 10 ms */
+    if( gtk_gui_nanos >= GUI_TICK_PERIOD ) { /* 10 ms */
         gtk_gui_nanos -= GUI_TICK_PERIOD;
         gtk_gui_ticks ++;
         uint32_t current_period = gtk_gui_ticks * GUI_TICK_PERIOD;
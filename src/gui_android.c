@@ -147,10 +147,19 @@ int android_toggle_run( void *data )
     }
 }
 
+uint32_t android_gui_next_deadline( void )
+{
+    if( android_gui_nanos >= GUI_TICK_PERIOD ) {
+        return 0;
+    } else {
+        return GUI_TICK_PERIOD - android_gui_nanos;
+    }
+}
+
 uint32_t android_gui_run_slice( uint32_t nanosecs )
 {
     android_gui_nanos += nanosecs;
-    if( android_gui_nanos > GUI_TICK_PERIOD ) { /* 10 ms */
+    if( android_gui_nanos >= GUI_TICK_PERIOD ) { /* 10 ms */
         android_gui_nanos -= GUI_TICK_PERIOD;
         android_gui_ticks ++;
         uint32_t current_period = android_gui_ticks * GUI_TICK_PERIOD;
@@ -193,7 +202,7 @@ struct dreamcast_module android_gui_module = { "gui", NULL,
         android_gui_start,
         android_gui_run_slice,
         android_gui_stop,
-        NULL, NULL };
+        NULL, NULL, android_gui_next_deadline };
 
 gboolean gui_error_dialog( const char *fmt, ... )
 {
@@ -36,18 +36,36 @@
 #include "serial.h"
 #include "syscall.h"
 #include "aica/audio.h"
+#include "aica/armcore.h"
 #include "aica/armdasm.h"
 #include "gdrom/gdrom.h"
 #include "maple/maple.h"
 #include "pvr2/glutil.h"
+#include "pvr2/pvr2.h"
 #include "sh4/sh4.h"
 #include "vmu/vmulist.h"
 
 #define GL_INFO_OPT 1
+#define SH4_SUPERBLOCKS_OPT 2
+#define SH4_OPTIMIZE_OPT 3
+#define SH4_CODE_CACHE_OPT 4
+#define SH4_PERF_MAP_OPT 5
+#define SH4_JITDUMP_OPT 6
+#define SH4_IDLE_SKIP_OPT 7
+#define SH4_ASYNC_TRANSLATE_OPT 8
+#define SHADOW_PARALLEL_OPT 9
+#define SH4_CYCLE_MODEL_OPT 10
+#define ARM_TRANSLATE_OPT 11
+#define RENDER_THREADS_OPT 12
+#define TA_THREAD_OPT 13
+#define RENDER_THREAD_OPT 14
+#define SOFT_RENDER_OPT 15
+#define SH4_NO_FASTMEM_OPT 16
 
 char *option_list = "a:A:bc:e:dfg:G:hHl:m:npPt:T:uvV:xX?";
 struct option longopts[] = {
         { "aica", required_argument, NULL, 'a' },
+        { "arm-translate", no_argument, NULL, ARM_TRANSLATE_OPT },
         { "audio", required_argument, NULL, 'A' },
         { "biosless", no_argument, NULL, 'b' },
         { "config", required_argument, NULL, 'c' },
@@ -61,13 +79,27 @@ struct option longopts[] = {
         { "headless", no_argument, NULL, 'H' },
         { "log", required_argument, NULL,'l' }, 
         { "multiplier", required_argument, NULL, 'm' },
+        { "render-thread", no_argument, NULL, RENDER_THREAD_OPT },
+        { "render-threads", required_argument, NULL, RENDER_THREADS_OPT },
         { "run-time", required_argument, NULL, 't' },
         { "shadow", no_argument, NULL, 'X' },
+        { "shadow-parallel", no_argument, NULL, SHADOW_PARALLEL_OPT },
+        { "soft-render", no_argument, NULL, SOFT_RENDER_OPT },
+        { "ta-thread", no_argument, NULL, TA_THREAD_OPT },
         { "trace", required_argument, NULL, 'T' },
         { "unsafe", no_argument, NULL, 'u' },
         { "video", no_argument, NULL, 'V' },
         { "version", no_argument, NULL, 'v' }, 
-        { "sh4-profile-blocks", no_argument, NULL, 'P' },
+        { "sh4-profile-blocks", optional_argument, NULL, 'P' },
+        { "sh4-no-fastmem", no_argument, NULL, SH4_NO_FASTMEM_OPT },
+        { "sh4-superblocks", no_argument, NULL, SH4_SUPERBLOCKS_OPT },
+        { "sh4-optimize", no_argument, NULL, SH4_OPTIMIZE_OPT },
+        { "sh4-idle-skip", no_argument, NULL, SH4_IDLE_SKIP_OPT },
+        { "sh4-async-translate", no_argument, NULL, SH4_ASYNC_TRANSLATE_OPT },
+        { "sh4-cycle-model", no_argument, NULL, SH4_CYCLE_MODEL_OPT },
+        { "sh4-code-cache", required_argument, NULL, SH4_CODE_CACHE_OPT },
+        { "sh4-perf-map", no_argument, NULL, SH4_PERF_MAP_OPT },
+        { "sh4-jitdump", no_argument, NULL, SH4_JITDUMP_OPT },
         { NULL, 0, 0, 0 } };
 char *aica_program = NULL;
 char *display_driver_name = NULL;
@@ -117,6 +149,22 @@ static void print_usage()
     printf( "   -V, --video=DRIVER     %s\n", _("Use the specified video driver (? to list)") );
     printf( "   -x                     %s\n", _("Disable the SH4 translator") );
     printf( "   -X                     %s\n", _("Run both SH4 interpreter and translator") );
+    printf( "   --shadow-parallel      %s\n", _("As -X, but run the interpreter check in a separate process") );
+    printf( "   --sh4-no-fastmem       %s\n", _("Don't access main RAM through a host view of the SH4 address space") );
+    printf( "   --sh4-superblocks      %s\n", _("Translate SH4 code across branches within a page") );
+    printf( "   --sh4-optimize         %s\n", _("Enable the SH4 translator's optimization passes") );
+    printf( "   --sh4-idle-skip        %s\n", _("Skip ahead to the next event from SH4 idle loops") );
+    printf( "   --sh4-async-translate  %s\n", _("Translate SH4 code in the background, interpreting it meanwhile") );
+    printf( "   --sh4-cycle-model      %s\n", _("Time translated SH4 code by pipeline cycles rather than instructions") );
+    printf( "   --sh4-code-cache=FILE  %s\n", _("Keep translated SH4 code in FILE between runs") );
+    printf( "   -P, --sh4-profile-blocks[=FILE] %s\n", _("Profile translated SH4 blocks, writing the report to FILE") );
+    printf( "   --sh4-perf-map         %s\n", _("Describe translated SH4 code to perf in /tmp/perf-PID.map") );
+    printf( "   --sh4-jitdump          %s\n", _("Write translated SH4 code to a jitdump file for perf inject") );
+    printf( "   --arm-translate        %s\n", _("Translate AICA ARM code rather than interpreting it") );
+    printf( "   --soft-render          %s\n", _("Render scenes in software when the video driver has no GL") );
+    printf( "   --render-threads=N     %s\n", _("Use N threads for software rendering (implies --soft-render)") );
+    printf( "   --ta-thread            %s\n", _("Process tile accelerator input on a separate thread") );
+    printf( "   --render-thread        %s\n", _("Render software (headless) scenes in the background") );
 }
 
 static void bind_gettext_domain()
@@ -132,7 +180,15 @@ int main (int argc, char *argv[])
     int opt;
     double t;
     gboolean display_ok, have_disc = FALSE, have_save = FALSE, have_exec = FALSE;
-    gboolean print_glinfo = FALSE, sh4_profile_blocks = FALSE;
+    gboolean print_glinfo = FALSE, sh4_profile_blocks = FALSE, sh4_superblocks = FALSE;
+    gboolean sh4_optimize = FALSE, sh4_perf_map = FALSE, sh4_jitdump = FALSE;
+    gboolean sh4_fastmem = TRUE;
+    gboolean sh4_idle_skip = FALSE, sh4_async_translate = FALSE, sh4_cycle_model = FALSE;
+    gboolean arm_translate = FALSE;
+    gboolean ta_thread = FALSE, render_thread = FALSE, soft_render = FALSE;
+    int render_threads = 0;
+    const char *sh4_code_cache = NULL;
+    const char *sh4_profile_report = NULL;
     uint32_t time_secs, time_nanos;
     const char *exec_name = NULL;
 
@@ -195,6 +251,7 @@ int main (int argc, char *argv[])
             break;
         case 'P':
             sh4_profile_blocks = TRUE;
+            sh4_profile_report = optarg;
             break;
         case 't': /* Time limit + auto quit */
             t = strtod(optarg, NULL);
@@ -223,9 +280,57 @@ int main (int argc, char *argv[])
         case 'X': /* Shadow translator */
             sh4_core = SH4_SHADOW;
             break;
+        case SHADOW_PARALLEL_OPT:
+            sh4_core = SH4_SHADOW_PARALLEL;
+            break;
         case GL_INFO_OPT:
             print_glinfo = TRUE;
             break;
+        case SH4_SUPERBLOCKS_OPT:
+            sh4_superblocks = TRUE;
+            break;
+        case SH4_OPTIMIZE_OPT:
+            sh4_optimize = TRUE;
+            break;
+        case SH4_IDLE_SKIP_OPT:
+            sh4_idle_skip = TRUE;
+            break;
+        case SH4_ASYNC_TRANSLATE_OPT:
+            sh4_async_translate = TRUE;
+            break;
+        case SH4_CYCLE_MODEL_OPT:
+            sh4_cycle_model = TRUE;
+            break;
+        case SH4_CODE_CACHE_OPT:
+            sh4_code_cache = optarg;
+            break;
+        case SH4_PERF_MAP_OPT:
+            sh4_perf_map = TRUE;
+            break;
+        case SH4_JITDUMP_OPT:
+            sh4_jitdump = TRUE;
+            break;
+        case SH4_NO_FASTMEM_OPT:
+            sh4_fastmem = FALSE;
+            break;
+        case ARM_TRANSLATE_OPT:
+            arm_translate = TRUE;
+            break;
+        case RENDER_THREADS_OPT:
+            render_threads = strtol(optarg, NULL, 0);
+            if( render_threads > 0 ) {
+                soft_render = TRUE;
+            }
+            break;
+        case SOFT_RENDER_OPT:
+            soft_render = TRUE;
+            break;
+        case TA_THREAD_OPT:
+            ta_thread = TRUE;
+            break;
+        case RENDER_THREAD_OPT:
+            render_thread = TRUE;
+            break;
         }
     }
 
@@ -272,6 +377,9 @@ int main (int argc, char *argv[])
     gdrom_list_init();
     vmulist_init();
 
+    /* Must be set before the MMU is initialized */
+    sh4_set_fastmem( sh4_fastmem );
+
     if( aica_program == NULL ) {
         dreamcast_init(use_bootrom);
     } else {
@@ -280,6 +388,10 @@ int main (int argc, char *argv[])
     }
     mem_set_trace( trace_regions, TRUE );
 
+    /* Must be set before any other threads are started, as the parallel
+     * shadow checker is forked from here (see sh4/shadow.c) */
+    sh4_set_core( sh4_core );
+
     audio_init_driver( audio_driver_name );
 
     headless = display_driver_name != NULL && strcasecmp( display_driver_name, "null" ) == 0;
@@ -358,8 +470,24 @@ int main (int argc, char *argv[])
         }
     }
 
-    sh4_set_core( sh4_core );
     sh4_set_profile_blocks( sh4_profile_blocks );
+    sh4_set_profile_report( sh4_profile_report );
+    sh4_set_superblocks( sh4_superblocks );
+    sh4_set_optimize( sh4_optimize );
+    sh4_set_idle_skip( sh4_idle_skip );
+    sh4_set_async_translate( sh4_async_translate );
+    sh4_set_cycle_model( sh4_cycle_model );
+    arm_set_translate( arm_translate );
+    pvr2_scene_set_soft_render( soft_render );
+    pvr2_scene_set_soft_threads( render_threads );
+    pvr2_ta_set_threaded( ta_thread );
+    pvr2_scene_set_soft_pipelined( render_thread );
+    if( sh4_code_cache != NULL ) {
+        sh4_set_code_cache( sh4_code_cache );
+    }
+    if( sh4_perf_map || sh4_jitdump ) {
+        sh4_set_perf_output( sh4_perf_map, sh4_jitdump );
+    }
 
     /* If requested, start the gdb server immediately before we go into the main
      * loop.
@@ -377,6 +505,8 @@ int main (int argc, char *argv[])
         gui_main_loop( start_immediately && dreamcast_can_run() );
     }
     dreamcast_shutdown();
+    sh4_set_code_cache( NULL );
+    sh4_set_perf_output( FALSE, FALSE );
     return 0;
 }
 
@@ -25,7 +25,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 #include <fcntl.h>
+#include <signal.h>
 #include <errno.h>
 #include <string.h>
 #include <zlib.h>
@@ -115,7 +119,7 @@ struct mem_region_fn mem_region_unmapped = {
 
 void *mem_alloc_pages( int n )
 {
-    void *mem = mmap( NULL, n * 4096,
+    void *mem = mmap( NULL, n * LXDREAM_PAGE_SIZE,
             PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE, -1, 0 );
     if( mem == MAP_FAILED ) {
         ERROR( "Memory allocation failure! (%s)", strerror(errno) );
@@ -124,6 +128,213 @@ void *mem_alloc_pages( int n )
     return mem;
 }
 
+/**
+ * Shared page allocations, which may have additional views mapped elsewhere
+ * in the host address space.
+ */
+#define MAX_SHARED_ALLOCS 8
+static struct {
+    void *mem;
+    size_t size;
+    int fd;
+} mem_shared_allocs[MAX_SHARED_ALLOCS];
+static int mem_num_shared_allocs = 0;
+
+/**
+ * Additional views of shared allocations (see mem_map_shared_pages), so that
+ * protection changes can be applied to every view of the memory.
+ */
+#define MAX_SHARED_VIEWS 64
+static struct {
+    void *target;
+    void *mem;
+    size_t size;
+} mem_shared_views[MAX_SHARED_VIEWS];
+static int mem_num_shared_views = 0;
+
+static mem_write_fault_handler_t mem_write_fault_handler = NULL;
+
+void *mem_alloc_shared_pages( int n )
+{
+#if defined(__linux__) && defined(SYS_memfd_create)
+    size_t size = ((size_t)n) * LXDREAM_PAGE_SIZE;
+    if( mem_num_shared_allocs < MAX_SHARED_ALLOCS ) {
+        int fd = syscall( SYS_memfd_create, "lxdream", 0 );
+        if( fd != -1 ) {
+            if( ftruncate( fd, size ) == 0 ) {
+                void *mem = mmap( NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0 );
+                if( mem != MAP_FAILED ) {
+                    mem_shared_allocs[mem_num_shared_allocs].mem = mem;
+                    mem_shared_allocs[mem_num_shared_allocs].size = size;
+                    mem_shared_allocs[mem_num_shared_allocs].fd = fd;
+                    mem_num_shared_allocs++;
+                    return mem;
+                }
+            }
+            close(fd);
+        }
+    }
+#endif
+    return mem_alloc_pages(n);
+}
+
+void *mem_reserve_pages( size_t n )
+{
+    void *mem = mmap( NULL, n * LXDREAM_PAGE_SIZE, PROT_NONE, MAP_ANON|MAP_PRIVATE|MAP_NORESERVE, -1, 0 );
+    if( mem == MAP_FAILED ) {
+        return NULL;
+    }
+    return mem;
+}
+
+void mem_release_pages( void *mem, size_t n )
+{
+    munmap( mem, n * LXDREAM_PAGE_SIZE );
+}
+
+gboolean mem_map_shared_pages( void *target, void *mem, int n )
+{
+    int i;
+    size_t size = ((size_t)n) * LXDREAM_PAGE_SIZE;
+    for( i=0; i<mem_num_shared_allocs; i++ ) {
+        uintptr_t offset = ((uintptr_t)mem) - ((uintptr_t)mem_shared_allocs[i].mem);
+        if( offset < mem_shared_allocs[i].size ) {
+            if( offset + size > mem_shared_allocs[i].size ) {
+                return FALSE;
+            }
+            if( mem_num_shared_views == MAX_SHARED_VIEWS ) {
+                return FALSE;
+            }
+            void *result = mmap( target, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED,
+                    mem_shared_allocs[i].fd, offset );
+            if( result == MAP_FAILED ) {
+                return FALSE;
+            }
+            mem_shared_views[mem_num_shared_views].target = target;
+            mem_shared_views[mem_num_shared_views].mem = mem;
+            mem_shared_views[mem_num_shared_views].size = size;
+            mem_num_shared_views++;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+gboolean mem_is_shared_pages( void *mem )
+{
+    int i;
+    for( i=0; i<mem_num_shared_allocs; i++ ) {
+        if( ((uintptr_t)mem) - ((uintptr_t)mem_shared_allocs[i].mem) < mem_shared_allocs[i].size ) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+gboolean mem_protect_pages( void *mem, int n, gboolean writable )
+{
+    int i;
+    size_t size = ((size_t)n) * LXDREAM_PAGE_SIZE;
+    int prot = writable ? (PROT_READ|PROT_WRITE) : PROT_READ;
+    gboolean result = mprotect( mem, size, prot ) == 0;
+
+    for( i=0; i<mem_num_shared_views; i++ ) {
+        uintptr_t start = (uintptr_t)mem, end = start + size;
+        uintptr_t view_start = (uintptr_t)mem_shared_views[i].mem;
+        uintptr_t view_end = view_start + mem_shared_views[i].size;
+        if( start < view_end && end > view_start ) {
+            if( start < view_start ) {
+                start = view_start;
+            }
+            if( end > view_end ) {
+                end = view_end;
+            }
+            if( mprotect( ((char *)mem_shared_views[i].target) + (start - view_start),
+                          end - start, prot ) != 0 ) {
+                result = FALSE;
+            }
+        }
+    }
+    return result;
+}
+
+gboolean mem_handle_write_fault( void *addr )
+{
+    int i;
+    uintptr_t p = (uintptr_t)addr;
+
+    if( mem_write_fault_handler == NULL ) {
+        return FALSE;
+    }
+    for( i=0; i<mem_num_shared_views; i++ ) {
+        uintptr_t offset = p - (uintptr_t)mem_shared_views[i].target;
+        if( offset < mem_shared_views[i].size ) {
+            p = ((uintptr_t)mem_shared_views[i].mem) + offset;
+            break;
+        }
+    }
+    return mem_write_fault_handler( (void *)p );
+}
+
+void mem_prepare_host_write( void *mem, size_t size )
+{
+    if( mem_write_fault_handler != NULL && size != 0 ) {
+        uintptr_t p = ((uintptr_t)mem) & ~((uintptr_t)(PAGE_SIZE-1));
+        uintptr_t end = ((uintptr_t)mem) + size;
+        for( ; p < end; p += PAGE_SIZE ) {
+            mem_write_fault_handler( (void *)p );
+        }
+    }
+}
+
+#if defined(SA_SIGINFO)
+static struct sigaction mem_old_segv_action, mem_old_bus_action;
+
+static void mem_write_fault( int signo, siginfo_t *info, void *ptr )
+{
+    struct sigaction *old = (signo == SIGBUS ? &mem_old_bus_action : &mem_old_segv_action);
+
+    if( mem_handle_write_fault( info->si_addr ) ) {
+        return; /* Retry the write */
+    }
+
+    /* Not ours - pass it on */
+    if( old->sa_flags & SA_SIGINFO ) {
+        old->sa_sigaction( signo, info, ptr );
+    } else if( old->sa_handler == SIG_DFL || old->sa_handler == SIG_IGN ) {
+        /* Restore the previous action and let the fault happen again */
+        sigaction( signo, old, NULL );
+    } else {
+        old->sa_handler( signo );
+    }
+}
+
+gboolean mem_set_write_fault_handler( mem_write_fault_handler_t handler )
+{
+    struct sigaction sa;
+
+    if( mem_write_fault_handler == NULL ) {
+        sa.sa_sigaction = mem_write_fault;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = SA_SIGINFO;
+        if( sigaction( SIGSEGV, &sa, &mem_old_segv_action ) != 0 ) {
+            return FALSE;
+        }
+        if( sigaction( SIGBUS, &sa, &mem_old_bus_action ) != 0 ) {
+            sigaction( SIGSEGV, &mem_old_segv_action, NULL );
+            return FALSE;
+        }
+    }
+    mem_write_fault_handler = handler;
+    return TRUE;
+}
+#else
+gboolean mem_set_write_fault_handler( mem_write_fault_handler_t handler )
+{
+    return FALSE;
+}
+#endif
+
 void mem_unprotect( void *region, uint32_t size )
 {
     /* Force page alignment */
@@ -325,6 +536,7 @@ int mem_load_block( const gchar *file, uint32_t start, uint32_t length )
         len = 4096 - (addr & 0x0FFF);
         if( len > (length-total) ) 
             len = (length-total);
+        mem_prepare_host_write( region, len );
         if( fread( region, len, 1, f ) != 1 ) {
             ERROR( "Unexpected error reading: %d (%s)", len, strerror(errno) );
             break;
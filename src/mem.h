@@ -108,6 +108,80 @@ struct mem_region *mem_map_region( void *mem, uint32_t base, uint32_t size,
  */
 gboolean mem_load_rom( void *output, const gchar *filename, uint32_t size, uint32_t crc ); 
 void *mem_alloc_pages( int n );
+
+/**
+ * Allocate n pages of memory that can also be mapped at other host addresses
+ * with mem_map_shared_pages(). If the host doesn't support this, the pages
+ * are allocated normally (and mem_map_shared_pages() will fail).
+ */
+void *mem_alloc_shared_pages( int n );
+
+/**
+ * Reserve n pages of host address space without allocating any memory. The
+ * pages are inaccessible until something is mapped into them.
+ * @return the start of the reserved region, or NULL on failure.
+ */
+void *mem_reserve_pages( size_t n );
+
+/**
+ * Release pages allocated by mem_reserve_pages() (including anything
+ * mapped into them)
+ */
+void mem_release_pages( void *mem, size_t n );
+
+/**
+ * Map an additional view of n pages of memory from mem_alloc_shared_pages()
+ * at the given (page-aligned) host address, replacing whatever was mapped
+ * there. Writes through either view are visible in both.
+ * @return TRUE on success, otherwise FALSE.
+ */
+gboolean mem_map_shared_pages( void *target, void *mem, int n );
+
+/**
+ * Test if mem is within an allocation from mem_alloc_shared_pages() that
+ * really is shared, ie writes to it are also seen by any child process forked
+ * after the allocation.
+ */
+gboolean mem_is_shared_pages( void *mem );
+
+/**
+ * Change the protection of n pages of memory from mem_alloc_pages() or
+ * mem_alloc_shared_pages(), together with any additional views of them. 
+ * Writes to read-only pages are passed to the write fault handler.
+ * @param writable TRUE to make the pages read/write, FALSE for read-only.
+ * @return TRUE on success, otherwise FALSE.
+ */
+gboolean mem_protect_pages( void *mem, int n, gboolean writable );
+
+/**
+ * Handler for writes to pages made read-only by mem_protect_pages(). The
+ * address is always within the original allocation, even if the write was
+ * through another view.
+ * @return TRUE if the handler has made the page writable (and the write
+ * should be retried), or FALSE if it isn't responsible for the address.
+ */
+typedef gboolean (*mem_write_fault_handler_t)( void *mem );
+
+/**
+ * Set the handler for writes to read-only pages.
+ * @return FALSE if write faults can't be handled on this host.
+ */
+gboolean mem_set_write_fault_handler( mem_write_fault_handler_t handler );
+
+/**
+ * Pass a memory fault at the given host address to the write fault handler.
+ * This is for use by other fault handlers, which may otherwise see the fault
+ * first.
+ * @return TRUE if the fault was handled
+ */
+gboolean mem_handle_write_fault( void *addr );
+
+/**
+ * Remove any write protection from the given region, before writing to it in
+ * a way that won't fault (eg by a system call, which will fail instead).
+ */
+void mem_prepare_host_write( void *mem, size_t size );
+
 sh4ptr_t mem_get_region( uint32_t addr );
 sh4ptr_t mem_get_region_by_name( const char *name );
 gboolean mem_has_page( uint32_t addr );
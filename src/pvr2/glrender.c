@@ -50,6 +50,14 @@ int pvr2_poly_dstblend[8] = {
 static gboolean have_shaders = FALSE;
 static int currentTexId = -1;
 
+/**
+ * Polygon list for gl_render_polylist, and the number of tiles each polygon
+ * was listed in (indexed by position in poly_array), which is also used to
+ * remove duplicates from the list.
+ */
+static struct polygon_struct **gl_poly_list = NULL;
+static uint16_t *gl_poly_tiles = NULL;
+
 static inline void bind_texture(int texid)
 {
     if( currentTexId != texid ) {
@@ -120,6 +128,8 @@ void pvr2_setup_gl_context()
     CGL_MACRO_CONTEXT = CGLGetCurrentContext();
 #endif
     texcache_gl_init(); // Allocate texture IDs
+    gl_poly_list = g_malloc( MAX_POLYGONS * sizeof(struct polygon_struct *) );
+    gl_poly_tiles = g_malloc0( MAX_POLYGONS * sizeof(uint16_t) );
 
     /* Global settings */
     glDisable( GL_CULL_FACE );
@@ -154,6 +164,10 @@ void pvr2_shutdown_gl_context()
 {
     texcache_gl_shutdown();
     pvr2_destroy_render_buffers();
+    g_free( gl_poly_list );
+    g_free( gl_poly_tiles );
+    gl_poly_list = NULL;
+    gl_poly_tiles = NULL;
 }
 
 /**
@@ -234,16 +248,101 @@ static inline void gl_draw_mod_vertexes( struct polygon_struct *poly )
     } while( poly != NULL );
 }
 
+/**
+ * Draw batching. Consecutive strips that use the same GL state (polygon
+ * context words + texture) are accumulated here and submitted as a single
+ * glMultiDrawArrays call when the state next changes. The GL state is only
+ * set up when it differs from the previous batch, so anything else that
+ * touches the depth, blend or texture state must call gl_batch_reset()
+ * first.
+ */
+#define MAX_BATCH_STRIPS 1024
+
+#define BATCH_NONE 0    /* GL state is unknown */
+#define BATCH_DEPTH 1   /* Full context including depth function */
+#define BATCH_NODEPTH 2 /* Full context, depth function set externally */
+#define BATCH_TSP 3     /* Texture/shading context only */
+
+static struct {
+    int mode;
+    uint32_t poly1, poly2;
+    int tex_id;
+    int count;
+    GLint first[MAX_BATCH_STRIPS];
+    GLsizei length[MAX_BATCH_STRIPS];
+} gl_batch;
+
+static void gl_batch_flush()
+{
+    if( gl_batch.count != 0 ) {
+#ifdef HAVE_OPENGL_MULTIDRAW
+        glMultiDrawArrays(GL_TRIANGLE_STRIP, gl_batch.first, gl_batch.length, gl_batch.count);
+#else
+        int i;
+        for( i=0; i<gl_batch.count; i++ ) {
+            glDrawArrays(GL_TRIANGLE_STRIP, gl_batch.first[i], gl_batch.length[i]);
+        }
+#endif
+        gl_batch.count = 0;
+    }
+}
+
+/**
+ * Flush any pending strips, and forget the current GL state.
+ */
+static void gl_batch_reset()
+{
+    gl_batch_flush();
+    gl_batch.mode = BATCH_NONE;
+}
+
+/**
+ * Prepare to add strips using the given context, flushing the current batch
+ * and updating the GL state if it doesn't match.
+ */
+static void gl_batch_begin( int mode, uint32_t *context, int tex_id )
+{
+    if( gl_batch.mode != mode || gl_batch.poly1 != context[0] ||
+            gl_batch.poly2 != context[1] || gl_batch.tex_id != tex_id ) {
+        gl_batch_flush();
+        bind_texture(tex_id);
+        if( mode == BATCH_TSP ) {
+            render_set_tsp_context( context[0], context[1] );
+        } else {
+            render_set_context( context, mode == BATCH_DEPTH );
+        }
+        gl_batch.mode = mode;
+        gl_batch.poly1 = context[0];
+        gl_batch.poly2 = context[1];
+        gl_batch.tex_id = tex_id;
+    }
+}
+
+static inline void gl_batch_add( GLint first, GLsizei length )
+{
+    if( gl_batch.count == MAX_BATCH_STRIPS ) {
+        gl_batch_flush();
+    }
+    gl_batch.first[gl_batch.count] = first;
+    gl_batch.length[gl_batch.count] = length;
+    gl_batch.count++;
+}
+
 static void gl_render_poly( struct polygon_struct *poly, gboolean set_depth)
 {
     if( poly->vertex_count == 0 )
         return; /* Culled */
 
-    bind_texture(poly->tex_id);
     if( poly->mod_vertex_index == -1 ) {
-        render_set_context( poly->context, set_depth );
-        gl_draw_vertexes(poly);
+        gl_batch_begin( set_depth ? BATCH_DEPTH : BATCH_NODEPTH, poly->context, poly->tex_id );
+        do {
+            gl_batch_add(poly->vertex_index, poly->vertex_count);
+            poly = poly->sub_next;
+        } while( poly != NULL );
     }  else {
+        /* Two-pass stencilled draw - leaves the GL state unknown */
+        gl_batch_reset();
+        bind_texture(poly->tex_id);
         glEnable( GL_STENCIL_TEST );
         render_set_base_context( poly->context[0], set_depth );
         render_set_tsp_context( poly->context[0], poly->context[1] );
@@ -337,12 +436,14 @@ static void gl_render_bkgnd( struct polygon_struct *poly )
     glEnable( GL_DEPTH_TEST );
 }
 
+/**
+ * Render a single triangle of a polygon. Note that the triangle may be left
+ * in the current batch - the caller must flush it with gl_batch_reset()
+ */
 void gl_render_triangle( struct polygon_struct *poly, int index )
 {
-    bind_texture(poly->tex_id);
-    render_set_tsp_context( poly->context[0], poly->context[1] );
-    glDrawArrays(GL_TRIANGLE_STRIP, poly->vertex_index + index, 3 );
-
+    gl_batch_begin( BATCH_TSP, poly->context, poly->tex_id );
+    gl_batch_add( poly->vertex_index + index, 3 );
 }
 
 void gl_render_tilelist( pvraddr_t tile_entry, gboolean set_depth )
@@ -358,6 +459,131 @@ void gl_render_tilelist( pvraddr_t tile_entry, gboolean set_depth )
             } while( list.strip_count-- > 0 );
         }
     }
+    gl_batch_flush();
+}
+
+/**
+ * Append all polygons in the tile list that aren't already in the polygon
+ * list, and count the tile for each of them. in_order is cleared if the
+ * polygons in the tile list aren't in polygon buffer order.
+ * @return the new length of the polygon list.
+ */
+static int gl_collect_tilelist( pvraddr_t tile_entry, int count, gboolean *in_order )
+{
+    tileentryiter list;
+    uint32_t *last_context = NULL;
+
+    FOREACH_TILEENTRY(list, tile_entry) {
+        struct polygon_struct *poly = pvr2_scene.buf_to_poly_map[TILEENTRYITER_POLYADDR(list)];
+        if( poly != NULL ) {
+            do {
+                int idx = poly - pvr2_scene.poly_array;
+                if( poly->context < last_context ) {
+                    *in_order = FALSE;
+                }
+                last_context = poly->context;
+                if( poly->vertex_count != 0 && gl_poly_tiles[idx]++ == 0 ) {
+                    gl_poly_list[count++] = poly;
+                }
+                poly = poly->next;
+            } while( list.strip_count-- > 0 );
+        }
+    }
+    return count;
+}
+
+/**
+ * Clear the tile counts for the polygon list.
+ */
+static void gl_clear_polylist( int count )
+{
+    int i;
+    for( i=0; i<count; i++ ) {
+        gl_poly_tiles[gl_poly_list[i] - pvr2_scene.poly_array] = 0;
+    }
+}
+
+/**
+ * Convert a vertex coordinate to a tile coordinate the same way as the TA,
+ * clamped to the range lo..hi
+ */
+static inline int gl_tile_coord( float v, int lo, int hi )
+{
+    if( !(v >= lo*32.0f) ) {
+        return lo;
+    } else if( v >= (hi+1)*32.0f ) {
+        return hi;
+    } else {
+        return (int)(v / 32.0);
+    }
+}
+
+/**
+ * Test if each polygon in the list was listed in every rendered tile that
+ * its bounding box overlaps, in which case drawing it once (clipped to the
+ * scene) is the same as drawing it in each tile. This isn't the case for
+ * polygons affected by the user tile clip, which the TA leaves out of the
+ * tiles inside (or outside) the clip rectangle, or where the application
+ * built the object lists itself.
+ * @param clip_tiles the range of tiles rendered, as x1,x2,y1,y2 (inclusive)
+ */
+static gboolean gl_is_polylist_complete( int count, int *clip_tiles )
+{
+    int i, j;
+
+    for( i=0; i<count; i++ ) {
+        struct polygon_struct *poly = gl_poly_list[i];
+        struct vertex_struct *vert = &pvr2_scene.vertex_array[poly->vertex_index];
+        float x1 = vert->x, x2 = vert->x, y1 = vert->y, y2 = vert->y;
+        int tiles;
+
+        do {
+            vert = &pvr2_scene.vertex_array[poly->vertex_index];
+            for( j=0; j<poly->vertex_count; j++, vert++ ) {
+                if( vert->x < x1 ) x1 = vert->x;
+                if( vert->x > x2 ) x2 = vert->x;
+                if( vert->y < y1 ) y1 = vert->y;
+                if( vert->y > y2 ) y2 = vert->y;
+            }
+            poly = poly->sub_next;
+        } while( poly != NULL );
+
+        if( !(x2 >= clip_tiles[0]*32.0f && y2 >= clip_tiles[2]*32.0f &&
+                x1 < (clip_tiles[1]+1)*32.0f && y1 < (clip_tiles[3]+1)*32.0f) ) {
+            /* Not in any rendered tile, so it must have come from elsewhere */
+            return FALSE;
+        }
+        tiles = (gl_tile_coord(x2, clip_tiles[0], clip_tiles[1]) - gl_tile_coord(x1, clip_tiles[0], clip_tiles[1]) + 1) *
+            (gl_tile_coord(y2, clip_tiles[2], clip_tiles[3]) - gl_tile_coord(y1, clip_tiles[2], clip_tiles[3]) + 1);
+        if( gl_poly_tiles[gl_poly_list[i] - pvr2_scene.poly_array] != tiles ) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static int gl_poly_compare( const void *a, const void *b )
+{
+    uint32_t *ctxa = (*(struct polygon_struct **)a)->context;
+    uint32_t *ctxb = (*(struct polygon_struct **)b)->context;
+    return ctxa < ctxb ? -1 : (ctxa > ctxb ? 1 : 0);
+}
+
+/**
+ * Render each polygon in the polygon list once, in polygon buffer order
+ * (which is the order the TA writes them into every tile list - see
+ * gl_collect_tilelist).
+ */
+static void gl_render_polylist( int count, gboolean set_depth )
+{
+    int i;
+
+    qsort( gl_poly_list, count, sizeof(struct polygon_struct *), gl_poly_compare );
+    for( i=0; i<count; i++ ) {
+        gl_render_poly(gl_poly_list[i], set_depth);
+    }
+    gl_clear_polylist(count);
+    gl_batch_flush();
 }
 
 /**
@@ -493,9 +719,11 @@ void pvr2_scene_render( render_buffer_t buffer )
 {
     /* Scene setup */
     struct timeval start_tv, tex_tv, end_tv;
-    int i;
+    int i, count;
     GLfloat viewMatrix[16];
     uint32_t clip_bounds[4];
+    int clip_tiles[4];
+    gboolean in_order;
 
 
     gettimeofday(&start_tv, NULL);
@@ -520,6 +748,10 @@ void pvr2_scene_render( render_buffer_t buffer )
     for( i=0; i<4; i++ ) {
         clip_bounds[i] = (uint32_t)pvr2_scene.bounds[i];
     }
+    clip_tiles[0] = clip_bounds[0] >> 5;
+    clip_tiles[1] = clip_bounds[1] == 0 ? 0 : (clip_bounds[1]-1) >> 5;
+    clip_tiles[2] = clip_bounds[2] >> 5;
+    clip_tiles[3] = clip_bounds[3] == 0 ? 0 : (clip_bounds[3]-1) >> 5;
 
     defineOrthoMatrix(viewMatrix, pvr2_scene.buffer_width, pvr2_scene.buffer_height, -farz, -nearz);
 
@@ -538,6 +770,7 @@ void pvr2_scene_render( render_buffer_t buffer )
 
     /* Render the background */
     gl_render_bkgnd( pvr2_scene.bkgnd_poly );
+    gl_batch_reset();
 
     glEnable( GL_SCISSOR_TEST );
     glEnable( GL_TEXTURE_2D );
@@ -589,11 +822,31 @@ void pvr2_scene_render( render_buffer_t buffer )
         glColorMask( GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE );
     }
 
-    /* Render the opaque polygons */
+#define CLIP_TO_SCENE() \
+    glScissor( clip_bounds[0], pvr2_scene.buffer_height-clip_bounds[3], clip_bounds[1]-clip_bounds[0], clip_bounds[3] - clip_bounds[2] )
+
+    /* Render the opaque polygons. If every polygon is in every tile it
+     * covers, in the same order in each tile, just draw each one once,
+     * clipped to the scene. Otherwise (eg user tile clipping) fall back to
+     * drawing them tile-by-tile */
+    count = 0;
+    in_order = TRUE;
     FOREACH_SEGMENT(segment)
-        CLIP_TO_SEGMENT();
-        gl_render_tilelist(segment->opaque_ptr,TRUE);
+        count = gl_collect_tilelist(segment->opaque_ptr, count, &in_order);
     END_FOREACH_SEGMENT()
+    if( in_order && gl_is_polylist_complete(count, clip_tiles) ) {
+        if( clip_bounds[0] < clip_bounds[1] && clip_bounds[2] < clip_bounds[3] ) {
+            CLIP_TO_SCENE();
+        }
+        gl_render_polylist(count, TRUE);
+    } else {
+        gl_clear_polylist(count);
+        FOREACH_SEGMENT(segment)
+            CLIP_TO_SEGMENT();
+            gl_render_tilelist(segment->opaque_ptr, TRUE);
+        END_FOREACH_SEGMENT()
+    }
+    gl_batch_reset();
     glDisable( GL_STENCIL_TEST );
 
     /* Render the punch-out polygons */
@@ -602,10 +855,24 @@ void pvr2_scene_render( render_buffer_t buffer )
     else
         pvr2_scene_set_alpha_fixed(alphaRef);
     glDepthFunc(GL_GEQUAL);
+    count = 0;
+    in_order = TRUE;
     FOREACH_SEGMENT(segment)
-        CLIP_TO_SEGMENT();
-        gl_render_tilelist(segment->punchout_ptr, FALSE );
+        count = gl_collect_tilelist(segment->punchout_ptr, count, &in_order);
     END_FOREACH_SEGMENT()
+    if( in_order && gl_is_polylist_complete(count, clip_tiles) ) {
+        if( clip_bounds[0] < clip_bounds[1] && clip_bounds[2] < clip_bounds[3] ) {
+            CLIP_TO_SCENE();
+        }
+        gl_render_polylist(count, FALSE);
+    } else {
+        gl_clear_polylist(count);
+        FOREACH_SEGMENT(segment)
+            CLIP_TO_SEGMENT();
+            gl_render_tilelist(segment->punchout_ptr, FALSE);
+        END_FOREACH_SEGMENT()
+    }
+    gl_batch_reset();
     if( have_shaders )
         pvr2_scene_set_alpha_shader(0.0);
     else
@@ -619,10 +886,13 @@ void pvr2_scene_render( render_buffer_t buffer )
                     (pvr2_scene.sort_mode == SORT_TILEFLAG && (segment->control&SEGMENT_SORT_TRANS))) {
                 gl_render_tilelist(segment->trans_ptr, TRUE);
             } else {
+                gl_batch_reset();
                 render_autosort_tile(segment->trans_ptr, RENDER_NORMAL );
+                gl_batch_reset();
             }
         }
     END_FOREACH_SEGMENT()
+    gl_batch_reset();
 
     glDisable( GL_SCISSOR_TEST );
 
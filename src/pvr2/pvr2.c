@@ -39,6 +39,7 @@
 static void pvr2_init( void );
 static void pvr2_reset( void );
 static uint32_t pvr2_run_slice( uint32_t );
+static uint32_t pvr2_next_deadline( void );
 static void pvr2_save_state( FILE *f );
 static int pvr2_load_state( FILE *f );
 static void pvr2_update_raster_posn( uint32_t nanosecs );
@@ -56,7 +57,7 @@ static int render_colour_formats[8] = {
 
 struct dreamcast_module pvr2_module = { "PVR2", pvr2_init, pvr2_reset, NULL, 
         pvr2_run_slice, NULL,
-        pvr2_save_state, pvr2_load_state };
+        pvr2_save_state, pvr2_load_state, pvr2_next_deadline };
 
 
 display_driver_t display_driver = NULL;
@@ -172,6 +173,7 @@ static void pvr2_reset( void )
 
     pvr2_ta_init();
     texcache_flush();
+    pvr2_scene_render_wait( NULL );
     if( display_driver ) {
         display_driver->display_blank(0);
         for( i=0; i<render_buffer_count; i++ ) {
@@ -193,6 +195,7 @@ void pvr2_save_render_buffer( FILE *f, render_buffer_t buffer )
     fbuf.inverted = buffer->inverted;
     fbuf.data = g_malloc0( buffer->width * buffer->height * 3 );
 
+    pvr2_scene_render_wait( buffer );
     display_driver->read_render_buffer( fbuf.data, buffer, fbuf.rowstride, COLFMT_BGR888 );
     write_png_to_stream( f, &fbuf );
     g_free( fbuf.data );
@@ -266,6 +269,7 @@ gboolean pvr2_load_render_buffers( FILE *f )
         return FALSE;
     }
     fread( &has_frontbuffer, sizeof(has_frontbuffer), 1, f );
+    pvr2_scene_render_wait( NULL );
     for( i=0; i<render_buffer_count; i++ ) {
         display_driver->destroy_render_buffer(render_buffers[i]);
         render_buffers[i] = NULL;
@@ -354,6 +358,20 @@ static uint32_t pvr2_run_slice( uint32_t nanosecs )
     return nanosecs;
 }
 
+/**
+ * The frame is presented from run_slice when the raster passes the end of
+ * retrace, so end the slice there rather than up to a slice later.
+ */
+static uint32_t pvr2_next_deadline( void )
+{
+    if( pvr2_state.line_time_ns == 0 || pvr2_state.total_lines == 0 ) {
+        return NO_DEADLINE;
+    }
+    uint32_t lines = (pvr2_state.retrace_end_line + pvr2_state.total_lines - 
+            pvr2_state.line_count - 1) % pvr2_state.total_lines + 1;
+    return pvr2_state.cycles_run + lines * pvr2_state.line_time_ns - pvr2_state.line_remainder;
+}
+
 int pvr2_get_frame_count() 
 {
     return pvr2_state.frame_count;
@@ -365,6 +383,7 @@ void pvr2_draw_frame()
         if( displayed_render_buffer == NULL ) {
             display_driver->display_blank(displayed_border_colour);
         } else {
+            pvr2_scene_render_wait( displayed_render_buffer );
             display_driver->display_render_buffer(displayed_render_buffer);
         }
     }
@@ -471,6 +490,7 @@ MMIO_REGION_WRITE_FN( PVR2, reg, val )
         MMIO_WRITE( PVR2, reg, val );
         break;
     case RENDER_START: /* Don't really care what value */
+        pvr2_ta_sync();
         if( save_next_render_filename != NULL ) {
             if( pvr2_render_save_scene(save_next_render_filename) == 0 ) {
                 INFO( "Saved scene to %s", save_next_render_filename);
@@ -478,10 +498,15 @@ MMIO_REGION_WRITE_FN( PVR2, reg, val )
             g_free( save_next_render_filename );
             save_next_render_filename = NULL;
         }
+        pvr2_scene_render_wait( NULL );
         pvr2_scene_read();
         render_buffer_t buffer = pvr2_next_render_buffer();
         if( buffer != NULL ) {
-            pvr2_scene_render( buffer );
+            if( display_driver->capabilities.has_gl || !pvr2_scene_get_soft_render() ) {
+                pvr2_scene_render( buffer );
+            } else {
+                pvr2_scene_render_soft( buffer );
+            }
             if( buffer->address < PVR2_RAM_BASE ) {
                 // Flush immediately - optimize this later. Otherwise this gets
                 // complicated very quickly trying to second-guess how it's
@@ -664,17 +689,21 @@ MMIO_REGION_WRITE_FN( PVR2, reg, val )
         case TA_TILEBASE:
         case TA_LISTEND:
         case TA_LISTBASE:
+            pvr2_ta_sync();
             MMIO_WRITE( PVR2, reg, val&0x00FFFFE0 );
             break;
         case RENDER_TILEBASE:
         case TA_POLYBASE:
         case TA_POLYEND:
+            pvr2_ta_sync();
             MMIO_WRITE( PVR2, reg, val&0x00FFFFFC );
             break;
         case TA_TILESIZE:
+            pvr2_ta_sync();
             MMIO_WRITE( PVR2, reg, val&0x000F003F );
             break;
         case TA_TILECFG:
+            pvr2_ta_sync();
             MMIO_WRITE( PVR2, reg, val&0x00133333 );
             break;
         case TA_INIT:
@@ -822,6 +851,10 @@ MMIO_REGION_READ_FN( PVR2, reg )
     switch( reg ) {
     case DISP_SYNCSTAT:
         return pvr2_get_sync_status();
+    case TA_LISTPOS:
+    case TA_POLYPOS:
+        pvr2_ta_sync();
+        return MMIO_READ( PVR2, reg );
     default:
         return MMIO_READ( PVR2, reg );
     }
@@ -863,6 +896,7 @@ render_buffer_t pvr2_create_render_buffer( sh4addr_t addr, int width, int height
 
 void pvr2_destroy_render_buffer( render_buffer_t buffer )
 {
+    pvr2_scene_render_wait( buffer );
     if( !buffer->flushed )
         pvr2_render_buffer_copy_to_sh4( buffer );
      display_driver->destroy_render_buffer( buffer );
@@ -936,6 +970,7 @@ void pvr2_restore_render_buffers( void )
 
 void pvr2_finish_render_buffer( render_buffer_t buffer )
 {
+    pvr2_scene_render_wait( buffer );
     display_driver->finish_render( buffer );
 }
 
@@ -975,6 +1010,9 @@ render_buffer_t pvr2_alloc_render_buffer( sh4addr_t render_addr, int width, int
     int i;
     render_buffer_t result = NULL;
 
+    /* Any buffer may be reused or destroyed below */
+    pvr2_scene_render_wait( NULL );
+
     /* Check existing buffers for an available buffer */
     for( i=0; i<render_buffer_count; i++ ) {
         if( render_buffers[i]->width == width && render_buffers[i]->height == height ) {
@@ -1108,6 +1146,7 @@ static frame_buffer_t pvr2_render_buffer_to_frame_buffer( render_buffer_t buffer
     result->address = buffer->address;
     result->size = buffer->size;
     result->inverted = buffer->inverted;
+    pvr2_scene_render_wait( buffer );
     display_driver->read_render_buffer( result->data, buffer, buffer->width * bpp, buffer->colour_format );
     return result;
 }
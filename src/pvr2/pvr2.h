@@ -249,6 +249,18 @@ void pvr2_ta_init( void );
 
 void pvr2_ta_reset( void );
 
+/**
+ * Wait for the TA thread (if enabled) to finish with all data written to the
+ * TA so far, and raise any events it generated. Must be called before
+ * accessing state that the TA updates (TA registers and buffers).
+ */
+void pvr2_ta_sync( void );
+
+/**
+ * Enable/disable parsing TA input on a separate thread
+ */
+void pvr2_ta_set_threaded( gboolean flag );
+
 void pvr2_ta_save_state( FILE *f );
 
 int pvr2_ta_load_state( FILE *f );
@@ -278,6 +290,41 @@ int pvr2_yuv_load_state( FILE *f );
  */
 void pvr2_scene_render( render_buffer_t buffer );
 
+/**
+ * Render the current scene stored in PVR ram in software, into the host
+ * pixels of the render buffer. Used by display drivers without GL.
+ */
+void pvr2_scene_render_soft( render_buffer_t buffer );
+
+/**
+ * Enable or disable the software renderer (off by default). When disabled,
+ * display drivers without GL don't provide render buffers, and scenes aren't
+ * rendered at all.
+ */
+void pvr2_scene_set_soft_render( gboolean flag );
+
+gboolean pvr2_scene_get_soft_render( void );
+
+/**
+ * Set the number of threads used by the software renderer, including the
+ * calling thread (0 = one per CPU).
+ */
+void pvr2_scene_set_soft_threads( int threads );
+
+/**
+ * Enable or disable the software render thread. When enabled,
+ * pvr2_scene_render_soft() returns once the scene has been copied out of vram,
+ * and the render completes in the background.
+ */
+void pvr2_scene_set_soft_pipelined( gboolean flag );
+
+/**
+ * Wait for a background render into the given buffer to complete (or any
+ * background render if buffer is NULL). Must be called before the buffer
+ * contents are read or the buffer is reused.
+ */
+void pvr2_scene_render_wait( render_buffer_t buffer );
+
 /**
  * Perform the initial once-off GL setup, usually immediately after the GL
  * context is first bound.
@@ -291,6 +338,14 @@ void render_backplane( uint32_t *polygon, uint32_t width, uint32_t height, uint3
 void render_autosort_tile( pvraddr_t tile_entry, int render_mode );
 
 struct polygon_struct;
+typedef void (*render_sort_fn_t)( struct polygon_struct *poly, int index, void *data );
+
+/**
+ * Depth-sort the triangles in the tile list (back to front, as for
+ * render_autosort_tile), and call fn for each triangle in order.
+ */
+void render_sort_tile( pvraddr_t tile_entry, render_sort_fn_t fn, void *data );
+
 void gl_render_triangle( struct polygon_struct *poly, int index );
 
 void gl_render_tilelist( pvraddr_t tile_entry, gboolean set_depth );
@@ -736,6 +736,7 @@ void pvr2_render_buffer_copy_to_sh4( render_buffer_t buffer )
     int src_stride = line_size;
     unsigned char target[buffer->size];
 
+    pvr2_scene_render_wait( buffer );
     display_driver->read_render_buffer( target, buffer, line_size, buffer->colour_format );
 
     if( (buffer->scale & 0xFFFF) == 0x0800 )
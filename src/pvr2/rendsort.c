@@ -287,3 +287,24 @@ void render_autosort_tile( pvraddr_t tile_entry, int render_mode )
         assert( triangles[num_triangles].poly == (void *)SENTINEL );
     }
 }
+
+void render_sort_tile( pvraddr_t tile_entry, render_sort_fn_t fn, void *data )
+{
+    int num_triangles = sort_count_triangles(tile_entry);
+    if( num_triangles > 0 ) {
+        int i;
+        struct sort_triangle triangles[num_triangles];
+        struct sort_triangle *triangle_order[num_triangles];
+        for( i=0; i<num_triangles; i++ ) {
+            triangle_order[i] = &triangles[i];
+        }
+        int extracted_triangles = sort_extract_triangles(tile_entry, triangles);
+        assert( extracted_triangles <= num_triangles );
+        if( extracted_triangles > 0 ) {
+            sort_triangles( triangle_order, extracted_triangles, triangle_order );
+        }
+        for( i=0; i<extracted_triangles; i++ ) {
+            fn( triangle_order[i]->poly, triangle_order[i]->triangle_num, data );
+        }
+    }
+}
@@ -19,6 +19,9 @@
 #include <assert.h>
 #include <string.h>
 #include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "lxdream.h"
 #include "display.h"
 #include "pvr2/pvr2.h"
@@ -29,17 +32,25 @@
 #define U8TOFLOAT(n)  (((float)((n)+1))/256.0)
 #define POLY_IDX(addr) ( ((uint32_t *)addr) - ((uint32_t *)pvr2_scene.pvr2_pbuf))
 
-static void unpack_bgra(uint32_t bgra, float *rgba)
+static inline uint32_t bgra_to_rgba(uint32_t bgra)
+{
+    return (bgra&0xFF00FF00) | ((bgra&0x00FF0000)>>16) | ((bgra&0x000000FF)<<16);
+}
+
+static inline void unpack_bgra(uint32_t bgra, float *rgba)
 {
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    __m128i v = _mm_cvtsi32_si128( bgra_to_rgba(bgra) );
+    v = _mm_unpacklo_epi16( _mm_unpacklo_epi8( v, zero ), zero );
+    v = _mm_add_epi32( v, _mm_set1_epi32(1) );
+    _mm_storeu_ps( rgba, _mm_mul_ps( _mm_cvtepi32_ps(v), _mm_set1_ps(1.0/256.0) ) );
+#else
     rgba[0] = ((float)(((bgra&0x00FF0000)>>16) + 1)) / 256.0;
     rgba[1] = ((float)(((bgra&0x0000FF00)>>8) + 1)) / 256.0;
     rgba[2] = ((float)((bgra&0x000000FF) + 1)) / 256.0;
     rgba[3] = ((float)(((bgra&0xFF000000)>>24) + 1)) / 256.0;
-}
-
-static inline uint32_t bgra_to_rgba(uint32_t bgra)
-{
-    return (bgra&0xFF00FF00) | ((bgra&0x00FF0000)>>16) | ((bgra&0x000000FF)<<16);
+#endif
 }
 
 /**
@@ -186,94 +197,185 @@ static float scene_get_palette_offset( uint32_t tex )
 }
 
 /**
- * Decode a single PVR2 renderable vertex (opaque/trans/punch-out, but not shadow
- * volume)
- * @param vert Pointer to output vertex structure
+ * Layout of a PVR2 renderable vertex (opaque/trans/punch-out, but not shadow
+ * volume), decoded once per polygon from the context words so that whole
+ * strips can be converted without re-examining the flags for each vertex.
+ */
+struct vertex_format {
+    int uv_words;         /* 0 if untextured, 1 for 16-bit uvs, otherwise 2 */
+    gboolean replace;     /* Texture replace mode - ignore the colour word */
+    gboolean specular;    /* Has an offset colour word */
+    gboolean force_alpha;
+    float tex_mode;
+    float palette_offset;
+};
+
+/**
+ * Determine the vertex layout from the polygon context.
  * @param poly1 First word of polygon context (needed to understand vertex)
  * @param poly2 Second word of polygon context
- * @param pvr2_data Pointer to raw pvr2 vertex data (in VRAM)
+ * @param tex Texture word of polygon context
+ */
+static void scene_vertex_format( struct vertex_format *fmt, uint32_t poly1,
+                                 uint32_t poly2, uint32_t tex )
+{
+    fmt->force_alpha = !POLY2_ALPHA_ENABLE(poly2);
+    fmt->replace = FALSE;
+    fmt->specular = POLY1_SPECULAR(poly1) ? TRUE : FALSE;
+    if( POLY1_TEXTURED(poly1) ) {
+        fmt->uv_words = POLY1_UV16(poly1) ? 1 : 2;
+        switch( POLY2_TEX_BLEND(poly2) ) {
+        case 0:/* Convert replace => modulate by setting colour values to 1.0 */
+            fmt->replace = TRUE;
+            fmt->tex_mode = 0.0;
+            break;
+        case 2: /* Decal */
+            fmt->tex_mode = 1.0;
+            break;
+        case 1:
+            fmt->force_alpha = TRUE;
+            /* fall-through */
+        default:
+            fmt->tex_mode = 0.0;
+            break;
+        }
+        fmt->palette_offset = scene_get_palette_offset(tex);
+    } else {
+        fmt->uv_words = 0;
+        fmt->tex_mode = 2.0;
+        fmt->palette_offset = -1.0;
+    }
+}
+
+/**
+ * Convert the vertex z (w) values to 1/w, and update the scene depth bounds.
+ * Non-finite values are treated as 0.
+ */
+static void scene_decode_depth( struct vertex_struct *vert, int count,
+                                uint32_t *pvr2_data, int vertex_length )
+{
+    float depth[4];
+    int i = 0, j, n;
+
+    while( i < count ) {
+#ifdef __SSE2__
+        if( i + 4 <= count ) {
+            __m128i bits = _mm_set_epi32( pvr2_data[3*vertex_length+2], pvr2_data[2*vertex_length+2],
+                                          pvr2_data[vertex_length+2], pvr2_data[2] );
+            __m128i exp_mask = _mm_set1_epi32( 0x7F800000 );
+            __m128 z = _mm_castsi128_ps( bits );
+            __m128 finite = _mm_castsi128_ps( _mm_xor_si128( _mm_cmpeq_epi32( _mm_and_si128( bits, exp_mask ), exp_mask ),
+                                                             _mm_set1_epi32(-1) ) );
+            __m128 recip = _mm_and_ps( finite, _mm_cmpneq_ps( z, _mm_setzero_ps() ) );
+            z = _mm_or_ps( _mm_and_ps( recip, _mm_div_ps( _mm_set1_ps(1.0f), z ) ),
+                           _mm_andnot_ps( recip, _mm_and_ps( finite, z ) ) );
+            _mm_storeu_ps( depth, z );
+            n = 4;
+        } else
+#endif
+        {
+            union {
+                uint32_t i;
+                float f;
+            } z;
+            z.i = pvr2_data[2];
+            if( !isfinite(z.f) ) {
+                z.f = 0;
+            } else if( z.f != 0 ) {
+                z.f = 1/z.f;
+            }
+            depth[0] = z.f;
+            n = 1;
+        }
+
+        for( j=0; j<n; j++ ) {
+            float z = depth[j];
+            if( z > pvr2_scene.bounds[5] ) {
+                pvr2_scene.bounds[5] = z;
+            } else if( z < pvr2_scene.bounds[4] && z != 0 ) {
+                pvr2_scene.bounds[4] = z;
+            }
+            vert[i+j].z = z;
+        }
+        i += n;
+        pvr2_data += n*vertex_length;
+    }
+}
+
+/**
+ * Decode a strip of PVR2 renderable vertexes which all share the same format
+ * @param vert Pointer to output vertex structures
+ * @param count Number of vertexes to decode
+ * @param fmt Vertex format, from scene_vertex_format()
+ * @param pvr2_data Pointer to raw pvr2 vertex data (in VRAM) for the first vertex
+ * @param vertex_length Length of each vertex in 32-bit words
  * @param modify_offset Offset in 32-bit words to the tex/color data. 0 for
  *        the normal vertex, half the vertex length for the modified vertex.
  */
-static void scene_decode_vertex( struct vertex_struct *vert, uint32_t poly1,
-                                       uint32_t poly2, uint32_t tex, uint32_t *pvr2_data,
-                                       int modify_offset )
+static void scene_decode_vertexes( struct vertex_struct *vert, int count,
+                                   const struct vertex_format *fmt, uint32_t *pvr2_data,
+                                   int vertex_length, int modify_offset )
 {
-    gboolean force_alpha = !POLY2_ALPHA_ENABLE(poly2);
     union pvr2_data_type {
         uint32_t *ival;
         float *fval;
     } data;
+    int i;
 
-    data.ival = pvr2_data;
+    scene_decode_depth( vert, count, pvr2_data, vertex_length );
 
-    vert->x = *data.fval++;
-    vert->y = *data.fval++;
+    for( i=0; i<count; i++, vert++, pvr2_data += vertex_length ) {
+        data.ival = pvr2_data;
+        vert->x = data.fval[0];
+        vert->y = data.fval[1];
+        data.ival += 3 + modify_offset;
 
-    float z = *data.fval++;
-    if( !isfinite(z) ) {
-        z = 0;
-    } else if( z != 0 ) {
-        z = 1/z;
-    }
-    if( z > pvr2_scene.bounds[5] ) {
-        pvr2_scene.bounds[5] = z;
-    } else if( z < pvr2_scene.bounds[4] && z != 0 ) {
-        pvr2_scene.bounds[4] = z;
-    }
-    vert->z = z;
-    data.ival += modify_offset;
-
-
-    if( POLY1_TEXTURED(poly1) ) {
-        if( POLY1_UV16(poly1) ) {
+        if( fmt->uv_words == 1 ) {
             vert->u = halftofloat( *data.ival>>16 );
             vert->v = halftofloat( *data.ival );
             data.ival++;
-        } else {
+        } else if( fmt->uv_words == 2 ) {
             vert->u = *data.fval++;
             vert->v = *data.fval++;
         }
+        vert->r = fmt->palette_offset;
+        vert->tex_mode = fmt->tex_mode;
 
-        switch( POLY2_TEX_BLEND(poly2) ) {
-        case 0:/* Convert replace => modulate by setting colour values to 1.0 */
+        if( fmt->replace ) {
             vert->rgba[0] = vert->rgba[1] = vert->rgba[2] = vert->rgba[3] = 1.0;
-            vert->tex_mode = 0.0;
             data.ival++; /* Skip the colour word */
-            break;
-        case 2: /* Decal */
-            vert->tex_mode = 1.0;
-            unpack_bgra(*data.ival++, vert->rgba);
-            break;
-        case 1:
-            force_alpha = TRUE;
-            /* fall-through */
-        default:
-            vert->tex_mode = 0.0;
+        } else {
             unpack_bgra(*data.ival++, vert->rgba);
-            break;
         }
-        vert->r = scene_get_palette_offset(tex);
-    } else {
-        vert->tex_mode = 2.0;
-        vert->r = -1.0;
-        unpack_bgra(*data.ival++, vert->rgba);
-    }
 
-    if( POLY1_SPECULAR(poly1) ) {
-        unpack_bgra(*data.ival++, vert->offset_rgba);
-    } else {
-        vert->offset_rgba[0] = 0.0;
-        vert->offset_rgba[1] = 0.0;
-        vert->offset_rgba[2] = 0.0;
-        vert->offset_rgba[3] = 0.0;
-    }
+        if( fmt->specular ) {
+            unpack_bgra(*data.ival++, vert->offset_rgba);
+        } else {
+            vert->offset_rgba[0] = 0.0;
+            vert->offset_rgba[1] = 0.0;
+            vert->offset_rgba[2] = 0.0;
+            vert->offset_rgba[3] = 0.0;
+        }
 
-    if( force_alpha ) {
-        vert->rgba[3] = 1.0;
+        if( fmt->force_alpha ) {
+            vert->rgba[3] = 1.0;
+        }
     }
 }
 
+/**
+ * Decode PVR2 renderable vertexes using the format given by the polygon
+ * context words.
+ */
+static void scene_decode_context_vertexes( struct vertex_struct *vert, int count, uint32_t poly1,
+                                           uint32_t poly2, uint32_t tex, uint32_t *pvr2_data,
+                                           int vertex_length, int modify_offset )
+{
+    struct vertex_format fmt;
+    scene_vertex_format( &fmt, poly1, poly2, tex );
+    scene_decode_vertexes( vert, count, &fmt, pvr2_data, vertex_length, modify_offset );
+}
+
 /**
  * Compute texture, colour, and z values for 1 or more result points by interpolating from
  * a set of 3 input points. The result point(s) must define their x,y.
@@ -468,8 +570,21 @@ static void scene_backface_cull()
 
 static void scene_add_cheap_shadow_vertexes( struct vertex_struct *src, struct vertex_struct *dest, int count )
 {
-    unsigned int i, j;
-    
+    unsigned int i;
+
+#ifdef __SSE2__
+    __m128 scale = _mm_set1_ps( scene_shadow_intensity );
+    __m128 offset_scale = _mm_setr_ps( scene_shadow_intensity, scene_shadow_intensity,
+                                       scene_shadow_intensity, 1.0 );
+    for( i=0; i<count; i++ ) {
+        _mm_storeu_ps( &dest->u, _mm_loadu_ps( &src->u ) ); /* u,v,r,tex_mode */
+        _mm_storeu_ps( &dest->x, _mm_loadu_ps( &src->x ) ); /* x,y,z,w */
+        _mm_storeu_ps( dest->rgba, _mm_mul_ps( _mm_loadu_ps( src->rgba ), scale ) );
+        _mm_storeu_ps( dest->offset_rgba, _mm_mul_ps( _mm_loadu_ps( src->offset_rgba ), offset_scale ) );
+        dest++;
+        src++;
+    }
+#else
     for( i=0; i<count; i++ ) {
         dest->x = src->x;
         dest->y = src->y;
@@ -489,6 +604,7 @@ static void scene_add_cheap_shadow_vertexes( struct vertex_struct *src, struct v
         dest++;
         src++;
     }
+#endif
 }
 
 static void scene_add_vertexes( pvraddr_t poly_idx, int vertex_length,
@@ -497,7 +613,6 @@ static void scene_add_vertexes( pvraddr_t poly_idx, int vertex_length,
     struct polygon_struct *poly = pvr2_scene.buf_to_poly_map[poly_idx];
     uint32_t *ptr = &pvr2_scene.pvr2_pbuf[poly_idx];
     uint32_t *context = ptr;
-    unsigned int i;
 
     if( poly->vertex_index == -1 ) {
         ptr += (is_modified == SHADOW_FULL ? 5 : 3 );
@@ -505,20 +620,18 @@ static void scene_add_vertexes( pvraddr_t poly_idx, int vertex_length,
 
         assert( poly != NULL );
         assert( pvr2_scene.vertex_index + poly->vertex_count <= pvr2_scene.vertex_count );
-        for( i=0; i<poly->vertex_count; i++ ) {
-            scene_decode_vertex( &pvr2_scene.vertex_array[pvr2_scene.vertex_index++], context[0], context[1], context[2], ptr, 0 );
-            ptr += vertex_length;
-        }
+        scene_decode_context_vertexes( &pvr2_scene.vertex_array[pvr2_scene.vertex_index], poly->vertex_count,
+                                       context[0], context[1], context[2], ptr, vertex_length, 0 );
+        pvr2_scene.vertex_index += poly->vertex_count;
         if( is_modified ) {
             assert( pvr2_scene.vertex_index + poly->vertex_count <= pvr2_scene.vertex_count );
             poly->mod_vertex_index = pvr2_scene.vertex_index;
             if( is_modified == SHADOW_FULL ) {
                 int mod_offset = (vertex_length - 3)>>1;
                 ptr = &pvr2_scene.pvr2_pbuf[poly_idx] + 5;
-                for( i=0; i<poly->vertex_count; i++ ) {
-                    scene_decode_vertex( &pvr2_scene.vertex_array[pvr2_scene.vertex_index++], context[0], context[3], context[4], ptr, mod_offset );
-                    ptr += vertex_length;
-                }
+                scene_decode_context_vertexes( &pvr2_scene.vertex_array[pvr2_scene.vertex_index], poly->vertex_count,
+                                               context[0], context[3], context[4], ptr, vertex_length, mod_offset );
+                pvr2_scene.vertex_index += poly->vertex_count;
             } else {
                 scene_add_cheap_shadow_vertexes( &pvr2_scene.vertex_array[poly->vertex_index], 
                         &pvr2_scene.vertex_array[poly->mod_vertex_index], poly->vertex_count );
@@ -534,7 +647,6 @@ static void scene_add_quad_vertexes( pvraddr_t poly_idx, int vertex_length,
     struct polygon_struct *poly = pvr2_scene.buf_to_poly_map[poly_idx];
     uint32_t *ptr = &pvr2_scene.pvr2_pbuf[poly_idx];
     uint32_t *context = ptr;
-    unsigned int i;
 
     if( poly->vertex_index == -1 ) {
         // Construct it locally and copy to the vertex buffer, as the VBO is
@@ -546,10 +658,7 @@ static void scene_add_quad_vertexes( pvraddr_t poly_idx, int vertex_length,
         assert( pvr2_scene.vertex_index + poly->vertex_count <= pvr2_scene.vertex_count );
         ptr += (is_modified == SHADOW_FULL ? 5 : 3 );
         poly->vertex_index = pvr2_scene.vertex_index;
-        for( i=0; i<4; i++ ) {
-            scene_decode_vertex( &quad[i], context[0], context[1], context[2], ptr, 0 );
-            ptr += vertex_length;
-        }
+        scene_decode_context_vertexes( quad, 4, context[0], context[1], context[2], ptr, vertex_length, 0 );
         scene_compute_vertexes( &quad[3], 1, &quad[0], !POLY1_GOURAUD_SHADED(context[0]) );
         // Swap last two vertexes (quad arrangement => tri strip arrangement)
         memcpy( &pvr2_scene.vertex_array[pvr2_scene.vertex_index], quad, sizeof(struct vertex_struct)*2 );
@@ -568,10 +677,7 @@ static void scene_add_quad_vertexes( pvraddr_t poly_idx, int vertex_length,
             if( is_modified == SHADOW_FULL ) {
                 int mod_offset = (vertex_length - 3)>>1;
                 ptr = &pvr2_scene.pvr2_pbuf[poly_idx] + 5;
-                for( i=0; i<4; i++ ) {
-                    scene_decode_vertex( &quad[4], context[0], context[3], context[4], ptr, mod_offset );
-                    ptr += vertex_length;
-                }
+                scene_decode_context_vertexes( quad, 4, context[0], context[3], context[4], ptr, vertex_length, mod_offset );
                 scene_compute_vertexes( &quad[3], 1, &quad[0], !POLY1_GOURAUD_SHADED(context[0]) );
                 memcpy( &pvr2_scene.vertex_array[pvr2_scene.vertex_index], quad, sizeof(struct vertex_struct)*2 );
                 memcpy( &pvr2_scene.vertex_array[pvr2_scene.vertex_index+2], &quad[3], sizeof(struct vertex_struct) );
@@ -714,7 +820,7 @@ static void scene_extract_background( void )
 {
     uint32_t bgplane = MMIO_READ(PVR2, RENDER_BGPLANE);
     int vertex_length = (bgplane >> 24) & 0x07;
-    int context_length = 3, i;
+    int context_length = 3;
     shadow_mode_t is_modified = (bgplane & 0x08000000) ? pvr2_scene.shadow_mode : SHADOW_NONE;
 
     struct polygon_struct *poly = &pvr2_scene.poly_array[pvr2_scene.poly_count++];
@@ -742,11 +848,8 @@ static void scene_extract_background( void )
 
     struct vertex_struct base_vertexes[3];
     uint32_t *ptr = context + context_length;
-    for( i=0; i<3; i++ ) {
-        scene_decode_vertex( &base_vertexes[i], context[0], context[1], context[2],
-                ptr, 0 );
-        ptr += vertex_length;
-    }
+    scene_decode_context_vertexes( base_vertexes, 3, context[0], context[1], context[2],
+            ptr, vertex_length, 0 );
     struct vertex_struct *result_vertexes = &pvr2_scene.vertex_array[poly->vertex_index];
     result_vertexes[0].x = result_vertexes[0].y = 0;
     result_vertexes[1].x = result_vertexes[3].x = pvr2_scene.buffer_width;
@@ -757,11 +860,8 @@ static void scene_extract_background( void )
     if( is_modified == SHADOW_FULL ) {
         int mod_offset = (vertex_length - 3)>>1;
         ptr = context + context_length;
-        for( i=0; i<3; i++ ) {
-            scene_decode_vertex( &base_vertexes[i], context[0], context[3], context[4],
-                    ptr, mod_offset );
-            ptr += vertex_length;
-        }
+        scene_decode_context_vertexes( base_vertexes, 3, context[0], context[3], context[4],
+                ptr, vertex_length, mod_offset );
         result_vertexes = &pvr2_scene.vertex_array[poly->mod_vertex_index];
         result_vertexes[0].x = result_vertexes[0].y = 0;
         result_vertexes[1].x = result_vertexes[3].x = pvr2_scene.buffer_width;
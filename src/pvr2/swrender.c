@@ -0,0 +1,1275 @@
+/**
+ * $Id$
+ *
+ * Software rendering engine. This renders the same scene data as the GL
+ * renderer (see scene.c), but rasterizes each 32x32 tile on the CPU, with the
+ * tiles spread across a pool of worker threads. Each tile goes through the
+ * same passes as the hardware (and glrender.c) - background, opaque with
+ * modifier volumes, punch-through, and translucent - in a local tile buffer,
+ * and is then written out to the host pixels of the render buffer, from where
+ * it's flushed to vram in the usual way.
+ *
+ * Each scene is first prepared on the emulation thread - textures decoded,
+ * and the tile lists and polygon contexts copied out of vram into a command
+ * list per tile - after which it can optionally be rendered on a separate
+ * render thread, while the emulation carries on. Anything that needs the
+ * rendered pixels calls pvr2_scene_render_wait() first.
+ *
+ * Depth is kept as 1/w, as on the PVR2, and is compared new OP stored.
+ *
+ * Copyright (c) 2005 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "display.h"
+#include "pvr2/pvr2.h"
+#include "pvr2/pvr2mmio.h"
+#include "pvr2/scene.h"
+#include "pvr2/tileiter.h"
+
+#define IS_NONEMPTY_TILE_LIST(p) (IS_TILE_PTR(p) && ((*((uint32_t *)(pvr2_main_ram+(p))) >> 28) != 0x0F))
+
+#define TILE_SIZE 32
+#define MAX_TILES 64 /* in each direction, as per SEGMENT_X/SEGMENT_Y */
+
+#define SWR_MAX_THREADS 32
+
+/* Depth compare modes (POLY1 bits 29-31), plus no depth test at all */
+#define DEPTH_GEQUAL 6
+#define DEPTH_NONE -1
+#define DEPTH_POLY -2 /* Use the polygon's own mode */
+
+/* Alpha reference outside of punch-through */
+#define NO_ALPHA_TEST -1e30f
+
+/* Stencil bits, used the same way as the GL renderer: bit 0 is the parity
+ * of the current modifier volume, bit 1 is set if the pixel is inside the
+ * accumulated volume */
+#define STENCIL_PARITY 0x01
+#define STENCIL_INSIDE 0x02
+
+typedef enum { DRAW_COLOUR, DRAW_DEPTH, DRAW_VOLUME } swr_draw_mode_t;
+
+struct swr_tile {
+    int x1, x2, y1, y2; /* Current drawing bounds */
+    int ox, oy; /* Tile origin */
+    float alpha_ref; /* Alpha test reference for the current pass */
+    float colour[TILE_SIZE*TILE_SIZE][4];
+    float depth[TILE_SIZE*TILE_SIZE];
+    uint8_t stencil[TILE_SIZE*TILE_SIZE];
+};
+
+struct swr_texture {
+    uint32_t texture_word;
+    uint32_t size_word; /* Texture size bits from the poly2 word */
+    int width, height;
+    size_t offset; /* Offset of the decoded pixels in swr_texture_data */
+};
+
+/**
+ * Polygon state for the rasterizer, decoded from the polygon context
+ */
+struct swr_state {
+    uint32_t poly2;
+    struct swr_texture *tex; /* NULL if untextured */
+    uint32_t *texels;
+    int depth_mode;
+    gboolean depth_write;
+    gboolean gouraud;
+    int src_blend, dst_blend;
+    float alpha_ref;
+    const float *fog_colour;
+    int stencil; /* Required STENCIL_INSIDE state, or -1 to ignore */
+};
+
+/**
+ * Decoded textures, which only last for the scene. Textures are identified
+ * by their texture word + size, and poly->tex_id holds the index + 1
+ */
+#define MAX_SWR_TEXTURES 8192
+#define SWR_TEXTURE_HASH_SIZE 16384
+static struct swr_texture swr_textures[MAX_SWR_TEXTURES];
+static uint32_t swr_texture_hash[SWR_TEXTURE_HASH_SIZE];
+static int swr_texture_count;
+static uint32_t *swr_texture_data;
+static size_t swr_texture_data_size;
+static uint32_t swr_palette[1024];
+static uint32_t swr_stride_width;
+
+/**
+ * Tile commands, built from the tile lists by swr_prepare_scene(). Each tile
+ * runs its commands from swr_tile_commands[tile] up to the next tile's.
+ */
+enum { SWR_CMD_DEPTH, SWR_CMD_VOLUME, SWR_CMD_CLEAR_DEPTH, SWR_CMD_OPAQUE,
+       SWR_CMD_PUNCH, SWR_CMD_TRANS, SWR_CMD_SORTED };
+
+struct swr_command {
+    struct polygon_struct *poly;
+    int op;
+    int index; /* Triangle vertex offset for SWR_CMD_SORTED */
+};
+
+/* Polygon contexts, copied out of vram (indexed by poly_array index) */
+#define SWR_CONTEXT_SIZE 5
+#define SWR_CONTEXT(poly) (&swr_contexts[((poly) - pvr2_scene.poly_array)*SWR_CONTEXT_SIZE])
+
+/* Current render state */
+static uint32_t *swr_data;
+static int swr_width, swr_height;
+static uint32_t swr_clip[4];
+static float swr_alpha_ref;
+static int swr_tiles_x, swr_tiles_y;
+static int swr_tile_first[MAX_TILES*MAX_TILES];
+static int swr_tile_last[MAX_TILES*MAX_TILES];
+static int *swr_segment_next;
+static struct tile_segment **swr_segments;
+static int swr_segment_alloc;
+static struct swr_command *swr_commands;
+static int swr_command_count, swr_command_alloc;
+static int swr_tile_commands[MAX_TILES*MAX_TILES+1];
+static uint32_t *swr_contexts;
+static int swr_context_alloc;
+
+/**
+ * Worker pool. Jobs are posted by bumping job_seq, after which each thread
+ * (including the poster) takes items off job_next until there are none left.
+ */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work;    /* Signalled when a new job is posted */
+    pthread_cond_t done;    /* Signalled when the last worker finishes a job */
+    gboolean started;
+    int wanted_threads;     /* Total threads including the caller, 0 = one per CPU */
+    int thread_count;       /* Number of worker threads running */
+    pthread_t threads[SWR_MAX_THREADS];
+    uint32_t job_seq;
+    void (*job_fn)( int index );
+    int job_count;
+    int job_next;
+    int busy;               /* Number of workers still running the current job */
+    gboolean stop;
+} swr_pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+/**
+ * Render thread. Each scene is posted by bumping post_seq, and the thread
+ * sets done_seq to match once it's been rendered.
+ */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work;    /* Signalled when a scene is posted */
+    pthread_cond_t done;    /* Signalled when the scene is complete */
+    gboolean enabled;
+    gboolean started;
+    gboolean stop;
+    pthread_t thread;
+    uint32_t post_seq;
+    uint32_t done_seq;
+    render_buffer_t buffer; /* Buffer being rendered, or NULL (emulation thread only) */
+} swr_pipe = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static gboolean swr_enabled = FALSE;
+
+/****************************** Worker pool *********************************/
+
+static void swr_run_jobs( void )
+{
+    int index;
+    while( (index = __sync_fetch_and_add( &swr_pool.job_next, 1 )) < swr_pool.job_count ) {
+        swr_pool.job_fn( index );
+    }
+}
+
+static void *swr_worker_thread( void *arg )
+{
+    uint32_t seq = (uint32_t)(uintptr_t)arg;
+
+    pthread_mutex_lock( &swr_pool.lock );
+    for(;;) {
+        while( !swr_pool.stop && swr_pool.job_seq == seq ) {
+            pthread_cond_wait( &swr_pool.work, &swr_pool.lock );
+        }
+        if( swr_pool.stop ) {
+            break;
+        }
+        seq = swr_pool.job_seq;
+        pthread_mutex_unlock( &swr_pool.lock );
+        swr_run_jobs();
+        pthread_mutex_lock( &swr_pool.lock );
+        if( --swr_pool.busy == 0 ) {
+            pthread_cond_signal( &swr_pool.done );
+        }
+    }
+    pthread_mutex_unlock( &swr_pool.lock );
+    return NULL;
+}
+
+static void swr_start_threads( void )
+{
+    int threads = swr_pool.wanted_threads;
+    if( threads <= 0 ) {
+        threads = sysconf( _SC_NPROCESSORS_ONLN );
+    }
+    if( threads > SWR_MAX_THREADS ) {
+        threads = SWR_MAX_THREADS;
+    }
+
+    swr_pool.started = TRUE;
+    swr_pool.thread_count = 0;
+    while( swr_pool.thread_count < threads-1 ) {
+        if( pthread_create( &swr_pool.threads[swr_pool.thread_count], NULL, swr_worker_thread,
+                            (void *)(uintptr_t)swr_pool.job_seq ) != 0 ) {
+            WARN( "Unable to start software render thread" );
+            break;
+        }
+        swr_pool.thread_count++;
+    }
+}
+
+static void swr_stop_threads( void )
+{
+    int i;
+    pthread_mutex_lock( &swr_pool.lock );
+    swr_pool.stop = TRUE;
+    pthread_cond_broadcast( &swr_pool.work );
+    pthread_mutex_unlock( &swr_pool.lock );
+    for( i=0; i<swr_pool.thread_count; i++ ) {
+        pthread_join( swr_pool.threads[i], NULL );
+    }
+    swr_pool.stop = FALSE;
+    swr_pool.thread_count = 0;
+    swr_pool.started = FALSE;
+}
+
+/**
+ * Call fn for each index from 0 to count-1, spread across the pool, and
+ * wait for them all to complete.
+ */
+static void swr_parallel( void (*fn)( int index ), int count )
+{
+    if( !swr_pool.started ) {
+        swr_start_threads();
+    }
+
+    swr_pool.job_fn = fn;
+    swr_pool.job_count = count;
+    swr_pool.job_next = 0;
+    if( swr_pool.thread_count == 0 || count <= 1 ) {
+        swr_run_jobs();
+        return;
+    }
+
+    pthread_mutex_lock( &swr_pool.lock );
+    swr_pool.busy = swr_pool.thread_count;
+    swr_pool.job_seq++;
+    pthread_cond_broadcast( &swr_pool.work );
+    pthread_mutex_unlock( &swr_pool.lock );
+
+    swr_run_jobs();
+
+    pthread_mutex_lock( &swr_pool.lock );
+    while( swr_pool.busy != 0 ) {
+        pthread_cond_wait( &swr_pool.done, &swr_pool.lock );
+    }
+    pthread_mutex_unlock( &swr_pool.lock );
+}
+
+void pvr2_scene_set_soft_render( gboolean flag )
+{
+    pvr2_scene_render_wait( NULL );
+    swr_enabled = flag;
+}
+
+gboolean pvr2_scene_get_soft_render( void )
+{
+    return swr_enabled;
+}
+
+void pvr2_scene_set_soft_threads( int threads )
+{
+    pvr2_scene_render_wait( NULL );
+    if( swr_pool.started ) {
+        swr_stop_threads();
+    }
+    swr_pool.wanted_threads = threads;
+}
+
+/******************************** Textures **********************************/
+
+/**
+ * Convert a 16-bit texel to 32-bit RGBA (R in the low byte)
+ */
+static inline uint32_t swr_texel16( uint32_t v, int format )
+{
+    uint32_t r, g, b, a;
+    switch( format ) {
+    case PVR2_TEX_FORMAT_RGB565:
+        r = (v >> 11) & 0x1F; g = (v >> 5) & 0x3F; b = v & 0x1F;
+        r = (r << 3) | (r >> 2); g = (g << 2) | (g >> 4); b = (b << 3) | (b >> 2);
+        a = 0xFF;
+        break;
+    case PVR2_TEX_FORMAT_ARGB4444:
+        a = ((v >> 12) & 0x0F) * 0x11; r = ((v >> 8) & 0x0F) * 0x11;
+        g = ((v >> 4) & 0x0F) * 0x11; b = (v & 0x0F) * 0x11;
+        break;
+    default: /* ARGB1555 */
+        a = (v & 0x8000) ? 0xFF : 0;
+        r = (v >> 10) & 0x1F; g = (v >> 5) & 0x1F; b = v & 0x1F;
+        r = (r << 3) | (r >> 2); g = (g << 3) | (g >> 2); b = (b << 3) | (b >> 2);
+        break;
+    }
+    return (a << 24) | (b << 16) | (g << 8) | r;
+}
+
+static inline uint32_t swr_yuv_to_rgba( int y, int u, int v )
+{
+    u -= 128;
+    v -= 128;
+    int r = y + ((v*11)>>3);
+    int g = y - ((u*11)>>5) - ((v*11)>>4);
+    int b = y + ((u*55)>>5);
+    if( r > 255 ) { r = 255; } else if( r < 0 ) { r = 0; }
+    if( g > 255 ) { g = 255; } else if( g < 0 ) { g = 0; }
+    if( b > 255 ) { b = 255; } else if( b < 0 ) { b = 0; }
+    return 0xFF000000 | (b<<16) | (g<<8) | r;
+}
+
+/**
+ * Convert the palette to 32-bit RGBA, according to the current palette mode
+ */
+static void swr_load_palette( void )
+{
+    uint32_t *palette = (uint32_t *)mmio_region_PVR2PAL.mem;
+    int mode = MMIO_READ( PVR2, RENDER_PALETTE ) & 0x03;
+    int i;
+
+    for( i=0; i<1024; i++ ) {
+        uint32_t v = palette[i];
+        switch( mode ) {
+        case 0: swr_palette[i] = swr_texel16( v, PVR2_TEX_FORMAT_ARGB1555 ); break;
+        case 1: swr_palette[i] = swr_texel16( v, PVR2_TEX_FORMAT_RGB565 ); break;
+        case 2: swr_palette[i] = swr_texel16( v, PVR2_TEX_FORMAT_ARGB4444 ); break;
+        default: swr_palette[i] = (v & 0xFF00FF00) | ((v >> 16) & 0xFF) | ((v & 0xFF) << 16); break;
+        }
+    }
+}
+
+/**
+ * Decode the top mip level of the texture into 32-bit RGBA.
+ */
+static void swr_decode_texture( int index )
+{
+    struct swr_texture *tex = &swr_textures[index];
+    uint32_t mode = tex->texture_word;
+    uint32_t texture_addr = (mode & 0x000FFFFF) << 3;
+    int format = mode & PVR2_TEX_FORMAT_MASK;
+    int width = tex->width, height = tex->height;
+    int pixels = width*height;
+    uint32_t *out = swr_texture_data + tex->offset;
+    uint16_t codebook[256][4];
+    int i, x, y;
+
+    if( format == PVR2_TEX_FORMAT_BUMPMAP ) {
+        for( i=0; i<pixels; i++ ) {
+            out[i] = 0xFFFFFFFF;
+        }
+        return;
+    }
+
+    unsigned char *raw = g_malloc( pixels*2 );
+
+    if( PVR2_TEX_IS_STRIDE(mode) && !PVR2_TEX_IS_PALETTE(mode) ) {
+        /* Stride textures cannot be mip-mapped, compressed, indexed or twiddled */
+        pvr2_vram64_read_stride( raw, width<<1, texture_addr, swr_stride_width<<1, height );
+    } else {
+        if( PVR2_TEX_IS_COMPRESSED(mode) ) {
+            uint16_t tmp[1024];
+            pvr2_vram64_read( (unsigned char *)tmp, texture_addr, sizeof(tmp) );
+            texture_addr += sizeof(tmp);
+            for( i=0; i<256; i++ ) {
+                codebook[i][0] = tmp[i*4];
+                codebook[i][2] = tmp[i*4+1];
+                codebook[i][1] = tmp[i*4+2];
+                codebook[i][3] = tmp[i*4+3];
+            }
+        }
+
+        if( PVR2_TEX_IS_MIPMAPPED(mode) ) {
+            /* Skip over the smaller levels to the top one */
+            uint32_t src_offset = 0;
+            int level = 0;
+            while( (1<<level) < width ) {
+                level++;
+                src_offset += ((width>>level)*(width>>level));
+            }
+            if( width != 1 ) {
+                src_offset += 3;
+            }
+            if( PVR2_TEX_IS_COMPRESSED(mode) ) {
+                src_offset >>= 2;
+            } else if( format == PVR2_TEX_FORMAT_IDX4 ) {
+                src_offset >>= 1;
+            } else if( format != PVR2_TEX_FORMAT_IDX8 ) {
+                src_offset <<= 1;
+            }
+            texture_addr += src_offset;
+        }
+
+        if( format == PVR2_TEX_FORMAT_IDX8 ) {
+            pvr2_vram64_read_twiddled_8( raw, texture_addr, width, height );
+        } else if( format == PVR2_TEX_FORMAT_IDX4 ) {
+            pvr2_vram64_read_twiddled_4( raw, texture_addr, width, height );
+        } else if( PVR2_TEX_IS_COMPRESSED(mode) ) {
+            if( PVR2_TEX_IS_TWIDDLED(mode) ) {
+                pvr2_vram64_read_twiddled_8( raw, texture_addr, width>>1, height>>1 );
+            } else {
+                pvr2_vram64_read( raw, texture_addr, pixels>>2 );
+            }
+        } else if( PVR2_TEX_IS_TWIDDLED(mode) ) {
+            pvr2_vram64_read_twiddled_16( raw, texture_addr, width, height );
+        } else {
+            pvr2_vram64_read( raw, texture_addr, pixels<<1 );
+        }
+    }
+
+    if( format == PVR2_TEX_FORMAT_IDX8 ) {
+        uint32_t *palette = swr_palette + (((mode >> 25) & 0x03) << 8);
+        for( i=0; i<pixels; i++ ) {
+            out[i] = palette[raw[i]];
+        }
+    } else if( format == PVR2_TEX_FORMAT_IDX4 ) {
+        uint32_t *palette = swr_palette + (((mode >> 21) & 0x3F) << 4);
+        for( i=0; i<pixels; i+=2 ) {
+            out[i] = palette[raw[i>>1] & 0x0F];
+            out[i+1] = palette[raw[i>>1] >> 4];
+        }
+    } else if( PVR2_TEX_IS_COMPRESSED(mode) && !PVR2_TEX_IS_STRIDE(mode) ) {
+        uint8_t *code = raw;
+        for( y=0; y<height; y+=2 ) {
+            for( x=0; x<width; x+=2 ) {
+                uint16_t *quad = codebook[*code++];
+                out[x + y*width] = swr_texel16( quad[0], format );
+                out[x + 1 + y*width] = swr_texel16( quad[1], format );
+                out[x + (y+1)*width] = swr_texel16( quad[2], format );
+                out[x + 1 + (y+1)*width] = swr_texel16( quad[3], format );
+            }
+        }
+    } else if( format == PVR2_TEX_FORMAT_YUV422 ) {
+        /* 32 bits = 2 horizontal pixels, UYVY */
+        for( i=0; i<pixels; i+=2 ) {
+            int u = raw[i*2], y0 = raw[i*2+1], v = raw[i*2+2], y1 = raw[i*2+3];
+            out[i] = swr_yuv_to_rgba( y0, u, v );
+            out[i+1] = swr_yuv_to_rgba( y1, u, v );
+        }
+    } else {
+        uint16_t *in = (uint16_t *)raw;
+        for( i=0; i<pixels; i++ ) {
+            out[i] = swr_texel16( in[i], format );
+        }
+    }
+    g_free( raw );
+}
+
+/**
+ * Find (or add) the texture for the given poly2 + texture words.
+ * @return the texture index + 1, or 0 if the texture table is full.
+ */
+static uint32_t swr_find_texture( uint32_t poly2, uint32_t texture_word )
+{
+    uint32_t size_word = poly2 & 0x3F;
+    uint32_t hash = ((texture_word * 0x9E3779B1) ^ size_word) & (SWR_TEXTURE_HASH_SIZE-1);
+
+    while( swr_texture_hash[hash] != 0 ) {
+        struct swr_texture *tex = &swr_textures[swr_texture_hash[hash]-1];
+        if( tex->texture_word == texture_word && tex->size_word == size_word ) {
+            return swr_texture_hash[hash];
+        }
+        hash = (hash + 1) & (SWR_TEXTURE_HASH_SIZE-1);
+    }
+    if( swr_texture_count == MAX_SWR_TEXTURES ) {
+        return 0;
+    }
+
+    struct swr_texture *tex = &swr_textures[swr_texture_count++];
+    tex->texture_word = texture_word;
+    tex->size_word = size_word;
+    tex->width = POLY2_TEX_WIDTH(poly2);
+    tex->height = PVR2_TEX_IS_MIPMAPPED(texture_word) ? tex->width : POLY2_TEX_HEIGHT(poly2);
+    tex->offset = swr_texture_data_size;
+    swr_texture_data_size += tex->width * tex->height;
+    swr_texture_hash[hash] = swr_texture_count;
+    return swr_texture_count;
+}
+
+/**
+ * Decode all textures used by the scene, and set the polygon tex_ids to
+ * match.
+ */
+static void swr_load_textures( void )
+{
+    static size_t data_alloc = 0;
+    int i;
+
+    swr_load_palette();
+    swr_stride_width = (MMIO_READ( PVR2, RENDER_TEXSIZE ) & 0x003F) << 5;
+    memset( swr_texture_hash, 0, sizeof(swr_texture_hash) );
+    swr_texture_count = 0;
+    swr_texture_data_size = 0;
+
+    for( i=0; i < pvr2_scene.poly_count; i++ ) {
+        struct polygon_struct *poly = &pvr2_scene.poly_array[i];
+        if( POLY1_TEXTURED(poly->context[0]) ) {
+            poly->tex_id = swr_find_texture( poly->context[1], poly->context[2] );
+            if( poly->mod_vertex_index != -1 ) {
+                if( pvr2_scene.shadow_mode == SHADOW_FULL ) {
+                    poly->mod_tex_id = swr_find_texture( poly->context[3], poly->context[4] );
+                } else {
+                    poly->mod_tex_id = poly->tex_id;
+                }
+            }
+        } else {
+            poly->tex_id = 0;
+            poly->mod_tex_id = 0;
+        }
+    }
+
+    if( swr_texture_data_size > data_alloc ) {
+        data_alloc = swr_texture_data_size;
+        g_free( swr_texture_data );
+        swr_texture_data = g_malloc( data_alloc * sizeof(uint32_t) );
+    }
+    swr_parallel( swr_decode_texture, swr_texture_count );
+}
+
+static inline int swr_wrap( int x, int size, gboolean clamp, gboolean mirror )
+{
+    if( clamp ) {
+        return x < 0 ? 0 : (x >= size ? size-1 : x);
+    } else if( mirror ) {
+        x &= (size<<1) - 1;
+        return x >= size ? (size<<1) - 1 - x : x;
+    } else {
+        return x & (size-1);
+    }
+}
+
+/**
+ * Point-sample the texture at (u,v).
+ */
+static inline uint32_t swr_sample( const struct swr_state *state, float u, float v )
+{
+    const struct swr_texture *tex = state->tex;
+    float fu = u * tex->width, fv = v * tex->height;
+    if( !(fu > -1e6 && fu < 1e6) ) fu = 0;
+    if( !(fv > -1e6 && fv < 1e6) ) fv = 0;
+    int x = swr_wrap( (int)floorf(fu), tex->width, POLY2_TEX_CLAMP_U(state->poly2), POLY2_TEX_MIRROR_U(state->poly2) );
+    int y = swr_wrap( (int)floorf(fv), tex->height, POLY2_TEX_CLAMP_V(state->poly2), POLY2_TEX_MIRROR_V(state->poly2) );
+    return state->texels[x + y*tex->width];
+}
+
+/******************************* Rasterizer *********************************/
+
+static void swr_setup_state( struct swr_state *state, uint32_t poly1, uint32_t poly2,
+                             uint32_t tex_id, int depth_mode, gboolean depth_write, float alpha_ref )
+{
+    state->poly2 = poly2;
+    if( POLY1_TEXTURED(poly1) && tex_id != 0 ) {
+        state->tex = &swr_textures[tex_id-1];
+        state->texels = swr_texture_data + state->tex->offset;
+    } else {
+        state->tex = NULL;
+        state->texels = NULL;
+    }
+    state->depth_mode = depth_mode;
+    state->depth_write = depth_write && POLY1_DEPTH_WRITE(poly1);
+    state->gouraud = POLY1_GOURAUD_SHADED(poly1) != 0;
+    state->src_blend = poly2 >> 29;
+    state->dst_blend = (poly2 >> 26) & 0x07;
+    state->alpha_ref = alpha_ref;
+    switch( POLY2_FOG_MODE(poly2) ) {
+    case PVR2_POLY_FOG_LOOKUP: state->fog_colour = pvr2_scene.fog_lut_colour; break;
+    case PVR2_POLY_FOG_VERTEX: state->fog_colour = pvr2_scene.fog_vert_colour; break;
+    default: state->fog_colour = NULL; break;
+    }
+    state->stencil = -1;
+}
+
+static inline gboolean swr_depth_test( int mode, float z, float stored )
+{
+    switch( mode ) {
+    case 0: return FALSE;
+    case 1: return z < stored;
+    case 2: return z == stored;
+    case 3: return z <= stored;
+    case 4: return z > stored;
+    case 5: return z != stored;
+    case 6: return z >= stored;
+    default: return TRUE;
+    }
+}
+
+static inline float swr_clamp( float f )
+{
+    return f < 0 ? 0 : (f > 1 ? 1 : f);
+}
+
+/**
+ * Blend factor (for one component) from the PVR2 src/dest blend mode.
+ * other is the source colour for dest factors and vice versa.
+ */
+static inline float swr_blend_factor( int mode, float other, float src_alpha, float dst_alpha )
+{
+    switch( mode ) {
+    case 0: return 0;
+    case 1: return 1;
+    case 2: return other;
+    case 3: return 1 - other;
+    case 4: return src_alpha;
+    case 5: return 1 - src_alpha;
+    case 6: return dst_alpha;
+    default: return 1 - dst_alpha;
+    }
+}
+
+/**
+ * Shade a single pixel and blend it into the tile.
+ * @return FALSE if the pixel was discarded by the alpha test.
+ */
+static inline gboolean swr_shade_pixel( struct swr_tile *tile, int pixel, const struct swr_state *state,
+                                        const struct vertex_struct *vert[3], const struct vertex_struct *flat,
+                                        const float w[3] )
+{
+    float colour[4], offset[4], out[4];
+    int i;
+
+    if( state->gouraud ) {
+        for( i=0; i<4; i++ ) {
+            colour[i] = vert[0]->rgba[i]*w[0] + vert[1]->rgba[i]*w[1] + vert[2]->rgba[i]*w[2];
+            offset[i] = vert[0]->offset_rgba[i]*w[0] + vert[1]->offset_rgba[i]*w[1] + vert[2]->offset_rgba[i]*w[2];
+        }
+    } else {
+        for( i=0; i<4; i++ ) {
+            colour[i] = flat->rgba[i];
+            offset[i] = flat->offset_rgba[i];
+        }
+    }
+
+    if( state->tex == NULL || vert[0]->tex_mode >= 1.5 ) {
+        out[0] = colour[0]; out[1] = colour[1]; out[2] = colour[2]; out[3] = colour[3];
+    } else {
+        float u = vert[0]->u*w[0] + vert[1]->u*w[1] + vert[2]->u*w[2];
+        float v = vert[0]->v*w[0] + vert[1]->v*w[1] + vert[2]->v*w[2];
+        uint32_t texel = swr_sample( state, u, v );
+        float tex[4] = { (texel & 0xFF)/255.0f, ((texel>>8) & 0xFF)/255.0f,
+                ((texel>>16) & 0xFF)/255.0f, (texel>>24)/255.0f };
+        if( vert[0]->tex_mode == 0 ) { /* Modulate */
+            for( i=0; i<3; i++ ) {
+                out[i] = colour[i]*tex[i] + offset[i];
+            }
+            out[3] = colour[3]*tex[3];
+        } else { /* Decal */
+            for( i=0; i<3; i++ ) {
+                out[i] = colour[i] + (tex[i]-colour[i])*tex[3] + offset[i];
+            }
+            out[3] = colour[3];
+        }
+    }
+
+    if( out[3] < state->alpha_ref ) {
+        return FALSE;
+    }
+
+    if( state->fog_colour != NULL ) {
+        float fog = swr_clamp( fabsf(offset[3]) );
+        for( i=0; i<3; i++ ) {
+            out[i] += (state->fog_colour[i] - out[i])*fog;
+        }
+    }
+
+    float *dst = tile->colour[pixel];
+    if( state->src_blend == 1 && state->dst_blend == 0 ) {
+        for( i=0; i<4; i++ ) {
+            dst[i] = swr_clamp(out[i]);
+        }
+    } else {
+        float src_alpha = swr_clamp(out[3]), dst_alpha = dst[3];
+        for( i=0; i<4; i++ ) {
+            float s = swr_clamp(out[i]);
+            dst[i] = swr_clamp( s * swr_blend_factor( state->src_blend, dst[i], src_alpha, dst_alpha ) +
+                                dst[i] * swr_blend_factor( state->dst_blend, s, src_alpha, dst_alpha ) );
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * Rasterize one triangle into the tile (within the current tile bounds),
+ * sampling at pixel centres with a top-left fill rule.
+ */
+static void swr_draw_triangle( struct swr_tile *tile, const struct swr_state *state,
+                               const struct vertex_struct *v0, const struct vertex_struct *v1,
+                               const struct vertex_struct *v2, swr_draw_mode_t mode )
+{
+    const struct vertex_struct *flat = v2;
+    float area = (v1->x - v0->x)*(v2->y - v0->y) - (v2->x - v0->x)*(v1->y - v0->y);
+    if( !(area > 0 || area < 0) ) {
+        return; /* Degenerate (or NaN) */
+    } else if( area < 0 ) {
+        const struct vertex_struct *tmp = v1;
+        v1 = v2;
+        v2 = tmp;
+        area = -area;
+    }
+    const struct vertex_struct *vert[3] = { v0, v1, v2 };
+
+    /* Bounding box */
+    float fminx = v0->x, fmaxx = v0->x, fminy = v0->y, fmaxy = v0->y;
+    int i;
+    for( i=1; i<3; i++ ) {
+        if( vert[i]->x < fminx ) fminx = vert[i]->x;
+        if( vert[i]->x > fmaxx ) fmaxx = vert[i]->x;
+        if( vert[i]->y < fminy ) fminy = vert[i]->y;
+        if( vert[i]->y > fmaxy ) fmaxy = vert[i]->y;
+    }
+    if( fmaxx < tile->x1 || fminx >= tile->x2 || fmaxy < tile->y1 || fminy >= tile->y2 ) {
+        return;
+    }
+    int x1 = fminx > tile->x1 ? (int)fminx : tile->x1;
+    int x2 = fmaxx < tile->x2 - 1 ? (int)fmaxx + 1 : tile->x2;
+    int y1 = fminy > tile->y1 ? (int)fminy : tile->y1;
+    int y2 = fmaxy < tile->y2 - 1 ? (int)fmaxy + 1 : tile->y2;
+
+    /* Edge functions: edge i is opposite vertex i, and is positive inside */
+    float a[3], b[3], c[3];
+    gboolean topleft[3];
+    for( i=0; i<3; i++ ) {
+        const struct vertex_struct *p = vert[(i+1)%3], *q = vert[(i+2)%3];
+        a[i] = p->y - q->y;
+        b[i] = q->x - p->x;
+        c[i] = -(a[i]*p->x + b[i]*p->y);
+        topleft[i] = a[i] > 0 || (a[i] == 0 && b[i] > 0);
+    }
+
+    float q[3];
+    for( i=0; i<3; i++ ) {
+        q[i] = vert[i]->z == 0 ? 0 : 1/vert[i]->z;
+    }
+    float inv_area = 1/area;
+
+    int x, y;
+    for( y=y1; y<y2; y++ ) {
+        float py = y + 0.5f, px = x1 + 0.5f;
+        float e[3];
+        for( i=0; i<3; i++ ) {
+            e[i] = a[i]*px + b[i]*py + c[i];
+        }
+        for( x=x1; x<x2; x++, e[0] += a[0], e[1] += a[1], e[2] += a[2] ) {
+            if( (e[0] < 0 || (e[0] == 0 && !topleft[0])) ||
+                (e[1] < 0 || (e[1] == 0 && !topleft[1])) ||
+                (e[2] < 0 || (e[2] == 0 && !topleft[2])) ) {
+                continue;
+            }
+            int pixel = (y - tile->oy)*TILE_SIZE + (x - tile->ox);
+            float bc[3] = { e[0]*inv_area, e[1]*inv_area, e[2]*inv_area };
+            float z = bc[0]*q[0] + bc[1]*q[1] + bc[2]*q[2];
+
+            if( mode == DRAW_VOLUME ) {
+                /* Count the volume faces in front of the stored surface */
+                if( z > tile->depth[pixel] ) {
+                    tile->stencil[pixel] ^= STENCIL_PARITY;
+                }
+                continue;
+            }
+            if( state->stencil != -1 &&
+                ((tile->stencil[pixel] & STENCIL_INSIDE) ? 1 : 0) != state->stencil ) {
+                continue;
+            }
+            if( state->depth_mode != DEPTH_NONE &&
+                !swr_depth_test( state->depth_mode, z, tile->depth[pixel] ) ) {
+                continue;
+            }
+            if( mode == DRAW_COLOUR ) {
+                /* Perspective-correct weights */
+                float w[3];
+                if( z > 0 ) {
+                    for( i=0; i<3; i++ ) {
+                        w[i] = bc[i]*q[i]/z;
+                    }
+                } else {
+                    w[0] = bc[0]; w[1] = bc[1]; w[2] = bc[2];
+                }
+                if( !swr_shade_pixel( tile, pixel, state, vert, flat, w ) ) {
+                    continue;
+                }
+            }
+            if( state->depth_write && state->depth_mode != DEPTH_NONE ) {
+                tile->depth[pixel] = z;
+            }
+        }
+    }
+}
+
+static void swr_draw_strips( struct swr_tile *tile, const struct swr_state *state,
+                             struct polygon_struct *poly, gboolean modified, swr_draw_mode_t mode )
+{
+    do {
+        int index = modified ? poly->mod_vertex_index : poly->vertex_index;
+        struct vertex_struct *vert = &pvr2_scene.vertex_array[index];
+        int i;
+        for( i=0; i+2 < poly->vertex_count; i++ ) {
+            swr_draw_triangle( tile, state, &vert[i], &vert[i+1], &vert[i+2], mode );
+        }
+        poly = poly->sub_next;
+    } while( poly != NULL );
+}
+
+/**
+ * Draw a polygon in the current pass. Modified polygons are drawn twice, with
+ * the normal and modified parameters respectively, split by the stencil.
+ */
+static void swr_draw_poly( struct swr_tile *tile, struct polygon_struct *poly,
+                           int depth_mode, gboolean depth_write, swr_draw_mode_t mode )
+{
+    struct swr_state state;
+
+    if( poly->vertex_count == 0 )
+        return; /* Culled */
+
+    uint32_t *context = SWR_CONTEXT(poly);
+    if( depth_mode == DEPTH_POLY ) {
+        depth_mode = context[0] >> 29;
+    }
+    swr_setup_state( &state, context[0], context[1], poly->tex_id, depth_mode, depth_write, tile->alpha_ref );
+    if( poly->mod_vertex_index == -1 || mode != DRAW_COLOUR ) {
+        swr_draw_strips( tile, &state, poly, FALSE, mode );
+    } else {
+        state.stencil = 0;
+        swr_draw_strips( tile, &state, poly, FALSE, mode );
+        if( pvr2_scene.shadow_mode == SHADOW_FULL ) {
+            swr_setup_state( &state, context[0], context[3], poly->mod_tex_id, depth_mode, depth_write, tile->alpha_ref );
+        }
+        state.stencil = 1;
+        swr_draw_strips( tile, &state, poly, TRUE, mode );
+    }
+}
+
+/**
+ * Draw a modifier volume polygon, and fold the volume into the inside bit if
+ * this is the last polygon of the volume.
+ */
+static void swr_draw_modifier_poly( struct swr_tile *tile, struct polygon_struct *poly )
+{
+    int x, y;
+
+    if( poly->vertex_count == 0 )
+        return; /* Culled */
+
+    swr_draw_strips( tile, NULL, poly, FALSE, DRAW_VOLUME );
+
+    int poly_type = POLY1_VOLUME_MODE(SWR_CONTEXT(poly)[0]);
+    if( poly_type == PVR2_VOLUME_REGION0 || poly_type == PVR2_VOLUME_REGION1 ) {
+        for( y=tile->y1; y<tile->y2; y++ ) {
+            uint8_t *stencil = &tile->stencil[(y - tile->oy)*TILE_SIZE];
+            for( x=tile->x1 - tile->ox; x<tile->x2 - tile->ox; x++ ) {
+                if( poly_type == PVR2_VOLUME_REGION1 ) {
+                    if( stencil[x] & STENCIL_PARITY )
+                        stencil[x] = STENCIL_INSIDE;
+                } else {
+                    if( stencil[x] & STENCIL_PARITY )
+                        stencil[x] = 0;
+                }
+                stencil[x] &= ~STENCIL_PARITY;
+            }
+        }
+    }
+}
+
+static void swr_draw_sorted_triangle( struct swr_tile *tile, struct polygon_struct *poly, int index )
+{
+    struct swr_state state;
+    uint32_t *context = SWR_CONTEXT(poly);
+    struct vertex_struct *vert = &pvr2_scene.vertex_array[poly->vertex_index + index];
+
+    swr_setup_state( &state, context[0], context[1], poly->tex_id, DEPTH_GEQUAL, FALSE, NO_ALPHA_TEST );
+    swr_draw_triangle( tile, &state, &vert[0], &vert[1], &vert[2], DRAW_COLOUR );
+}
+
+/**
+ * Render one tile of the scene (worker job)
+ */
+static void swr_render_tile( int tile_index )
+{
+    struct swr_tile tile;
+    struct swr_command *cmd = &swr_commands[swr_tile_commands[tile_index]];
+    struct swr_command *end = &swr_commands[swr_tile_commands[tile_index+1]];
+    int tile_x = tile_index % swr_tiles_x, tile_y = tile_index / swr_tiles_x;
+    int x, y;
+
+    tile.ox = tile_x * TILE_SIZE;
+    tile.oy = tile_y * TILE_SIZE;
+    tile.x1 = tile.ox;
+    tile.y1 = tile.oy;
+    tile.x2 = MIN( tile.ox + TILE_SIZE, swr_width );
+    tile.y2 = MIN( tile.oy + TILE_SIZE, swr_height );
+    tile.alpha_ref = NO_ALPHA_TEST;
+    memset( tile.colour, 0, sizeof(tile.colour) );
+    memset( tile.depth, 0, sizeof(tile.depth) );
+    memset( tile.stencil, 0, sizeof(tile.stencil) );
+
+    /* Background covers the whole buffer, regardless of clipping */
+    if( pvr2_scene.bkgnd_poly != NULL ) {
+        struct swr_state state;
+        uint32_t *context = SWR_CONTEXT(pvr2_scene.bkgnd_poly);
+        swr_setup_state( &state, context[0], context[1], pvr2_scene.bkgnd_poly->tex_id,
+                         DEPTH_NONE, FALSE, NO_ALPHA_TEST );
+        state.src_blend = 1;
+        state.dst_blend = 0;
+        swr_draw_strips( &tile, &state, pvr2_scene.bkgnd_poly, FALSE, DRAW_COLOUR );
+    }
+
+    if( tile.x1 < swr_clip[0] ) tile.x1 = swr_clip[0];
+    if( tile.x2 > swr_clip[1] ) tile.x2 = swr_clip[1];
+    if( tile.y1 < swr_clip[2] ) tile.y1 = swr_clip[2];
+    if( tile.y2 > swr_clip[3] ) tile.y2 = swr_clip[3];
+
+    if( tile.x1 < tile.x2 && tile.y1 < tile.y2 ) {
+        for( ; cmd != end; cmd++ ) {
+            switch( cmd->op ) {
+            case SWR_CMD_DEPTH:
+                swr_draw_poly( &tile, cmd->poly, DEPTH_POLY, TRUE, DRAW_DEPTH );
+                break;
+            case SWR_CMD_VOLUME:
+                swr_draw_modifier_poly( &tile, cmd->poly );
+                break;
+            case SWR_CMD_CLEAR_DEPTH:
+                memset( tile.depth, 0, sizeof(tile.depth) );
+                break;
+            case SWR_CMD_OPAQUE:
+            case SWR_CMD_TRANS:
+                swr_draw_poly( &tile, cmd->poly, DEPTH_POLY, TRUE, DRAW_COLOUR );
+                break;
+            case SWR_CMD_PUNCH:
+                tile.alpha_ref = swr_alpha_ref;
+                swr_draw_poly( &tile, cmd->poly, DEPTH_GEQUAL, TRUE, DRAW_COLOUR );
+                tile.alpha_ref = NO_ALPHA_TEST;
+                break;
+            case SWR_CMD_SORTED:
+                swr_draw_sorted_triangle( &tile, cmd->poly, cmd->index );
+                break;
+            }
+        }
+    }
+
+    /* Write the tile out */
+    for( y=tile.oy; y < tile.oy + TILE_SIZE && y < swr_height; y++ ) {
+        uint32_t *out = swr_data + y*swr_width;
+        float (*colour)[4] = &tile.colour[(y - tile.oy)*TILE_SIZE];
+        for( x=tile.ox; x < tile.ox + TILE_SIZE && x < swr_width; x++ ) {
+            float *c = colour[x - tile.ox];
+            out[x] = ((uint32_t)(c[0]*255 + 0.5f)) | (((uint32_t)(c[1]*255 + 0.5f)) << 8) |
+                    (((uint32_t)(c[2]*255 + 0.5f)) << 16) | (((uint32_t)(c[3]*255 + 0.5f)) << 24);
+        }
+    }
+}
+
+/*************************** Scene preparation ******************************/
+
+static void swr_add_command( struct polygon_struct *poly, int op, int index )
+{
+    if( swr_command_count == swr_command_alloc ) {
+        swr_command_alloc = swr_command_alloc == 0 ? 4096 : swr_command_alloc*2;
+        swr_commands = g_realloc( swr_commands, swr_command_alloc * sizeof(struct swr_command) );
+    }
+    swr_commands[swr_command_count].poly = poly;
+    swr_commands[swr_command_count].op = op;
+    swr_commands[swr_command_count].index = index;
+    swr_command_count++;
+}
+
+/**
+ * Add a command for each polygon in the tile list
+ */
+static void swr_add_tilelist( pvraddr_t tile_entry, int op )
+{
+    tileentryiter list;
+
+    FOREACH_TILEENTRY(list, tile_entry) {
+        struct polygon_struct *poly = pvr2_scene.buf_to_poly_map[TILEENTRYITER_POLYADDR(list)];
+        if( poly != NULL ) {
+            do {
+                swr_add_command( poly, op, 0 );
+                poly = poly->next;
+            } while( list.strip_count-- > 0 );
+        }
+    }
+}
+
+static void swr_add_sorted_triangle( struct polygon_struct *poly, int index, void *data )
+{
+    swr_add_command( poly, SWR_CMD_SORTED, index );
+}
+
+#define FOREACH_TILE_SEGMENT(tile_index, segment) \
+    for( int seg_idx = swr_tile_first[tile_index]; \
+         seg_idx != -1 && ((segment = swr_segments[seg_idx]), TRUE); \
+         seg_idx = swr_segment_next[seg_idx] )
+
+/**
+ * Build the command list for one tile, from its tile lists in vram. This
+ * follows the same passes as the hardware: opaque modifier volumes, opaque,
+ * punch-through, then translucent.
+ */
+static void swr_prepare_tile( int tile_index )
+{
+    struct tile_segment *segment;
+    int tile_x = tile_index % swr_tiles_x, tile_y = tile_index / swr_tiles_x;
+    gboolean have_modifiers = FALSE;
+
+    swr_tile_commands[tile_index] = swr_command_count;
+    if( tile_x * TILE_SIZE + TILE_SIZE <= swr_clip[0] || tile_x * TILE_SIZE >= swr_clip[1] ||
+        tile_y * TILE_SIZE + TILE_SIZE <= swr_clip[2] || tile_y * TILE_SIZE >= swr_clip[3] ) {
+        return; /* Background only */
+    }
+
+    /* Build up the opaque modifier stencil */
+    FOREACH_TILE_SEGMENT(tile_index, segment) {
+        if( IS_NONEMPTY_TILE_LIST(segment->opaquemod_ptr) ) {
+            swr_add_tilelist( segment->opaque_ptr, SWR_CMD_DEPTH );
+            have_modifiers = TRUE;
+        }
+    }
+    if( have_modifiers ) {
+        FOREACH_TILE_SEGMENT(tile_index, segment) {
+            if( IS_NONEMPTY_TILE_LIST(segment->opaquemod_ptr) ) {
+                swr_add_tilelist( segment->opaquemod_ptr, SWR_CMD_VOLUME );
+            }
+        }
+        swr_add_command( NULL, SWR_CMD_CLEAR_DEPTH, 0 );
+    }
+
+    FOREACH_TILE_SEGMENT(tile_index, segment) {
+        swr_add_tilelist( segment->opaque_ptr, SWR_CMD_OPAQUE );
+    }
+
+    FOREACH_TILE_SEGMENT(tile_index, segment) {
+        if( IS_NONEMPTY_TILE_LIST(segment->punchout_ptr) ) {
+            swr_add_tilelist( segment->punchout_ptr, SWR_CMD_PUNCH );
+        }
+    }
+
+    FOREACH_TILE_SEGMENT(tile_index, segment) {
+        if( IS_NONEMPTY_TILE_LIST(segment->trans_ptr) ) {
+            if( pvr2_scene.sort_mode == SORT_NEVER ||
+                (pvr2_scene.sort_mode == SORT_TILEFLAG && (segment->control&SEGMENT_SORT_TRANS)) ) {
+                swr_add_tilelist( segment->trans_ptr, SWR_CMD_TRANS );
+            } else {
+                render_sort_tile( segment->trans_ptr, swr_add_sorted_triangle, NULL );
+            }
+        }
+    }
+}
+
+/**
+ * Group the segments by tile, preserving their order within each tile.
+ */
+static void swr_bin_segments( void )
+{
+    struct tile_segment *segment = pvr2_scene.segment_list;
+    int count = 0, i;
+
+    for( i=0; i < swr_tiles_x * swr_tiles_y; i++ ) {
+        swr_tile_first[i] = -1;
+    }
+
+    do {
+        int tile_x = SEGMENT_X(segment->control);
+        int tile_y = SEGMENT_Y(segment->control);
+        if( tile_x < swr_tiles_x && tile_y < swr_tiles_y ) {
+            int tile = tile_y * swr_tiles_x + tile_x;
+            if( count == swr_segment_alloc ) {
+                swr_segment_alloc = swr_segment_alloc == 0 ? 1024 : swr_segment_alloc*2;
+                swr_segments = g_realloc( swr_segments, swr_segment_alloc * sizeof(struct tile_segment *) );
+                swr_segment_next = g_realloc( swr_segment_next, swr_segment_alloc * sizeof(int) );
+            }
+            swr_segments[count] = segment;
+            swr_segment_next[count] = -1;
+            if( swr_tile_first[tile] == -1 ) {
+                swr_tile_first[tile] = count;
+            } else {
+                swr_segment_next[swr_tile_last[tile]] = count;
+            }
+            swr_tile_last[tile] = count;
+            count++;
+        }
+    } while( !IS_LAST_SEGMENT(segment++) );
+}
+
+/**
+ * Copy the polygon contexts out of vram, so that the scene can be rendered
+ * while the TA (and the game) carry on writing to it.
+ */
+static void swr_copy_contexts( void )
+{
+    int i;
+
+    if( pvr2_scene.poly_count > swr_context_alloc ) {
+        swr_context_alloc = pvr2_scene.poly_count;
+        swr_contexts = g_realloc( swr_contexts, swr_context_alloc * SWR_CONTEXT_SIZE * sizeof(uint32_t) );
+    }
+    for( i=0; i < pvr2_scene.poly_count; i++ ) {
+        struct polygon_struct *poly = &pvr2_scene.poly_array[i];
+        int words = poly->mod_vertex_index != -1 && pvr2_scene.shadow_mode == SHADOW_FULL ? 5 : 3;
+        memcpy( &swr_contexts[i*SWR_CONTEXT_SIZE], poly->context, words * sizeof(uint32_t) );
+    }
+}
+
+/**
+ * Take everything the render needs from vram and the PVR2 registers. After
+ * this, rendering only touches pvr2_scene, the decoded textures and the
+ * command list.
+ */
+static void swr_prepare_scene( render_buffer_t buffer )
+{
+    int i;
+
+    swr_load_textures();
+    swr_copy_contexts();
+
+    swr_data = buffer->data;
+    swr_width = buffer->width;
+    swr_height = buffer->height;
+    swr_alpha_ref = ((float)(MMIO_READ(PVR2, RENDER_ALPHA_REF)&0xFF)+1)/256.0;
+    for( i=0; i<4; i++ ) {
+        swr_clip[i] = (uint32_t)pvr2_scene.bounds[i];
+    }
+    swr_tiles_x = MIN( (swr_width + TILE_SIZE - 1) / TILE_SIZE, MAX_TILES );
+    swr_tiles_y = MIN( (swr_height + TILE_SIZE - 1) / TILE_SIZE, MAX_TILES );
+    swr_bin_segments();
+
+    swr_command_count = 0;
+    for( i=0; i < swr_tiles_x * swr_tiles_y; i++ ) {
+        swr_prepare_tile( i );
+    }
+    swr_tile_commands[i] = swr_command_count;
+}
+
+static void swr_render_scene( void )
+{
+    struct timeval start_tv, end_tv;
+
+    gettimeofday( &start_tv, NULL );
+    swr_parallel( swr_render_tile, swr_tiles_x * swr_tiles_y );
+    gettimeofday( &end_tv, NULL );
+    uint32_t ms = (end_tv.tv_sec - start_tv.tv_sec) * 1000 +
+    (end_tv.tv_usec - start_tv.tv_usec)/1000;
+    DEBUG( "Scene render in %dms", ms );
+}
+
+/****************************** Render thread *******************************/
+
+static void *swr_render_thread( void *arg )
+{
+    pthread_mutex_lock( &swr_pipe.lock );
+    for(;;) {
+        while( !swr_pipe.stop && swr_pipe.done_seq == swr_pipe.post_seq ) {
+            pthread_cond_wait( &swr_pipe.work, &swr_pipe.lock );
+        }
+        if( swr_pipe.stop ) {
+            break;
+        }
+        pthread_mutex_unlock( &swr_pipe.lock );
+        swr_render_scene();
+        pthread_mutex_lock( &swr_pipe.lock );
+        swr_pipe.done_seq = swr_pipe.post_seq;
+        pthread_cond_signal( &swr_pipe.done );
+    }
+    pthread_mutex_unlock( &swr_pipe.lock );
+    return NULL;
+}
+
+void pvr2_scene_render_wait( render_buffer_t buffer )
+{
+    if( swr_pipe.buffer == NULL || (buffer != NULL && buffer != swr_pipe.buffer) ) {
+        return;
+    }
+
+    pthread_mutex_lock( &swr_pipe.lock );
+    while( swr_pipe.done_seq != swr_pipe.post_seq ) {
+        pthread_cond_wait( &swr_pipe.done, &swr_pipe.lock );
+    }
+    pthread_mutex_unlock( &swr_pipe.lock );
+    swr_pipe.buffer = NULL;
+    pvr2_scene_finished();
+}
+
+void pvr2_scene_set_soft_pipelined( gboolean flag )
+{
+    pvr2_scene_render_wait( NULL );
+    if( swr_pipe.started && !flag ) {
+        pthread_mutex_lock( &swr_pipe.lock );
+        swr_pipe.stop = TRUE;
+        pthread_cond_signal( &swr_pipe.work );
+        pthread_mutex_unlock( &swr_pipe.lock );
+        pthread_join( swr_pipe.thread, NULL );
+        swr_pipe.stop = FALSE;
+        swr_pipe.started = FALSE;
+    }
+    swr_pipe.enabled = flag;
+}
+
+/**
+ * Render the currently defined scene in pvr2_scene. If the render thread is
+ * enabled, this returns as soon as the scene has been prepared, and the
+ * buffer is completed by pvr2_scene_render_wait().
+ */
+void pvr2_scene_render_soft( render_buffer_t buffer )
+{
+    struct timeval start_tv, end_tv;
+
+    pvr2_scene_render_wait( NULL );
+    if( buffer->data == NULL ) {
+        pvr2_scene_finished();
+        return;
+    }
+
+    gettimeofday( &start_tv, NULL );
+    swr_prepare_scene( buffer );
+    gettimeofday( &end_tv, NULL );
+    uint32_t ms = (end_tv.tv_sec - start_tv.tv_sec) * 1000 +
+    (end_tv.tv_usec - start_tv.tv_usec)/1000;
+    DEBUG( "Scene prepare in %dms", ms );
+
+    if( swr_pipe.enabled && !swr_pipe.started ) {
+        swr_pipe.started = TRUE;
+        if( pthread_create( &swr_pipe.thread, NULL, swr_render_thread, NULL ) != 0 ) {
+            WARN( "Unable to start render thread" );
+            swr_pipe.started = FALSE;
+            swr_pipe.enabled = FALSE;
+        }
+    }
+
+    if( swr_pipe.enabled ) {
+        swr_pipe.buffer = buffer;
+        pthread_mutex_lock( &swr_pipe.lock );
+        swr_pipe.post_seq++;
+        pthread_cond_signal( &swr_pipe.work );
+        pthread_mutex_unlock( &swr_pipe.lock );
+    } else {
+        swr_render_scene();
+        pvr2_scene_finished();
+    }
+}
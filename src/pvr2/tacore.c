@@ -15,6 +15,7 @@
  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
  * GNU General Public License for more details.
  */
+#include <pthread.h>
 #include <string.h>
 #include "lxdream.h"
 #include "pvr2/pvr2.h"
@@ -160,6 +161,50 @@ struct pvr2_ta_status {
 
 static struct pvr2_ta_status ta_status;
 
+/**
+ * Threaded TA: blocks written to the TA are appended to a single-producer,
+ * single-consumer ring by the SH4 thread and parsed by the TA thread. The SH4
+ * thread only waits for the TA thread to catch up at the end of a list (so
+ * the list-end interrupt arrives in order), and when it touches TA state
+ * (registers, init, save/restore, render).
+ */
+#define TA_RING_BLOCKS 4096 /* Must be a power of 2 */
+#define TA_SYNC_SPIN 4096   /* Polls of the ring before blocking in pvr2_ta_sync */
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work;        /* Signalled when the ring becomes non-empty */
+    pthread_cond_t drained;     /* Signalled when tail reaches wait_posn */
+    pthread_t thread;
+    gboolean enabled;
+    gboolean stop;              /* Thread should exit */
+    volatile gboolean sleeping; /* TA thread is waiting for work */
+    volatile gboolean waiting;  /* SH4 thread is waiting for tail to reach wait_posn */
+    uint32_t wait_posn;
+    volatile uint32_t events[3]; /* ASIC events raised on the TA thread */
+    /* head and tail are kept on separate cache lines, as each is written by
+     * a different thread */
+    char pad0[64];
+    volatile uint32_t head;     /* Next block to be written (SH4 thread) */
+    char pad1[64];
+    volatile uint32_t tail;     /* Next block to be parsed (TA thread) */
+    char pad2[64];
+    uint32_t ring[TA_RING_BLOCKS][8];
+} ta_async = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+/**
+ * Raise an ASIC event from the TA. On the TA thread, the event is deferred
+ * until the SH4 thread next picks them up (see ta_async_deliver_events)
+ */
+static void ta_raise_event( int event )
+{
+    if( ta_async.enabled ) {
+        __sync_fetch_and_or( &ta_async.events[event>>5], 1<<(event&0x1F) );
+    } else {
+        asic_event( event );
+    }
+}
+
 static int tilematrix_sizes[4] = {0,8,16,32};
 
 /**
@@ -172,23 +217,27 @@ union ta_data {
 
 
 void pvr2_ta_reset() {
+    pvr2_ta_sync();
     ta_status.state = STATE_ERROR; /* State not valid until initialized */
     ta_status.debug_output = 0;
 }
 
 void pvr2_ta_save_state( FILE *f )
 {
+    pvr2_ta_sync();
     fwrite( &ta_status, sizeof(ta_status), 1, f );
 }
 
 int pvr2_ta_load_state( FILE *f )
 {
+    pvr2_ta_sync();
     if( fread( &ta_status, sizeof(ta_status), 1, f ) != 1 )
         return 1;
     return 0;
 }
 
 void pvr2_ta_init() {
+    pvr2_ta_sync();
     ta_status.state = STATE_IDLE;
     ta_status.current_list_type = -1;
     ta_status.current_vertex_type = -1;
@@ -316,7 +365,7 @@ static int list_events[5] = {EVENT_PVR_OPAQUE_DONE, EVENT_PVR_OPAQUEMOD_DONE,
 
 static void ta_end_list() {
     if( ta_status.current_list_type != TA_LIST_NONE ) {
-        asic_event( list_events[ta_status.current_list_type] );
+        ta_raise_event( list_events[ta_status.current_list_type] );
     }
     ta_status.current_list_type = TA_LIST_NONE;
     ta_status.current_vertex_type = TA_VERTEX_LISTLESS;
@@ -326,7 +375,7 @@ static void ta_end_list() {
 }
 
 static void ta_bad_input_error() {
-    asic_event( EVENT_PVR_BAD_INPUT );
+    ta_raise_event( EVENT_PVR_BAD_INPUT );
 }
 
 /**
@@ -344,7 +393,7 @@ static int ta_write_polygon_buffer( uint32_t *data, int length )
     uint32_t *target = (uint32_t *)(pvr2_main_ram + posn);
     for( rv=0; rv < length; rv++ ) {
         if( posn == end ) {
-            asic_event( EVENT_PVR_PRIM_ALLOC_FAIL );
+            ta_raise_event( EVENT_PVR_PRIM_ALLOC_FAIL );
             //	    ta_status.state = STATE_ERROR;
             break;
         }
@@ -379,7 +428,7 @@ static uint32_t ta_alloc_tilelist( uint32_t reference ) {
             return TA_NO_ALLOC;
         } else if( newposn <= limit ) {
         } else if( newposn <= (limit + ta_status.tilelist_size) ) {
-            asic_event( EVENT_PVR_MATRIX_ALLOC_FAIL );
+            ta_raise_event( EVENT_PVR_MATRIX_ALLOC_FAIL );
             MMIO_WRITE( PVR2, TA_LISTPOS, newposn );
         } else {
             MMIO_WRITE( PVR2, TA_LISTPOS, newposn );
@@ -397,7 +446,7 @@ static uint32_t ta_alloc_tilelist( uint32_t reference ) {
             return TA_NO_ALLOC;
         } else if( newposn >= limit ) {
         } else if( newposn >= (limit - ta_status.tilelist_size) ) {
-            asic_event( EVENT_PVR_MATRIX_ALLOC_FAIL );
+            ta_raise_event( EVENT_PVR_MATRIX_ALLOC_FAIL );
             MMIO_WRITE( PVR2, TA_LISTPOS, newposn );
         } else {
             MMIO_WRITE( PVR2, TA_LISTPOS, newposn );
@@ -1175,6 +1224,165 @@ uint32_t *pvr2_ta_find_polygon_context( uint32_t *buf, uint32_t length )
     return NULL;
 }
 
+/**
+ * Deliver any ASIC events raised on the TA thread
+ */
+static void ta_async_deliver_events( void )
+{
+    int i, j;
+    for( i=0; i<3; i++ ) {
+        if( ta_async.events[i] != 0 ) {
+            uint32_t events = __sync_fetch_and_and( &ta_async.events[i], 0 );
+            for( j=0; j<32; j++ ) {
+                if( events & (1<<j) ) {
+                    asic_event( (i<<5) + j );
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Wait until the TA thread has parsed everything up to (but not including)
+ * the given ring position.
+ */
+static void ta_async_wait( uint32_t posn )
+{
+    int i;
+    for( i=0; i<TA_SYNC_SPIN; i++ ) {
+        if( (int32_t)(ta_async.tail - posn) >= 0 ) {
+            __sync_synchronize();
+            return;
+        }
+    }
+
+    pthread_mutex_lock( &ta_async.lock );
+    ta_async.wait_posn = posn;
+    ta_async.waiting = TRUE;
+    __sync_synchronize();
+    if( ta_async.sleeping ) {
+        /* Missed a wakeup from ta_async_queue_block */
+        pthread_cond_signal( &ta_async.work );
+    }
+    while( (int32_t)(ta_async.tail - posn) < 0 ) {
+        pthread_cond_wait( &ta_async.drained, &ta_async.lock );
+    }
+    ta_async.waiting = FALSE;
+    pthread_mutex_unlock( &ta_async.lock );
+}
+
+/**
+ * Append a block to the ring. If the ring is full, waits for the TA thread
+ * to work through half of it, rather than handing over block by block.
+ * @return TRUE if the block may end a list, in which case the caller should
+ * sync before continuing.
+ */
+static gboolean ta_async_queue_block( unsigned char *data )
+{
+    uint32_t head = ta_async.head;
+    if( head - ta_async.tail == TA_RING_BLOCKS ) {
+        ta_async_wait( head - TA_RING_BLOCKS/2 );
+    }
+    memcpy( ta_async.ring[head & (TA_RING_BLOCKS-1)], data, 32 );
+    __sync_synchronize();
+    ta_async.head = head + 1;
+    __sync_synchronize();
+    if( ta_async.sleeping ) {
+        pthread_mutex_lock( &ta_async.lock );
+        pthread_cond_signal( &ta_async.work );
+        pthread_mutex_unlock( &ta_async.lock );
+    }
+    if( ta_async.events[0] | ta_async.events[1] | ta_async.events[2] ) {
+        ta_async_deliver_events();
+    }
+    /* Can't tell second vertex blocks apart from commands here, so this may
+     * give false positives, which just cost an early sync */
+    return TA_CMD(*(uint32_t *)data) == TA_CMD_END_LIST;
+}
+
+/**
+ * Wake the SH4 thread if it's waiting for the current tail.
+ */
+static void ta_async_check_waiter( uint32_t tail )
+{
+    if( ta_async.waiting ) {
+        pthread_mutex_lock( &ta_async.lock );
+        if( ta_async.waiting && (int32_t)(tail - ta_async.wait_posn) >= 0 ) {
+            pthread_cond_signal( &ta_async.drained );
+        }
+        pthread_mutex_unlock( &ta_async.lock );
+    }
+}
+
+static void *ta_async_thread( void *arg )
+{
+    uint32_t tail = ta_async.tail;
+    for(;;) {
+        uint32_t head = ta_async.head;
+        if( tail == head ) {
+            pthread_mutex_lock( &ta_async.lock );
+            ta_async.sleeping = TRUE;
+            __sync_synchronize();
+            while( !ta_async.stop && tail == ta_async.head ) {
+                pthread_cond_wait( &ta_async.work, &ta_async.lock );
+            }
+            ta_async.sleeping = FALSE;
+            pthread_mutex_unlock( &ta_async.lock );
+            if( ta_async.stop ) {
+                break;
+            }
+            continue;
+        }
+        __sync_synchronize();
+        while( tail != head ) {
+            pvr2_ta_process_block( (unsigned char *)ta_async.ring[tail & (TA_RING_BLOCKS-1)] );
+            tail++;
+            __sync_synchronize();
+            ta_async.tail = tail;
+            if( ta_async.waiting && (int32_t)(tail - ta_async.wait_posn) >= 0 ) {
+                ta_async_check_waiter( tail );
+            }
+        }
+        /* Pairs with the barrier in ta_async_wait, in case the check above
+         * raced with the waiter */
+        __sync_synchronize();
+        ta_async_check_waiter( tail );
+    }
+    return NULL;
+}
+
+void pvr2_ta_sync( void )
+{
+    if( ta_async.enabled ) {
+        ta_async_wait( ta_async.head );
+        ta_async_deliver_events();
+    }
+}
+
+void pvr2_ta_set_threaded( gboolean flag )
+{
+    if( flag == ta_async.enabled ) {
+        return;
+    }
+    if( flag ) {
+        ta_async.stop = FALSE;
+        ta_async.head = ta_async.tail = 0;
+        ta_async.enabled = TRUE;
+        if( pthread_create( &ta_async.thread, NULL, ta_async_thread, NULL ) != 0 ) {
+            WARN( "Unable to start tile accelerator thread" );
+            ta_async.enabled = FALSE;
+        }
+    } else {
+        pvr2_ta_sync();
+        pthread_mutex_lock( &ta_async.lock );
+        ta_async.stop = TRUE;
+        pthread_cond_signal( &ta_async.work );
+        pthread_mutex_unlock( &ta_async.lock );
+        pthread_join( ta_async.thread, NULL );
+        ta_async.enabled = FALSE;
+    }
+}
+
 /**
  * Write a block of data to the tile accelerator, adding the data to the 
  * current scene. We don't make any particular attempt to interpret the data
@@ -1190,6 +1398,18 @@ void pvr2_ta_write( unsigned char *buf, uint32_t length )
         fwrite_dump32( (uint32_t *)buf, length, stderr );
     }
 
+    if( ta_async.enabled ) {
+        gboolean list_end = FALSE;
+        for( ; length >=32; length -= 32 ) {
+            list_end |= ta_async_queue_block( buf );
+            buf += 32;
+        }
+        if( list_end ) {
+            pvr2_ta_sync();
+        }
+        return;
+    }
+
     for( ; length >=32; length -= 32 ) {
         pvr2_ta_process_block( buf );
         buf += 32;
@@ -1201,5 +1421,11 @@ void FASTCALL pvr2_ta_write_burst( sh4addr_t addr, unsigned char *data )
     if( ta_status.debug_output ) {
         fwrite_dump32( (uint32_t *)data, 32, stderr );
     }
-    pvr2_ta_process_block( data );
+    if( ta_async.enabled ) {
+        if( ta_async_queue_block( data ) ) {
+            pvr2_ta_sync();
+        }
+    } else {
+        pvr2_ta_process_block( data );
+    }
 }
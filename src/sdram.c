@@ -23,6 +23,28 @@
 #include "xlat/xltcache.h"
 #include <string.h>
 
+/**
+ * Code protection state for each 4K page of main RAM
+ */
+#define SDRAM_CODE_PAGES ((16 MB) >> 12)
+#define SDRAM_PAGE_UNPROTECTED 0  /* No (known) translated code */
+#define SDRAM_PAGE_PROTECTED 1    /* Write-protected */
+#define SDRAM_PAGE_CHECKED 2      /* Writable, code checks its source on entry */
+
+/* Number of write faults within one window after which a page is demoted
+ * to checked. The window is measured in blocks translated from main RAM, so
+ * that a page is only demoted if it keeps being rewritten while it runs. */
+#define SDRAM_MAX_CODE_FAULTS 8
+#define SDRAM_CODE_FAULT_WINDOW 4096
+
+static gboolean sdram_code_protect = FALSE;
+static uint8_t sdram_page_state[SDRAM_CODE_PAGES];
+static uint8_t sdram_page_faults[SDRAM_CODE_PAGES];
+static uint32_t sdram_page_window[SDRAM_CODE_PAGES];
+static uint32_t sdram_translations = 0;
+
+#define IS_SDRAM_ADDR(addr) (((addr) & 0x1C000000) == 0x0C000000)
+
 
 static int32_t FASTCALL ext_sdram_read_long( sh4addr_t addr )
 {
@@ -39,17 +61,23 @@ static int32_t FASTCALL ext_sdram_read_byte( sh4addr_t addr )
 static void FASTCALL ext_sdram_write_long( sh4addr_t addr, uint32_t val )
 {
     *(uint32_t *)(dc_main_ram + (addr&0x00FFFFFF)) = val;
-    xlat_invalidate_long(addr);
+    if( !sdram_code_protect ) {
+        xlat_invalidate_long(addr);
+    }
 }
 static void FASTCALL ext_sdram_write_word( sh4addr_t addr, uint32_t val )
 {
     *(uint16_t *)(dc_main_ram + (addr&0x00FFFFFF)) = (uint16_t)val;
-    xlat_invalidate_word(addr);
+    if( !sdram_code_protect ) {
+        xlat_invalidate_word(addr);
+    }
 }
 static void FASTCALL ext_sdram_write_byte( sh4addr_t addr, uint32_t val )
 {
     *(uint8_t *)(dc_main_ram + (addr&0x00FFFFFF)) = (uint8_t)val;
-    xlat_invalidate_word(addr);
+    if( !sdram_code_protect ) {
+        xlat_invalidate_word(addr);
+    }
 }
 static void FASTCALL ext_sdram_read_burst( unsigned char *dest, sh4addr_t addr )
 {
@@ -64,3 +92,93 @@ struct mem_region_fn mem_region_sdram = { ext_sdram_read_long, ext_sdram_write_l
         ext_sdram_read_word, ext_sdram_write_word, 
         ext_sdram_read_byte, ext_sdram_write_byte, 
         ext_sdram_read_burst, ext_sdram_write_burst }; 
+
+/**
+ * Start a new fault window for the page if the current one has expired.
+ */
+static void sdram_update_fault_window( uint32_t page )
+{
+    if( sdram_translations - sdram_page_window[page] >= SDRAM_CODE_FAULT_WINDOW ) {
+        sdram_page_window[page] = sdram_translations;
+        sdram_page_faults[page] = 0;
+    }
+}
+
+/**
+ * Write fault on a protected page - invalidate any code in the page (at every
+ * address it appears at) and make it writable. Pages that fault too often are
+ * left writable, and translated as checked instead until the fault window
+ * expires.
+ */
+static gboolean sdram_write_fault( void *mem )
+{
+    uintptr_t offset = ((uintptr_t)mem) - ((uintptr_t)dc_main_ram);
+    uint32_t page = offset >> 12, mirror;
+
+    if( offset >= (16 MB) || sdram_page_state[page] != SDRAM_PAGE_PROTECTED ) {
+        return FALSE;
+    }
+    for( mirror = 0x0C000000; mirror < 0x10000000; mirror += 0x01000000 ) {
+        xlat_invalidate_block( mirror + (page << 12), 4096 );
+    }
+    sdram_update_fault_window( page );
+    if( ++sdram_page_faults[page] >= SDRAM_MAX_CODE_FAULTS ) {
+        sdram_page_state[page] = SDRAM_PAGE_CHECKED;
+    } else {
+        sdram_page_state[page] = SDRAM_PAGE_UNPROTECTED;
+    }
+    mem_protect_pages( dc_main_ram + (page << 12), 1, TRUE );
+    return TRUE;
+}
+
+gboolean sdram_enable_code_protection( void )
+{
+    if( !sdram_code_protect && mem_set_write_fault_handler( sdram_write_fault ) ) {
+        memset( sdram_page_state, SDRAM_PAGE_UNPROTECTED, sizeof(sdram_page_state) );
+        memset( sdram_page_faults, 0, sizeof(sdram_page_faults) );
+        memset( sdram_page_window, 0, sizeof(sdram_page_window) );
+        sdram_translations = 0;
+        sdram_code_protect = TRUE;
+    }
+    return sdram_code_protect;
+}
+
+void sdram_protect_code( sh4addr_t start, sh4addr_t end )
+{
+    sh4addr_t addr;
+    if( !sdram_code_protect || !IS_SDRAM_ADDR(start) || end <= start ) {
+        return;
+    }
+    sdram_translations++;
+    for( addr = start & 0xFFFFF000; addr < end; addr += 4096 ) {
+        uint32_t page = (addr & 0x00FFFFFF) >> 12;
+        sdram_update_fault_window( page );
+        if( sdram_page_state[page] == SDRAM_PAGE_CHECKED && sdram_page_faults[page] == 0 ) {
+            /* Quiet for a whole window - try protecting it again */
+            sdram_page_state[page] = SDRAM_PAGE_UNPROTECTED;
+        }
+        if( sdram_page_state[page] == SDRAM_PAGE_UNPROTECTED ) {
+            if( mem_protect_pages( dc_main_ram + (page << 12), 1, FALSE ) ) {
+                sdram_page_state[page] = SDRAM_PAGE_PROTECTED;
+            } else {
+                mem_protect_pages( dc_main_ram + (page << 12), 1, TRUE );
+                sdram_page_state[page] = SDRAM_PAGE_CHECKED;
+            }
+        }
+    }
+}
+
+gboolean sdram_is_code_checked( sh4addr_t addr )
+{
+    return sdram_code_protect && IS_SDRAM_ADDR(addr) &&
+        sdram_page_state[(addr & 0x00FFFFFF) >> 12] == SDRAM_PAGE_CHECKED;
+}
+
+uint32_t FASTCALL sdram_get_code_hash( sh4addr_t start, sh4addr_t end )
+{
+    uint32_t hash = 0x811C9DC5;
+    for( ; start < end; start += 2 ) {
+        hash = (hash ^ *(uint16_t *)(dc_main_ram + (start & 0x00FFFFFF))) * 0x01000193;
+    }
+    return hash;
+}
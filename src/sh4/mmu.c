@@ -34,6 +34,10 @@
 mem_region_fn_t *sh4_address_space;
 mem_region_fn_t *sh4_user_address_space;
 
+/* Host view of the privileged (non-TLB) address space, or NULL if unavailable */
+static unsigned char *mmu_fastmem_base = NULL;
+static gboolean mmu_fastmem_enabled = TRUE;
+
 /* External address space (usually the same as the global ext_address_space) */
 static mem_region_fn_t *sh4_ext_address_space;
 
@@ -74,6 +78,7 @@ static void mmu_utlb_1k_init();
 static struct utlb_1k_entry *mmu_utlb_1k_alloc();
 static void mmu_utlb_1k_free( struct utlb_1k_entry *entry );
 static int mmu_read_urc();
+static void mmu_fastmem_init();
 
 static void FASTCALL tlb_miss_read( sh4addr_t addr, void *exc );
 static int32_t FASTCALL tlb_protected_read( sh4addr_t addr, void *exc );
@@ -162,6 +167,49 @@ void MMU_init()
      */
     mem_unprotect( mmu_utlb_pages, sizeof(mmu_utlb_pages) );
     mem_unprotect( mmu_utlb_1k_pages, sizeof(mmu_utlb_1k_pages) );
+
+    if( mmu_fastmem_enabled ) {
+        mmu_fastmem_init();
+    }
+}
+
+/**
+ * Reserve 4GB of host address space covering the entire SH4 address space,
+ * and map main RAM into it at each of its addresses in P0-P3 (with the TLB
+ * off). Everything else is left inaccessible, so that the translator can
+ * access memory as base+address and fall back to the region functions on a
+ * fault. This is only possible on 64-bit hosts, and only if main RAM was
+ * allocated with mem_alloc_shared_pages().
+ */
+static void mmu_fastmem_init()
+{
+#if SIZEOF_VOID_P == 8
+    uint32_t area, mirror;
+    unsigned char *base = mem_reserve_pages( ((size_t)1) << (32 - 12) );
+    if( base == NULL ) {
+        return;
+    }
+    for( area = 0x00000000; area < 0xE0000000; area += 0x20000000 ) {
+        for( mirror = 0x0C000000; mirror < 0x10000000; mirror += 0x01000000 ) {
+            if( !mem_map_shared_pages( base + area + mirror, dc_main_ram, (16 MB)/LXDREAM_PAGE_SIZE ) ) {
+                WARN( "Unable to map main RAM for fastmem, disabling" );
+                mem_release_pages( base, ((size_t)1) << (32 - 12) );
+                return;
+            }
+        }
+    }
+    mmu_fastmem_base = base;
+#endif
+}
+
+void *mmu_get_fastmem_base()
+{
+    return mmu_fastmem_base;
+}
+
+void mmu_set_fastmem( gboolean flag )
+{
+    mmu_fastmem_enabled = flag;
 }
 
 void MMU_reset()
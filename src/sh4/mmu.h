@@ -117,6 +117,20 @@ mem_region_fn_t FASTCALL mmu_get_region_for_vma_read( sh4vma_t *addr );
 mem_region_fn_t FASTCALL mmu_get_region_for_vma_write( sh4vma_t *addr );
 mem_region_fn_t FASTCALL mmu_get_region_for_vma_prefetch( sh4vma_t *addr );
 
+/**
+ * Retrieve the base of the host view of the privileged address space with the
+ * TLB disabled, ie main RAM is accessible at base+address for any of its
+ * addresses in P0-P3, and any other address faults. 
+ * @return the base address, or NULL if the view isn't available.
+ */
+void *mmu_get_fastmem_base();
+
+/**
+ * Enable/disable creating the fastmem view (enabled by default). Must be called
+ * before MMU_init() to take effect.
+ */
+void mmu_set_fastmem( gboolean flag );
+
 /* Translator provided helpers */
 void mmu_utlb_init_vtable( struct utlb_entry *ent, struct utlb_page_entry *page, gboolean writable ); 
 void mmu_utlb_1k_init_vtable( struct utlb_1k_entry *ent ); 
@@ -21,6 +21,8 @@
 #include <math.h>
 #include <setjmp.h>
 #include <assert.h>
+#include <errno.h>
+#include <string.h>
 #include "lxdream.h"
 #include "dreamcast.h"
 #include "cpu.h"
@@ -36,6 +38,7 @@
 #include "sh4/sh4stat.h"
 #include "sh4/sh4trans.h"
 #include "xlat/xltcache.h"
+#include "xlat/xltperf.h"
 
 #ifndef M_PI
 #define M_PI        3.14159265358979323846264338327950288
@@ -47,6 +50,9 @@ void sh4_start( void );
 void sh4_stop( void );
 void sh4_save_state( FILE *f );
 int sh4_load_state( FILE *f );
+#ifdef SH4_TRANSLATOR
+static void sh4_write_profile_report();
+#endif
 size_t sh4_debug_read_phys( unsigned char *buf, uint32_t addr, size_t length );
 size_t sh4_debug_write_phys( uint32_t addr, unsigned char *buf, size_t length );
 size_t sh4_debug_read_vma( unsigned char *buf, uint32_t addr, size_t length );
@@ -150,6 +156,8 @@ int sh4_breakpoint_count = 0;
 gboolean sh4_starting = FALSE;
 gboolean sh4_profile_blocks = FALSE;
 static gboolean sh4_use_translator = FALSE;
+static gboolean sh4_use_shadow = FALSE;
+static gchar *sh4_profile_report = NULL;
 static jmp_buf sh4_exit_jmp_buf;
 static gboolean sh4_running = FALSE;
 struct sh4_icache_struct sh4_icache = { NULL, -1, -1, 0 };
@@ -168,11 +176,15 @@ void sh4_set_core( sh4core_t core )
     if( core != SH4_INTERPRET ) {
         sh4_translate_init();
         sh4_use_translator = TRUE;
-        if( core == SH4_SHADOW ) {
-            sh4_shadow_init();
+        sh4_use_shadow = (core == SH4_SHADOW || core == SH4_SHADOW_PARALLEL);
+        if( sh4_use_shadow ) {
+            sh4_shadow_init( core == SH4_SHADOW_PARALLEL );
+        } else if( sh4_profile_blocks ) {
+            sh4_profile_init();
         }
     } else {
         sh4_use_translator = FALSE;
+        sh4_use_shadow = FALSE;
     }
 #endif
 }
@@ -238,6 +250,7 @@ void sh4_stop(void)
         sh4r.in_delay_slot = FALSE;
 #ifdef SH4_TRANSLATOR
         if( sh4_profile_blocks ) {
+            sh4_write_profile_report();
             sh4_translate_dump_cache_by_activity(30);
         }
 #endif
@@ -412,14 +425,111 @@ void sh4_set_event_pending( uint32_t cycles )
 
 void sh4_set_profile_blocks( gboolean flag )
 {
+#ifdef SH4_TRANSLATOR
+    if( sh4_use_translator && !sh4_use_shadow && flag != sh4_profile_blocks ) {
+        /* Existing blocks don't have the profiling instrumentation */
+        if( flag ) {
+            sh4_profile_reset();
+            sh4_profile_init();
+        } else {
+            sh4_translate_set_callbacks( NULL, NULL );
+        }
+        xlat_flush_cache();
+    }
+#endif
     sh4_profile_blocks = flag;
 }
 
+void sh4_set_profile_report( const gchar *filename )
+{
+    g_free( sh4_profile_report );
+    sh4_profile_report = filename == NULL ? NULL : g_strdup(filename);
+}
+
+#ifdef SH4_TRANSLATOR
+/**
+ * Write the block profile report (if block profiling is supported by the
+ * current core)
+ */
+static void sh4_write_profile_report()
+{
+    if( sh4_use_shadow ) {
+        return;
+    }
+    if( sh4_profile_report == NULL ) {
+        sh4_profile_write_report( stderr, 0 );
+    } else {
+        FILE *f = fopen( sh4_profile_report, "w" );
+        if( f == NULL ) {
+            WARN( "Unable to write block profile to %s: %s", sh4_profile_report, strerror(errno) );
+        } else {
+            sh4_profile_write_report( f, 0 );
+            fclose( f );
+        }
+    }
+}
+#endif
+
 gboolean sh4_get_profile_blocks( )
 {
     return sh4_profile_blocks;
 }
 
+void sh4_set_fastmem( gboolean flag )
+{
+    mmu_set_fastmem( flag );
+}
+
+void sh4_set_superblocks( gboolean flag )
+{
+#ifdef SH4_TRANSLATOR
+    sh4_translate_set_superblocks( flag );
+#endif
+}
+
+void sh4_set_optimize( gboolean flag )
+{
+#ifdef SH4_TRANSLATOR
+    sh4_translate_set_optimize( flag );
+#endif
+}
+
+void sh4_set_idle_skip( gboolean flag )
+{
+#ifdef SH4_TRANSLATOR
+    sh4_translate_set_idle_skip( flag );
+#endif
+}
+
+void sh4_set_cycle_model( gboolean flag )
+{
+#ifdef SH4_TRANSLATOR
+    /* Shadow mode replays each block by instruction count */
+    sh4_translate_set_cycle_model( flag && !sh4_use_shadow );
+#endif
+}
+
+void sh4_set_async_translate( gboolean flag )
+{
+#ifdef SH4_TRANSLATOR
+    sh4_translate_set_async( flag );
+#endif
+}
+
+void sh4_set_code_cache( const gchar *filename )
+{
+#ifdef SH4_TRANSLATOR
+    sh4_translate_set_code_cache( filename );
+#endif
+}
+
+void sh4_set_perf_output( gboolean perf_map, gboolean jitdump )
+{
+#ifdef SH4_TRANSLATOR
+    xlat_perf_open( (perf_map ? XLAT_PERF_MAP : 0) | (jitdump ? XLAT_PERF_JITDUMP : 0) );
+#endif
+}
+
 /**
  * Dump all SH4 core information for crash-dump purposes
  */
@@ -100,7 +100,8 @@ extern const struct cpu_desc_struct sh4_cpu_desc;
 typedef enum {
     SH4_INTERPRET,
     SH4_TRANSLATE,
-    SH4_SHADOW
+    SH4_SHADOW,
+    SH4_SHADOW_PARALLEL
 } sh4core_t;
 
 /**
@@ -161,6 +162,61 @@ void sh4_set_profile_blocks( gboolean flag );
  */
 gboolean sh4_get_profile_blocks();
 
+/**
+ * Set the file that the block profile report is written to when the SH4 is
+ * stopped, or NULL to write it to stderr.
+ */
+void sh4_set_profile_report( const gchar *filename );
+
+/**
+ * Enable/disable accessing main RAM from translated code through a host view
+ * of the SH4 address space (see mmu_get_fastmem_base). This must be called
+ * before dreamcast_init() to take effect.
+ */
+void sh4_set_fastmem( gboolean flag );
+
+/**
+ * Enable/disable superblock translation (Note only supported by translation cores)
+ */
+void sh4_set_superblocks( gboolean flag );
+
+/**
+ * Enable/disable the translator's IR optimization passes (Note only supported
+ * by translation cores)
+ */
+void sh4_set_optimize( gboolean flag );
+
+/**
+ * Enable/disable skipping ahead to the next event from idle loops (Note only
+ * supported by translation cores)
+ */
+void sh4_set_idle_skip( gboolean flag );
+
+/**
+ * Enable/disable charging translated code by the static pipeline cycle model
+ * rather than per instruction (Note only supported by translation cores, and
+ * ignored in shadow mode)
+ */
+void sh4_set_cycle_model( gboolean flag );
+
+/**
+ * Enable/disable translating code on a background thread, interpreting it
+ * until the translation is ready (Note only supported by translation cores)
+ */
+void sh4_set_async_translate( gboolean flag );
+
+/**
+ * Set the file to use as a persistent cache of translated code, or NULL for
+ * none (Note only supported by translation cores)
+ */
+void sh4_set_code_cache( const gchar *filename );
+
+/**
+ * Enable/disable reporting of translated code to the Linux perf tool, via a
+ * perf map and/or a jitdump file (Note only supported by translation cores)
+ */
+void sh4_set_perf_output( gboolean perf_map, gboolean jitdump );
+
 
 
 #ifdef __cplusplus
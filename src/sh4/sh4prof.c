@@ -0,0 +1,225 @@
+/**
+ * $Id$
+ *
+ * SH4 translated block profiler - uses the translator's instrumentation
+ * callbacks to record the number of entries, host cycles, and exit reasons for
+ * each block, identified by its SH4 start address.
+ *
+ * Copyright (c) 2010 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lxdream.h"
+#include "sh4/sh4.h"
+#include "sh4/sh4core.h"
+#include "sh4/sh4trans.h"
+
+/* Pseudo exit reason for blocks that were left without calling the end
+ * callback (eg SLEEP, breakpoints) */
+#define PROFILE_EXIT_UNWOUND XLAT_EXIT_REASONS
+#define PROFILE_EXIT_COUNT (XLAT_EXIT_REASONS+1)
+
+/* Block start addresses are always even, so this marks an unused slot */
+#define PROFILE_EMPTY_PC 1
+#define PROFILE_INITIAL_SIZE 4096
+
+static const char *profile_exit_names[PROFILE_EXIT_COUNT] =
+    { "chain", "return", "exception", "emulate", "changed", "unwound" };
+
+struct block_profile {
+    sh4vma_t start_pc;
+    sh4vma_t end_pc;    /* End of the SH4 code covered by the block (exclusive) */
+    uint64_t entries;
+    uint64_t cycles;    /* Total host cycles spent in the block */
+    uint64_t exits[PROFILE_EXIT_COUNT];
+};
+
+/* Open-addressed hash table of profile records, keyed by start_pc */
+static struct block_profile *profile_table = NULL;
+static uint32_t profile_table_size = 0;
+static uint32_t profile_table_count = 0;
+
+/* Block currently executing, and the clock when it was entered */
+static struct block_profile *profile_current = NULL;
+static uint64_t profile_start_time;
+
+static inline uint64_t sh4_profile_clock( void )
+{
+#if defined(__i386__) || defined(__x86_64__)
+    uint32_t lo, hi;
+    __asm__ __volatile__( "rdtsc" : "=a" (lo), "=d" (hi) );
+    return (((uint64_t)hi) << 32) | lo;
+#else
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ((uint64_t)ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static inline uint32_t sh4_profile_hash( sh4vma_t pc )
+{
+    return ((pc >> 1) * 2654435761U) & (profile_table_size - 1);
+}
+
+static void sh4_profile_alloc_table( uint32_t size )
+{
+    struct block_profile *old_table = profile_table;
+    uint32_t old_size = profile_table_size;
+    uint32_t i;
+
+    profile_table = malloc( size * sizeof(struct block_profile) );
+    profile_table_size = size;
+    for( i=0; i<size; i++ ) {
+        profile_table[i].start_pc = PROFILE_EMPTY_PC;
+    }
+    for( i=0; i<old_size; i++ ) {
+        if( old_table[i].start_pc != PROFILE_EMPTY_PC ) {
+            uint32_t posn = sh4_profile_hash( old_table[i].start_pc );
+            while( profile_table[posn].start_pc != PROFILE_EMPTY_PC ) {
+                posn = (posn + 1) & (size - 1);
+            }
+            profile_table[posn] = old_table[i];
+        }
+    }
+    free( old_table );
+}
+
+/**
+ * Compute the end of the SH4 code covered by the block from its recovery
+ * table. The last record is the end-of-block record, the others each mark the
+ * start of an instruction.
+ */
+static sh4vma_t sh4_profile_get_block_end( void *code, sh4vma_t start )
+{
+    xlat_recovery_record_t recov = XLAT_RECOVERY_TABLE(code);
+    uint32_t count = XLAT_BLOCK_FOR_CODE(code)->recover_table_size;
+    int32_t end = 2;
+    uint32_t i;
+
+    for( i=0; i<count; i++ ) {
+        int32_t posn = recov[i].sh4_pc_offset + (i == count-1 ? 0 : 2);
+        if( posn > end ) {
+            end = posn;
+        }
+    }
+    return start + end;
+}
+
+static struct block_profile *sh4_profile_get_block( sh4vma_t pc, void *code )
+{
+    if( profile_table_count*2 >= profile_table_size ) {
+        sh4_profile_alloc_table( profile_table_size == 0 ? PROFILE_INITIAL_SIZE : profile_table_size*2 );
+    }
+
+    uint32_t posn = sh4_profile_hash(pc);
+    while( profile_table[posn].start_pc != pc ) {
+        if( profile_table[posn].start_pc == PROFILE_EMPTY_PC ) {
+            struct block_profile *prof = &profile_table[posn];
+            memset( prof, 0, sizeof(struct block_profile) );
+            prof->start_pc = pc;
+            prof->end_pc = sh4_profile_get_block_end( code, pc );
+            profile_table_count++;
+            return prof;
+        }
+        posn = (posn + 1) & (profile_table_size - 1);
+    }
+    return &profile_table[posn];
+}
+
+static void FASTCALL sh4_profile_block_begin( void *code )
+{
+    if( profile_current != NULL ) {
+        profile_current->exits[PROFILE_EXIT_UNWOUND]++;
+    }
+    profile_current = sh4_profile_get_block( sh4r.pc, code );
+    profile_current->entries++;
+    profile_start_time = sh4_profile_clock();
+}
+
+static void FASTCALL sh4_profile_block_end( uint32_t exit_reason )
+{
+    uint64_t now = sh4_profile_clock();
+    if( profile_current != NULL ) {
+        profile_current->cycles += now - profile_start_time;
+        profile_current->exits[exit_reason]++;
+        profile_current = NULL;
+    }
+}
+
+void sh4_profile_init( void )
+{
+    sh4_translate_set_callbacks( sh4_profile_block_begin, sh4_profile_block_end );
+}
+
+void sh4_profile_reset( void )
+{
+    free( profile_table );
+    profile_table = NULL;
+    profile_table_size = 0;
+    profile_table_count = 0;
+    profile_current = NULL;
+}
+
+static int sh4_profile_compare_cycles( const void *a, const void *b )
+{
+    const struct block_profile *pa = *(const struct block_profile **)a;
+    const struct block_profile *pb = *(const struct block_profile **)b;
+    if( pa->cycles != pb->cycles ) {
+        return pa->cycles > pb->cycles ? -1 : 1;
+    }
+    return pa->start_pc < pb->start_pc ? -1 : (pa->start_pc > pb->start_pc ? 1 : 0);
+}
+
+void sh4_profile_write_report( FILE *out, unsigned int topN )
+{
+    struct block_profile **sorted = malloc( (profile_table_count+1) * sizeof(struct block_profile *) );
+    uint64_t total_cycles = 0, total_entries = 0;
+    unsigned int i, j, count = 0;
+
+    for( i=0; i<profile_table_size; i++ ) {
+        if( profile_table[i].start_pc != PROFILE_EMPTY_PC ) {
+            sorted[count++] = &profile_table[i];
+            total_cycles += profile_table[i].cycles;
+            total_entries += profile_table[i].entries;
+        }
+    }
+    qsort( sorted, count, sizeof(struct block_profile *), sh4_profile_compare_cycles );
+    if( topN == 0 || topN > count ) {
+        topN = count;
+    }
+
+    fprintf( out, "# Block profile: %u blocks, %llu entries, %llu host cycles\n", count,
+             (unsigned long long)total_entries, (unsigned long long)total_cycles );
+    fprintf( out, "# %-8s %-8s %12s %14s %10s %7s", "start", "end", "entries", "cycles",
+             "cyc/entry", "%cycles" );
+    for( j=0; j<PROFILE_EXIT_COUNT; j++ ) {
+        fprintf( out, " %10s", profile_exit_names[j] );
+    }
+    fprintf( out, "\n" );
+
+    for( i=0; i<topN; i++ ) {
+        struct block_profile *prof = sorted[i];
+        fprintf( out, "  %08X %08X %12llu %14llu %10.1f %7.2f", prof->start_pc, prof->end_pc,
+                 (unsigned long long)prof->entries, (unsigned long long)prof->cycles,
+                 prof->entries == 0 ? 0.0 : ((double)prof->cycles) / prof->entries,
+                 total_cycles == 0 ? 0.0 : ((double)prof->cycles) * 100.0 / total_cycles );
+        for( j=0; j<PROFILE_EXIT_COUNT; j++ ) {
+            fprintf( out, " %10llu", (unsigned long long)prof->exits[j] );
+        }
+        fprintf( out, "\n" );
+    }
+    free( sorted );
+}
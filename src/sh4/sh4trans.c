@@ -17,6 +17,8 @@
  * GNU General Public License for more details.
  */
 #include <assert.h>
+#include <string.h>
+#include <pthread.h>
 #include "eventq.h"
 #include "syscall.h"
 #include "clock.h"
@@ -28,11 +30,46 @@
 #include "sh4/mmu.h"
 #include "xlat/xltcache.h"
 #include "xlat/xlatdasm.h"
+#include "xlat/xir.h"
+#include "xlat/xltpersist.h"
 
 //#define SINGLESTEP 1
 
 /**
- * Execute a timeslice using translated code only (ie translate/execute loop)
+ * Background translation state. Jobs are queued by the CPU thread when it
+ * misses in the cache, translated by the background thread into blocks
+ * outside of the cache (see xlat_set_staging), and then installed by the CPU
+ * thread. translate_lock is held by whichever thread is translating, as the
+ * translator state (xlat_source, xlat_trace, the code generator etc) is
+ * shared, and while installing.
+ */
+#define XLAT_ASYNC_JOBS 32
+
+#define XLAT_JOB_FREE 0
+#define XLAT_JOB_QUEUED 1
+#define XLAT_JOB_RUNNING 2
+#define XLAT_JOB_DONE 3
+
+static struct {
+    pthread_mutex_t lock;           /* Protects the job states and flags */
+    pthread_cond_t work;            /* Signalled when there's work for the thread */
+    pthread_mutex_t translate_lock;
+    pthread_t thread;
+    gboolean enabled;
+    gboolean stop;                  /* Thread should exit */
+    gboolean install_wanted;        /* CPU thread is waiting to install blocks */
+    volatile int done_count;        /* Number of jobs in the DONE state */
+    uint32_t next_seq;              /* Queue order of the next job */
+} xlat_async = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_MUTEX_INITIALIZER };
+
+static void sh4_translate_install_jobs( void );
+static void *sh4_translate_queue_block( sh4addr_t start );
+static void sh4_translate_interpret_block( void );
+
+/**
+ * Execute a timeslice using translated code only (ie translate/execute loop),
+ * or with background translation, translated code where it's available and
+ * the interpreter elsewhere.
  */
 uint32_t sh4_translate_run_slice( uint32_t nanosecs ) 
 {
@@ -51,56 +88,486 @@ uint32_t sh4_translate_run_slice( uint32_t nanosecs )
             syscall_invoke( pc );
         }
 
+        if( xlat_async.done_count != 0 ) {
+            sh4_translate_install_jobs();
+        }
+
         void * (*code)() = xlat_get_code_by_vma( sh4r.pc );
-        if( code != NULL ) {
-            while( sh4r.xlat_sh4_mode != XLAT_BLOCK_MODE(code) ) {
-                code = XLAT_BLOCK_CHAIN(code);
+        while( code != NULL && sh4r.xlat_sh4_mode != XLAT_BLOCK_MODE(code) ) {
+            code = XLAT_BLOCK_CHAIN(code);
+        }
+        if( code == NULL ) {
+            if( xlat_async.enabled && sh4_breakpoint_count == 0 && IS_IN_ICACHE(sh4r.pc) ) {
+                code = sh4_translate_queue_block( sh4r.pc );
                 if( code == NULL ) {
-                    code = sh4_translate_basic_block( sh4r.pc );
-                    break;
+                    sh4_translate_interpret_block();
+                    continue;
                 }
+            } else {
+                code = sh4_translate_basic_block( sh4r.pc );
             }
-        } else {
-            code = sh4_translate_basic_block( sh4r.pc );
         }
         sh4_translate_enter(code);
     }
 }
 
-uint8_t *xlat_output;
+__thread uint8_t *xlat_output;
+struct xlat_source_state xlat_source;
 xlat_cache_block_t xlat_current_block;
 struct xlat_recovery_record xlat_recovery[MAX_RECOVERY_SIZE];
 uint32_t xlat_recovery_posn;
 
-void sh4_translate_add_recovery( uint32_t icount )
+/**
+ * Superblock (trace) state. A trace is made up of one or more linear segments
+ * of SH4 code, joined by branches that the translator has chosen to follow
+ * rather than exiting the block. All segments lie within the same 4K page as
+ * the block start, and no two segments overlap, so a trace never translates
+ * any given instruction more than once.
+ */
+struct xlat_trace_segment {
+    sh4addr_t start_pc;   /* First instruction in the segment */
+    sh4addr_t end_pc;     /* Address following the last instruction in the segment */
+    uint32_t icount;      /* Instruction count of the trace at start_pc */
+    struct sh4_timing_state timing; /* Timing model state at start_pc */
+};
+
+static gboolean xlat_trace_enabled = FALSE;
+static struct xlat_trace_segment xlat_trace[MAX_TRACE_SEGMENTS];
+static int xlat_trace_posn;         /* Index of the current (last) segment */
+static sh4addr_t xlat_trace_lastpc; /* End of the translatable region of the page */
+static sh4addr_t xlat_trace_limit;  /* End of the translatable region for the current segment */
+static sh4addr_t xlat_trace_nextpc; /* Address following the followed branch */
+static sh4addr_t xlat_trace_target; /* Destination of the followed branch */
+
+void sh4_translate_set_superblocks( gboolean flag )
+{
+    xlat_trace_enabled = flag;
+}
+
+/**
+ * IR for the run of instructions currently being translated. This is rebuilt
+ * whenever the translation reaches an instruction outside of it, ie at the
+ * start of each block and segment, and after each branch.
+ */
+static gboolean xlat_optimize_enabled = FALSE;
+static struct xir_block xlat_ir;
+
+void sh4_translate_set_optimize( gboolean flag )
+{
+    xlat_optimize_enabled = flag;
+}
+
+static gboolean xlat_idle_skip_enabled = FALSE;
+
+void sh4_translate_set_idle_skip( gboolean flag )
+{
+    xlat_idle_skip_enabled = flag;
+}
+
+/**
+ * Timing model state for the current segment, after the instructions from
+ * the start of the segment up to xlat_timing_pc.
+ */
+static gboolean xlat_cycle_model_enabled = FALSE;
+static struct sh4_timing_state xlat_timing;
+static sh4addr_t xlat_timing_pc;
+
+void sh4_translate_set_cycle_model( gboolean flag )
+{
+    xlat_cycle_model_enabled = flag;
+}
+
+xir_op_t sh4_translate_get_ir( sh4addr_t pc )
+{
+    if( !xlat_optimize_enabled ) {
+        return NULL;
+    }
+    return xir_get_op( &xlat_ir, pc );
+}
+
+static xir_op_t sh4_translate_decode_ir( xir_block_t block, sh4addr_t pc )
+{
+    xir_op_t op = &block->ops[block->count++];
+    memset( op, 0, sizeof(struct xir_op) );
+    op->pc = pc;
+    sh4_decode_xir( *(uint16_t *)XLAT_ICACHE_PTR(pc), op );
+    return op;
+}
+
+/**
+ * Decode the instructions from pc up to the first branch (including its delay
+ * slot), or endpc, whichever comes first, into xlat_ir and run the
+ * optimization passes over the result. Breakpoints disable the optimizer,
+ * as they expose the machine state at arbitrary instructions.
+ */
+static void sh4_translate_build_ir( sh4addr_t pc, sh4addr_t endpc )
+{
+    xir_block_t block = &xlat_ir;
+    block->start_pc = pc;
+    block->insn_size = 2;
+    block->count = 0;
+#ifdef SINGLESTEP
+    endpc = pc + 2;
+#endif
+
+    if( sh4_breakpoint_count == 0 ) {
+        while( pc < endpc && block->count < XIR_MAX_OPS ) {
+            xir_op_t op = sh4_translate_decode_ir( block, pc );
+            pc += 2;
+            if( op->flags & XIR_FLAG_END ) {
+                if( (op->flags & XIR_FLAG_DELAYED) && pc < endpc ) {
+                    sh4_translate_decode_ir( block, pc );
+                    pc += 2;
+                }
+                break;
+            }
+        }
+    }
+    block->end_pc = pc;
+    xir_optimize( block );
+}
+
+gboolean sh4_translate_is_idle_loop( sh4addr_t endpc )
+{
+    static struct xir_block loop;
+    sh4addr_t pc;
+
+    /* Only a single linear run of code can be checked */
+    if( !xlat_idle_skip_enabled || xlat_trace_posn != 0 ||
+        endpc - xlat_trace[0].start_pc > XIR_MAX_OPS*2 ) {
+        return FALSE;
+    }
+    loop.start_pc = xlat_trace[0].start_pc;
+    loop.end_pc = endpc;
+    loop.insn_size = 2;
+    loop.count = 0;
+    for( pc = loop.start_pc; pc < endpc; pc += 2 ) {
+        sh4_translate_decode_ir( &loop, pc );
+    }
+    return xir_is_idle_loop( &loop );
+}
+
+uint32_t sh4_translate_get_icount( sh4addr_t pc )
+{
+    struct xlat_trace_segment *seg = &xlat_trace[xlat_trace_posn];
+    return seg->icount + ((pc - seg->start_pc)>>1);
+}
+
+uint32_t sh4_translate_get_cycles( sh4addr_t pc )
+{
+    struct xlat_trace_segment *seg = &xlat_trace[xlat_trace_posn];
+
+    if( !xlat_cycle_model_enabled ) {
+        return sh4_translate_get_icount( pc );
+    }
+    if( pc < xlat_timing_pc ) {
+        xlat_timing = seg->timing;
+        xlat_timing_pc = seg->start_pc;
+    }
+    while( xlat_timing_pc < pc ) {
+        sh4_timing_issue( &xlat_timing, *(uint16_t *)XLAT_ICACHE_PTR(xlat_timing_pc) );
+        xlat_timing_pc += 2;
+    }
+    return xlat_timing.cycle;
+}
+
+gboolean sh4_translate_follow_branch( sh4addr_t target, sh4addr_t nextpc )
+{
+    int i;
+    if( !xlat_trace_enabled ) {
+        return FALSE;
+    }
+    if( target == nextpc ) {
+        if( nextpc >= xlat_trace_limit ) {
+            return FALSE;
+        }
+    } else {
+        if( xlat_trace_posn+1 >= MAX_TRACE_SEGMENTS || (target & 1) != 0 ||
+            target < (xlat_trace[0].start_pc & 0xFFFFF000) ||
+            target >= xlat_trace_lastpc || !XLAT_IS_IN_ICACHE(target) ) {
+            return FALSE;
+        }
+        for( i=0; i<xlat_trace_posn; i++ ) {
+            if( target >= xlat_trace[i].start_pc && target < xlat_trace[i].end_pc ) {
+                return FALSE;
+            }
+        }
+        if( target >= xlat_trace[i].start_pc && target < nextpc ) {
+            return FALSE;
+        }
+    }
+    xlat_trace_nextpc = nextpc;
+    xlat_trace_target = target;
+    return TRUE;
+}
+
+/**
+ * Finish the current trace segment at the last followed branch, and start a
+ * new one at the branch target (unless the branch was a fall-through, in
+ * which case the current segment just continues). The new segment is limited
+ * to end at the end of the page, or the start of the next segment in memory,
+ * whichever is lower.
+ * @return the address of the next instruction to translate.
+ */
+static sh4addr_t sh4_translate_next_segment( )
+{
+    struct xlat_trace_segment *seg = &xlat_trace[xlat_trace_posn];
+    sh4addr_t target = xlat_trace_target;
+    int i;
+
+    if( target == xlat_trace_nextpc ) {
+        return target;
+    }
+
+    if( xlat_cycle_model_enabled ) {
+        sh4_translate_get_cycles( xlat_trace_nextpc );
+        seg[1].timing = xlat_timing;
+        xlat_timing_pc = target;
+    }
+    seg->end_pc = xlat_trace_nextpc;
+    seg[1].start_pc = target;
+    seg[1].icount = seg->icount + ((xlat_trace_nextpc - seg->start_pc)>>1);
+    xlat_trace_posn++;
+
+    xlat_trace_limit = xlat_trace_lastpc;
+    for( i=0; i<xlat_trace_posn; i++ ) {
+        if( xlat_trace[i].start_pc > target && xlat_trace[i].start_pc < xlat_trace_limit ) {
+            xlat_trace_limit = xlat_trace[i].start_pc;
+        }
+    }
+    return target;
+}
+
+void sh4_translate_add_recovery( sh4addr_t pc )
 {
     xlat_recovery[xlat_recovery_posn].xlat_offset = 
         ((uintptr_t)xlat_output) - ((uintptr_t)xlat_current_block->code);
-    xlat_recovery[xlat_recovery_posn].sh4_icount = icount;
+    xlat_recovery[xlat_recovery_posn].sh4_icount = sh4_translate_get_icount(pc);
+    xlat_recovery[xlat_recovery_posn].sh4_cycles = sh4_translate_get_cycles(pc);
+    xlat_recovery[xlat_recovery_posn].sh4_pc_offset = pc - xlat_trace[0].start_pc;
     xlat_recovery_posn++;
 }
 
 /**
- * Translate a linear basic block, ie all instructions from the start address
- * (inclusive) until the next branch/jump instruction or the end of the page
- * is reached.
- * @param start VMA of the block start (which must already be in the icache)
- * @return the address of the translated block
- * eg due to lack of buffer space.
+ * Capture the current CPU state for a translation (see struct xlat_source_state)
  */
-void * sh4_translate_basic_block( sh4addr_t start )
+static void sh4_translate_get_source( struct xlat_source_state *source )
+{
+    source->icache = sh4_icache;
+    source->sh4_mode = sh4r.xlat_sh4_mode;
+    source->tlb_on = IS_TLB_ENABLED() ? TRUE : FALSE;
+}
+
+/**
+ * Return the end of the translatable region for a block starting at start,
+ * ie the end of the page or of the source icache region, whichever is lower.
+ */
+static sh4addr_t sh4_translate_get_lastpc( sh4addr_t start )
+{
+    sh4addr_t lastpc = (start&0xFFFFF000)+0x1000;
+    if( XLAT_ICACHE_END() < lastpc ) {
+        lastpc = XLAT_ICACHE_END();
+    }
+    return lastpc;
+}
+
+/**
+ * Hash the source code that a block starting at start can have been
+ * translated from, ie from the start of the page to lastpc (plus a delay slot).
+ */
+static uint64_t sh4_translate_hash_source( sh4addr_t start, sh4addr_t lastpc )
+{
+    sh4addr_t hashstart = start & 0xFFFFF000;
+    sh4addr_t hashend = lastpc;
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    uint16_t *p;
+
+    if( !XLAT_IS_IN_ICACHE(hashstart) ) {
+        hashstart = xlat_source.icache.page_vma;
+    }
+    if( XLAT_IS_IN_ICACHE(hashend) ) {
+        hashend += 2; /* May be read as a delay slot */
+    }
+    for( p = (uint16_t *)XLAT_ICACHE_PTR(hashstart); p < (uint16_t *)XLAT_ICACHE_PTR(hashend); p++ ) {
+        hash = (hash ^ *p) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+/**
+ * Persistent code cache. A block is identified by everything its translation
+ * depends on: the contents of the source page, the start address, the SH4
+ * mode, and the translator settings.
+ */
+struct xlat_persist_key {
+    sh4addr_t start;
+    sh4addr_t lastpc;        /* End of the translatable region */
+    uint32_t sh4_mode;
+    uint32_t cpu_period;
+    uint32_t options;        /* Translator settings */
+    uint32_t codegen;        /* Code generator settings */
+    sh4addr_t icache_vma;
+    uint32_t icache_mask;
+    uint64_t page_hash;      /* Hash of the source code from the start of the page to lastpc */
+};
+
+/** Everything else needed to commit a block loaded from the cache */
+struct xlat_persist_data {
+    uint32_t size;
+    sh4addr_t end_pc;
+    uint32_t trace_count;
+    struct {
+        sh4addr_t start_pc;
+        sh4addr_t end_pc;
+    } trace[MAX_TRACE_SEGMENTS];
+};
+
+gboolean sh4_translate_set_code_cache( const gchar *filename )
+{
+    if( filename == NULL ) {
+        xlat_persist_close();
+        return TRUE;
+    }
+#if SIZEOF_VOID_P == 8
+    xlat_persist_set_anchor( 0, sh4_address_space, sizeof(mem_region_fn_t) << 20 );
+    xlat_persist_set_anchor( 1, sh4_user_address_space, sizeof(mem_region_fn_t) << 20 );
+    xlat_persist_set_anchor( 2, dc_main_ram, 16 MB );
+    xlat_persist_set_anchor( 3, mmu_get_fastmem_base(), ((size_t)1) << 32 );
+    return xlat_persist_open( filename );
+#else
+    /* The ia32 code generator embeds pointers in instruction displacements,
+     * which aren't recorded for relocation */
+    WARN( "Persistent translation cache is not supported on this platform" );
+    return FALSE;
+#endif
+}
+
+/**
+ * Compute the persistent cache key for the block starting at start.
+ * @return FALSE if the block can't be cached (eg breakpoints are set)
+ */
+static gboolean sh4_translate_get_persist_key( sh4addr_t start, sh4addr_t lastpc,
+                                               struct xlat_persist_key *key )
+{
+    memset( key, 0, sizeof(struct xlat_persist_key) );
+    if( sh4_breakpoint_count != 0 || !sh4_translate_get_codegen_flags( &key->codegen ) ) {
+        return FALSE;
+    }
+    key->start = start;
+    key->lastpc = lastpc;
+    key->sh4_mode = xlat_source.sh4_mode;
+    key->cpu_period = sh4_cpu_period;
+    key->options = (xlat_trace_enabled ? 1 : 0) | (xlat_optimize_enabled ? 2 : 0) |
+        (xlat_source.tlb_on ? 4 : 0) | (sh4_translate_is_source_checked(start) ? 8 : 0) |
+        (xlat_idle_skip_enabled ? 16 : 0) | (xlat_cycle_model_enabled ? 32 : 0);
+    key->icache_vma = xlat_source.icache.page_vma;
+    key->icache_mask = xlat_source.icache.mask;
+    key->page_hash = sh4_translate_hash_source( start, lastpc );
+    return TRUE;
+}
+
+gboolean sh4_translate_is_source_checked( sh4addr_t start )
+{
+    return sdram_is_code_checked( XLAT_ICACHE_PHYS(start) ) ||
+        sdram_is_code_checked( XLAT_ICACHE_PHYS((start & 0xFFFFF000) + 0x1000) );
+}
+
+/**
+ * Write-protect the source of the block that was just committed, where end is
+ * the end of its last segment (all segments start within the same page).
+ */
+static void sh4_translate_protect_source( sh4addr_t start, sh4addr_t end )
+{
+    sdram_protect_code( XLAT_ICACHE_PHYS(start), XLAT_ICACHE_PHYS(start) + (end - start) );
+}
+
+/**
+ * Commit the block in xlat_current_block, translated from the given trace
+ * segments (the first of which starts at start).
+ */
+static void sh4_translate_commit_trace( sh4addr_t start, uint32_t size,
+                                        struct xlat_trace_segment *trace, int count )
+{
+    sh4addr_t end = trace[0].end_pc;
+    int i;
+
+    for( i=1; i<count; i++ ) {
+        xlat_add_block_range( XLAT_ICACHE_PHYS(trace[i].start_pc),
+                              XLAT_ICACHE_PHYS(trace[i].end_pc) );
+        if( trace[i].end_pc > end ) {
+            end = trace[i].end_pc;
+        }
+    }
+    xlat_commit_block( size, start, trace[0].end_pc );
+    sh4_translate_protect_source( start, end );
+}
+
+static void *sh4_translate_load_block( sh4addr_t start, struct xlat_persist_key *key )
+{
+    struct xlat_persist_data data;
+    sh4addr_t end;
+    int i;
+
+    xlat_current_block = xlat_persist_load( key, sizeof(struct xlat_persist_key),
+                                            &data, sizeof(data), XLAT_ICACHE_PHYS(start) );
+    if( xlat_current_block == NULL ) {
+        return NULL;
+    }
+    end = data.end_pc;
+    for( i=0; i<data.trace_count && i<MAX_TRACE_SEGMENTS; i++ ) {
+        xlat_add_block_range( XLAT_ICACHE_PHYS(data.trace[i].start_pc),
+                              XLAT_ICACHE_PHYS(data.trace[i].end_pc) );
+        if( data.trace[i].end_pc > end ) {
+            end = data.trace[i].end_pc;
+        }
+    }
+    xlat_commit_block( data.size, start, data.end_pc );
+    sh4_translate_protect_source( start, end );
+    return xlat_current_block->code;
+}
+
+static void sh4_translate_store_block( struct xlat_persist_key *key, uint32_t size,
+                                       struct xlat_trace_segment *trace, int count )
+{
+    struct xlat_persist_data data;
+    int i;
+
+    memset( &data, 0, sizeof(data) );
+    data.size = size;
+    data.end_pc = trace[0].end_pc;
+    data.trace_count = count-1;
+    for( i=1; i<count; i++ ) {
+        data.trace[i-1].start_pc = trace[i].start_pc;
+        data.trace[i-1].end_pc = trace[i].end_pc;
+    }
+    xlat_persist_store( key, sizeof(struct xlat_persist_key), &data, sizeof(data),
+                        xlat_current_block->code, size );
+}
+
+/**
+ * Generate the code for the block starting at start into xlat_current_block,
+ * which must have just been started with xlat_start_block(). The trace
+ * segments are left in xlat_trace.
+ * @return the final size of the block, including the recovery and fixup tables.
+ */
+static uint32_t sh4_translate_emit_block( sh4addr_t start, sh4addr_t lastpc )
 {
     sh4addr_t pc = start;
-    sh4addr_t lastpc = (pc&0xFFFFF000)+0x1000;
-    int done, i;
-    xlat_current_block = xlat_start_block( GET_ICACHE_PHYS(start) );
+    int done;
+
     xlat_output = (uint8_t *)xlat_current_block->code;
     xlat_recovery_posn = 0;
     uint8_t *eob = xlat_output + xlat_current_block->size;
 
-    if( GET_ICACHE_END() < lastpc ) {
-        lastpc = GET_ICACHE_END();
-    }
+    xlat_trace_posn = 0;
+    xlat_trace[0].start_pc = start;
+    xlat_trace[0].icount = 0;
+    sh4_timing_init( &xlat_trace[0].timing, xlat_source.sh4_mode );
+    xlat_timing = xlat_trace[0].timing;
+    xlat_timing_pc = start;
+    xlat_trace_lastpc = lastpc;
+    xlat_trace_limit = lastpc;
+    xlat_ir.start_pc = xlat_ir.end_pc = start;
 
     sh4_translate_begin_block(pc);
 
@@ -111,8 +578,17 @@ void * sh4_translate_basic_block( sh4addr_t start )
             xlat_output = xlat_current_block->code + (xlat_output - oldstart);
             eob = xlat_current_block->code + xlat_current_block->size;
         }
-        done = sh4_translate_instruction( pc ); 
+        if( xlat_optimize_enabled && xir_get_op( &xlat_ir, pc ) == NULL ) {
+            sh4_translate_build_ir( pc, lastpc );
+        }
+        done = sh4_translate_instruction( pc );
         assert( xlat_output <= eob );
+        if( done == TRANSLATE_FOLLOW_BRANCH ) {
+            pc = sh4_translate_next_segment();
+            lastpc = xlat_trace_limit;
+            done = 0;
+            continue;
+        }
         pc += 2;
         if ( pc >= lastpc && done == 0 ) {
             done = 2;
@@ -122,9 +598,10 @@ void * sh4_translate_basic_block( sh4addr_t start )
 #endif
     } while( !done );
     pc += (done - 2);
+    xlat_trace[xlat_trace_posn].end_pc = pc;
 
     // Add end-of-block recovery for post-instruction checks
-    sh4_translate_add_recovery( (pc - start)>>1 ); 
+    sh4_translate_add_recovery( pc );
 
     int epilogue_size = sh4_translate_end_block_size();
     uint32_t recovery_size = sizeof(struct xlat_recovery_record)*xlat_recovery_posn;
@@ -133,19 +610,383 @@ void * sh4_translate_basic_block( sh4addr_t start )
         uint8_t *oldstart = xlat_current_block->code;
         xlat_current_block = xlat_extend_block( finalsize );
         xlat_output = xlat_current_block->code + (xlat_output - oldstart);
-    }	
+    }
     sh4_translate_end_block(pc);
     assert( xlat_output <= (xlat_current_block->code + xlat_current_block->size - recovery_size) );
 
-    /* Write the recovery records onto the end of the code block */
+    /* Write the recovery records onto the end of the code block, followed by
+     * the fixup records */
+    uint32_t recovery_offset = xlat_output - (uint8_t *)xlat_current_block->code;
+    uint32_t fixup_offset = recovery_offset + recovery_size;
+    uint32_t fixup_size = xlat_get_fixup_table_size();
+    if( finalsize < fixup_offset + fixup_size ) {
+        finalsize = fixup_offset + fixup_size;
+        if( xlat_current_block->size < finalsize ) {
+            xlat_current_block = xlat_extend_block( finalsize );
+            xlat_output = xlat_current_block->code + recovery_offset;
+        }
+    }
     memcpy( xlat_output, xlat_recovery, recovery_size);
-    xlat_current_block->recover_table_offset = xlat_output - (uint8_t *)xlat_current_block->code;
+    xlat_current_block->recover_table_offset = recovery_offset;
     xlat_current_block->recover_table_size = xlat_recovery_posn;
-    xlat_current_block->xlat_sh4_mode = sh4r.xlat_sh4_mode;
-    xlat_commit_block( finalsize, start, pc );
+    xlat_write_fixup_table( fixup_offset );
+    xlat_current_block->xlat_sh4_mode = xlat_source.sh4_mode;
+    return finalsize;
+}
+
+/**
+ * Translate the block starting at start from the source in xlat_source into
+ * the cache, or load it from the persistent cache if it's there.
+ */
+static void *sh4_translate_source_block( sh4addr_t start )
+{
+    sh4addr_t lastpc = sh4_translate_get_lastpc( start );
+    struct xlat_persist_key key;
+    gboolean persist = FALSE;
+    uint32_t size;
+
+    if( xlat_persist_is_open() && sh4_translate_get_persist_key( start, lastpc, &key ) ) {
+        void *code = sh4_translate_load_block( start, &key );
+        if( code != NULL ) {
+            return code;
+        }
+        persist = TRUE;
+    }
+
+    xlat_current_block = xlat_start_block( XLAT_ICACHE_PHYS(start) );
+    size = sh4_translate_emit_block( start, lastpc );
+    sh4_translate_commit_trace( start, size, xlat_trace, xlat_trace_posn+1 );
+    if( persist ) {
+        sh4_translate_store_block( &key, size, xlat_trace, xlat_trace_posn+1 );
+    }
     return xlat_current_block->code;
 }
 
+/**
+ * Translate a linear basic block, ie all instructions from the start address
+ * (inclusive) until the next branch/jump instruction or the end of the page
+ * is reached. If superblocks are enabled, the block may also continue through
+ * branches with a static target within the same page (see
+ * sh4_translate_follow_branch()).
+ * @param start VMA of the block start (which must already be in the icache)
+ * @return the address of the translated block
+ * eg due to lack of buffer space.
+ */
+void * sh4_translate_basic_block( sh4addr_t start )
+{
+    void *code;
+
+    pthread_mutex_lock( &xlat_async.translate_lock );
+    sh4_translate_get_source( &xlat_source );
+    code = sh4_translate_source_block( start );
+    pthread_mutex_unlock( &xlat_async.translate_lock );
+    return code;
+}
+
+void sh4_translate_lock( void )
+{
+    pthread_mutex_lock( &xlat_async.translate_lock );
+}
+
+void sh4_translate_unlock( void )
+{
+    pthread_mutex_unlock( &xlat_async.translate_lock );
+}
+
+/**
+ * A block queued for (or completed by) the background thread. Everything the
+ * translation depends on is captured when it's queued, and checked again
+ * before the result is installed.
+ */
+struct xlat_async_job {
+    int state;
+    uint32_t seq;
+    sh4addr_t start;
+    sh4addr_t start_phys;
+    struct xlat_source_state source;
+    uint32_t flush_count;      /* xlat_get_flush_count() when queued */
+
+    /* Results, valid in the DONE state */
+    uint64_t source_hash;      /* Hash of the source code after the block was translated */
+    gboolean source_checked;   /* sh4_translate_is_source_checked() when translated */
+    gboolean persist;
+    struct xlat_persist_key key;
+    uint32_t *host_pointers;   /* Host pointers in the block, if it's to be persisted */
+    int host_pointer_count;
+    xlat_cache_block_t block;  /* Staged block, or NULL if not translated (or discarded) */
+    uint32_t size;
+    int trace_count;
+    struct xlat_trace_segment trace[MAX_TRACE_SEGMENTS];
+};
+
+static struct xlat_async_job xlat_async_jobs[XLAT_ASYNC_JOBS];
+
+static void sh4_translate_free_job( struct xlat_async_job *job )
+{
+    xlat_free_staged_block( job->block );
+    g_free( job->host_pointers );
+    job->block = NULL;
+    job->host_pointers = NULL;
+    job->host_pointer_count = 0;
+    job->state = XLAT_JOB_FREE;
+}
+
+/**
+ * Translate the job's block into a staging block (run on the background
+ * thread with translate_lock held). The CPU thread may write to the source
+ * while it's being read, so the block is discarded unless the source hashes
+ * the same before and after - otherwise the code could have been generated
+ * from a mix of old and new instructions, and still match the source by the
+ * time it's installed.
+ */
+static void sh4_translate_run_job( struct xlat_async_job *job )
+{
+    sh4addr_t lastpc;
+    uint64_t hash;
+
+    xlat_source = job->source;
+    lastpc = sh4_translate_get_lastpc( job->start );
+    hash = sh4_translate_hash_source( job->start, lastpc );
+    job->persist = xlat_persist_is_open() &&
+        sh4_translate_get_persist_key( job->start, lastpc, &job->key );
+
+    xlat_set_staging( TRUE );
+    xlat_current_block = xlat_start_block( job->start_phys );
+    job->size = sh4_translate_emit_block( job->start, lastpc );
+    xlat_set_staging( FALSE );
+    job->block = xlat_current_block;
+    job->source_hash = sh4_translate_hash_source( job->start, lastpc );
+    if( job->source_hash != hash ) {
+        xlat_free_staged_block( job->block );
+        job->block = NULL;
+        job->persist = FALSE;
+        return;
+    }
+    job->source_checked = sh4_translate_is_source_checked( job->start );
+    job->trace_count = xlat_trace_posn+1;
+    memcpy( job->trace, xlat_trace, job->trace_count * sizeof(struct xlat_trace_segment) );
+    if( job->persist ) {
+        uint32_t *offsets;
+        job->host_pointer_count = xlat_get_host_pointers( &offsets );
+        if( job->host_pointer_count > 0 ) {
+            job->host_pointers = g_malloc( job->host_pointer_count * sizeof(uint32_t) );
+            memcpy( job->host_pointers, offsets, job->host_pointer_count * sizeof(uint32_t) );
+        }
+    }
+}
+
+static void *sh4_translate_async_thread( void *arg )
+{
+    pthread_mutex_lock( &xlat_async.lock );
+    for(;;) {
+        struct xlat_async_job *job = NULL;
+        int i;
+
+        if( xlat_async.stop ) {
+            break;
+        }
+        if( !xlat_async.install_wanted ) {
+            for( i=0; i<XLAT_ASYNC_JOBS; i++ ) {
+                if( xlat_async_jobs[i].state == XLAT_JOB_QUEUED &&
+                    (job == NULL || (int32_t)(xlat_async_jobs[i].seq - job->seq) < 0) ) {
+                    job = &xlat_async_jobs[i];
+                }
+            }
+        }
+        if( job == NULL ) {
+            pthread_cond_wait( &xlat_async.work, &xlat_async.lock );
+            continue;
+        }
+        job->state = XLAT_JOB_RUNNING;
+        pthread_mutex_unlock( &xlat_async.lock );
+
+        pthread_mutex_lock( &xlat_async.translate_lock );
+        sh4_translate_run_job( job );
+        pthread_mutex_unlock( &xlat_async.translate_lock );
+
+        pthread_mutex_lock( &xlat_async.lock );
+        job->state = XLAT_JOB_DONE;
+        xlat_async.done_count++;
+    }
+    pthread_mutex_unlock( &xlat_async.lock );
+    return NULL;
+}
+
+/**
+ * Test if there's already a block in the cache for the given start address
+ * and mode (eg translated synchronously since the job was queued)
+ */
+static gboolean sh4_translate_has_block( sh4addr_t start_phys, uint32_t sh4_mode )
+{
+    void *code = xlat_get_code( start_phys );
+    while( code != NULL && XLAT_BLOCK_MODE(code) != sh4_mode ) {
+        code = XLAT_BLOCK_CHAIN(code);
+    }
+    return code != NULL;
+}
+
+/**
+ * Install the job's block in the cache, provided that nothing it depends on
+ * has changed since it was translated. Called with translate_lock held.
+ */
+static void sh4_translate_install_job( struct xlat_async_job *job )
+{
+    sh4addr_t lastpc;
+
+    xlat_source = job->source;
+    lastpc = sh4_translate_get_lastpc( job->start );
+    if( job->block == NULL ||
+        job->flush_count != xlat_get_flush_count() || sh4_breakpoint_count != 0 ||
+        sh4_translate_has_block( job->start_phys, job->source.sh4_mode ) ||
+        job->source_checked != sh4_translate_is_source_checked( job->start ) ||
+        job->source_hash != sh4_translate_hash_source( job->start, lastpc ) ) {
+        return;
+    }
+    xlat_current_block = xlat_install_block( job->block, job->start_phys, job->size );
+    if( xlat_current_block == NULL ) {
+        /* Not relocatable - just translate it again */
+        sh4_translate_source_block( job->start );
+        return;
+    }
+    sh4_translate_commit_trace( job->start, job->size, job->trace, job->trace_count );
+    if( job->persist ) {
+        xlat_set_host_pointers( job->host_pointers, job->host_pointer_count );
+        sh4_translate_store_block( &job->key, job->size, job->trace, job->trace_count );
+    }
+}
+
+/**
+ * Install all completed jobs. If the background thread is in the middle of a
+ * translation, this just asks it to stop after the current job, and the
+ * install happens on a later call.
+ */
+static void sh4_translate_install_jobs( void )
+{
+    int i;
+
+    if( pthread_mutex_trylock( &xlat_async.translate_lock ) != 0 ) {
+        pthread_mutex_lock( &xlat_async.lock );
+        xlat_async.install_wanted = TRUE;
+        pthread_mutex_unlock( &xlat_async.lock );
+        return;
+    }
+    pthread_mutex_lock( &xlat_async.lock );
+    for( i=0; i<XLAT_ASYNC_JOBS; i++ ) {
+        struct xlat_async_job *job = &xlat_async_jobs[i];
+        if( job->state == XLAT_JOB_DONE ) {
+            sh4_translate_install_job( job );
+            sh4_translate_free_job( job );
+            xlat_async.done_count--;
+        }
+    }
+    xlat_async.install_wanted = FALSE;
+    pthread_cond_signal( &xlat_async.work );
+    pthread_mutex_unlock( &xlat_async.lock );
+    pthread_mutex_unlock( &xlat_async.translate_lock );
+}
+
+/**
+ * Queue the block starting at start (in the icache) for translation by the
+ * background thread, unless it's already queued or the queue is full. If the
+ * block is in the persistent cache, it's loaded immediately instead.
+ * @return the loaded block, or NULL if the caller should interpret the code
+ * in the meantime.
+ */
+static void *sh4_translate_queue_block( sh4addr_t start )
+{
+    struct xlat_async_job *job = NULL;
+    sh4addr_t start_phys = GET_ICACHE_PHYS(start);
+    int i;
+
+    if( xlat_persist_is_open() && pthread_mutex_trylock( &xlat_async.translate_lock ) == 0 ) {
+        struct xlat_persist_key key;
+        void *code = NULL;
+        sh4_translate_get_source( &xlat_source );
+        if( sh4_translate_get_persist_key( start, sh4_translate_get_lastpc(start), &key ) ) {
+            code = sh4_translate_load_block( start, &key );
+        }
+        pthread_mutex_unlock( &xlat_async.translate_lock );
+        if( code != NULL ) {
+            return code;
+        }
+    }
+
+    pthread_mutex_lock( &xlat_async.lock );
+    for( i=0; i<XLAT_ASYNC_JOBS; i++ ) {
+        struct xlat_async_job *p = &xlat_async_jobs[i];
+        if( p->state == XLAT_JOB_FREE ) {
+            if( job == NULL ) {
+                job = p;
+            }
+        } else if( p->start_phys == start_phys && p->source.sh4_mode == sh4r.xlat_sh4_mode ) {
+            job = NULL; /* Already queued */
+            break;
+        }
+    }
+    if( job != NULL ) {
+        job->state = XLAT_JOB_QUEUED;
+        job->seq = xlat_async.next_seq++;
+        job->start = start;
+        job->start_phys = start_phys;
+        sh4_translate_get_source( &job->source );
+        job->flush_count = xlat_get_flush_count();
+        pthread_cond_signal( &xlat_async.work );
+    }
+    pthread_mutex_unlock( &xlat_async.lock );
+    return NULL;
+}
+
+/**
+ * Interpret the code from sh4r.pc up to the next branch (including its delay
+ * slot), exception, or page boundary, ie roughly what the block would have
+ * covered, while it's translated in the background. As with translated code,
+ * pending events are only checked afterwards.
+ */
+static void sh4_translate_interpret_block( void )
+{
+    sh4addr_t pc;
+
+    sh4r.new_pc = sh4r.pc + 2;
+    do {
+        pc = sh4r.pc;
+        sh4r.slice_cycle += sh4_cpu_period;
+        if( !sh4_execute_instruction() ) {
+            /* SLEEP - finish it off the same way as the translated version */
+            sh4_sleep();
+        }
+    } while( sh4r.in_delay_slot || (sh4r.pc == pc + 2 && (sh4r.pc & 0xFFF) != 0) );
+}
+
+void sh4_translate_set_async( gboolean flag )
+{
+    int i;
+
+    if( flag == xlat_async.enabled ) {
+        return;
+    }
+    if( flag ) {
+        xlat_async.stop = FALSE;
+        if( pthread_create( &xlat_async.thread, NULL, sh4_translate_async_thread, NULL ) != 0 ) {
+            WARN( "Unable to start background translation thread" );
+            return;
+        }
+    } else {
+        pthread_mutex_lock( &xlat_async.lock );
+        xlat_async.stop = TRUE;
+        pthread_cond_signal( &xlat_async.work );
+        pthread_mutex_unlock( &xlat_async.lock );
+        pthread_join( xlat_async.thread, NULL );
+
+        for( i=0; i<XLAT_ASYNC_JOBS; i++ ) {
+            sh4_translate_free_job( &xlat_async_jobs[i] );
+        }
+        xlat_async.done_count = 0;
+        xlat_async.install_wanted = FALSE;
+    }
+    xlat_async.enabled = flag;
+    sh4_translate_set_direct_link( !flag );
+}
+
 /**
  * "Execute" the supplied recovery record. Currently this only updates
  * sh4r.pc and sh4r.slice_cycle according to the currently executing
@@ -154,8 +995,8 @@ void * sh4_translate_basic_block( sh4addr_t start )
  */
 void sh4_translate_run_recovery( xlat_recovery_record_t recovery )
 {
-    sh4r.slice_cycle += (recovery->sh4_icount * sh4_cpu_period);
-    sh4r.pc += (recovery->sh4_icount<<1);
+    sh4r.slice_cycle += (recovery->sh4_cycles * sh4_cpu_period);
+    sh4r.pc += recovery->sh4_pc_offset;
 }
 
 /**
@@ -164,8 +1005,8 @@ void sh4_translate_run_recovery( xlat_recovery_record_t recovery )
  */
 void sh4_translate_run_exception_recovery( xlat_recovery_record_t recovery )
 {
-    sh4r.slice_cycle += (recovery->sh4_icount * sh4_cpu_period);
-    sh4r.spc += (recovery->sh4_icount<<1);
+    sh4r.slice_cycle += (recovery->sh4_cycles * sh4_cpu_period);
+    sh4r.spc += recovery->sh4_pc_offset;
 }    
 
 void sh4_translate_exit_recover( )
@@ -300,6 +1141,10 @@ static struct xlat_symbol xlat_symbol_table[] = {
     { "sh4_cpu_period", &sh4_cpu_period },
     { "sh4_address_space", NULL },
     { "sh4_user_address_space", NULL },
+    { "xlat_lut", NULL },
+    { "dc_main_ram", NULL },
+    { "sh4_fastmem", NULL },
+    { "mem_region_sdram", &mem_region_sdram },
     { "sh4_translate_breakpoint_hit", sh4_translate_breakpoint_hit },
     { "sh4_translate_link_block", sh4_translate_link_block },
     { "sh4_write_fpscr", sh4_write_fpscr },
@@ -316,6 +1161,22 @@ static struct xlat_symbol xlat_symbol_table[] = {
     { "xlat_get_code", xlat_get_code }
 };
 
+/**
+ * Print out count source instructions starting from source_pc, indented to
+ * line up with the source column of sh4_translate_disasm_block.
+ */
+static void sh4_translate_disasm_source( FILE *out, uint32_t source_pc, uint32_t count )
+{
+    char buf[256];
+    char op[256];
+
+    while( count-- > 0 ) {
+        uint32_t source_pc2 = sh4_disasm_instruction( source_pc, buf, sizeof(buf), op );
+        fprintf( out, "%*c %08X: %s  %s\n", 72,' ', source_pc, op, buf );
+        source_pc = source_pc2;
+    }
+}
+
 /**
  * Disassemble the given translated code block, and it's source code block
  * side-by-side. The current native pc will be marked if non-null.
@@ -327,16 +1188,33 @@ void sh4_translate_disasm_block( FILE *out, void *code, sh4addr_t source_start,
 
     xlat_symbol_table[2].ptr = sh4_address_space;
     xlat_symbol_table[3].ptr = sh4_user_address_space;
+    xlat_symbol_table[4].ptr = xlat_get_lut_base();
+    xlat_symbol_table[5].ptr = dc_main_ram;
+    xlat_symbol_table[6].ptr = mmu_get_fastmem_base();
     xlat_disasm_init( xlat_symbol_table, sizeof(xlat_symbol_table)/sizeof(struct xlat_symbol) );
 
     uintptr_t target_start = (uintptr_t)code, target_pc;
     uintptr_t target_end = target_start + xlat_get_code_size(code);
     uint32_t source_pc = source_start;
-    uint32_t source_end = source_pc;
+    uint32_t source_count = 0;
     xlat_recovery_record_t source_recov_table = XLAT_RECOVERY_TABLE(code);
     xlat_recovery_record_t source_recov_end = source_recov_table + XLAT_BLOCK_FOR_CODE(code)->recover_table_size - 1;
 
     for( target_pc = target_start; target_pc < target_end;  ) {
+        if( source_recov_table < source_recov_end &&
+            target_pc >= (target_start + source_recov_table->xlat_offset) ) {
+            /* Queue the source instructions up to the next record. Superblocks
+             * may jump around, in which case flush anything still pending first */
+            uint32_t rec_pc = source_start + source_recov_table->sh4_pc_offset;
+            if( rec_pc != source_pc + (source_count<<1) ) {
+                sh4_translate_disasm_source( out, source_pc, source_count );
+                source_pc = rec_pc;
+                source_count = 0;
+            }
+            source_count += source_recov_table[1].sh4_icount - source_recov_table->sh4_icount;
+            source_recov_table++;
+        }
+
         uintptr_t pc2 = xlat_disasm_instruction( target_pc, buf, sizeof(buf), op );
 #if SIZEOF_VOID_P == 8
         fprintf( out, "%c%016lx: %-30s %-40s", (target_pc == (uintptr_t)native_pc ? '*' : ' '),
@@ -345,17 +1223,12 @@ void sh4_translate_disasm_block( FILE *out, void *code, sh4addr_t source_start,
         fprintf( out, "%c%08lx: %-30s %-40s", (target_pc == (uintptr_t)native_pc ? '*' : ' '),
                       target_pc, op, buf );
 #endif
-        if( source_recov_table < source_recov_end &&
-            target_pc >= (target_start + source_recov_table->xlat_offset) ) {
-            source_recov_table++;
-            if( source_end < (source_start + (source_recov_table->sh4_icount)*2) )
-                source_end = source_start + (source_recov_table->sh4_icount)*2;
-        }
 
-        if( source_pc < source_end ) {
+        if( source_count > 0 ) {
             uint32_t source_pc2 = sh4_disasm_instruction( source_pc, buf, sizeof(buf), op );
             fprintf( out, " %08X: %s  %s\n", source_pc, op, buf );
             source_pc = source_pc2;
+            source_count--;
         } else {
             fprintf( out, "\n" );
         }
@@ -363,17 +1236,21 @@ void sh4_translate_disasm_block( FILE *out, void *code, sh4addr_t source_start,
         target_pc = pc2;
     }
 
-    while( source_pc < source_end ) {
-        uint32_t source_pc2 = sh4_disasm_instruction( source_pc, buf, sizeof(buf), op );
-        fprintf( out, "%*c %08X: %s  %s\n", 72,' ', source_pc, op, buf );
-        source_pc = source_pc2;
-    }
+    sh4_translate_disasm_source( out, source_pc, source_count );
 }
 
 
 void sh4_translate_dump_cache_by_activity( unsigned int topN )
 {
     struct xlat_block_ref blocks[topN];
+    struct xlat_cache_stats stats;
+    xlat_get_cache_stats(&stats);
+    fprintf( stderr, "Translation cache: new %d blocks (%d bytes), temp %d blocks (%d bytes), old %d blocks (%d bytes)\n",
+             stats.new_blocks, stats.new_bytes, stats.temp_blocks, stats.temp_bytes,
+             stats.old_blocks, stats.old_bytes );
+    fprintf( stderr, "  %d promoted to temp, %d promoted to old, %d evicted, %d invalidated, %d flushes\n\n",
+             stats.temp_promotions, stats.old_promotions, stats.evictions, 
+             stats.invalidations, stats.flushes );
     topN = xlat_get_cache_blocks_by_activity(blocks, topN);
     unsigned int i;
     for( i=0; i<topN; i++ ) {
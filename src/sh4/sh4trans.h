@@ -20,17 +20,20 @@
 #define lxdream_sh4trans_H 1
 
 #include "xlat/xltcache.h"
+#include "xlat/xir.h"
 #include "dream.h"
 #include "mem.h"
+#include "sh4/sh4core.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 /** Maximum size of a translated instruction, in bytes. Current worst case seems
- * to be a BF/S followed by one of the long FMOVs.
+ * to be a BF/S followed by a MAC.L or one of the long FMOVs (ie four inline
+ * memory accesses, each of which has both the RAM and the vtable path)
  */
-#define MAX_INSTRUCTION_SIZE 512
+#define MAX_INSTRUCTION_SIZE 768
 /** Maximum size of the translation epilogue (current real size is 116 bytes, so
  * allows a little room
  */
@@ -41,8 +44,56 @@ extern "C" {
  */
 #define MAX_RECOVERY_SIZE 2049
 
-typedef void (*xlat_block_begin_callback_t)();
-typedef void (*xlat_block_end_callback_t)();
+/** Maximum number of linear segments in a single superblock
+ */
+#define MAX_TRACE_SEGMENTS 16
+
+/** Return code from sh4_translate_instruction() indicating that translation
+ * should continue at the branch target accepted by the last call to
+ * sh4_translate_follow_branch()
+ */
+#define TRANSLATE_FOLLOW_BRANCH 1
+
+/**
+ * Reasons for leaving a translated block, as passed to the end callback
+ * (see sh4_translate_set_callbacks)
+ */
+#define XLAT_EXIT_CHAIN 0          /* Continued directly into the next block */
+#define XLAT_EXIT_RETURN 1         /* Returned to the main loop (event pending or no code for the next block) */
+#define XLAT_EXIT_EXCEPTION 2      /* Raised an SH4 exception */
+#define XLAT_EXIT_EMULATE 3        /* Returned after emulating an untranslatable instruction */
+#define XLAT_EXIT_SOURCE_CHANGED 4 /* Discarded because its source code was modified */
+#define XLAT_EXIT_REASONS 5
+
+/**
+ * Instrumentation callbacks. The begin callback is called on entry to each
+ * block with the block's code, and the end callback on exit with one of the
+ * XLAT_EXIT_* reasons. Note that if the block is left abnormally (eg by
+ * sh4_core_exit()), the end callback isn't called.
+ */
+typedef void FASTCALL (*xlat_block_begin_callback_t)( void *code );
+typedef void FASTCALL (*xlat_block_end_callback_t)( uint32_t exit_reason );
+
+/**
+ * The CPU state that a translation depends on. The translator reads the
+ * source code and mode from xlat_source rather than from sh4_icache and sh4r,
+ * so that a block can be translated on the background thread (see
+ * sh4_translate_set_async) while the CPU carries on running. It's only valid
+ * while a block is being translated.
+ */
+struct xlat_source_state {
+    struct sh4_icache_struct icache;
+    uint32_t sh4_mode;   /* sh4r.xlat_sh4_mode */
+    gboolean tlb_on;     /* IS_TLB_ENABLED() */
+};
+
+extern struct xlat_source_state xlat_source;
+
+/* Equivalents of IS_IN_ICACHE etc for the source of the current translation */
+#define XLAT_IS_IN_ICACHE(addr) (xlat_source.icache.page_vma == ((addr) & xlat_source.icache.mask))
+#define XLAT_ICACHE_PTR(addr) (xlat_source.icache.page + ((addr)-xlat_source.icache.page_vma))
+#define XLAT_ICACHE_PHYS(addr) (xlat_source.icache.page_ppa + ((addr)-xlat_source.icache.page_vma))
+#define XLAT_ICACHE_END() (xlat_source.icache.page_vma + (~xlat_source.icache.mask) + 1)
 
 /**
  */
@@ -61,22 +112,183 @@ void sh4_translate_init( void);
 void *sh4_translate_basic_block( sh4addr_t start );
 
 /**
- * Add a recovery record for the current code generation position, with the
- * specified instruction count
+ * Add a recovery record for the current code generation position, for the
+ * instruction at the specified pc.
+ */
+void sh4_translate_add_recovery( sh4addr_t pc );
+
+/**
+ * Enable/disable superblock translation, ie continuing the translation
+ * through unconditional branches to targets in the same page, and through
+ * the fall-through side of conditional branches. Default is disabled.
+ */
+void sh4_translate_set_superblocks( gboolean flag );
+
+/**
+ * Enable/disable the IR optimization passes (see xlat/xir.h). When enabled,
+ * each linear run of instructions is decoded to IR and optimized before
+ * translation, and the code generator uses the results to drop dead flag
+ * stores and dead instructions, fold constants, and avoid redundant FPU
+ * checks. Default is disabled.
+ */
+void sh4_translate_set_optimize( gboolean flag );
+
+/**
+ * Enable/disable idle loop detection. When enabled, a block which loops back
+ * to its own start and only waits for memory to change (eg polling a status
+ * register, see xir_is_idle_loop()) skips ahead to the next pending event
+ * instead of spinning until it arrives, as SLEEP does. Default is disabled.
+ */
+void sh4_translate_set_idle_skip( gboolean flag );
+
+/**
+ * Enable/disable the static cycle model. When enabled, translated code
+ * charges each run of instructions with the number of CPU cycles estimated by
+ * the pipeline model in sh4timing.in (including dual issue and interlocks),
+ * rather than one cycle per instruction. Either way, each cycle is charged at
+ * sh4_cpu_period. Not compatible with shadow mode, which relies on the
+ * per-instruction count. Default is disabled.
+ */
+void sh4_translate_set_cycle_model( gboolean flag );
+
+/**
+ * Test if the code from the start of the block currently being translated up
+ * to endpc (exclusive) is an idle loop, for a branch at the end of it back to
+ * the start of the block. Always FALSE if idle loop detection is disabled.
+ */
+gboolean sh4_translate_is_idle_loop( sh4addr_t endpc );
+
+/**
+ * Use the given file as a persistent cache of translated blocks, so that
+ * code translated in one session can be reloaded rather than retranslated 
+ * in the next (see xlat/xltpersist.h). NULL closes the current file.
+ * @return TRUE on success, FALSE if the file couldn't be opened or the
+ * cache isn't supported on this platform.
+ */
+gboolean sh4_translate_set_code_cache( const gchar *filename );
+
+/**
+ * Enable/disable background translation. When enabled, blocks are translated
+ * on a separate thread, and the code is interpreted until the translation is
+ * ready rather than stopping the CPU to translate it. Finished blocks are
+ * checked against the current source code and installed in the cache from
+ * sh4_translate_run_slice(), so all cache updates still happen on the CPU
+ * thread. Direct block linking is disabled while this is on, as it needs the
+ * target translated immediately. Default is disabled.
+ */
+void sh4_translate_set_async( gboolean flag );
+
+/**
+ * Take/release the translation lock, for other translators sharing the xlat
+ * cache (ie the ARM translator), so that they don't create blocks while the
+ * background thread is staging one.
+ */
+void sh4_translate_lock( void );
+void sh4_translate_unlock( void );
+
+/**
+ * Return the optimized IR for the instruction at pc, or NULL if the
+ * optimizer is disabled or has no information about the instruction.
  */
-void sh4_translate_add_recovery( uint32_t icount );
+xir_op_t sh4_translate_get_ir( sh4addr_t pc );
+
+/**
+ * Decode the SH4 instruction ir into the IR op (generated from sh4xir.in).
+ * The op should be cleared apart from the pc before calling.
+ */
+void sh4_decode_xir( uint16_t ir, xir_op_t op );
+
+/** Number of resources tracked by the timing model (registers, FPUL, etc) */
+#define SH4_TIMING_RESOURCES 39
+
+/**
+ * State of the static pipeline timing model through a run of instructions,
+ * ie everything needed to work out when the next instruction can issue.
+ * Cycles are counted from the start of the run.
+ */
+struct sh4_timing_state {
+    uint32_t cycle;       /* First cycle after the issue of the last instruction */
+    uint32_t last_issue;  /* Cycle the last instruction issued in */
+    int last_group;       /* Issue group of the last instruction, if it can pair */
+    uint32_t penalty;     /* Branch penalty to charge after the next instruction */
+    gboolean double_prec; /* FPSCR.PR */
+    gboolean double_size; /* FPSCR.SZ */
+    uint32_t ready[SH4_TIMING_RESOURCES]; /* Cycle each resource is ready in */
+};
+
+/**
+ * Start a new run of instructions for the timing model in the given
+ * execution mode (as per sh4r.xlat_sh4_mode).
+ */
+void sh4_timing_init( struct sh4_timing_state *state, uint32_t sh4_mode );
+
+/**
+ * Add the instruction ir to the run (generated from sh4timing.in).
+ */
+void sh4_timing_issue( struct sh4_timing_state *state, uint16_t ir );
+
+/**
+ * Return the number of instructions executed from the start of the block
+ * currently being translated up to (but not including) the instruction at pc.
+ * pc must be within the current segment (ie the linear run of instructions
+ * currently being translated).
+ */
+uint32_t sh4_translate_get_icount( sh4addr_t pc );
+
+/**
+ * Return the number of cycles to charge for the code from the start of the
+ * block currently being translated up to (but not including) the instruction
+ * at pc. This is the instruction count unless the cycle model is enabled
+ * (see sh4_translate_set_cycle_model). pc must be within the current segment.
+ */
+uint32_t sh4_translate_get_cycles( sh4addr_t pc );
+
+/**
+ * Called by the code generator on reaching a branch with a static target,
+ * to determine whether the translation should continue at the target rather
+ * than ending the block. If this returns TRUE, the code generator should
+ * translate the branch's delay slot (if any) but no exit code, and return
+ * TRANSLATE_FOLLOW_BRANCH from sh4_translate_instruction().
+ * @param target Address to continue translating from
+ * @param nextpc Address following the branch (and its delay slot, if any).
+ *   target == nextpc is used for the fall-through side of conditional branches.
+ */
+gboolean sh4_translate_follow_branch( sh4addr_t target, sh4addr_t nextpc );
 
 /**
  * Enter the VM at the given translated entry point
  */
-void FASTCALL (*sh4_translate_enter)(void *code);
+extern void FASTCALL (*sh4_translate_enter)(void *code);
 
 /**
  * Initialize shadow execution mode
+ * @param parallel if TRUE, check the translator from a separate process
+ * rather than inline (falling back to inline if this isn't possible)
+ */
+void sh4_shadow_init( gboolean parallel );
+
+/**
+ * Initialize block profiling mode, which uses the instrumentation callbacks to
+ * record the entry count, host cycles and exit reasons of each block. Not
+ * compatible with shadow mode.
+ */
+void sh4_profile_init( void );
+
+/**
+ * Discard all accumulated block profile data
+ */
+void sh4_profile_reset( void );
+
+/**
+ * Write the block profile report to the given stream. The report has one line
+ * per SH4 block range, ordered by total host cycles, in whitespace-separated
+ * columns to allow re-sorting with sort(1).
+ * @param topN maximum number of blocks to report, or 0 for all blocks.
  */
-void sh4_shadow_init( void );
+void sh4_profile_write_report( FILE *out, unsigned int topN );
 
-extern uint8_t *xlat_output;
+/* Per-thread, as the TLB code (mmux86.c) also generates code on the CPU thread */
+extern __thread uint8_t *xlat_output;
 extern struct xlat_recovery_record xlat_recovery[MAX_RECOVERY_SIZE];
 extern xlat_cache_block_t xlat_current_block;
 extern uint32_t xlat_recovery_posn;
@@ -93,6 +305,21 @@ uint32_t sh4_translate_instruction( sh4addr_t pc );
 void sh4_translate_end_block( sh4addr_t pc );
 uint32_t sh4_translate_end_block_size();
 void sh4_translate_emit_breakpoint( sh4vma_t pc );
+
+/**
+ * Retrieve the code generator settings that affect the generated code, for
+ * the persistent code cache key.
+ * @return FALSE if the generated code can't be persisted (eg instrumentation
+ * is enabled)
+ */
+gboolean sh4_translate_get_codegen_flags( uint32_t *flags );
+
+/**
+ * Test if the block starting at the given address (in the icache) must check
+ * its source code on entry, rather than relying on write-protection of the
+ * page to detect changes (see sdram_enable_code_protection).
+ */
+gboolean sh4_translate_is_source_checked( sh4addr_t start );
 void sh4_translate_crashdump();
 
 typedef void (*unwind_thunk_t)(void);
@@ -107,6 +334,14 @@ void sh4_translate_set_callbacks( xlat_block_begin_callback_t begin, xlat_block_
  */
 void sh4_translate_set_fastmem( gboolean flag );
 
+/**
+ * Enable/disable direct linking of blocks with a static successor, ie
+ * replacing the exit with a branch to the successor's code the first time it
+ * runs, which translates the successor if needed. When disabled, the exit
+ * looks up the successor each time instead. Default is enabled.
+ */
+void sh4_translate_set_direct_link( gboolean flag );
+
 /**
  * Set the address spaces for the translated code.
  */
@@ -167,7 +402,8 @@ void FASTCALL sh4_translate_breakpoint_hit( sh4vma_t pc );
 void sh4_translate_disasm_block( FILE *out, void *code, sh4addr_t source_start, void *native_pc );
 
 /**
- * Dump the top N blocks in the SH4 translation cache
+ * Dump the translation cache statistics and the top N blocks in the SH4
+ * translation cache
  */
 void sh4_translate_dump_cache_by_activity( unsigned int topN );
 
@@ -4,6 +4,23 @@
  * SH4 shadow execution core - runs xlat + emu together and checks that the
  * results are the same.
  *
+ * In the default (inline) mode, each translated block is re-run through the
+ * interpreter as soon as it exits. In parallel mode, the translated code just
+ * logs the registers at the start and end of each block, together with its
+ * memory operations, into a ring buffer shared with a child process, which
+ * replays the blocks through the interpreter and compares the results while
+ * the CPU carries on. The child is forked from the emulator, so it has its
+ * own copy of the interpreter state, but shares main RAM (which it only reads
+ * code from). Blocks are dropped rather than waiting for the checker when
+ * the ring is full, so not every block is checked.
+ *
+ * As the checker is forked rather than exec'd, it must be started before the
+ * emulator starts any other threads (ie before the GUI, audio driver, or any
+ * of the translator and renderer threads) - otherwise the child could inherit
+ * a lock, such as stdio's or malloc's, that was held by one of those threads
+ * at the time of the fork, and never released. main() ensures this by
+ * selecting the SH4 core immediately after dreamcast_init().
+ *
  * Copyright (c) 2010 Nathan Keynes.
  *
  * This program is free software; you can redistribute it and/or modify
@@ -18,16 +35,26 @@
  */
 
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
+#include <stddef.h>
+#include <errno.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 
 #include "clock.h"
 #include "mem.h"
 #include "mmio.h"
+#include "dreamcast.h"
 #include "sh4/sh4.h"
 #include "sh4/sh4core.h"
+#include "sh4/sh4mmio.h"
 #include "sh4/sh4trans.h"
 #include "sh4/mmu.h"
+#include "xlat/xltcache.h"
 
 typedef enum {
     READ_LONG,
@@ -62,12 +89,120 @@ static shadow_mode_t shadow_address_mode = SHADOW_LOG;
 #define MEM_LOG_SIZE 4096
 static struct mem_log_entry *mem_log;
 static uint32_t mem_log_posn, mem_log_size;
-static uint32_t mem_check_posn;
+static uint32_t mem_check_posn, mem_check_end;
 
 #define IS_STORE_QUEUE(X) (((X)&0xFC000000) == 0xE0000000)
 
+/* Parallel mode ring buffer sizes - must be powers of 2 */
+#define SHADOW_RING_BLOCKS 4096
+#define SHADOW_RING_OPS (256*1024)
+
+/**
+ * A block logged in parallel mode. Each block is checked independently,
+ * starting from its own register snapshot, so that blocks can be dropped.
+ */
+struct shadow_block_record {
+    struct sh4_registers start;
+    struct sh4_registers end;
+    uint32_t generation;  /* Code generation when the block started (see shadow_get_generation) */
+    gboolean tlb_on;      /* The checker can't follow TLB changes, so these aren't checked */
+    uint32_t op_start;    /* Memory operations for the block in the op ring */
+    uint32_t op_end;
+};
+
+/**
+ * Ring buffer shared between the CPU (which writes it) and the checker
+ * process (which reads it). The head and tail counts only ever increase, and
+ * are wrapped when indexing the arrays.
+ */
+struct shadow_ring {
+    volatile uint32_t block_head;   /* Blocks completed by the CPU */
+    volatile uint32_t block_tail;   /* Blocks consumed by the checker */
+    volatile uint32_t op_tail;      /* End of the memory operations consumed by the checker */
+    volatile uint32_t started;      /* Blocks started by the CPU (including dropped blocks) */
+    volatile uint32_t generation;   /* Code generation as of the last block start */
+    volatile uint32_t dropped;      /* Blocks not logged as the ring was full */
+    volatile uint32_t failed;       /* Set by the checker when it finds a difference */
+    volatile sh4addr_t failed_pc;   /* Start of the block that failed */
+    struct shadow_block_record blocks[SHADOW_RING_BLOCKS];
+    struct mem_log_entry ops[SHADOW_RING_OPS];
+};
+
+static struct shadow_ring *shadow_ring = NULL;
+static pid_t shadow_checker_pid;
+static struct shadow_block_record *shadow_record = NULL; /* Block being logged, if any */
+static uint32_t shadow_op_head = 0;
+static uint32_t shadow_code_writes = 0;
+
+/* Checker reports go here, or nowhere if NULL */
+static FILE *shadow_out;
+
+static void shadow_printf( const char *msg, ... )
+{
+    va_list ap;
+    if( shadow_out != NULL ) {
+        va_start( ap, msg );
+        vfprintf( shadow_out, msg, ap );
+        va_end( ap );
+    }
+}
+
+/**
+ * Called when the interpreter doesn't match the translator - inline mode
+ * gives up immediately, while parallel mode finishes running the block.
+ */
+static gboolean shadow_mismatch;
+static void shadow_fail( void )
+{
+    if( shadow_ring == NULL ) {
+        abort();
+    }
+    shadow_mismatch = TRUE;
+}
+
+/**
+ * Return the current code generation, which changes whenever the code of a
+ * block that's already run might have changed. A block is only reported as
+ * failing if the generation is unchanged from when it ran, as otherwise the
+ * checker may have run different code.
+ */
+static uint32_t shadow_get_generation( void )
+{
+    return xlat_get_discard_count() + shadow_code_writes;
+}
+
+static void log_ring_op( MemOp op, sh4addr_t addr, uint32_t value )
+{
+    struct mem_log_entry *entry;
+    if( (op == WRITE_LONG || op == WRITE_WORD || op == WRITE_BYTE) &&
+        xlat_get_lut_base()[(addr >> XLAT_LUT_PAGE_SHIFT) & XLAT_LUT_PAGE_MASK] != NULL ) {
+        /* Possibly a write to code, which doesn't always invalidate it (eg
+         * checked pages) - see shadow_get_generation */
+        shadow_code_writes++;
+        shadow_ring->generation = shadow_get_generation();
+    }
+    if( shadow_record == NULL ) {
+        return;
+    }
+    if( shadow_op_head - shadow_ring->op_tail == SHADOW_RING_OPS ) {
+        /* Out of space - give up on the block */
+        shadow_ring->dropped++;
+        shadow_record = NULL;
+        return;
+    }
+    entry = &shadow_ring->ops[shadow_op_head & (SHADOW_RING_OPS-1)];
+    entry->op = op;
+    entry->addr = addr;
+    entry->value = value;
+    shadow_op_head++;
+}
+
 static void log_mem_op( MemOp op, sh4addr_t addr, uint32_t value )
 {
+    if( shadow_ring != NULL ) {
+        log_ring_op( op, addr, value );
+        return;
+    }
     if( mem_log_posn == mem_log_size ) {
         struct mem_log_entry *tmp = realloc(mem_log, mem_log_size * sizeof(struct mem_log_entry) * 2);
         assert( tmp != NULL );
@@ -80,45 +215,58 @@ static void log_mem_op( MemOp op, sh4addr_t addr, uint32_t value )
     mem_log_posn++;
 }
 
-static void print_mem_op( FILE *f, MemOp op, sh4addr_t addr, uint32_t value )
+static void print_mem_op( MemOp op, sh4addr_t addr, uint32_t value )
 {
     if( op == WRITE_LONG || op == WRITE_WORD || op == WRITE_BYTE ) {
-        fprintf( f, "%s( %08X, %08X )\n", memOpNames[op], addr, value );
+        shadow_printf( "%s( %08X, %08X )\n", memOpNames[op], addr, value );
     } else {
-        fprintf( f, "%s( %08X )\n", memOpNames[op], addr );
+        shadow_printf( "%s( %08X )\n", memOpNames[op], addr );
     }
 }
 
 static void dump_mem_ops()
 {
     for( unsigned i=0; i<mem_log_posn; i++ ) {
-        print_mem_op( stderr, mem_log[i].op, mem_log[i].addr, mem_log[i].value );
+        print_mem_op( mem_log[i].op, mem_log[i].addr, mem_log[i].value );
+    }
+}
+
+/**
+ * Return the nth logged memory operation (from the ring in parallel mode)
+ */
+static struct mem_log_entry *get_mem_op( uint32_t n )
+{
+    if( shadow_ring != NULL ) {
+        return &shadow_ring->ops[n & (SHADOW_RING_OPS-1)];
+    } else {
+        return &mem_log[n];
     }
 }
 
 static int32_t check_mem_op( MemOp op, sh4addr_t addr, uint32_t value )
 {
-    if( mem_check_posn >= mem_log_posn ) {
-        fprintf( stderr, "Unexpected interpreter memory operation: " );
-        print_mem_op(stderr, op, addr, value );
-        abort();
+    struct mem_log_entry *entry;
+    if( mem_check_posn == mem_check_end ) {
+        shadow_printf( "Unexpected interpreter memory operation: " );
+        print_mem_op( op, addr, value );
+        shadow_fail();
+        return 0;
     }
-    if( mem_log[mem_check_posn].op != op ||
-        mem_log[mem_check_posn].addr != addr ||
+    entry = get_mem_op( mem_check_posn++ );
+    if( entry->op != op || entry->addr != addr ||
         (( op == WRITE_LONG || op == WRITE_WORD || op == WRITE_BYTE ) &&
-           mem_log[mem_check_posn].value != value ) ) {
-        fprintf(stderr, "Memory operation mismatch. Translator: " );
-        print_mem_op(stderr, mem_log[mem_check_posn].op,
-                mem_log[mem_check_posn].addr, mem_log[mem_check_posn].value );
-        fprintf(stderr, "Emulator: ");
-        print_mem_op(stderr, op, addr, value );
-        abort();
+           entry->value != value ) ) {
+        shadow_printf( "Memory operation mismatch. Translator: " );
+        print_mem_op( entry->op, entry->addr, entry->value );
+        shadow_printf( "Emulator: " );
+        print_mem_op( op, addr, value );
+        shadow_fail();
     }
-    return mem_log[mem_check_posn++].value;
+    return entry->value;
 }
 
 #define CHECK_REG(sym, name) if( xsh4r->sym != esh4r->sym ) { \
-    isgood = FALSE; fprintf( stderr, name "  Xlt = %08X, Emu = %08X\n", xsh4r->sym, esh4r->sym ); }
+    isgood = FALSE; shadow_printf( name "  Xlt = %08X, Emu = %08X\n", xsh4r->sym, esh4r->sym ); }
 
 static gboolean check_registers( struct sh4_registers *xsh4r, struct sh4_registers *esh4r )
 {
@@ -126,19 +274,19 @@ static gboolean check_registers( struct sh4_registers *xsh4r, struct sh4_registe
     for( unsigned i=0; i<16; i++ ) {
         if( xsh4r->r[i] != esh4r->r[i] ) {
             isgood = FALSE;
-            fprintf( stderr, "R%d  Xlt = %08X, Emu = %08X\n", i, xsh4r->r[i], esh4r->r[i] );
+            shadow_printf( "R%d  Xlt = %08X, Emu = %08X\n", i, xsh4r->r[i], esh4r->r[i] );
         }
     }
     for( unsigned i=0; i<8; i++ ) {
         if( xsh4r->r_bank[i] != esh4r->r_bank[i] ) {
             isgood = FALSE;
-            fprintf( stderr, "R_BANK%d  Xlt = %08X, Emu = %08X\n", i, xsh4r->r_bank[i], esh4r->r_bank[i] );
+            shadow_printf( "R_BANK%d  Xlt = %08X, Emu = %08X\n", i, xsh4r->r_bank[i], esh4r->r_bank[i] );
         }
     }
     for( unsigned i=0; i<16; i++ ) {
         if( *((uint32_t *)&xsh4r->fr[0][i]) != *((uint32_t *)&esh4r->fr[0][i]) ) {
             isgood = FALSE;
-            fprintf( stderr, "FR%d  Xlt = %f (0x%08X), Emu = %f (0x%08X)\n", i, xsh4r->fr[0][i],
+            shadow_printf( "FR%d  Xlt = %f (0x%08X), Emu = %f (0x%08X)\n", i, xsh4r->fr[0][i],
                     *((uint32_t *)&xsh4r->fr[0][i]),
                     esh4r->fr[0][i],
                     *((uint32_t *)&esh4r->fr[0][i])
@@ -148,7 +296,7 @@ static gboolean check_registers( struct sh4_registers *xsh4r, struct sh4_registe
     for( unsigned i=0; i<16; i++ ) {
         if( *((uint32_t *)&xsh4r->fr[1][i]) != *((uint32_t *)&esh4r->fr[1][i]) ) {
             isgood = FALSE;
-            fprintf( stderr, "XF%d  Xlt = %f (0x%08X), Emu = %f (0x%08X)\n", i, xsh4r->fr[1][i],
+            shadow_printf( "XF%d  Xlt = %f (0x%08X), Emu = %f (0x%08X)\n", i, xsh4r->fr[1][i],
                     *((uint32_t *)&xsh4r->fr[1][i]),
                     esh4r->fr[1][i],
                     *((uint32_t *)&esh4r->fr[1][i])
@@ -167,7 +315,7 @@ static gboolean check_registers( struct sh4_registers *xsh4r, struct sh4_registe
     CHECK_REG(fpul.i, "FPUL");
     if( xsh4r->mac != esh4r->mac ) {
         isgood = FALSE;
-        fprintf( stderr, "MAC  Xlt = %016llX, Emu = %016llX\n", xsh4r->mac, esh4r->mac );
+        shadow_printf( "MAC  Xlt = %016llX, Emu = %016llX\n", xsh4r->mac, esh4r->mac );
     }
     CHECK_REG(gbr, "GBR");
     CHECK_REG(ssr, "SSR");
@@ -178,10 +326,12 @@ static gboolean check_registers( struct sh4_registers *xsh4r, struct sh4_registe
     CHECK_REG(sh4_state, "STATE");
     if( memcmp( xsh4r->store_queue, esh4r->store_queue, sizeof(xsh4r->store_queue) ) != 0 ) {
         isgood = FALSE;
-        fprintf( stderr, "Store queue  Xlt =\n" );
-        fwrite_dump( (unsigned char *)xsh4r->store_queue, sizeof(xsh4r->store_queue), stderr );
-        fprintf( stderr, "             Emu =\n" );
-        fwrite_dump( (unsigned char *)esh4r->store_queue, sizeof(esh4r->store_queue), stderr );
+        if( shadow_out != NULL ) {
+            fprintf( shadow_out, "Store queue  Xlt =\n" );
+            fwrite_dump( (unsigned char *)xsh4r->store_queue, sizeof(xsh4r->store_queue), shadow_out );
+            fprintf( shadow_out, "             Emu =\n" );
+            fwrite_dump( (unsigned char *)esh4r->store_queue, sizeof(esh4r->store_queue), shadow_out );
+        }
     }
     return isgood;
 }
@@ -298,13 +448,13 @@ struct mem_region_fn shadow_fns = {
         shadow_read_byte, shadow_write_byte,
         NULL, NULL, shadow_prefetch, shadow_read_byte_for_write };
 
-void sh4_shadow_block_begin()
+void FASTCALL sh4_shadow_block_begin( void *code )
 {
     memcpy( &shadow_sh4r, &sh4r, sizeof(struct sh4_registers) );
     mem_log_posn = 0;
 }
 
-void sh4_shadow_block_end()
+void FASTCALL sh4_shadow_block_end( uint32_t exit_reason )
 {
     struct sh4_registers temp_sh4r;
 
@@ -314,6 +464,7 @@ void sh4_shadow_block_end()
 
     shadow_address_mode = SHADOW_CHECK;
     mem_check_posn = 0;
+    mem_check_end = mem_log_posn;
     sh4r.new_pc = sh4r.pc + 2;
     while( sh4r.slice_cycle < temp_sh4r.slice_cycle ) {
         sh4_execute_instruction();
@@ -329,7 +480,7 @@ void sh4_shadow_block_end()
     if( mem_check_posn < mem_log_posn ) {
         fprintf( stderr, "Additional translator memory operations:\n" );
         while( mem_check_posn < mem_log_posn ) {
-            print_mem_op( stderr, mem_log[mem_check_posn].op, mem_log[mem_check_posn].addr, mem_log[mem_check_posn].value );
+            print_mem_op( mem_log[mem_check_posn].op, mem_log[mem_check_posn].addr, mem_log[mem_check_posn].value );
             mem_check_posn++;
         }
         abort();
@@ -337,10 +488,209 @@ void sh4_shadow_block_end()
     shadow_address_mode = SHADOW_LOG;
 }
 
+/**
+ * Check for a failure report from the checker process, or the checker having
+ * died, and if so give up in the same way as the inline mode.
+ */
+static void shadow_check_status( void )
+{
+    if( shadow_ring->failed ) {
+        fprintf( stderr, "Translated block was:\n" );
+        sh4_translate_dump_block( shadow_ring->failed_pc );
+        abort();
+    }
+    if( waitpid( shadow_checker_pid, NULL, WNOHANG ) == shadow_checker_pid ) {
+        fprintf( stderr, "Shadow checker process exited unexpectedly\n" );
+        abort();
+    }
+}
 
-void sh4_shadow_init()
+void FASTCALL sh4_shadow_parallel_block_begin( void *code )
+{
+    uint32_t generation = shadow_get_generation();
+
+    if( shadow_ring->failed ) {
+        shadow_check_status();
+    }
+    shadow_ring->generation = generation;
+    __sync_synchronize();
+    shadow_ring->started++;
+
+    if( shadow_ring->block_head - shadow_ring->block_tail == SHADOW_RING_BLOCKS ) {
+        /* Checker has fallen behind */
+        shadow_ring->dropped++;
+        shadow_record = NULL;
+        if( (shadow_ring->dropped & 0xFFFF) == 0 ) {
+            shadow_check_status();
+        }
+        return;
+    }
+    shadow_record = &shadow_ring->blocks[shadow_ring->block_head & (SHADOW_RING_BLOCKS-1)];
+    memcpy( &shadow_record->start, &sh4r, sizeof(struct sh4_registers) );
+    shadow_record->generation = generation;
+    shadow_record->tlb_on = IS_TLB_ENABLED();
+    shadow_record->op_start = shadow_op_head;
+}
+
+void FASTCALL sh4_shadow_parallel_block_end( uint32_t exit_reason )
+{
+    if( shadow_record != NULL ) {
+        memcpy( &shadow_record->end, &sh4r, sizeof(struct sh4_registers) );
+        shadow_record->op_end = shadow_op_head;
+        __sync_synchronize();
+        shadow_ring->block_head++;
+        shadow_record = NULL;
+    }
+}
+
+/**
+ * Run the block through the interpreter, and compare the result with the
+ * translator's. Differences are printed to shadow_out.
+ * @return TRUE if the results are the same, otherwise FALSE.
+ */
+static gboolean shadow_check_block( struct shadow_block_record *block )
+{
+    memcpy( &sh4r, &block->start, sizeof(struct sh4_registers) );
+    shadow_mismatch = FALSE;
+    mem_check_posn = block->op_start;
+    mem_check_end = block->op_end;
+    sh4r.new_pc = sh4r.pc + 2;
+    while( sh4r.slice_cycle < block->end.slice_cycle ) {
+        sh4_execute_instruction();
+        sh4r.slice_cycle += sh4_cpu_period;
+    }
+
+    if( !check_registers( &block->end, &sh4r ) ) {
+        shadow_mismatch = TRUE;
+    }
+    if( mem_check_posn != mem_check_end ) {
+        shadow_printf( "Additional translator memory operations:\n" );
+        while( mem_check_posn != mem_check_end ) {
+            struct mem_log_entry *entry = get_mem_op( mem_check_posn++ );
+            print_mem_op( entry->op, entry->addr, entry->value );
+        }
+        shadow_mismatch = TRUE;
+    }
+    return !shadow_mismatch;
+}
+
+static FASTCALL void shadow_discard_write( sh4addr_t addr, uint32_t val )
+{
+}
+
+static FASTCALL void shadow_discard_write_burst( sh4addr_t addr, unsigned char *src )
+{
+}
+
+/**
+ * Main loop of the checker process. Main RAM is shared with the CPU, so the
+ * checker's own view of it (used outside of the shadow address space, eg by
+ * store queue flushes) is made read-only first.
+ */
+static void shadow_checker_run( pid_t parent )
+{
+    static struct mem_region_fn sdram_readonly;
+    uint32_t checked = 0, skipped = 0;
+    int i;
+
+    sdram_readonly = mem_region_sdram;
+    sdram_readonly.write_long = shadow_discard_write;
+    sdram_readonly.write_word = shadow_discard_write;
+    sdram_readonly.write_byte = shadow_discard_write;
+    sdram_readonly.write_burst = shadow_discard_write_burst;
+    for( i=0; i < LXDREAM_PAGE_TABLE_ENTRIES; i++ ) {
+        if( ext_address_space[i] == &mem_region_sdram ) {
+            ext_address_space[i] = &sdram_readonly;
+        }
+    }
+    shadow_address_mode = SHADOW_CHECK;
+
+    for(;;) {
+        struct shadow_block_record *block;
+
+        while( shadow_ring->block_tail == shadow_ring->block_head ) {
+            if( getppid() != parent ) {
+                fprintf( stderr, "Shadow check: %u blocks checked, %u not checked, %u dropped\n",
+                         checked, skipped, shadow_ring->dropped );
+                _exit(0);
+            }
+            usleep(100);
+        }
+        __sync_synchronize();
+        block = &shadow_ring->blocks[shadow_ring->block_tail & (SHADOW_RING_BLOCKS-1)];
+
+        shadow_out = NULL;
+        if( block->tlb_on ) {
+            skipped++;
+        } else if( shadow_check_block( block ) ) {
+            checked++;
+        } else {
+            /* Wait for the CPU to start another block, so that the
+             * generation includes any change to the code made before the
+             * check (giving up after a while, eg if the CPU is stopped) */
+            uint32_t started = shadow_ring->started;
+            for( i=0; i<10000 && shadow_ring->started == started && getppid() == parent; i++ ) {
+                usleep(100);
+            }
+            __sync_synchronize();
+            if( shadow_ring->generation != block->generation ) {
+                skipped++;
+            } else {
+                shadow_out = stderr;
+                shadow_check_block( block );
+                fprintf( stderr, "After executing block at %08X\n", block->start.pc );
+                fflush( stderr );
+                shadow_ring->failed_pc = block->start.pc;
+                __sync_synchronize();
+                shadow_ring->failed = TRUE;
+                _exit(1);
+            }
+        }
+
+        shadow_ring->op_tail = block->op_end;
+        __sync_synchronize();
+        shadow_ring->block_tail++;
+    }
+}
+
+/**
+ * Set up parallel mode - allocate the ring and start the checker process.
+ * Must be called before any other threads are started (see above).
+ * @return TRUE on success, or FALSE if parallel mode isn't available.
+ */
+static gboolean sh4_shadow_init_parallel( void )
+{
+    pid_t parent = getpid();
+
+    if( !mem_is_shared_pages( dc_main_ram ) ) {
+        WARN( "Parallel shadow mode needs main RAM to be shared with the checker process" );
+        return FALSE;
+    }
+    shadow_ring = mmap( NULL, sizeof(struct shadow_ring), PROT_READ|PROT_WRITE,
+                        MAP_ANON|MAP_SHARED, -1, 0 );
+    if( shadow_ring == MAP_FAILED ) {
+        WARN( "Unable to allocate shadow ring buffer: %s", strerror(errno) );
+        shadow_ring = NULL;
+        return FALSE;
+    }
+    memset( (void *)shadow_ring, 0, offsetof(struct shadow_ring, blocks) );
+
+    shadow_checker_pid = fork();
+    if( shadow_checker_pid == -1 ) {
+        WARN( "Unable to start shadow checker process: %s", strerror(errno) );
+        munmap( shadow_ring, sizeof(struct shadow_ring) );
+        shadow_ring = NULL;
+        return FALSE;
+    } else if( shadow_checker_pid == 0 ) {
+        shadow_checker_run( parent );
+    }
+    return TRUE;
+}
+
+void sh4_shadow_init( gboolean parallel )
 {
     shadow_address_mode = SHADOW_LOG;
+    shadow_out = stderr;
     p4_address_space = mem_alloc_pages( sizeof(mem_region_fn_t) * 32 );
     shadow_address_space = mem_alloc_pages( sizeof(mem_region_fn_t) * 32 );
     for( unsigned i=0; i < (32 * 4096); i++ ) {
@@ -351,12 +701,17 @@ void sh4_shadow_init()
     mem_log = malloc( mem_log_size * sizeof(struct mem_log_entry) );
     assert( mem_log != NULL );
 
-    sh4_translate_set_callbacks( sh4_shadow_block_begin, sh4_shadow_block_end );
     sh4_translate_set_fastmem( FALSE );
+    sh4_translate_set_cycle_model( FALSE );
     memcpy( p4_address_space, sh4_address_space + (0xE0000000>>LXDREAM_PAGE_BITS),
             sizeof(mem_region_fn_t) * (0x20000000>>LXDREAM_PAGE_BITS) );
     memcpy( sh4_address_space + (0xE0000000>>LXDREAM_PAGE_BITS), shadow_address_space,
             sizeof(mem_region_fn_t) * (0x20000000>>LXDREAM_PAGE_BITS) );
     mmu_set_ext_address_space(shadow_address_space);
-}
 
+    if( parallel && sh4_shadow_init_parallel() ) {
+        sh4_translate_set_callbacks( sh4_shadow_parallel_block_begin, sh4_shadow_parallel_block_end );
+    } else {
+        sh4_translate_set_callbacks( sh4_shadow_block_begin, sh4_shadow_block_end );
+    }
+}
@@ -0,0 +1,255 @@
+/**
+ * $Id$
+ *
+ * ARM translator tests - runs randomly generated ARM programs through both
+ * the translator (armtrans.c) and the interpreter (armcore.c), from the same
+ * starting state, and checks that the results are identical. The programs
+ * mix the directly translated instructions with ones left to the
+ * interpreter, and some of them store into their own code.
+ *
+ * Copyright (c) 2005 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dream.h"
+#include "aica/aica.h"
+#include "aica/armcore.h"
+#include "aica/armtrans.h"
+#include "xlat/xltcache.h"
+
+#define TEST_PROGRAMS 500
+#define TEST_PROGRAM_LENGTH 256      /* Instructions */
+#define TEST_CODE_START 0x00010000
+#define TEST_DATA_START 0x00030000
+#define TEST_RAM_SIZE 0x00200000
+#define TEST_RUN_LENGTH 20000        /* Instructions */
+#define TEST_RUN_SLICE 937           /* Instructions per arm_translate_run() */
+
+/* Registers with a fixed role in the generated programs, which are never
+ * written by them */
+#define REG_SMC_VALUE 10  /* An instruction to store into the code */
+#define REG_CODE_BASE 11  /* Start of the code */
+#define REG_DATA_BASE 12  /* Load/store base */
+
+__thread unsigned char *xlat_output; /* Normally in sh4trans.c */
+struct dreamcast_module aica_module;
+unsigned char aica_main_ram[TEST_RAM_SIZE];
+unsigned char aica_scratch_ram[8 KB];
+struct mmio_region mmio_region_AICA2;
+static unsigned char start_ram[TEST_RAM_SIZE], xlat_ram[TEST_RAM_SIZE];
+
+uint32_t arm_read_long( uint32_t addr )
+{
+    if( addr < TEST_RAM_SIZE ) {
+        return *(uint32_t *)(aica_main_ram + addr);
+    }
+    return 0;
+}
+uint32_t arm_read_word( uint32_t addr ) { return (uint32_t)(uint16_t)arm_read_long(addr); }
+uint32_t arm_read_byte( uint32_t addr ) { return (uint32_t)(uint8_t)arm_read_long(addr); }
+uint32_t arm_read_long_user( uint32_t addr ) { return arm_read_long(addr); }
+uint32_t arm_read_byte_user( uint32_t addr ) { return arm_read_byte(addr); }
+
+void arm_write_long( uint32_t addr, uint32_t val )
+{
+    if( addr < TEST_RAM_SIZE ) {
+        *(uint32_t *)(aica_main_ram + addr) = val;
+        xlat_invalidate_long(ARM_XLAT_ADDR(addr));
+    }
+}
+void arm_write_word( uint32_t addr, uint32_t val )
+{
+    if( addr < TEST_RAM_SIZE ) {
+        *(uint16_t *)(aica_main_ram + addr) = (uint16_t)val;
+        xlat_invalidate_word(ARM_XLAT_ADDR(addr));
+    }
+}
+void arm_write_byte( uint32_t addr, uint32_t val )
+{
+    if( addr < TEST_RAM_SIZE ) {
+        aica_main_ram[addr] = (uint8_t)val;
+        xlat_invalidate_word(ARM_XLAT_ADDR(addr));
+    }
+}
+void arm_write_long_user( uint32_t addr, uint32_t val ) { arm_write_long(addr, val); }
+void arm_write_byte_user( uint32_t addr, uint32_t val ) { arm_write_byte(addr, val); }
+
+// Stubs
+void sh4_translate_lock( void ) { }
+void sh4_translate_unlock( void ) { }
+void sh4_translate_unlink_block( void *use_list ) { }
+void aica_event( int event ) { }
+void dreamcast_stop( void ) { }
+gboolean dreamcast_is_running( void ) { return TRUE; }
+void log_message( void *ptr, int level, const gchar *source, const char *msg, ... ) { }
+
+static uint32_t rand32( void )
+{
+    return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
+
+/** Random condition - mostly AL, never NV */
+static uint32_t random_cond( void )
+{
+    return (rand() & 1) ? 0xE0000000 : ((uint32_t)(rand() % 15) << 28);
+}
+
+/** Random register that the program may write */
+static uint32_t random_reg( void )
+{
+    return rand() % 10;
+}
+
+/**
+ * Random data processing opcode and S flag (always set for the test
+ * opcodes, which would otherwise be misc instructions)
+ */
+static uint32_t random_dp_opcode( void )
+{
+    uint32_t op = rand() & 0x0F;
+    if( op >= 8 && op <= 11 ) {
+        return (op << 21) | 0x00100000;
+    }
+    return (op << 21) | ((rand() & 1) << 20);
+}
+
+/**
+ * Generate a random instruction for the given address in the program.
+ */
+static uint32_t random_instruction( uint32_t pc )
+{
+    uint32_t cond = random_cond();
+    uint32_t rd = random_reg(), rn = rand() % 16, rm = rand() % 16, rs = random_reg();
+    int32_t target;
+
+    if( rn == 15 && (rand() & 1) ) {
+        rn = random_reg();
+    }
+    switch( rand() % 12 ) {
+    case 0: case 1: case 2: /* Data processing, immediate */
+        return cond | 0x02000000 | random_dp_opcode() | (rn << 16) |
+            (rd << 12) | (rand() & 0xFFF);
+    case 3: case 4: /* Data processing, immediate shift (including ROR/RRX) */
+        return cond | random_dp_opcode() | (rn << 16) | (rd << 12) |
+            (((uint32_t)rand() << 5) & 0xFE0) | rm;
+    case 5: /* Data processing, register shift */
+        return cond | random_dp_opcode() | (rn << 16) | (rd << 12) |
+            (rs << 8) | ((rand() & 0x03) << 5) | 0x10 | rm;
+    case 6: case 7: /* LDR/STR/LDRB/STRB, immediate offset */
+        return cond | 0x04000000 | ((rand() & 0x1D) << 20) |
+            (REG_DATA_BASE << 16) | (rd << 12) | (rand() & 0xFFF);
+    case 8: /* Store into the code */
+        return cond | 0x05800000 | (rand() & 0x00400000) | (REG_CODE_BASE << 16) |
+            (REG_SMC_VALUE << 12) | ((rand() % TEST_PROGRAM_LENGTH) << 2);
+    case 9: /* B/BL within the program */
+        target = (int32_t)(rand() % TEST_PROGRAM_LENGTH) -
+            (int32_t)((pc - TEST_CODE_START) >> 2) - 2;
+        return cond | 0x0A000000 | (rand() & 0x01000000) | (target & 0x00FFFFFF);
+    case 10: /* MUL/MLA */
+        return cond | 0x00000090 | ((rand() & 0x03) << 20) | (rd << 16) |
+            (random_reg() << 12) | (rs << 8) | rm;
+    default: /* LDM/STM without r15, or MRS */
+        if( rand() & 1 ) {
+            return cond | 0x010F0000 | (rd << 12);
+        }
+        return cond | 0x08000000 | ((rand() & 0x1B) << 20) | (REG_DATA_BASE << 16) |
+            (rand() & 0x03FF);
+    }
+}
+
+static void init_program( void )
+{
+    int i;
+    uint32_t pc = TEST_CODE_START;
+
+    memset( aica_main_ram, 0, sizeof(aica_main_ram) );
+    for( i=TEST_DATA_START; i<TEST_DATA_START + 0x2000; i++ ) {
+        aica_main_ram[i] = (unsigned char)rand();
+    }
+    for( i=0; i<TEST_PROGRAM_LENGTH - 1; i++, pc += 4 ) {
+        *(uint32_t *)(aica_main_ram + pc) = random_instruction( pc );
+    }
+    /* Loop back to the start */
+    *(uint32_t *)(aica_main_ram + pc) = 0xEA000000 |
+        (((uint32_t)(-(TEST_PROGRAM_LENGTH + 1))) & 0x00FFFFFF);
+
+    arm_reset();
+    for( i=0; i<10; i++ ) {
+        armr.r[i] = (rand() & 3) ? rand32() : (rand() & 0xFF);
+    }
+    armr.r[REG_SMC_VALUE] = 0xE2800001; /* add r0, r0, #1 */
+    armr.r[REG_CODE_BASE] = TEST_CODE_START;
+    armr.r[REG_DATA_BASE] = TEST_DATA_START + 0x1000;
+    armr.r[13] = rand32();
+    armr.r[14] = rand32();
+    armr.r[15] = TEST_CODE_START;
+    armr.cpsr = MODE_SYS | CPSR_I | CPSR_F;
+    armr.n = rand() & 1;
+    armr.z = rand() & 1;
+    armr.c = rand() & 1;
+    armr.v = rand() & 1;
+}
+
+int main( int argc, char *argv[] )
+{
+    struct arm_registers start_regs, xlat_regs;
+    int failures = 0, i;
+    uint32_t n;
+
+    xlat_cache_init();
+    arm_translate_init();
+    srand(1);
+    for( i=0; i<TEST_PROGRAMS; i++ ) {
+        init_program();
+        memcpy( start_ram, aica_main_ram, sizeof(start_ram) );
+        memcpy( &start_regs, &armr, sizeof(armr) );
+
+        xlat_flush_cache();
+        for( n=0; n<TEST_RUN_LENGTH; n += TEST_RUN_SLICE ) {
+            if( !arm_translate_run( TEST_RUN_SLICE ) ) {
+                break;
+            }
+        }
+        memcpy( xlat_ram, aica_main_ram, sizeof(xlat_ram) );
+        memcpy( &xlat_regs, &armr, sizeof(armr) );
+
+        /* The translated code counts each instruction as it runs, so the
+         * interpreter runs exactly as many */
+        memcpy( aica_main_ram, start_ram, sizeof(start_ram) );
+        memcpy( &armr, &start_regs, sizeof(armr) );
+        while( armr.icount < xlat_regs.icount ) {
+            armr.icount++;
+            if( !arm_execute_instruction() ) {
+                break;
+            }
+        }
+        /* shift_c is only scratch space for the interpreter */
+        armr.shift_c = xlat_regs.shift_c;
+
+        if( memcmp( &armr, &xlat_regs, sizeof(armr) ) != 0 ||
+                memcmp( aica_main_ram, xlat_ram, sizeof(xlat_ram) ) != 0 ) {
+            if( failures++ < 10 ) {
+                printf( "FAIL: Results differ for program %d (after %d instructions, pc = %08X/%08X)\n",
+                        i, xlat_regs.icount, xlat_regs.r[15], armr.r[15] );
+            }
+        }
+    }
+    if( failures == 0 ) {
+        printf( "OK: translator and interpreter agree on %d programs\n", TEST_PROGRAMS );
+    } else {
+        printf( "%d programs differ\n", failures );
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,192 @@
+/**
+ * $Id$
+ *
+ * Event queue tests, plus a scheduling microbenchmark
+ *
+ * Copyright (c) 2005 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <assert.h>
+#include <time.h>
+#include "dream.h"
+#include "eventq.h"
+#include "sh4/sh4.h"
+
+extern struct dreamcast_module eventq_module;
+
+struct sh4_registers sh4r;
+
+void sh4_set_event_pending( uint32_t cycles )
+{
+    sh4r.event_pending = cycles;
+}
+
+void asic_event( int eventid ) { }
+
+void log_message( void *ptr, int level, const gchar *source, const char *msg, ... ) { }
+
+#define SLICE 1000000
+
+static int fired[64];
+static int fired_count;
+
+static void record_event( int eventid )
+{
+    fired[fired_count++] = eventid;
+}
+
+/**
+ * Run the SH4 side of the queue up to the given slice time
+ */
+static void run_to( uint32_t nanosecs )
+{
+    while( sh4r.event_pending <= nanosecs ) {
+        sh4r.slice_cycle = sh4r.event_pending;
+        event_execute();
+    }
+    sh4r.slice_cycle = nanosecs;
+}
+
+static void end_slice( void )
+{
+    run_to( SLICE );
+    eventq_module.run_time_slice( SLICE );
+    sh4r.slice_cycle = 0;
+}
+
+static void test_reset( void )
+{
+    int i;
+    eventq_module.reset();
+    for( i=0; i<MAX_EVENT_ID; i++ ) {
+        register_event_callback( i, record_event );
+    }
+    sh4r.slice_cycle = 0;
+    fired_count = 0;
+}
+
+/**
+ * Events fire in time order, with events at the same time in schedule order
+ */
+void test_order()
+{
+    test_reset();
+    event_schedule( 5, 5000 );
+    event_schedule( 3, 3000 );
+    event_schedule( 9, 9000 );
+    event_schedule( 4, 3000 );
+    event_schedule( 1, 1000 );
+    assert( event_get_next_time() == 1000 );
+    assert( sh4r.event_pending == 1000 );
+    assert( sh4r.event_types & PENDING_EVENT );
+    run_to( 4000 );
+    assert( fired_count == 3 );
+    assert( fired[0] == 1 && fired[1] == 3 && fired[2] == 4 );
+    end_slice();
+    assert( fired_count == 5 );
+    assert( fired[3] == 5 && fired[4] == 9 );
+    assert( event_get_next_time() == NOT_SCHEDULED );
+    assert( (sh4r.event_types & PENDING_EVENT) == 0 );
+}
+
+/**
+ * Rescheduling moves an event, cancelling removes it
+ */
+void test_reschedule()
+{
+    test_reset();
+    event_schedule( 1, 1000 );
+    event_schedule( 2, 2000 );
+    event_schedule( 3, 3000 );
+    event_schedule( 1, 4000 );
+    assert( sh4r.event_pending == 2000 );
+    event_cancel( 2 );
+    assert( sh4r.event_pending == 3000 );
+    event_cancel( 2 );
+    event_schedule( 3, 500 );
+    assert( sh4r.event_pending == 500 );
+    end_slice();
+    assert( fired_count == 2 );
+    assert( fired[0] == 3 && fired[1] == 1 );
+}
+
+/**
+ * Events scheduled across slices and seconds are relative to the time they
+ * were scheduled
+ */
+void test_long()
+{
+    int i;
+    test_reset();
+    sh4r.slice_cycle = 250000;
+    event_schedule_long( 7, 2, 500000 );
+    event_schedule( 8, 2*SLICE );
+    assert( event_get_next_time() == 2*SLICE + 250000 );
+    end_slice();
+    assert( fired_count == 0 );
+    assert( event_get_next_time() == SLICE + 250000 );
+    end_slice();
+    assert( fired_count == 0 );
+    end_slice();
+    assert( fired_count == 1 && fired[0] == 8 );
+    for( i=3; i<2000; i++ ) {
+        end_slice();
+    }
+    assert( fired_count == 1 );
+    assert( event_get_next_time() == 750000 );
+    end_slice();
+    assert( fired_count == 2 && fired[1] == 7 );
+}
+
+/**
+ * Simulate a typical load - a couple of dozen events continually rescheduled
+ * (scanlines, timers, DMA completions), about half of which fire each slice.
+ */
+void bench_schedule()
+{
+    int i, ops = 0;
+    uint32_t rand = 12345;
+    struct timespec start, end;
+
+    test_reset();
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    for( i=0; i<20000; i++ ) {
+        int j;
+        for( j=0; j<64; j++ ) {
+            rand = rand * 1103515245 + 12345;
+            int id = 1 + ((rand >> 16) % 24);
+            sh4r.slice_cycle = j * (SLICE/64);
+            if( (rand & 0x0F) == 0 ) {
+                event_cancel( id );
+            } else {
+                event_schedule( id, (rand >> 8) % (2*SLICE) );
+            }
+            ops++;
+        }
+        fired_count = 0;
+        end_slice();
+    }
+    clock_gettime( CLOCK_MONOTONIC, &end );
+    double ns = (end.tv_sec - start.tv_sec) * 1000000000.0 + (end.tv_nsec - start.tv_nsec);
+    printf( "event_schedule/cancel: %d ops, %.1f ns/op\n", ops, ns / ops );
+}
+
+int main()
+{
+    event_init();
+    test_order();
+    test_reschedule();
+    test_long();
+    bench_schedule();
+    return 0;
+}
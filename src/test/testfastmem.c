@@ -0,0 +1,99 @@
+/**
+ * $Id$
+ *
+ * Fastmem fault handler tests - checks that a faulting access site is
+ * patched to take its slow path.
+ *
+ * Copyright (c) 2005 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <assert.h>
+#include <sys/mman.h>
+#include "dream.h"
+#include "mem.h"
+#include "xlat/x86/fastmem.h"
+
+gboolean mem_handle_write_fault( void *addr ) { return FALSE; }
+
+#define PAGE 4096
+#define SLOW_RESULT 42
+
+typedef uint32_t (*access_fn_t)( void *unused, uintptr_t offset );
+
+/**
+ * Build a function containing a single access site reading the long at
+ * base+offset, which returns SLOW_RESULT if it takes the slow path.
+ * @return pointer to the site within code.
+ */
+static uint8_t *emit_access( uint8_t *code, void *base )
+{
+    uint8_t *site;
+    *code++ = 0x48; *code++ = 0x89; *code++ = 0xF1; /* mov %rsi, %rcx */
+    site = code;
+    *code++ = 0x48; *code++ = 0xBF;                 /* mov $base, %rdi */
+    *((uintptr_t *)code) = (uintptr_t)base;
+    code += sizeof(uintptr_t);
+    *code++ = 0x8B; *code++ = 0x04; *code++ = 0x0F; /* mov (%rdi,%rcx), %eax */
+    *code++ = 0x90; *code++ = 0x90; *code++ = 0x90;
+    *code++ = 0xEB; *code++ = 0x05;                 /* jmp done */
+    *code++ = 0xB8;                                 /* slow: mov $42, %eax */
+    *((uint32_t *)code) = SLOW_RESULT;
+    code += 4;
+    *code++ = 0xC3;                                 /* done: ret */
+    return site;
+}
+
+int main( int argc, char *argv[] )
+{
+    int failed = 0;
+    uint8_t *code, *site, *view;
+    access_fn_t fn;
+
+    view = mmap( NULL, 2*PAGE, PROT_NONE, MAP_ANON|MAP_PRIVATE, -1, 0 );
+    code = mmap( NULL, PAGE, PROT_READ|PROT_WRITE|PROT_EXEC, MAP_ANON|MAP_PRIVATE, -1, 0 );
+    assert( view != MAP_FAILED && code != MAP_FAILED );
+    mprotect( view, PAGE, PROT_READ|PROT_WRITE );
+    *((uint32_t *)view) = 0x12345678;
+
+    if( !x86_fastmem_install( view ) ) {
+#if SIZEOF_VOID_P == 8 && defined(__linux__)
+        printf( "FAIL: fastmem handler not available\n" );
+        return 1;
+#else
+        printf( "fastmem not supported on this host, skipping\n" );
+        return 0;
+#endif
+    }
+
+    site = emit_access( code, view );
+    fn = (access_fn_t)code;
+
+    /* Mapped: fast path, site untouched */
+    if( fn( NULL, 0 ) != 0x12345678 || site[0] != 0x48 ) {
+        printf( "FAIL: mapped access\n" );
+        failed++;
+    }
+    /* Unmapped: faults, gets patched and restarted down the slow path */
+    if( fn( NULL, PAGE ) != SLOW_RESULT || site[0] != 0xE9 ) {
+        printf( "FAIL: unmapped access\n" );
+        failed++;
+    }
+    /* Once patched the site always takes the slow path */
+    if( fn( NULL, 0 ) != SLOW_RESULT ) {
+        printf( "FAIL: patched access\n" );
+        failed++;
+    }
+
+    printf( "%s\n", failed ? "FAIL" : "OK" );
+    return failed;
+}
@@ -0,0 +1,401 @@
+/**
+ * $Id$
+ *
+ * Scene extraction tests, plus a pvr2_scene_read() benchmark. Any saved
+ * scene files given on the command line (see rendsave.c) are replayed
+ * through the benchmark as well.
+ *
+ * Copyright (c) 2005 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "dreamcast.h"
+#include "display.h"
+#include "pvr2/pvr2.h"
+#include "pvr2/pvr2mmio.h"
+#include "pvr2/scene.h"
+
+unsigned char pvr2_main_ram[8 MB];
+static char pvr2_regs[0x1000], pvr2_pal_regs[0x1000];
+struct mmio_region mmio_region_PVR2, mmio_region_PVR2PAL;
+
+void log_message( void *ptr, int level, const gchar *source, const char *msg, ... ) { }
+
+/* Vertex buffer in host memory */
+static void *vbuf_data;
+static uint32_t vbuf_size;
+
+static void *vbuf_map( vertex_buffer_t buf, uint32_t size )
+{
+    if( size > vbuf_size ) {
+        vbuf_data = g_realloc( vbuf_data, size );
+        vbuf_size = size;
+    }
+    return vbuf_data;
+}
+
+static void *vbuf_unmap( vertex_buffer_t buf )
+{
+    return vbuf_data;
+}
+
+static void vbuf_finished( vertex_buffer_t buf ) { }
+
+static void vbuf_destroy( vertex_buffer_t buf ) { }
+
+static struct vertex_buffer test_vbuf = { vbuf_map, vbuf_unmap, vbuf_finished, vbuf_destroy };
+
+static vertex_buffer_t test_create_vertex_buffer( )
+{
+    return &test_vbuf;
+}
+
+static struct display_driver test_driver;
+display_driver_t display_driver = &test_driver;
+
+#define TILE_BASE 0x100000
+#define LIST_BASE 0x180000
+#define POLY_BASE 0x200000
+
+static uint32_t rand_seed = 12345;
+
+static uint32_t next_rand( void )
+{
+    rand_seed = rand_seed * 1103515245 + 12345;
+    return rand_seed >> 8;
+}
+
+static uint32_t float_bits( float f )
+{
+    union { float f; uint32_t i; } u;
+    u.f = f;
+    return u.i;
+}
+
+static uint32_t random_w( void )
+{
+    switch( next_rand() % 16 ) {
+    case 0: return float_bits(0.0);
+    case 1: return float_bits(-0.0);
+    case 2: return float_bits(INFINITY);
+    case 3: return 0x7FC00000; /* NaN */
+    default: return float_bits( 0.01 + (next_rand() % 10000) / 100.0 );
+    }
+}
+
+/* Polygon formats exercised by the test scene: poly1, poly2, tex (all
+ * with vertex fog, so that the offset alpha is left as decoded) */
+static const uint32_t formats[][3] = {
+        { 0x00800000, 0x00500000, 0 },          /* Gouraud */
+        { 0x01800000, 0x00500000, 0 },          /* Gouraud + specular */
+        { 0x02800000, 0x00400080, 0x00001234 }, /* Decal, float uv, no alpha */
+        { 0x03C00000, 0x00500000, 0x30401234 }, /* Replace, 16-bit uv, specular, paletted */
+        { 0x02000000, 0x00500040, 0x28001234 }, /* Modulate alpha, float uv */
+        { 0x02400000, 0x005000C0, 0x00001234 }, /* Modulate, 16-bit uv */
+};
+#define FORMAT_COUNT (sizeof(formats)/sizeof(formats[0]))
+
+static int vertex_words( uint32_t poly1 )
+{
+    int words = 1;
+    if( POLY1_TEXTURED(poly1) ) {
+        words += POLY1_UV16(poly1) ? 1 : 2;
+    }
+    if( POLY1_SPECULAR(poly1) ) {
+        words++;
+    }
+    return words;
+}
+
+/**
+ * Build a scene of strip_count polygons in a single tile, cycling through the
+ * formats (with every fourth polygon modified), with 3-8 vertexes each.
+ * @param shadow RENDER_SHADOW value (bit 8 set for cheap shadows)
+ */
+static void build_scene( int strip_count, uint32_t shadow )
+{
+    gboolean full_shadow = (shadow & 0x100) == 0;
+    uint32_t *segment = (uint32_t *)(pvr2_main_ram + TILE_BASE);
+    uint32_t *list = (uint32_t *)(pvr2_main_ram + LIST_BASE);
+    uint32_t *pbuf = (uint32_t *)(pvr2_main_ram + POLY_BASE);
+    uint32_t posn = 64; /* Leave room for the background */
+    int i, j, k;
+
+    memset( pvr2_regs, 0, sizeof(pvr2_regs) );
+    MMIO_WRITE( PVR2, RENDER_TILEBASE, TILE_BASE );
+    MMIO_WRITE( PVR2, RENDER_POLYBASE, POLY_BASE );
+    MMIO_WRITE( PVR2, RENDER_HCLIP, 0x027F0000 );
+    MMIO_WRITE( PVR2, RENDER_VCLIP, 0x01DF0000 );
+    MMIO_WRITE( PVR2, RENDER_SHADOW, shadow );
+    MMIO_WRITE( PVR2, RENDER_ISPCFG, 1 );
+    memset( pbuf, 0, 64*4 );
+
+    segment[0] = SEGMENT_END;
+    segment[1] = LIST_BASE;
+    for( i=2; i<6; i++ ) {
+        segment[i] = NO_POINTER;
+    }
+
+    for( i=0; i<strip_count; i++ ) {
+        const uint32_t *fmt = formats[i % FORMAT_COUNT];
+        gboolean modified = (i % 4) == 3;
+        int words = vertex_words( fmt[0] );
+        int vertex_length = 3 + (modified && full_shadow ? words*2 : words);
+        int vertex_count = 3 + (next_rand() % 6);
+
+        list[i] = ((0x40000000 >> (vertex_count-3))) | (words << 21) |
+                (modified ? 0x01000000 : 0) | posn;
+        pbuf[posn++] = fmt[0];
+        pbuf[posn++] = fmt[1];
+        pbuf[posn++] = fmt[2];
+        if( modified && full_shadow ) {
+            pbuf[posn++] = fmt[1] ^ 0x00000040;
+            pbuf[posn++] = fmt[2];
+        }
+        for( j=0; j<vertex_count; j++ ) {
+            pbuf[posn++] = float_bits( next_rand() % 640 );
+            pbuf[posn++] = float_bits( next_rand() % 480 );
+            pbuf[posn++] = random_w();
+            for( k=3; k<vertex_length; k++ ) {
+                pbuf[posn++] = next_rand() ^ (next_rand() << 24);
+            }
+        }
+    }
+    list[i] = 0xF0000000;
+}
+
+/**
+ * Decode a vertex one field at a time, directly from the format description
+ */
+static void ref_decode_vertex( struct vertex_struct *vert, uint32_t poly1, uint32_t poly2,
+                               uint32_t tex, uint32_t *data, int modify_offset, float *bounds )
+{
+    union { uint32_t i; float f; } u;
+    int i;
+
+    u.i = data[0]; vert->x = u.f;
+    u.i = data[1]; vert->y = u.f;
+    u.i = data[2];
+    vert->z = !isfinite(u.f) ? 0 : (u.f == 0 ? u.f : 1/u.f);
+    if( vert->z > bounds[1] ) {
+        bounds[1] = vert->z;
+    } else if( vert->z < bounds[0] && vert->z != 0 ) {
+        bounds[0] = vert->z;
+    }
+    data += 3 + modify_offset;
+
+    gboolean force_alpha = !POLY2_ALPHA_ENABLE(poly2);
+    vert->tex_mode = 2.0;
+    vert->r = -1.0;
+    if( POLY1_TEXTURED(poly1) ) {
+        if( POLY1_UV16(poly1) ) {
+            u.i = *data & 0xFFFF0000; vert->u = u.f;
+            u.i = *data << 16; vert->v = u.f;
+            data++;
+        } else {
+            u.i = *data++; vert->u = u.f;
+            u.i = *data++; vert->v = u.f;
+        }
+        vert->tex_mode = POLY2_TEX_BLEND(poly2) == 2 ? 1.0 : 0.0;
+        if( POLY2_TEX_BLEND(poly2) == 1 ) {
+            force_alpha = TRUE;
+        }
+        switch( tex & PVR2_TEX_FORMAT_MASK ) {
+        case PVR2_TEX_FORMAT_IDX4: vert->r = ((float)((tex & 0x07E00000) >> 17))/1024.0 + 0.0002; break;
+        case PVR2_TEX_FORMAT_IDX8: vert->r = ((float)((tex & 0x06000000) >> 17))/1024.0 + 0.0002; break;
+        }
+    }
+    for( i=0; i<4; i++ ) {
+        vert->rgba[i] = ((*data >> ((i == 3 ? 3 : 2-i)*8)) & 0xFF) + 1;
+        vert->rgba[i] /= 256.0;
+        if( POLY1_TEXTURED(poly1) && POLY2_TEX_BLEND(poly2) == 0 ) {
+            vert->rgba[i] = 1.0;
+        }
+    }
+    data++;
+    for( i=0; i<4; i++ ) {
+        vert->offset_rgba[i] = 0.0;
+        if( POLY1_SPECULAR(poly1) ) {
+            vert->offset_rgba[i] = (((*data >> ((i == 3 ? 3 : 2-i)*8)) & 0xFF) + 1) / 256.0;
+        }
+    }
+    if( force_alpha ) {
+        vert->rgba[3] = 1.0;
+    }
+}
+
+static int compare_vertex( struct vertex_struct *a, struct vertex_struct *b, gboolean textured )
+{
+    if( memcmp( &a->x, &b->x, 3*sizeof(float) ) != 0 ||
+        memcmp( &a->r, &b->r, 2*sizeof(float) ) != 0 ||
+        memcmp( a->rgba, b->rgba, 8*sizeof(float) ) != 0 ) {
+        return 1;
+    }
+    if( textured && memcmp( &a->u, &b->u, 2*sizeof(float) ) != 0 ) {
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Decoded vertexes match the reference decoder, for each vertex format
+ */
+void test_decode( uint32_t shadow )
+{
+    float bounds[2] = { 0, 0 };
+    float intensity = ((shadow & 0xFF)+1)/256.0;
+    int i, j, k, errors = 0, checked = 0;
+
+    build_scene( 600, shadow );
+    pvr2_scene_read();
+
+    for( i=0; i<pvr2_scene.poly_count; i++ ) {
+        struct polygon_struct *poly = &pvr2_scene.poly_array[i];
+        uint32_t *context = poly->context;
+        int words = vertex_words( context[0] );
+        if( poly == pvr2_scene.bkgnd_poly ) {
+            continue;
+        }
+        int modified = poly->mod_vertex_index != -1;
+        int full = modified && pvr2_scene.shadow_mode == SHADOW_FULL;
+        int vertex_length = 3 + (full ? words*2 : words);
+        uint32_t *data = context + (full ? 5 : 3);
+        struct vertex_struct vert;
+
+        for( j=0; j<poly->vertex_count; j++ ) {
+            ref_decode_vertex( &vert, context[0], context[1], context[2], data + j*vertex_length, 0, bounds );
+            errors += compare_vertex( &vert, &pvr2_scene.vertex_array[poly->vertex_index+j],
+                                      POLY1_TEXTURED(context[0]) );
+            checked++;
+        }
+        if( full ) {
+            for( j=0; j<poly->vertex_count; j++ ) {
+                ref_decode_vertex( &vert, context[0], context[3], context[4], data + j*vertex_length, words, bounds );
+                errors += compare_vertex( &vert, &pvr2_scene.vertex_array[poly->mod_vertex_index+j],
+                                          POLY1_TEXTURED(context[0]) );
+                checked++;
+            }
+        } else if( modified ) {
+            /* Cheap shadow - the normal vertexes scaled by the shadow intensity */
+            for( j=0; j<poly->vertex_count; j++ ) {
+                vert = pvr2_scene.vertex_array[poly->vertex_index+j];
+                for( k=0; k<4; k++ ) {
+                    vert.rgba[k] *= intensity;
+                    if( k < 3 ) {
+                        vert.offset_rgba[k] *= intensity;
+                    }
+                }
+                errors += compare_vertex( &vert, &pvr2_scene.vertex_array[poly->mod_vertex_index+j],
+                                          POLY1_TEXTURED(context[0]) );
+                checked++;
+            }
+        }
+    }
+    if( errors != 0 ) {
+        printf( "decode: %d of %d vertexes differ\n", errors, checked );
+    }
+    assert( checked > 2000 );
+    fflush( stdout );
+    assert( errors == 0 );
+    assert( memcmp( bounds, &pvr2_scene.bounds[4], sizeof(bounds) ) == 0 );
+}
+
+static double time_scene_read( int iterations )
+{
+    struct timespec start, end;
+    int i;
+
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    for( i=0; i<iterations; i++ ) {
+        pvr2_scene_read();
+        pvr2_scene_finished();
+    }
+    clock_gettime( CLOCK_MONOTONIC, &end );
+    return ((end.tv_sec - start.tv_sec) * 1000000000.0 + (end.tv_nsec - start.tv_nsec)) / iterations;
+}
+
+/**
+ * A polygon-dense scene, about 30000 vertexes
+ */
+void bench_scene_read()
+{
+    build_scene( 6000, 0x80 );
+    double ns = time_scene_read( 50 );
+    printf( "pvr2_scene_read: %d vertexes, %.2f ms/scene, %.1f ns/vertex\n",
+            pvr2_scene.vertex_count, ns / 1000000.0, ns / pvr2_scene.vertex_count );
+}
+
+/**
+ * Load a scene saved by pvr2_render_save_scene()
+ */
+static gboolean load_scene( const char *filename )
+{
+    struct {
+        char magic[16];
+        uint32_t version;
+        uint32_t timestamp;
+        uint32_t frame_count;
+    } header;
+    uint32_t start, length;
+    gboolean ok = FALSE;
+
+    FILE *f = fopen( filename, "rb" );
+    if( f == NULL ) {
+        return FALSE;
+    }
+    if( fread( &header, sizeof(header), 1, f ) == 1 &&
+        memcmp( header.magic, SCENE_SAVE_MAGIC, 16 ) == 0 &&
+        fread( pvr2_regs, 0x1000, 1, f ) == 1 &&
+        fread( pvr2_pal_regs, 0x1000, 1, f ) == 1 ) {
+        while( fread( &start, sizeof(start), 1, f ) == 1 ) {
+            if( start == 0xFFFFFFFF ) {
+                ok = TRUE;
+                break;
+            }
+            if( fread( &length, sizeof(length), 1, f ) != 1 || start + length > sizeof(pvr2_main_ram) ||
+                fread( pvr2_main_ram + start, 1, length, f ) != length ) {
+                break;
+            }
+        }
+    }
+    fclose( f );
+    return ok;
+}
+
+int main( int argc, char *argv[] )
+{
+    int i;
+
+    mmio_region_PVR2.mem = pvr2_regs;
+    mmio_region_PVR2PAL.mem = pvr2_pal_regs;
+    test_driver.create_vertex_buffer = test_create_vertex_buffer;
+
+    test_decode( 0x80 );
+    test_decode( 0x1A0 );
+    bench_scene_read();
+
+    for( i=1; i<argc; i++ ) {
+        if( !load_scene( argv[i] ) ) {
+            fprintf( stderr, "Unable to load scene %s\n", argv[i] );
+            return 1;
+        }
+        double ns = time_scene_read( 100 );
+        printf( "%s: %d polygons, %d vertexes, %.2f ms/scene\n", argv[i],
+                pvr2_scene.poly_count, pvr2_scene.vertex_count, ns / 1000000.0 );
+    }
+    return 0;
+}
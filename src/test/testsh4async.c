@@ -0,0 +1,173 @@
+/**
+ * $Id$
+ *
+ * Test cases for background translation. The job functions are static, so
+ * the translator core is included directly, and the jobs are run on this
+ * thread rather than the background thread so that the source can be
+ * changed at a known point in the translation.
+ *
+ * Copyright (c) 2005 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include "sh4/sh4trans.c"
+
+struct dreamcast_module sh4_module;
+struct mmio_region mmio_region_MMU;
+struct mmio_region mmio_region_PMM;
+struct breakpoint_struct sh4_breakpoints[MAX_BREAKPOINTS];
+int sh4_breakpoint_count = 0;
+gboolean sh4_profile_blocks = FALSE;
+struct mem_region_fn **sh4_address_space = (void *)0x12345432;
+struct mem_region_fn **sh4_user_address_space = (void *)0x12345678;
+uint32_t sh4_cpu_period = 5;
+gboolean sh4_starting;
+static unsigned char main_ram[4096];
+unsigned char *dc_main_ram = main_ram;
+unsigned char dc_boot_rom[4096];
+struct mem_region_fn mem_region_sdram;
+struct sh4_icache_struct sh4_icache;
+struct sh4_registers sh4r;
+const struct cpu_desc_struct sh4_cpu_desc;
+
+#define START_ADDR 0x8C010000
+
+/* add #1, r0; rts; nop */
+static uint16_t block_a[] = { 0x7001, 0x000B, 0x0009 };
+/* add #2, r0 */
+#define BLOCK_B_INSN 0x7002
+
+static uint16_t *source = (uint16_t *)main_ram;
+static gboolean rewrite_source = FALSE;
+
+/**
+ * Called at the start of the block while it's being translated, which is
+ * where the CPU thread rewrites the source in the test.
+ */
+gboolean sdram_is_code_checked( sh4addr_t addr )
+{
+    if( rewrite_source ) {
+        source[0] = BLOCK_B_INSN;
+        rewrite_source = FALSE;
+    }
+    return FALSE;
+}
+
+gboolean sdram_enable_code_protection( void ) { return TRUE; }
+void sdram_protect_code( sh4addr_t start, sh4addr_t end ) { }
+uint32_t FASTCALL sdram_get_code_hash( sh4addr_t start, sh4addr_t end ) { return 0; }
+
+// Stubs
+gboolean sh4_execute_instruction( ) { return TRUE; }
+void sh4_accept_interrupt() {}
+void sh4_set_breakpoint( uint32_t pc, breakpoint_type_t type ) { }
+gboolean sh4_clear_breakpoint( uint32_t pc, breakpoint_type_t type ) { return TRUE; }
+gboolean dreamcast_is_running() { return FALSE; }
+int sh4_get_breakpoint( uint32_t pc ) { return 0; }
+void sh4_finalize_instruction() { }
+void sh4_core_exit( int exit_code ){}
+void sh4_crashdump() {}
+void event_execute() {}
+void TMU_run_slice( uint32_t nanos ) {}
+void CCN_set_cache_control( int val ) { }
+void PMM_write_control( int ctr, uint32_t val ) { }
+void SCIF_run_slice( uint32_t nanos ) {}
+void FASTCALL sh4_write_fpscr( uint32_t val ) { }
+void FASTCALL sh4_write_sr( uint32_t val ) { }
+uint32_t FASTCALL sh4_read_sr( void ) { return 0; }
+void FASTCALL sh4_sleep() { }
+void FASTCALL sh4_fsca( uint32_t angle, float *fr ) { }
+void FASTCALL sh4_ftrv( float *fv ) { }
+void FASTCALL signsat48(void) { }
+void sh4_switch_fr_banks() { }
+void mem_copy_to_sh4( sh4addr_t addr, sh4ptr_t src, size_t size ) { }
+gboolean sh4_has_page( sh4vma_t vma ) { return TRUE; }
+void syscall_invoke( uint32_t val ) { }
+void dreamcast_stop() {}
+void dreamcast_reset() {}
+void FASTCALL sh4_raise_reset( int exc ) { }
+void FASTCALL sh4_raise_exception( int exc ) { }
+void FASTCALL sh4_raise_tlb_exception( int exc, sh4vma_t vma ) { }
+void FASTCALL sh4_raise_tlb_multihit( sh4vma_t vma) { }
+void FASTCALL sh4_raise_trap( int exc ) { }
+void FASTCALL sh4_flush_store_queue( sh4addr_t addr ) { }
+void FASTCALL sh4_flush_store_queue_mmu( sh4addr_t addr, void *exc ) { }
+void sh4_handle_pending_events() { }
+uint32_t sh4_sleep_run_slice(uint32_t nanosecs) { return nanosecs; }
+gboolean gui_error_dialog( const char *fmt, ... ) { return TRUE; }
+gboolean FASTCALL mmu_update_icache( sh4vma_t addr ) { return TRUE; }
+void *mmu_get_fastmem_base() { return NULL; }
+void MMU_ldtlb() { }
+void event_schedule(int event, uint32_t nanos) { }
+sh4addr_t FASTCALL mmu_vma_to_phys_disasm( sh4vma_t vma ) { return vma; }
+
+/**
+ * Queue, translate and install the block at START_ADDR, optionally rewriting
+ * its first instruction part way through the translation and then putting it
+ * back before the install.
+ * @return TRUE if the block was installed.
+ */
+static gboolean translate_async( gboolean rewrite )
+{
+    struct xlat_async_job *job = NULL;
+    int i;
+
+    memcpy( source, block_a, sizeof(block_a) );
+    sh4_translate_queue_block( START_ADDR );
+    for( i=0; i<XLAT_ASYNC_JOBS; i++ ) {
+        if( xlat_async_jobs[i].state == XLAT_JOB_QUEUED ) {
+            job = &xlat_async_jobs[i];
+        }
+    }
+    if( job == NULL ) {
+        return FALSE;
+    }
+
+    rewrite_source = rewrite;
+    sh4_translate_run_job( job );
+    job->state = XLAT_JOB_DONE;
+    memcpy( source, block_a, sizeof(block_a) );
+
+    sh4_translate_install_job( job );
+    sh4_translate_free_job( job );
+    return sh4_translate_has_block( GET_ICACHE_PHYS(START_ADDR), sh4r.xlat_sh4_mode );
+}
+
+int main( int argc, char *argv[] )
+{
+    int failures = 0;
+
+    mmio_region_MMU.mem = malloc(4096);
+    memset( mmio_region_MMU.mem, 0, 4096 );
+    sh4_icache.mask = 0xFFFFF000;
+    sh4_icache.page_vma = START_ADDR & 0xFFFFF000;
+    sh4_icache.page = main_ram;
+    sh4_icache.page_ppa = START_ADDR & 0x1FFFF000;
+
+    xlat_cache_init();
+    sh4_translate_init();
+
+    if( !translate_async( TRUE ) ) {
+        printf( "OK: block rewritten during translation was discarded\n" );
+    } else {
+        printf( "FAIL: block rewritten during translation was installed\n" );
+        failures++;
+    }
+    if( translate_async( FALSE ) ) {
+        printf( "OK: unchanged block was installed\n" );
+    } else {
+        printf( "FAIL: unchanged block was not installed\n" );
+        failures++;
+    }
+    return failures;
+}
@@ -0,0 +1,210 @@
+/**
+ * $Id$
+ *
+ * SH4 interpreter decoder tests - runs every instruction word through both
+ * the jump table decoder (sh4core.c, generated with gendec -j) and the
+ * switch-based decoder (sh4core-switch.c, generated without), from the same
+ * starting state, and checks that the results are identical.
+ *
+ * Copyright (c) 2005 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dream.h"
+#include "dreamcast.h"
+#include "mem.h"
+#include "sh4/sh4core.h"
+#include "sh4/sh4mmio.h"
+#include "sh4/mmu.h"
+
+/* The switch-based core, renamed so that it can be linked alongside the
+ * jump table core */
+#define sh4_emulate_run_slice sh4_emulate_run_slice_switch
+#define sh4_execute_instruction sh4_execute_instruction_switch
+#define sh4_finalize_instruction sh4_finalize_instruction_switch
+#define fprint_stack_trace fprint_stack_trace_switch
+#define sh4_call_trace_on sh4_call_trace_on_switch
+gboolean sh4_execute_instruction( void );
+void sh4_finalize_instruction( void );
+#include "test/sh4core-switch.c"
+#undef sh4_emulate_run_slice
+#undef sh4_execute_instruction
+#undef sh4_finalize_instruction
+#undef fprint_stack_trace
+#undef sh4_call_trace_on
+
+#define TEST_PC 0x8C000800
+#define TEST_RAM_SIZE 4096
+
+/**
+ * Everything an instruction can affect
+ */
+struct test_state {
+    struct sh4_registers regs;
+    unsigned char ram[TEST_RAM_SIZE];
+    int exception;
+    int exit_code;
+    int calls;     /* Number of calls out to the stubs below */
+};
+
+static struct test_state state;
+
+struct dreamcast_module sh4_module;
+struct mmio_region mmio_region_CPG;
+struct sh4_registers sh4r;
+struct sh4_icache_struct sh4_icache;
+uint32_t sh4_cpu_period = 5;
+int sh4_breakpoint_count = 0;
+struct breakpoint_struct sh4_breakpoints[MAX_BREAKPOINTS];
+struct mem_region_fn **sh4_address_space;
+struct mem_region_fn **sh4_user_address_space;
+struct mem_region_fn **storequeue_address_space;
+struct mem_region_fn **storequeue_user_address_space;
+
+static int32_t FASTCALL test_read_long( sh4addr_t addr )
+{
+    return *(int32_t *)(state.ram + (addr & (TEST_RAM_SIZE-4)));
+}
+static int32_t FASTCALL test_read_word( sh4addr_t addr )
+{
+    return SIGNEXT16(*(int16_t *)(state.ram + (addr & (TEST_RAM_SIZE-2))));
+}
+static int32_t FASTCALL test_read_byte( sh4addr_t addr )
+{
+    return SIGNEXT8(state.ram[addr & (TEST_RAM_SIZE-1)]);
+}
+static void FASTCALL test_write_long( sh4addr_t addr, uint32_t val )
+{
+    *(uint32_t *)(state.ram + (addr & (TEST_RAM_SIZE-4))) = val;
+}
+static void FASTCALL test_write_word( sh4addr_t addr, uint32_t val )
+{
+    *(uint16_t *)(state.ram + (addr & (TEST_RAM_SIZE-2))) = (uint16_t)val;
+}
+static void FASTCALL test_write_byte( sh4addr_t addr, uint32_t val )
+{
+    state.ram[addr & (TEST_RAM_SIZE-1)] = (uint8_t)val;
+}
+static void FASTCALL test_prefetch( sh4addr_t addr )
+{
+    state.calls++;
+}
+
+static struct mem_region_fn mem_region_test = { test_read_long, test_write_long,
+        test_read_word, test_write_word, test_read_byte, test_write_byte,
+        NULL, NULL, test_prefetch, test_read_byte };
+
+mem_region_fn_t FASTCALL mmu_get_region_for_vma_read( sh4vma_t *addr ) { return &mem_region_test; }
+mem_region_fn_t FASTCALL mmu_get_region_for_vma_write( sh4vma_t *addr ) { return &mem_region_test; }
+mem_region_fn_t FASTCALL mmu_get_region_for_vma_prefetch( sh4vma_t *addr ) { return &mem_region_test; }
+
+void FASTCALL sh4_raise_exception( int code ) { state.exception = code; }
+void FASTCALL sh4_raise_trap( int trap ) { state.exception = 0x160; state.regs.r[0] ^= trap; }
+void sh4_core_exit( int exit_code ) { state.exit_code = exit_code; }
+uint32_t FASTCALL sh4_read_sr( void ) { state.calls++; return sh4r.sr; }
+void FASTCALL sh4_write_sr( uint32_t val ) { state.calls++; sh4r.sr = val; }
+void FASTCALL sh4_write_fpscr( uint32_t val ) { state.calls++; sh4r.fpscr = val; }
+void FASTCALL sh4_switch_fr_banks( void ) { state.calls++; }
+void FASTCALL sh4_sleep( void ) { state.calls++; }
+void FASTCALL sh4_fsca( uint32_t angle, float *fr ) { fr[0] = (float)angle; fr[1] = -(float)angle; }
+void FASTCALL sh4_ftrv( float *fv ) { fv[0] += fv[1] + fv[2] + fv[3]; }
+void FASTCALL sh4_flush_store_queue( sh4addr_t addr ) { state.calls++; }
+void FASTCALL sh4_flush_store_queue_mmu( sh4addr_t addr, void *exc ) { state.calls++; }
+gboolean FASTCALL mmu_update_icache( sh4vma_t addr ) { return FALSE; }
+void FASTCALL MMU_ldtlb( void ) { state.calls++; }
+void syscall_invoke( uint32_t val ) { }
+void sh4_handle_pending_events( void ) { }
+void TMU_run_slice( uint32_t nanos ) { }
+void SCIF_run_slice( uint32_t nanos ) { }
+void log_message( void *ptr, int level, const gchar *source, const char *msg, ... ) { }
+
+/**
+ * Run the instruction ir from the given starting state with the given core,
+ * leaving the results in state.
+ */
+static void run_instruction( const struct test_state *start, uint16_t ir,
+                             gboolean (*execute)(void) )
+{
+    memcpy( &state, start, sizeof(state) );
+    *(uint16_t *)(state.ram + (TEST_PC & (TEST_RAM_SIZE-1))) = ir;
+    memcpy( &sh4r, &state.regs, sizeof(sh4r) );
+    sh4_icache.mask = 0xFFFFF000;
+    sh4_icache.page_vma = TEST_PC & 0xFFFFF000;
+    sh4_icache.page = state.ram;
+    sh4_icache.page_ppa = TEST_PC & 0x1FFFF000;
+    execute();
+    memcpy( &state.regs, &sh4r, sizeof(sh4r) );
+}
+
+static void init_state( struct test_state *start, uint32_t sr, uint32_t fpscr )
+{
+    int i;
+
+    memset( start, 0, sizeof(struct test_state) );
+    for( i=0; i<TEST_RAM_SIZE; i++ ) {
+        start->ram[i] = (unsigned char)rand();
+    }
+    for( i=0; i<16; i++ ) {
+        start->regs.r[i] = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+        start->regs.fr[0][i] = (float)(rand() - RAND_MAX/2) / 1024.0f;
+        start->regs.fr[1][i] = (float)(rand() - RAND_MAX/2) / 1024.0f;
+    }
+    for( i=0; i<8; i++ ) {
+        start->regs.r_bank[i] = (uint32_t)rand();
+    }
+    start->regs.sr = sr;
+    start->regs.fpscr = fpscr;
+    start->regs.t = rand() & 1;
+    start->regs.m = rand() & 1;
+    start->regs.q = rand() & 1;
+    start->regs.s = rand() & 1;
+    start->regs.pc = TEST_PC;
+    start->regs.new_pc = TEST_PC + 2;
+    start->regs.pr = TEST_PC + 0x100;
+    start->regs.gbr = (uint32_t)rand();
+    start->regs.mac = ((uint64_t)rand() << 32) | (uint32_t)rand();
+    start->regs.event_pending = 0xFFFFFFFF;
+}
+
+int main( int argc, char *argv[] )
+{
+    /* Privileged with the FPU enabled, in each FPU precision/size mode */
+    static const uint32_t fpscr_modes[] = { 0x00040001, 0x00080000, 0x00100000, 0x00180000 };
+    struct test_state start, table_result;
+    int failures = 0, mode;
+    uint32_t ir;
+
+    mmio_region_CPG.mem = calloc( 1, 4096 );
+    srand(1);
+    for( mode=0; mode<4; mode++ ) {
+        init_state( &start, 0x700000F0, fpscr_modes[mode] );
+        for( ir=0; ir<0x10000; ir++ ) {
+            run_instruction( &start, ir, sh4_execute_instruction );
+            memcpy( &table_result, &state, sizeof(state) );
+            run_instruction( &start, ir, sh4_execute_instruction_switch );
+            if( memcmp( &table_result, &state, sizeof(state) ) != 0 ) {
+                if( failures++ < 10 ) {
+                    printf( "FAIL: Results differ for %04X (FPSCR = %08X)\n", ir, fpscr_modes[mode] );
+                }
+            }
+        }
+    }
+    if( failures == 0 ) {
+        printf( "OK: jump table and switch decoders agree on all instructions\n" );
+    } else {
+        printf( "%d instructions differ\n", failures );
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -42,7 +42,7 @@ gboolean sh4_profile_blocks = FALSE;
 
 struct mem_region_fn **sh4_address_space = (void *)0x12345432;
 struct mem_region_fn **sh4_user_address_space = (void *)0x12345678;
-char *option_list = "s:o:d:h";
+char *option_list = "s:o:d:hSO";
 struct option longopts[1] = { { NULL, 0, 0, 0 } };
 
 char *input_file = NULL;
@@ -51,8 +51,10 @@ char *output_file = NULL;
 gboolean sh4_starting;
 uint32_t start_addr = 0x8C010000;
 uint32_t sh4_cpu_period = 5;
-unsigned char dc_main_ram[4096];
+static unsigned char main_ram[4096];
+unsigned char *dc_main_ram = main_ram;
 unsigned char dc_boot_rom[4096];
+struct mem_region_fn mem_region_sdram;
 FILE *in;
 
 char *inbuf;
@@ -62,6 +64,8 @@ struct xlat_symbol local_symbols[] = {
     { "sh4_cpu_period", &sh4_cpu_period },
     { "sh4_address_space", (void *)0x12345432 },
     { "sh4_user_address_space", (void *)0x12345678 },
+    { "dc_main_ram", main_ram },
+    { "mem_region_sdram", &mem_region_sdram },
     { "sh4_write_fpscr", sh4_write_fpscr },
     { "sh4_write_sr", sh4_write_sr },
     { "sh4_read_sr", sh4_read_sr },
@@ -114,6 +118,11 @@ void sh4_handle_pending_events() { }
 uint32_t sh4_sleep_run_slice(uint32_t nanosecs) { return nanosecs; }
 gboolean gui_error_dialog( const char *fmt, ... ) { return TRUE; }
 gboolean FASTCALL mmu_update_icache( sh4vma_t addr ) { return TRUE; }
+void *mmu_get_fastmem_base() { return NULL; }
+gboolean sdram_enable_code_protection( void ) { return FALSE; }
+void sdram_protect_code( sh4addr_t start, sh4addr_t end ) { }
+gboolean sdram_is_code_checked( sh4addr_t addr ) { return FALSE; }
+uint32_t FASTCALL sdram_get_code_hash( sh4addr_t start, sh4addr_t end ) { return 0; }
 void MMU_ldtlb() { }
 void event_schedule(int event, uint32_t nanos) { }
 struct sh4_icache_struct sh4_icache;
@@ -129,6 +138,8 @@ void usage()
     fprintf( stderr, "  -h             Display this help message\n" );
     fprintf( stderr, "  -o <filename>  Output disassembly to file [stdout]\n" );
     fprintf( stderr, "  -s <addr>      Specify start address of binary [8C010000]\n" );
+    fprintf( stderr, "  -S             Enable superblock translation\n" );
+    fprintf( stderr, "  -O             Enable the IR optimization passes\n" );
 }
 
 void emit( void *ptr, int level, const gchar *source, const char *msg, ... )
@@ -159,6 +170,12 @@ int main( int argc, char *argv[] )
 	case 's':
 	    start_addr = strtoul(optarg, NULL, 0);
 	    break;
+	case 'S':
+	    sh4_translate_set_superblocks( TRUE );
+	    break;
+	case 'O':
+	    sh4_translate_set_optimize( TRUE );
+	    break;
 	case 'h':
 	    usage();
 	    exit(0);
@@ -190,6 +207,7 @@ int main( int argc, char *argv[] )
     sh4_icache.page_ppa = start_addr & 0xFFFFF000;
 
     xlat_cache_init();
+    sh4_translate_init();
     uintptr_t pc;
     uint8_t *buf = sh4_translate_basic_block( start_addr );
     uint32_t buflen = xlat_get_code_size(buf);
@@ -27,6 +27,8 @@ void sh4_translate_unlink_block( void *use_list )
 {
 }
 
+void log_message( void *ptr, int level, const gchar *source, const char *msg, ... ) { }
+
 /**
  * Test initial allocations from the new cache
  */
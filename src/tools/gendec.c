@@ -38,15 +38,17 @@ const char *out_filename = NULL;
 
 FILE *ins_file, *act_file, *out_file;
 
-char *option_list = "tmho:w";
+char *option_list = "tmho:wj";
 int gen_mode = GEN_SOURCE;
 int emit_warnings = 0;
+int emit_jump_table = 0;
 
 struct option longopts[] = { 
     { "help", no_argument, NULL, 'h' },
     { "output", required_argument, NULL, 'o' },
     { "template", no_argument, NULL, 't' },
     { "warnings", no_argument, NULL, 'w' },
+    { "jump-table", no_argument, NULL, 'j' },
     { NULL, 0, 0, 0 } };
 
 static void usage() {
@@ -56,6 +58,8 @@ static void usage() {
     printf( "  -o, --output=FILE  Generate output to the given file\n" );
     printf( "  -t, --template     Generate a template skeleton instead of an instruction matcher\n" );
     printf( "  -w, --warnings     Emit warnings when unmatched instructions are found\n" );
+    printf( "  -j, --jump-table   Dispatch through a table indexed by the instruction, using\n" );
+    printf( "                     computed goto (16-bit instructions only, requires GCC)\n" );
 }
 
 /**
@@ -271,9 +275,118 @@ static void split_and_generate( struct ruleset *rules, const struct action *acti
     }
 }
 
+/**
+ * Fill in the rule for each instruction word in the same way as the decoder
+ * generated by split_and_generate. Note that this stops testing bits as soon
+ * as only one rule is left, so some undefined instructions decode to the
+ * nearest rule, as they do with the switch.
+ * @return 0 on success, -1 if the rules can't be split
+ */
+static int fill_jump_table( struct ruleset *rules, int ruleidx[], int rule_count,
+                            uint32_t input_mask, uint32_t input_bits, uint16_t *table )
+{
+    uint32_t mask, ir;
+    int i,j;
+
+    if( rule_count == 1 ) {
+        for( ir=0; ir<0x10000; ir++ ) {
+            if( (ir & input_mask) == input_bits ) {
+                table[ir] = ruleidx[0];
+            }
+        }
+    } else if( rule_count > 1 ) {
+        mask = find_mask(rules, ruleidx, rule_count, input_mask);
+        if( mask == 0 ) { /* No matching mask? */
+            fprintf( stderr, "Error: unable to find a valid bitmask (%d rules, %08X input mask)\n", rule_count, input_mask );
+            dump_rulesubset( rules, ruleidx, rule_count, stderr );
+            return -1;
+        }
+
+        int option_count = get_option_count_for_mask( mask );
+        uint32_t options[option_count];
+        int subruleidx[rule_count];
+        int subrule_count;
+        get_option_values_for_mask( options, mask );
+
+        for( i=0; i<option_count; i++ ) {
+            subrule_count = 0;
+            for( j=0; j<rule_count; j++ ) {
+                if( (rules->rules[ruleidx[j]]->bits & mask) == options[i] ) {
+                    subruleidx[subrule_count++] = ruleidx[j];
+                }
+            }
+            if( fill_jump_table( rules, subruleidx, subrule_count, mask|input_mask,
+                                 options[i]|input_bits, table ) != 0 ) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Generate a decoder for 16-bit instructions which looks up the rule for the
+ * instruction in a table of all possible instruction words, and jumps
+ * directly to the action through a table of label addresses. The table
+ * selects the same rule as the switch-based decoder for every instruction
+ * (see fill_jump_table).
+ */
+static int generate_jump_table( struct ruleset *rules, const struct action *actions,
+                                int ruleidx[], int block, FILE *f )
+{
+    uint32_t undef = rules->rule_count;
+    const char *index_type = undef < 256 ? "uint8_t" : "uint16_t";
+    uint16_t *table;
+    uint32_t ir;
+    int i;
+
+    for( i=0; i<rules->rule_count; i++ ) {
+        if( (rules->rules[i]->mask & 0xFFFF0000) != 0 ) {
+            fprintf( stderr, "Error: jump tables are only supported for 16-bit instructions (rule %s)\n",
+                     rules->rules[i]->format );
+            return -1;
+        }
+    }
+
+    table = malloc( 0x10000 * sizeof(uint16_t) );
+    for( ir=0; ir<0x10000; ir++ ) {
+        table[ir] = undef;
+    }
+    if( fill_jump_table( rules, ruleidx, rules->rule_count, 0, 0, table ) != 0 ) {
+        free( table );
+        return -1;
+    }
+
+    fprintf( f, "    {\n" );
+    fprintf( f, "        static const %s gendec%d_index[0x10000] = {", index_type, block );
+    for( ir=0; ir<0x10000; ir++ ) {
+        fprintf( f, "%s%d%s", (ir&0x0F) == 0 ? "\n            " : "", table[ir],
+                 ir == 0xFFFF ? "" : "," );
+    }
+    fprintf( f, " };\n" );
+    free( table );
+
+    fprintf( f, "        static void * const gendec%d_labels[] = {", block );
+    for( i=0; i<rules->rule_count; i++ ) {
+        fprintf( f, "%s&&gendec%d_rule%d,", (i&0x07) == 0 ? "\n            " : " ", block, i );
+    }
+    fprintf( f, "\n            &&gendec%d_undef };\n", block );
+    fprintf( f, "        goto *gendec%d_labels[gendec%d_index[ir]];\n", block, block );
+
+    for( i=0; i<rules->rule_count; i++ ) {
+        fprintf( f, "    gendec%d_rule%d:\n", block, i );
+        fprint_action( rules->rules[i], &actions[i], 1, f );
+        fprintf( f, "        goto gendec%d_end;\n", block );
+    }
+    fprintf( f, "    gendec%d_undef:\n        UNDEF(ir);\n", block );
+    fprintf( f, "    gendec%d_end: ;\n    }\n", block );
+    return 0;
+}
+
 static int generate_decoder( struct ruleset *rules, actionfile_t af, FILE *out )
 {
     int ruleidx[rules->rule_count];
+    int block = 0;
     int i;
 
     for( i=0; i<rules->rule_count; i++ ) {
@@ -292,7 +405,13 @@ static int generate_decoder( struct ruleset *rules, actionfile_t af, FILE *out )
             if( emit_warnings ) {
                 check_actions( rules, token );
             }
-            split_and_generate( rules, token->actions, ruleidx, rules->rule_count, 0, 1, out );
+            if( emit_jump_table ) {
+                if( generate_jump_table( rules, token->actions, ruleidx, block++, out ) != 0 ) {
+                    return -1;
+                }
+            } else {
+                split_and_generate( rules, token->actions, ruleidx, rules->rule_count, 0, 1, out );
+            }
         }
         token = action_file_next(af);
     }
@@ -341,6 +460,9 @@ int main( int argc, char *argv[] )
         case 'w':
             emit_warnings = 1;
             break;
+        case 'j':
+            emit_jump_table = 1;
+            break;
         case 'h':
             usage();
             exit(0);
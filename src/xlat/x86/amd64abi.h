@@ -36,6 +36,27 @@ static inline void decode_address( uintptr_t base, int addr_reg, int target_reg
     MOVP_sib_rptr( 3, target_reg, REG_RDI, 0, target_reg );
 }
 
+/**
+ * Compare a register against a host pointer constant. Clobbers RDI (as per
+ * decode_address)
+ */
+static inline void compare_host_ptr( uintptr_t ptr, int reg )
+{
+    MOVP_immptr_rptr( ptr, REG_RDI );
+    CMPP_rptr_rptr( REG_RDI, reg );
+}
+
+/**
+ * Setup to address host memory at base + index, returning the base register
+ * and displacement to use for the sib-form instruction. Clobbers RDI.
+ */
+static inline int load_host_base( uintptr_t base, int32_t *disp )
+{
+    MOVP_immptr_rptr( base, REG_RDI );
+    *disp = 0;
+    return REG_RDI;
+}
+
 /**
  * Note: clobbers ECX to make the indirect call - this isn't usually
  * a problem since the callee will generally clobber it anyway.
@@ -0,0 +1,92 @@
+/**
+ * $Id$
+ * 
+ * Fault handling for fastmem accesses in translated x86 code. This is kept
+ * apart from the code generator as the host's signal context definitions
+ * conflict with the x86op.h register names.
+ *
+ * Copyright (c) 2005 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for REG_RIP */
+#endif
+
+#include <stdint.h>
+#include <signal.h>
+#include "xlat/x86/fastmem.h"
+#include "mem.h"
+
+#if SIZEOF_VOID_P == 8 && defined(__linux__) && defined(REG_RIP)
+
+static uintptr_t fastmem_base = 0;
+static struct sigaction fastmem_old_action;
+
+static void fastmem_fault( int signo, siginfo_t *info, void *ptr )
+{
+    ucontext_t *uc = (ucontext_t *)ptr;
+    uintptr_t fault = (uintptr_t)info->si_addr;
+
+    if( mem_handle_write_fault( info->si_addr ) ) {
+        return; /* Write to a protected page, not an unmapped one */
+    }
+    if( fault - fastmem_base < (((uintptr_t)1)<<32) ) {
+        uint8_t *site = ((uint8_t *)uc->uc_mcontext.gregs[REG_RIP]) - FASTMEM_SITE_SIZE;
+        /* 48 BF imm64 = mov $imm64, %rdi */
+        if( site[0] == 0x48 && site[1] == 0xBF && *((uintptr_t *)(site+2)) == fastmem_base ) {
+            uint8_t *slow = site + FASTMEM_SITE_SIZE + FASTMEM_ACCESS_SIZE + 2;
+            *((int32_t *)(site+1)) = (int32_t)(slow - (site+5));
+            site[0] = 0xE9; /* jmp rel32 */
+            uc->uc_mcontext.gregs[REG_RIP] = (greg_t)site;
+            return;
+        }
+    }
+
+    /* Not ours - pass it on */
+    if( fastmem_old_action.sa_flags & SA_SIGINFO ) {
+        fastmem_old_action.sa_sigaction( signo, info, ptr );
+    } else if( fastmem_old_action.sa_handler == SIG_DFL ||
+               fastmem_old_action.sa_handler == SIG_IGN ) {
+        /* Restore the previous action and let the fault happen again */
+        sigaction( signo, &fastmem_old_action, NULL );
+    } else {
+        fastmem_old_action.sa_handler( signo );
+    }
+}
+
+gboolean x86_fastmem_install( void *base )
+{
+    struct sigaction sa;
+
+    if( fastmem_base != 0 ) {
+        fastmem_base = (uintptr_t)base;
+        return TRUE;
+    }
+    sa.sa_sigaction = fastmem_fault;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_SIGINFO;
+    if( sigaction( SIGSEGV, &sa, &fastmem_old_action ) != 0 ) {
+        return FALSE;
+    }
+    fastmem_base = (uintptr_t)base;
+    return TRUE;
+}
+
+#else
+
+gboolean x86_fastmem_install( void *base )
+{
+    return FALSE;
+}
+
+#endif
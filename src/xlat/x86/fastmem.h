@@ -0,0 +1,48 @@
+/**
+ * $Id$
+ * 
+ * Fault handling for fastmem accesses in translated x86 code.
+ *
+ * Copyright (c) 2005 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef lxdream_x86_fastmem_H
+#define lxdream_x86_fastmem_H 1
+
+#include "dream.h"
+
+/**
+ * Fastmem access sites have the fixed layout
+ *     mov $base, %rdi             (FASTMEM_SITE_SIZE bytes)
+ *     <access> (%rdi,%rcx)        (padded to FASTMEM_ACCESS_SIZE bytes)
+ *     jmp done                    (2 bytes)
+ *   slow:
+ *     <region function call>
+ *   done:
+ * where base is the 4GB view of the address space. When the access faults
+ * (ie the address isn't mapped in the view), the handler overwrites the mov
+ * with a jmp to the slow path and restarts at the site, so each site faults
+ * at most once.
+ */
+#define FASTMEM_SITE_SIZE 10
+#define FASTMEM_ACCESS_SIZE 6
+
+/**
+ * Install the fault handler for access sites using the given base. Any faults
+ * that aren't at an access site are passed on to the previous handler.
+ * @return TRUE if the handler was installed, FALSE if fastmem isn't supported
+ * on this host.
+ */
+gboolean x86_fastmem_install( void *base );
+
+#endif /* !lxdream_x86_fastmem_H */
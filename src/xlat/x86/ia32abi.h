@@ -37,6 +37,25 @@ static inline void decode_address( uintptr_t base, int addr_reg, int target_reg
     MOVP_sib_rptr( 2, target_reg, -1, base, target_reg );
 }
 
+/**
+ * Compare a register against a host pointer constant.
+ */
+static inline void compare_host_ptr( uintptr_t ptr, int reg )
+{
+    CMPL_imms_r32( ptr, reg );
+}
+
+/**
+ * Setup to address host memory at base + index, returning the base register
+ * and displacement to use for the sib-form instruction. (On ia32 the base
+ * pointer fits in the displacement, so no register is required)
+ */
+static inline int load_host_base( uintptr_t base, int32_t *disp )
+{
+    *disp = (int32_t)base;
+    return -1;
+}
+
 /**
  * Note: clobbers ECX to make the indirect call - this isn't usually
  * a problem since the callee will generally clobber it anyway.
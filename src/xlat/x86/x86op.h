@@ -137,13 +137,14 @@
 /* PREF_REXW if required for pointer operations, otherwise 0 */
 #define PREF_PTR     ((sizeof(void *) == 8) ? PREF_REXW : 0) 
 
-extern unsigned char *xlat_output;
+extern __thread unsigned char *xlat_output;
+extern void xlat_note_host_pointer( unsigned char *ptr );
 
 #define OP(x) *xlat_output++ = (x)
 #define OP16(x) *((uint16_t *)xlat_output) = (x); xlat_output+=2
 #define OP32(x) *((uint32_t *)xlat_output) = (x); xlat_output+=4
 #define OP64(x) *((uint64_t *)xlat_output) = (x); xlat_output+=8
-#define OPPTR(x) *((void **)xlat_output) = ((void *)x); xlat_output+=(sizeof(void*))
+#define OPPTR(x) xlat_note_host_pointer(xlat_output); *((void **)xlat_output) = ((void *)x); xlat_output+=(sizeof(void*))
 
 /* Primary opcode emitter, eg OPCODE(0x0FBE) for MOVSX */
 #define OPCODE(x) if( (x) > 0xFFFF ) { OP((x)>>16); OP(((x)>>8)&0xFF); OP((x)&0xFF); } else if( (x) > 0xFF ) { OP((x)>>8); OP((x)&0xFF); } else { OP(x); }
@@ -373,6 +374,7 @@ static inline void x86_encode_modrm_rip(int rexw, uint32_t opcode, int rr, int32
 #define ADDL_r32_r32(r1,r2)          x86_encode_r32_rm32(0x01, r1, r2)
 #define ADDL_r32_rbpdisp(r1,disp)    x86_encode_r32_rbpdisp32(0x01, r1, disp)
 #define ADDL_r32_r32disp(r1,r2,dsp)  x86_encode_r32_mem32disp32(0x01, r1, r2, dsp)
+#define ADDL_r32disp_r32(r1,dsp,r2)  x86_encode_r32_mem32disp32(0x03, r2, r1, dsp)
 #define ADDL_rbpdisp_r32(disp,r1)    x86_encode_r32_rbpdisp32(0x03, r1, disp)
 #define ADDQ_imms_r64(imm,r1)        x86_encode_imms_rm64(0x83, 0x81, 0, imm, r1)
 #define ADDQ_r64_r64(r1,r2)          x86_encode_r64_rm64(0x01, r1, r2)
@@ -407,6 +409,7 @@ static inline void x86_encode_modrm_rip(int rexw, uint32_t opcode, int rr, int32
 #define CMPL_rbpdisp_r32(disp,r1)    x86_encode_r32_rbpdisp32(0x3B, r1, disp)
 #define CMPQ_imms_r64(imm,r1)        x86_encode_imms_rm64(0x83, 0x81, 7, imm, r1)
 #define CMPQ_r64_r64(r1,r2)          x86_encode_r64_rm64(0x39, r1, r2)
+#define CMPP_rptr_rptr(r1,r2)        x86_encode_rptr_rmptr(0x39, r1, r2)
 
 #define IDIVL_r32(r1)                x86_encode_r32_rm32(0xF7, 7, r1)
 #define IDIVL_rbpdisp(disp)          x86_encode_r32_rbpdisp32(0xF7, 7, disp)
@@ -434,6 +437,7 @@ static inline void x86_encode_modrm_rip(int rexw, uint32_t opcode, int rr, int32
 #define LEAP_sib_rptr(ss,ii,bb,d,r1) x86_encode_rptr_memptr(0x8D, r1, bb, ii, ss, d)
 
 #define MOVB_r8_r8(r1,r2)            x86_encode_r32_rm32(0x88, r1, r2)
+#define MOVB_r8_sib(r1,ss,ii,bb,d)   x86_encode_r32_mem32(0x88, r1, bb, ii, ss, d)
 #define MOVL_imm32_r32(i32,r1)       x86_encode_opcode32(0xB8, r1); OP32(i32)
 #define MOVL_imm32_rbpdisp(i,disp)   x86_encode_r32_rbpdisp32(0xC7,0,disp); OP32(i)
 #define MOVL_imm32_rspdisp(i,disp)   x86_encode_r32_rspdisp32(0xC7,0,disp); OP32(i)
@@ -464,12 +468,16 @@ static inline void x86_encode_modrm_rip(int rexw, uint32_t opcode, int rr, int32
 #define MOVSXL_r16_r32(r1,r2)        x86_encode_r32_rm32(0x0FBF, r2, r1)
 #define MOVSXL_rbpdisp8_r32(disp,r1) x86_encode_r32_rbpdisp32(0x0FBE, r1, disp) 
 #define MOVSXL_rbpdisp16_r32(dsp,r1) x86_encode_r32_rbpdisp32(0x0FBF, r1, dsp) 
+#define MOVSXL_sib8_r32(ss,ii,bb,d,r1)  x86_encode_r32_mem32(0x0FBE, r1, bb, ii, ss, d)
+#define MOVSXL_sib16_r32(ss,ii,bb,d,r1) x86_encode_r32_mem32(0x0FBF, r1, bb, ii, ss, d)
 #define MOVSXQ_imm32_r64(i32,r1)     x86_encode_r64_rm64(0xC7, 0, r1); OP32(i32) /* Technically a MOV */
 #define MOVSXQ_r8_r64(r1,r2)         x86_encode_r64_rm64(0x0FBE, r2, r1)
 #define MOVSXQ_r16_r64(r1,r2)        x86_encode_r64_rm64(0x0FBF, r2, r1)
 #define MOVSXQ_r32_r64(r1,r2)        x86_encode_r64_rm64(0x63, r2, r1)
 #define MOVSXQ_rbpdisp32_r64(dsp,r1) x86_encode_r64_rbpdisp64(0x63, r1, dsp)
 
+#define MOVW_r16_sib(r1,ss,ii,bb,d)  OP(0x66); x86_encode_r32_mem32(0x89, r1, bb, ii, ss, d)
+
 #define MOVZXL_r8_r32(r1,r2)         x86_encode_r32_rm32(0x0FB6, r2, r1)
 #define MOVZXL_r16_r32(r1,r2)        x86_encode_r32_rm32(0x0FB7, r2, r1)
 #define MOVZXL_rbpdisp8_r32(disp,r1) x86_encode_r32_rbpdisp32(0x0FB6, r1, disp)
@@ -773,6 +781,21 @@ static inline void x86_encode_modrm_rip(int rexw, uint32_t opcode, int rr, int32
 #define UCOMISD_rbpdisp_xmm(dsp,r1)  OP(0x66); x86_encode_r32_rbpdisp32(0x0F2E, r1, dsp)
 #define UCOMISD_xmm_xmm(r1,r2)       OP(0x66); x86_encode_r32_rm32(0x0F2E, r2, r1)
 
+/* SSE/SSE2 floating point conversion instructions */
+#define CVTSD2SS_rbpdisp_xmm(dsp,r1) OP(0xF2); x86_encode_r32_rbpdisp32(0x0F5A, r1, dsp)
+#define CVTSD2SS_xmm_xmm(r1,r2)      OP(0xF2); x86_encode_r32_rm32(0x0F5A, r2, r1)
+#define CVTSI2SD_rbpdisp_xmm(dsp,r1) OP(0xF2); x86_encode_r32_rbpdisp32(0x0F2A, r1, dsp)
+#define CVTSI2SS_rbpdisp_xmm(dsp,r1) OP(0xF3); x86_encode_r32_rbpdisp32(0x0F2A, r1, dsp)
+#define CVTSS2SD_rbpdisp_xmm(dsp,r1) OP(0xF3); x86_encode_r32_rbpdisp32(0x0F5A, r1, dsp)
+#define CVTSS2SD_xmm_xmm(r1,r2)      OP(0xF3); x86_encode_r32_rm32(0x0F5A, r2, r1)
+#define CVTTSD2SI_rbpdisp_r32(dsp,r1) OP(0xF2); x86_encode_r32_rbpdisp32(0x0F2C, r1, dsp)
+#define CVTTSS2SI_rbpdisp_r32(dsp,r1) OP(0xF3); x86_encode_r32_rbpdisp32(0x0F2C, r1, dsp)
+
+/* SSE2 integer instructions */
+#define MOVD_r32_xmm(r1,r2)          OP(0x66); x86_encode_r32_rm32(0x0F6E, r2, r1)
+#define PSHUFD_imm_rbpdisp_xmm(imm,dsp,r1) OP(0x66); x86_encode_r32_rbpdisp32(0x0F70, r1, dsp); OP(imm)
+#define PSHUFD_imm_xmm_xmm(imm,r1,r2) OP(0x66); x86_encode_r32_rm32(0x0F70, r2, r1); OP(imm)
+
 /* SSE3 floating point instructions */
 #define ADDSUBPD_rbpdisp_xmm(dsp,r1) OP(0x66); x86_encode_r32_rbpdisp32(0x0FD0, r1, dsp)
 #define ADDSUBPD_xmm_xmm(r1,r2)      OP(0x66); x86_encode_r32_rm32(0x0FD0, r2, r1)
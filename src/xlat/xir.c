@@ -0,0 +1,156 @@
+/**
+ * $Id$
+ *
+ * Optimization passes over the translator IR.
+ *
+ * Copyright (c) 2005 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "xlat/xir.h"
+
+/**
+ * Evaluate the operation given the (known) register values.
+ * @return TRUE if the result could be computed, otherwise FALSE.
+ */
+static gboolean xir_evaluate( xir_op_t op, uint32_t known, uint32_t *values )
+{
+    uint32_t dest = values[op->dest];
+    uint32_t src = values[op->src];
+    gboolean need_dest = FALSE, need_src = FALSE;
+    uint32_t result;
+
+    switch( op->opcode ) {
+    case XIR_MOV_IMM: result = op->imm; break;
+    case XIR_MOV: need_src = TRUE; result = src; break;
+    case XIR_ADD_IMM: need_dest = TRUE; result = dest + op->imm; break;
+    case XIR_ADD: need_dest = need_src = TRUE; result = dest + src; break;
+    case XIR_SUB: need_dest = need_src = TRUE; result = dest - src; break;
+    case XIR_AND_IMM: need_dest = TRUE; result = dest & op->imm; break;
+    case XIR_AND: need_dest = need_src = TRUE; result = dest & src; break;
+    case XIR_OR_IMM: need_dest = TRUE; result = dest | op->imm; break;
+    case XIR_OR: need_dest = need_src = TRUE; result = dest | src; break;
+    case XIR_XOR_IMM: need_dest = TRUE; result = dest ^ op->imm; break;
+    case XIR_XOR: need_dest = need_src = TRUE; result = dest ^ src; break;
+    case XIR_SHL_IMM: need_dest = TRUE; result = dest << op->imm; break;
+    case XIR_SHR_IMM: need_dest = TRUE; result = dest >> op->imm; break;
+    case XIR_NEG: need_src = TRUE; result = -src; break;
+    case XIR_NOT: need_src = TRUE; result = ~src; break;
+    case XIR_EXTS8: need_src = TRUE; result = (int32_t)(int8_t)src; break;
+    case XIR_EXTS16: need_src = TRUE; result = (int32_t)(int16_t)src; break;
+    case XIR_EXTU8: need_src = TRUE; result = (uint8_t)src; break;
+    case XIR_EXTU16: need_src = TRUE; result = (uint16_t)src; break;
+    default: return FALSE;
+    }
+
+    if( (need_dest && (known & XIR_RES_REG(op->dest)) == 0) ||
+        (need_src && (known & XIR_RES_REG(op->src)) == 0) ) {
+        return FALSE;
+    }
+    op->value = result;
+    return TRUE;
+}
+
+void xir_pass_constants( xir_block_t block )
+{
+    uint32_t values[XIR_MAX_REGS] = { 0 };
+    uint32_t known = 0;
+    int i;
+
+    for( i=0; i<block->count; i++ ) {
+        xir_op_t op = &block->ops[i];
+        if( xir_evaluate( op, known, values ) ) {
+            op->result |= XIR_RESULT_CONSTANT;
+            /* The folded instruction no longer needs its operands */
+            op->use &= ~XIR_RES_REGS;
+            values[op->dest] = op->value;
+            known |= XIR_RES_REG(op->dest);
+        } else {
+            known &= ~op->def;
+        }
+    }
+}
+
+void xir_pass_liveness( xir_block_t block )
+{
+    uint32_t live = XIR_RES_ALL;
+    int i;
+
+    for( i=block->count-1; i>=0; i-- ) {
+        xir_op_t op = &block->ops[i];
+        if( (op->flags & XIR_FLAG_BARRIER) || (op->result & XIR_RESULT_MODE_CHECK) ) {
+            /* Everything is live on both sides, including the instruction's
+             * own results (as it may not complete) */
+            live = XIR_RES_ALL;
+            continue;
+        }
+        if( (op->flags & XIR_FLAG_PURE) && (op->def & live) == 0 ) {
+            /* Skip over the instruction entirely - it doesn't read anything either */
+            op->result |= XIR_RESULT_DEAD;
+            continue;
+        }
+        if( (op->def & XIR_RES_FLAG) && (live & XIR_RES_FLAG) == 0 ) {
+            op->result |= XIR_RESULT_FLAG_DEAD;
+        }
+        live = (live & ~op->def) | op->use;
+    }
+}
+
+void xir_pass_mode_checks( xir_block_t block )
+{
+    gboolean checked = FALSE;
+    int i;
+
+    for( i=0; i<block->count; i++ ) {
+        xir_op_t op = &block->ops[i];
+        if( (op->flags & XIR_FLAG_MODE_CHECK) && !checked ) {
+            op->result |= XIR_RESULT_MODE_CHECK;
+            checked = TRUE;
+        }
+        if( op->def & XIR_RES_MODE ) {
+            checked = FALSE;
+        }
+        if( (op->flags & XIR_FLAG_SPLIT) && i+1 < block->count &&
+            (block->ops[i+1].flags & XIR_FLAG_MODE_CHECK) && !checked ) {
+            op->result |= XIR_RESULT_MODE_CHECK;
+            checked = TRUE;
+        }
+    }
+}
+
+void xir_optimize( xir_block_t block )
+{
+    xir_pass_constants( block );
+    xir_pass_mode_checks( block );
+    xir_pass_liveness( block );
+}
+
+gboolean xir_is_idle_loop( xir_block_t block )
+{
+    uint32_t written = 0, read_first = 0;
+    int i;
+
+    for( i=0; i<block->count; i++ ) {
+        xir_op_t op = &block->ops[i];
+        if( op->flags & XIR_FLAG_END ) {
+            /* The loop branch, or a conditional branch out of the loop */
+            if( op->def != 0 ) {
+                return FALSE;
+            }
+        } else if( (op->flags & (XIR_FLAG_PURE|XIR_FLAG_NO_SIDE_EFFECTS)) == 0 ) {
+            return FALSE;
+        }
+        read_first |= op->use & ~written;
+        written |= op->def;
+    }
+    return block->count != 0 && (read_first & written) == 0;
+}
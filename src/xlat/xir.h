@@ -0,0 +1,192 @@
+/**
+ * $Id$
+ *
+ * Intermediate representation for the translators (architecture independent).
+ *
+ * The IR is deliberately minimal - each source instruction in a linear run of
+ * code is described by the resources it reads and writes, plus (for a small
+ * set of simple ALU operations) enough information to evaluate it. The
+ * optimization passes then annotate each instruction with results that the
+ * target code generator can use to emit better code (or no code at all).
+ * Code generation itself still works directly from the source instructions.
+ *
+ * Copyright (c) 2005 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef lxdream_xir_H
+#define lxdream_xir_H 1
+
+#include <stdint.h>
+#include "dream.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Maximum number of instructions in an IR block */
+#define XIR_MAX_OPS 128
+
+/**
+ * Resources tracked by the passes. General registers 0..XIR_MAX_REGS-1 are
+ * tracked individually, together with the condition flag and the mode
+ * register (ie whatever the XIR_FLAG_MODE_CHECK checks depend on). Anything
+ * else is not tracked, so any instruction which affects untracked state must
+ * not be marked XIR_FLAG_PURE.
+ */
+#define XIR_MAX_REGS 16
+#define XIR_RES_REG(n) (1<<(n))
+#define XIR_RES_REGS   0x0000FFFF
+#define XIR_RES_FLAG   0x00010000
+#define XIR_RES_MODE   0x00020000
+#define XIR_RES_ALL    0xFFFFFFFF
+
+/**
+ * Operations that the passes know how to evaluate. Everything else is
+ * XIR_OTHER, and is only described by its use/def sets.
+ */
+typedef enum {
+    XIR_OTHER = 0,
+    XIR_MOV_IMM,   /* dest = imm */
+    XIR_MOV,       /* dest = src */
+    XIR_ADD_IMM,   /* dest += imm */
+    XIR_ADD,       /* dest += src */
+    XIR_SUB,       /* dest -= src */
+    XIR_AND_IMM,   /* dest &= imm */
+    XIR_AND,       /* dest &= src */
+    XIR_OR_IMM,    /* dest |= imm */
+    XIR_OR,        /* dest |= src */
+    XIR_XOR_IMM,   /* dest ^= imm */
+    XIR_XOR,       /* dest ^= src */
+    XIR_SHL_IMM,   /* dest <<= imm */
+    XIR_SHR_IMM,   /* dest >>= imm (logical) */
+    XIR_NEG,       /* dest = -src */
+    XIR_NOT,       /* dest = ~src */
+    XIR_EXTS8,     /* dest = (int8_t)src */
+    XIR_EXTS16,    /* dest = (int16_t)src */
+    XIR_EXTU8,     /* dest = (uint8_t)src */
+    XIR_EXTU16     /* dest = (uint16_t)src */
+} xir_opcode_t;
+
+/* Instruction properties (set by the front-end) */
+/** The only effect of the instruction is to write its def set */
+#define XIR_FLAG_PURE       0x01
+/** The instruction may raise an exception, exit the block or otherwise expose
+ * the machine state, so all resources are live before and after it. */
+#define XIR_FLAG_BARRIER    0x02
+/** The instruction ends the run (ie a branch, or anything that ends the block) */
+#define XIR_FLAG_END        0x04
+/** The instruction is a delayed branch - the run also includes the delay slot */
+#define XIR_FLAG_DELAYED    0x08
+/** Delayed branch whose slot is generated on both sides of the branch (ie a
+ * conditional delayed branch) */
+#define XIR_FLAG_SPLIT      0x10
+/** The instruction requires the mode check (eg FPU enabled) to have been done */
+#define XIR_FLAG_MODE_CHECK 0x20
+/** The instruction doesn't write memory or any untracked state, although it
+ * may read them (and may raise an exception). Implied by XIR_FLAG_PURE. */
+#define XIR_FLAG_NO_SIDE_EFFECTS 0x40
+
+/* Pass results */
+/** The instruction has no live effects, and doesn't need to be generated */
+#define XIR_RESULT_DEAD       0x01
+/** The flag written by the instruction is dead, and doesn't need to be stored */
+#define XIR_RESULT_FLAG_DEAD  0x02
+/** The result of the instruction is the constant xir_op.value */
+#define XIR_RESULT_CONSTANT   0x04
+/** The mode check must be generated at this instruction (for a split branch,
+ * on behalf of the delay slot) */
+#define XIR_RESULT_MODE_CHECK 0x08
+
+typedef struct xir_op {
+    uint32_t pc;          /* Source address of the instruction */
+    xir_opcode_t opcode;
+    uint8_t dest;         /* Destination register (XIR_OTHER excluded) */
+    uint8_t src;          /* Source register, for two-register operations */
+    int32_t imm;          /* Immediate operand */
+    uint32_t use;         /* Resources read by the instruction */
+    uint32_t def;         /* Resources written by the instruction */
+    uint32_t flags;       /* XIR_FLAG_* */
+    uint32_t result;      /* XIR_RESULT_* */
+    uint32_t value;       /* Result value, if XIR_RESULT_CONSTANT */
+} *xir_op_t;
+
+/**
+ * A linear run of instructions, from start_pc up to (but not including)
+ * end_pc, each instruction being 'insn_size' bytes long. Everything is
+ * considered to be live at the end of the block.
+ */
+typedef struct xir_block {
+    uint32_t start_pc;
+    uint32_t end_pc;
+    uint32_t insn_size;
+    int count;
+    struct xir_op ops[XIR_MAX_OPS+1];
+} *xir_block_t;
+
+/**
+ * Constant propagation/folding: mark every evaluable instruction whose
+ * result can be computed from constants earlier in the block.
+ */
+void xir_pass_constants( xir_block_t block );
+
+/**
+ * Mode-check placement: mark the first instruction requiring the mode check
+ * since the start of the block (or the last write to the mode register).
+ * Checks required by the delay slot of a split branch are hoisted onto the
+ * branch itself, so that they're generated once rather than on both sides.
+ */
+void xir_pass_mode_checks( xir_block_t block );
+
+/**
+ * Backwards liveness analysis: mark pure instructions with no live results as
+ * dead, and instructions whose flag result is dead. Must be run after
+ * xir_pass_constants(), as folded instructions no longer read their sources,
+ * and after xir_pass_mode_checks(), as the checks may raise exceptions.
+ */
+void xir_pass_liveness( xir_block_t block );
+
+/**
+ * Run the full pass pipeline over the block
+ */
+void xir_optimize( xir_block_t block );
+
+/**
+ * Test if the block is an idle loop, ie the body of a loop that branches
+ * back to its start at the end of the block (ending with the branch, or the
+ * branch's delay slot) and which only waits for memory to change. Apart from
+ * the branches (the loop branch and any conditional exits), every
+ * instruction must be free of side effects, and no resource may be read in
+ * the loop before it's written if it's written anywhere in the loop. Each
+ * iteration then leaves the machine in the same state as the last, until
+ * something outside the loop (ie an event) changes the memory it reads.
+ * Note the passes must not have been run on the block.
+ */
+gboolean xir_is_idle_loop( xir_block_t block );
+
+/**
+ * Retrieve the instruction at the given address, or NULL if the address
+ * is not within the block.
+ */
+static inline xir_op_t xir_get_op( xir_block_t block, uint32_t pc )
+{
+    if( pc < block->start_pc || pc >= block->end_pc ) {
+        return NULL;
+    }
+    return &block->ops[(pc - block->start_pc)/block->insn_size];
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !lxdream_xir_H */
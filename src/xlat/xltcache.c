@@ -24,16 +24,22 @@
 #include "sh4/sh4core.h"
 #include "sh4/sh4trans.h"
 #include "xlat/xltcache.h"
+#include "xlat/xltperf.h"
 
 #define XLAT_LUT_PAGE_BITS 12
 #define XLAT_LUT_TOTAL_BITS 28
-#define XLAT_LUT_PAGE(addr) (((addr)>>13) & 0xFFFF)
+#define XLAT_LUT_PAGE(addr) (((addr)>>XLAT_LUT_PAGE_SHIFT) & XLAT_LUT_PAGE_MASK)
 #define XLAT_LUT_ENTRY(addr) (((addr)&0x1FFE) >> 1)
 
 #define XLAT_LUT_PAGES (1<<(XLAT_LUT_TOTAL_BITS-XLAT_LUT_PAGE_BITS))
 #define XLAT_LUT_PAGE_ENTRIES (1<<XLAT_LUT_PAGE_BITS)
 #define XLAT_LUT_PAGE_SIZE (XLAT_LUT_PAGE_ENTRIES * sizeof(void *))
 
+/* Invalidation is done in units of 4K code pages (see xlat_flush_code_page) */
+#define XLAT_CODE_PAGE_SIZE 0x1000
+#define XLAT_CODE_PAGE_ENTRIES (XLAT_CODE_PAGE_SIZE >> 1)
+#define IS_FIRST_ENTRY_IN_CODE_PAGE(entry) (((entry) & (XLAT_CODE_PAGE_ENTRIES-1)) == 0)
+
 #define XLAT_LUT_ENTRY_EMPTY (void *)0
 #define XLAT_LUT_ENTRY_USED  (void *)1
 
@@ -68,7 +74,24 @@ xlat_cache_block_t xlat_old_cache_ptr;
 
 static void **xlat_lut[XLAT_LUT_PAGES];
 static gboolean xlat_initialized = FALSE;
+
+/* Offsets (from the start of the code) of the host pointers embedded in the
+ * block currently being created, or -1 if there were too many to record */
+#define XLAT_MAX_HOST_POINTERS 1024
+static uint32_t xlat_host_pointers[XLAT_MAX_HOST_POINTERS];
+static int xlat_host_pointer_count = 0;
+/* Likewise for the link sites in the current block */
+#define XLAT_MAX_LINK_SITES 256
+static uint32_t xlat_link_sites[XLAT_MAX_LINK_SITES];
+static int xlat_link_site_count = 0;
 static xlat_target_fns_t xlat_target = NULL;
+static struct xlat_cache_stats xlat_stats;
+static uint32_t xlat_flush_count = 0;
+static uint32_t xlat_discard_count = 0;
+
+/* Initial code size of a staged block (see xlat_set_staging) */
+#define XLAT_STAGING_BLOCK_SIZE 8192
+static gboolean xlat_staging = FALSE;
 
 void xlat_cache_init(void) 
 {
@@ -91,6 +114,7 @@ void xlat_cache_init(void)
         memset( xlat_lut, 0, XLAT_LUT_PAGES*sizeof(void *) );
     }
     xlat_flush_cache();
+    memset( &xlat_stats, 0, sizeof(xlat_stats) );
 }
 
 void xlat_set_target_fns( xlat_target_fns_t target )
@@ -130,25 +154,88 @@ void xlat_flush_cache()
             memset( xlat_lut[i], 0, XLAT_LUT_PAGE_SIZE );
         }
     }
+    xlat_stats.flushes++;
+    xlat_flush_count++;
+    xlat_discard_count++;
+    xlat_perf_flush();
+}
+
+uint32_t xlat_get_flush_count( void )
+{
+    return xlat_flush_count;
+}
+
+uint32_t xlat_get_discard_count( void )
+{
+    return xlat_discard_count;
+}
+
+/**
+ * Replace the reference to the block from the lookup table (or from the
+ * previous block in the chain, if it isn't the first) with the given code
+ * pointer.
+ */
+static void xlat_replace_block_ref( xlat_cache_block_t block, void *code )
+{
+    void **entry = block->lut_entry;
+    void *p = XLAT_CODE_ADDR(*entry);
+    if( p == block->code ) {
+        *((uintptr_t *)entry) = ((uintptr_t)code) | (((uintptr_t)*entry) & ((uintptr_t)0x03));
+    } else {
+        while( p != NULL ) {
+            xlat_cache_block_t prev = XLAT_BLOCK_FOR_CODE(p);
+            if( prev->chain == block->code ) {
+                prev->chain = code;
+                break;
+            }
+            p = prev->chain;
+        }
+    }
+}
+
+/**
+ * Remove all direct links into and out of the block.
+ */
+static void xlat_unlink_block( xlat_cache_block_t block )
+{
+    if( block->fixup_table_size != XLAT_FIXUPS_UNKNOWN ) {
+        xlat_fixup_record_t fixups = XLAT_FIXUP_TABLE(block->code);
+        uint32_t i;
+        for( i=0; i<block->fixup_table_size; i++ ) {
+            if( fixups[i].type == XLAT_FIXUP_LINK ) {
+                xlat_target->unlink_site( &block->code[fixups[i].xlat_offset] );
+            }
+        }
+    }
+    if( block->use_list != NULL ) {
+        xlat_target->unlink_block(block->use_list);
+        block->use_list = NULL;
+    }
 }
 
 void xlat_delete_block( xlat_cache_block_t block )
 {
+    xlat_discard_count++;
     block->active = 0;
-    *block->lut_entry = block->chain;
-    if( block->use_list != NULL )
-        xlat_target->unlink_block(block->use_list);
+    xlat_replace_block_ref( block, block->chain );
+    xlat_unlink_block( block );
+    xlat_perf_delete_block( block->code );
 }
 
-static void xlat_flush_page_by_lut( void **page )
+/**
+ * Delete all blocks starting in the given range of entries in a LUT page, and
+ * clear the entries.
+ */
+static void xlat_flush_lut_entries( void **page, int first, int count )
 {
     int i;
-    for( i=0; i<XLAT_LUT_PAGE_ENTRIES; i++ ) {
+    for( i=first; i<first+count; i++ ) {
         if( IS_ENTRY_POINT(page[i]) ) {
             void *p = XLAT_CODE_ADDR(page[i]);
             do {
                 xlat_cache_block_t block = XLAT_BLOCK_FOR_CODE(p);
                 xlat_delete_block(block);
+                xlat_stats.invalidations++;
                 p = block->chain;
             } while( p != NULL );
         }
@@ -156,17 +243,37 @@ static void xlat_flush_page_by_lut( void **page )
     }
 }
 
+static void xlat_flush_page_by_lut( void **page )
+{
+    xlat_flush_lut_entries( page, 0, XLAT_LUT_PAGE_ENTRIES );
+}
+
+/**
+ * Flush all blocks starting in the code page containing the given address.
+ * Since a block never extends beyond the code page it starts in (other than
+ * a delay slot in the first word of the next page), this is sufficient to 
+ * invalidate any write to the page.
+ */
+static void xlat_flush_code_page( sh4addr_t address )
+{
+    void **page = xlat_lut[XLAT_LUT_PAGE(address)];
+    if( page != NULL ) {
+        xlat_flush_lut_entries( page, XLAT_LUT_ENTRY(address) & ~(XLAT_CODE_PAGE_ENTRIES-1),
+                                XLAT_CODE_PAGE_ENTRIES );
+    }
+}
+
 void FASTCALL xlat_invalidate_word( sh4addr_t addr )
 {
     void **page = xlat_lut[XLAT_LUT_PAGE(addr)];
     if( page != NULL ) {
         int entry = XLAT_LUT_ENTRY(addr);
-        if( entry == 0 && IS_ENTRY_CONTINUATION(page[entry]) ) {
+        if( IS_FIRST_ENTRY_IN_CODE_PAGE(entry) && IS_ENTRY_CONTINUATION(page[entry]) ) {
             /* First entry may be a delay-slot for the previous page */
-            xlat_flush_page_by_lut(xlat_lut[XLAT_LUT_PAGE(addr-2)]);
+            xlat_flush_code_page(addr-2);
         }
         if( page[entry] != NULL ) {
-            xlat_flush_page_by_lut(page);
+            xlat_flush_code_page(addr);
         }
     }
 }
@@ -176,12 +283,12 @@ void FASTCALL xlat_invalidate_long( sh4addr_t addr )
     void **page = xlat_lut[XLAT_LUT_PAGE(addr)];
     if( page != NULL ) {
         int entry = XLAT_LUT_ENTRY(addr);
-        if( entry == 0 && IS_ENTRY_CONTINUATION(page[entry]) ) {
+        if( IS_FIRST_ENTRY_IN_CODE_PAGE(entry) && IS_ENTRY_CONTINUATION(page[entry]) ) {
             /* First entry may be a delay-slot for the previous page */
-            xlat_flush_page_by_lut(xlat_lut[XLAT_LUT_PAGE(addr-2)]);
+            xlat_flush_code_page(addr-2);
         }
-        if( *(uint64_t *)&page[entry] != 0 ) {
-            xlat_flush_page_by_lut(page);
+        if( page[entry] != NULL || page[entry+1] != NULL ) {
+            xlat_flush_code_page(addr);
         }
     }
 }
@@ -189,38 +296,31 @@ void FASTCALL xlat_invalidate_long( sh4addr_t addr )
 void FASTCALL xlat_invalidate_block( sh4addr_t address, size_t size )
 {
     int i;
-    int entry_count = size >> 1; // words;
-    uint32_t page_no = XLAT_LUT_PAGE(address);
+    void **page = xlat_lut[XLAT_LUT_PAGE(address)];
     int entry = XLAT_LUT_ENTRY(address);
 
-    if( entry == 0 && xlat_lut[page_no] != NULL && IS_ENTRY_CONTINUATION(xlat_lut[page_no][entry])) {
+    if( page != NULL && IS_FIRST_ENTRY_IN_CODE_PAGE(entry) && IS_ENTRY_CONTINUATION(page[entry]) ) {
         /* First entry may be a delay-slot for the previous page */
-        xlat_flush_page_by_lut(xlat_lut[XLAT_LUT_PAGE(address-2)]);
+        xlat_flush_code_page(address-2);
     }
-    do {
-        void **page = xlat_lut[page_no];
-        int page_entries = XLAT_LUT_PAGE_ENTRIES - entry;
-        if( entry_count < page_entries ) {
-            page_entries = entry_count;
+    while( size > 0 ) {
+        size_t count = XLAT_CODE_PAGE_SIZE - (address & (XLAT_CODE_PAGE_SIZE-1));
+        if( count > size ) {
+            count = size;
         }
+        page = xlat_lut[XLAT_LUT_PAGE(address)];
         if( page != NULL ) {
-            if( page_entries == XLAT_LUT_PAGE_ENTRIES ) {
-                /* Overwriting the entire page anyway */
-                xlat_flush_page_by_lut(page);
-            } else {
-                for( i=entry; i<entry+page_entries; i++ ) {
-                    if( page[i] != NULL ) {
-                        xlat_flush_page_by_lut(page);
-                        break;
-                    }
+            int last = XLAT_LUT_ENTRY(address + count - 1);
+            for( i=XLAT_LUT_ENTRY(address); i<=last; i++ ) {
+                if( page[i] != NULL ) {
+                    xlat_flush_code_page(address);
+                    break;
                 }
             }
-            entry_count -= page_entries;
         }
-        page_no ++;
-        entry_count -= page_entries;
-        entry = 0;
-    } while( entry_count > 0 );
+        address += count;
+        size -= count;
+    }
 }
 
 void FASTCALL xlat_flush_page( sh4addr_t address )
@@ -237,6 +337,12 @@ void * FASTCALL xlat_get_code( sh4addr_t address )
     void **page = xlat_lut[XLAT_LUT_PAGE(address)];
     if( page != NULL ) {
         result = XLAT_CODE_ADDR(page[XLAT_LUT_ENTRY(address)]);
+#ifdef XLAT_GENERATIONAL_CACHE
+        /* Mark the block as used, so it'll be retained if it's in temp space */
+        if( result != NULL && XLAT_BLOCK_FOR_CODE(result)->active == BLOCK_ACTIVE ) {
+            XLAT_BLOCK_FOR_CODE(result)->active = BLOCK_USED;
+        }
+#endif
     }
     return result;
 }
@@ -259,16 +365,24 @@ xlat_recovery_record_t xlat_get_pre_recovery( void *code, void *native_pc )
     return NULL;	
 }
 
+/**
+ * Return the LUT page for the given address, allocating it if necessary. This
+ * may be called from a staging translation at the same time as from the CPU
+ * thread, so only one of the threads gets to install a new page.
+ */
 static void **xlat_get_lut_page( sh4addr_t address )
 {
     void **page = xlat_lut[XLAT_LUT_PAGE(address)];
 
      /* Add the LUT entry for the block */
      if( page == NULL ) {
-         xlat_lut[XLAT_LUT_PAGE(address)] = page =
-             (void **)mmap( NULL, XLAT_LUT_PAGE_SIZE, PROT_READ|PROT_WRITE,
+         page = (void **)mmap( NULL, XLAT_LUT_PAGE_SIZE, PROT_READ|PROT_WRITE,
                      MAP_PRIVATE|MAP_ANON, -1, 0 );
          memset( page, 0, XLAT_LUT_PAGE_SIZE );
+         if( !__sync_bool_compare_and_swap( &xlat_lut[XLAT_LUT_PAGE(address)], NULL, page ) ) {
+             munmap( page, XLAT_LUT_PAGE_SIZE );
+             page = xlat_lut[XLAT_LUT_PAGE(address)];
+         }
      }
 
      return page;
@@ -280,6 +394,24 @@ void ** FASTCALL xlat_get_lut_entry( sh4addr_t address )
     return &page[XLAT_LUT_ENTRY(address)];
 }
 
+gboolean xlat_get_lut_address( void **entry, sh4addr_t *address )
+{
+    int i;
+    for( i=0; i<XLAT_LUT_PAGES; i++ ) {
+        void **page = xlat_lut[i];
+        if( page != NULL && entry >= page && entry < page + XLAT_LUT_PAGE_ENTRIES ) {
+            *address = XLAT_ADDR_FROM_ENTRY( i, entry - page );
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+void ***xlat_get_lut_base( void )
+{
+    return xlat_lut;
+}
+
 
 
 uint32_t FASTCALL xlat_get_block_size( void *block )
@@ -320,19 +452,65 @@ static inline xlat_cache_block_t xlat_cut_block( xlat_cache_block_t block, int c
     }
 }
 
+/**
+ * Move the block to the (already allocated) destination block, updating
+ * the lookup table and any pointers into the block. Direct links into and out
+ * of the block are removed, and will be re-established when next executed.
+ */
+static void xlat_move_block( xlat_cache_block_t block, xlat_cache_block_t dest )
+{
+    uint32_t i;
+    xlat_unlink_block( block );
+    dest->lut_entry = block->lut_entry;
+    dest->chain = block->chain;
+    dest->use_list = NULL;
+    dest->xlat_sh4_mode = block->xlat_sh4_mode;
+    dest->recover_table_offset = block->recover_table_offset;
+    dest->recover_table_size = block->recover_table_size;
+    dest->fixup_table_offset = block->fixup_table_offset;
+    dest->fixup_table_size = block->fixup_table_size;
+    memcpy( dest->code, block->code, block->size );
+
+    xlat_fixup_record_t fixups = XLAT_FIXUP_TABLE(dest->code);
+    for( i=0; i<dest->fixup_table_size; i++ ) {
+        if( fixups[i].type == XLAT_FIXUP_SELF_PTR ) {
+            *((uintptr_t *)&dest->code[fixups[i].xlat_offset]) += dest->code - block->code;
+        }
+    }
+    xlat_replace_block_ref( block, dest->code );
+    block->active = 0;
+    xlat_perf_move_block( block->code, dest->code );
+}
+
 #ifdef XLAT_GENERATIONAL_CACHE
+static void xlat_promote_to_old_space( xlat_cache_block_t block );
+
 /**
- * Promote a block in temp space (or elsewhere for that matter) to old space.
+ * Allocate a block of the given size from the temp or old space, starting
+ * from *cache_ptr and wrapping around to the start of the space as needed.
+ * Any blocks in the way are released - blocks in temp space that have been
+ * used since they were promoted are moved on to old space, everything else
+ * is discarded.
  *
- * @param block to promote.
+ * @return the new block, which must be passed to xlat_cut_block when filled.
  */
-static void xlat_promote_to_old_space( xlat_cache_block_t block )
+static xlat_cache_block_t xlat_alloc_space_block( xlat_cache_block_t cache, 
+                                                  xlat_cache_block_t *cache_ptr, int size )
 {
     int allocation = (int)-sizeof(struct xlat_cache_block);
-    int size = block->size;
-    xlat_cache_block_t curr = xlat_old_cache_ptr;
+    xlat_cache_block_t curr = *cache_ptr;
     xlat_cache_block_t start_block = curr;
     do {
+        if( curr->active ) {
+            if( cache == xlat_temp_cache && 
+                (curr->active >= BLOCK_USED || curr->use_list != NULL) &&
+                curr->fixup_table_size != XLAT_FIXUPS_UNKNOWN ) {
+                xlat_promote_to_old_space( curr );
+            } else {
+                xlat_delete_block( curr );
+                xlat_stats.evictions++;
+            }
+        }
         allocation += curr->size + sizeof(struct xlat_cache_block);
         curr = NEXT(curr);
         if( allocation > size ) {
@@ -345,78 +523,59 @@ static void xlat_promote_to_old_space( xlat_cache_block_t block )
             start_block->active = 0;
             start_block->size = allocation;
             allocation = (int)-sizeof(struct xlat_cache_block);
-            start_block = curr = xlat_old_cache;
+            start_block = curr = cache;
         }
     } while(1);
     start_block->active = 1;
     start_block->size = allocation;
-    start_block->lut_entry = block->lut_entry;
-    start_block->chain = block->chain;
-    start_block->fpscr_mask = block->fpscr_mask;
-    start_block->fpscr = block->fpscr;
-    start_block->recover_table_offset = block->recover_table_offset;
-    start_block->recover_table_size = block->recover_table_size;
-    *block->lut_entry = &start_block->code;
-    memcpy( start_block->code, block->code, block->size );
-    xlat_old_cache_ptr = xlat_cut_block(start_block, size );
+    return start_block;
+}
+
+/**
+ * Promote a block in temp space to old space. Old space is maintained
+ * as a simple FIFO.
+ *
+ * @param block to promote.
+ */
+static void xlat_promote_to_old_space( xlat_cache_block_t block )
+{
+    int size = block->size;
+    xlat_cache_block_t dest = xlat_alloc_space_block( xlat_old_cache, &xlat_old_cache_ptr, size );
+    xlat_move_block( block, dest );
+    dest->active = BLOCK_ACTIVE;
+    xlat_old_cache_ptr = xlat_cut_block( dest, size );
     if( xlat_old_cache_ptr->size == 0 ) {
         xlat_old_cache_ptr = xlat_old_cache;
     }
+    xlat_stats.old_promotions++;
 }
 
 /**
- * Similarly to the above method, promotes a block to temp space.
- * TODO: Try to combine these - they're nearly identical
+ * Promote a block evicted from new space to temp space. 
  */
 void xlat_promote_to_temp_space( xlat_cache_block_t block )
 {
     int size = block->size;
-    int allocation = (int)-sizeof(struct xlat_cache_block);
-    xlat_cache_block_t curr = xlat_temp_cache_ptr;
-    xlat_cache_block_t start_block = curr;
-    do {
-        if( curr->active == BLOCK_USED ) {
-            xlat_promote_to_old_space( curr );
-        } else if( curr->active == BLOCK_ACTIVE ) {
-            // Active but not used, release block
-            *((uintptr_t *)curr->lut_entry) &= ((uintptr_t)0x03);
-        }
-        allocation += curr->size + sizeof(struct xlat_cache_block);
-        curr = NEXT(curr);
-        if( allocation > size ) {
-            break; /* done */
-        }
-        if( curr->size == 0 ) { /* End-of-cache Sentinel */
-            /* Leave what we just released as free space and start again from the
-             * top of the cache
-             */
-            start_block->active = 0;
-            start_block->size = allocation;
-            allocation = (int)-sizeof(struct xlat_cache_block);
-            start_block = curr = xlat_temp_cache;
-        }
-    } while(1);
-    start_block->active = 1;
-    start_block->size = allocation;
-    start_block->lut_entry = block->lut_entry;
-    start_block->chain = block->chain;
-    start_block->fpscr_mask = block->fpscr_mask;
-    start_block->fpscr = block->fpscr;
-    start_block->recover_table_offset = block->recover_table_offset;
-    start_block->recover_table_size = block->recover_table_size;
-    *block->lut_entry = &start_block->code;
-    memcpy( start_block->code, block->code, block->size );
-    xlat_temp_cache_ptr = xlat_cut_block(start_block, size );
+    if( block->fixup_table_size == XLAT_FIXUPS_UNKNOWN ) {
+        /* Can't be moved safely */
+        xlat_delete_block(block);
+        xlat_stats.evictions++;
+        return;
+    }
+    xlat_cache_block_t dest = xlat_alloc_space_block( xlat_temp_cache, &xlat_temp_cache_ptr, size );
+    xlat_move_block( block, dest );
+    dest->active = BLOCK_ACTIVE;
+    xlat_temp_cache_ptr = xlat_cut_block( dest, size );
     if( xlat_temp_cache_ptr->size == 0 ) {
         xlat_temp_cache_ptr = xlat_temp_cache;
     }
-
+    xlat_stats.temp_promotions++;
 }
 #else 
 void xlat_promote_to_temp_space( xlat_cache_block_t block )
 {
-    *block->lut_entry = block->chain;
     xlat_delete_block(block);
+    xlat_stats.evictions++;
 }
 #endif
 
@@ -426,6 +585,16 @@ void xlat_promote_to_temp_space( xlat_cache_block_t block )
  */
 xlat_cache_block_t xlat_start_block( sh4addr_t address )
 {
+    if( xlat_staging ) {
+        xlat_new_create_ptr = g_malloc( sizeof(struct xlat_cache_block) + XLAT_STAGING_BLOCK_SIZE );
+        memset( xlat_new_create_ptr, 0, sizeof(struct xlat_cache_block) );
+        xlat_new_create_ptr->active = 1;
+        xlat_new_create_ptr->size = XLAT_STAGING_BLOCK_SIZE;
+        xlat_host_pointer_count = 0;
+        xlat_link_site_count = 0;
+        return xlat_new_create_ptr;
+    }
+
     if( xlat_new_cache_ptr->size == 0 ) {
         xlat_new_cache_ptr = xlat_new_cache;
     }
@@ -436,6 +605,8 @@ xlat_cache_block_t xlat_start_block( sh4addr_t address )
     xlat_new_create_ptr = xlat_new_cache_ptr;
     xlat_new_create_ptr->active = 1;
     xlat_new_cache_ptr = NEXT(xlat_new_cache_ptr);
+    xlat_host_pointer_count = 0;
+    xlat_link_site_count = 0;
 
     /* Add the LUT entry for the block */
     void **p = xlat_get_lut_entry(address);
@@ -448,6 +619,8 @@ xlat_cache_block_t xlat_start_block( sh4addr_t address )
         xlat_new_create_ptr->chain = NULL;
     }
     xlat_new_create_ptr->use_list = NULL;
+    xlat_new_create_ptr->fixup_table_offset = 0;
+    xlat_new_create_ptr->fixup_table_size = 0;
 
     *p = &xlat_new_create_ptr->code;
     if( IS_ENTRY_CONTINUATION(entry) ) {
@@ -458,9 +631,37 @@ xlat_cache_block_t xlat_start_block( sh4addr_t address )
     return xlat_new_create_ptr;
 }
 
+/**
+ * Adjust any pointers into the current block (including its header, eg the
+ * active count), after it has been moved from olddata.
+ */
+static void xlat_relocate_host_pointers( unsigned char *olddata, uint32_t oldsize )
+{
+    int i;
+    for( i=0; i<xlat_host_pointer_count; i++ ) {
+        uintptr_t *ptr = (uintptr_t *)&xlat_new_create_ptr->code[xlat_host_pointers[i]];
+        if( *ptr >= (uintptr_t)olddata - sizeof(struct xlat_cache_block) &&
+            *ptr < (uintptr_t)(olddata + oldsize) ) {
+            *ptr += xlat_new_create_ptr->code - olddata;
+        }
+    }
+}
+
 xlat_cache_block_t xlat_extend_block( uint32_t newSize )
 {
     assert( xlat_new_create_ptr->use_list == NULL );
+    if( xlat_staging ) {
+        if( xlat_new_create_ptr->size < newSize ) {
+            uintptr_t olddata = (uintptr_t)xlat_new_create_ptr->code;
+            uint32_t oldsize = xlat_new_create_ptr->size;
+            uint32_t size = MAX( newSize, oldsize*2 );
+            xlat_new_create_ptr = g_realloc( xlat_new_create_ptr, sizeof(struct xlat_cache_block) + size );
+            xlat_new_create_ptr->size = size;
+            xlat_relocate_host_pointers( (unsigned char *)olddata, oldsize );
+        }
+        return xlat_new_create_ptr;
+    }
+
     while( xlat_new_create_ptr->size < newSize ) {
         if( xlat_new_cache_ptr->size == 0 ) {
             /* Migrate to the front of the cache to keep it contiguous */
@@ -485,8 +686,11 @@ xlat_cache_block_t xlat_extend_block( uint32_t newSize )
             xlat_new_create_ptr->lut_entry = lut_entry;
             xlat_new_create_ptr->chain = chain;
             xlat_new_create_ptr->use_list = NULL;
+            xlat_new_create_ptr->fixup_table_offset = 0;
+            xlat_new_create_ptr->fixup_table_size = 0;
             *lut_entry = &xlat_new_create_ptr->code;
             memmove( xlat_new_create_ptr->code, olddata, oldsize );
+            xlat_relocate_host_pointers( olddata, oldsize );
         } else {
             if( xlat_new_cache_ptr->active ) {
                 xlat_promote_to_temp_space( xlat_new_cache_ptr );
@@ -499,19 +703,163 @@ xlat_cache_block_t xlat_extend_block( uint32_t newSize )
 
 }
 
-void xlat_commit_block( uint32_t destsize, sh4addr_t startpc, sh4addr_t endpc )
+void xlat_set_staging( gboolean flag )
 {
-    void **entry = xlat_get_lut_entry(startpc+2);
-    /* assume main entry has already been set at this point */
+    xlat_staging = flag;
+    if( !flag ) {
+        /* The staged block belongs to the caller from here on */
+        xlat_new_create_ptr = NULL;
+    }
+}
+
+xlat_cache_block_t xlat_install_block( xlat_cache_block_t staged, sh4addr_t address, uint32_t size )
+{
+    xlat_cache_block_t block;
+    uint32_t i;
+
+    if( staged->fixup_table_size == XLAT_FIXUPS_UNKNOWN ) {
+        return NULL;
+    }
+    block = xlat_start_block( address );
+    if( block->size < size ) {
+        block = xlat_extend_block( size );
+    }
+    block->xlat_sh4_mode = staged->xlat_sh4_mode;
+    block->recover_table_offset = staged->recover_table_offset;
+    block->recover_table_size = staged->recover_table_size;
+    block->fixup_table_offset = staged->fixup_table_offset;
+    block->fixup_table_size = staged->fixup_table_size;
+    memcpy( block->code, staged->code, size );
+
+    xlat_fixup_record_t fixups = XLAT_FIXUP_TABLE(block->code);
+    for( i=0; i<block->fixup_table_size; i++ ) {
+        if( fixups[i].type == XLAT_FIXUP_SELF_PTR ) {
+            *((uintptr_t *)&block->code[fixups[i].xlat_offset]) += block->code - staged->code;
+        }
+    }
+    return block;
+}
+
+void xlat_free_staged_block( xlat_cache_block_t staged )
+{
+    g_free( staged );
+}
+
+void xlat_note_host_pointer( unsigned char *ptr )
+{
+    if( xlat_new_create_ptr != NULL && xlat_host_pointer_count != -1 &&
+        ptr >= xlat_new_create_ptr->code && 
+        ptr < xlat_new_create_ptr->code + xlat_new_create_ptr->size ) {
+        if( xlat_host_pointer_count == XLAT_MAX_HOST_POINTERS ) {
+            xlat_host_pointer_count = -1;
+        } else {
+            xlat_host_pointers[xlat_host_pointer_count++] = ptr - xlat_new_create_ptr->code;
+        }
+    }
+}
 
-    for( sh4addr_t pc = startpc+2; pc < endpc; pc += 2 ) {
+int xlat_get_host_pointers( uint32_t **offsets )
+{
+    *offsets = xlat_host_pointers;
+    return xlat_host_pointer_count;
+}
+
+void xlat_set_host_pointers( const uint32_t *offsets, int count )
+{
+    if( count > XLAT_MAX_HOST_POINTERS ) {
+        count = -1;
+    }
+    if( count > 0 ) {
+        memcpy( xlat_host_pointers, offsets, count * sizeof(uint32_t) );
+    }
+    xlat_host_pointer_count = count;
+}
+
+void xlat_note_link_site( unsigned char *ptr )
+{
+    if( xlat_new_create_ptr != NULL && xlat_link_site_count != -1 &&
+        ptr >= xlat_new_create_ptr->code && 
+        ptr < xlat_new_create_ptr->code + xlat_new_create_ptr->size ) {
+        if( xlat_link_site_count == XLAT_MAX_LINK_SITES ) {
+            xlat_link_site_count = -1;
+        } else {
+            xlat_link_sites[xlat_link_site_count++] = ptr - xlat_new_create_ptr->code;
+        }
+    }
+}
+
+/**
+ * Test if the given host pointer is an absolute pointer into the current block
+ * (or its header)
+ */
+static gboolean xlat_is_self_pointer( uint32_t offset )
+{
+    uintptr_t value = *((uintptr_t *)&xlat_new_create_ptr->code[offset]);
+    return value >= (uintptr_t)xlat_new_create_ptr && 
+        value < (uintptr_t)(xlat_new_create_ptr->code + xlat_new_create_ptr->size);
+}
+
+uint32_t xlat_get_fixup_table_size( void )
+{
+    int i, count;
+    if( xlat_host_pointer_count == -1 || xlat_link_site_count == -1 ) {
+        return 0;
+    }
+    count = xlat_link_site_count;
+    for( i=0; i<xlat_host_pointer_count; i++ ) {
+        if( xlat_is_self_pointer(xlat_host_pointers[i]) ) {
+            count++;
+        }
+    }
+    return count * sizeof(struct xlat_fixup_record);
+}
+
+void xlat_write_fixup_table( uint32_t offset )
+{
+    int i;
+    xlat_fixup_record_t fixups = (xlat_fixup_record_t)&xlat_new_create_ptr->code[offset];
+    uint32_t count = 0;
+
+    xlat_new_create_ptr->fixup_table_offset = offset;
+    if( xlat_host_pointer_count == -1 || xlat_link_site_count == -1 ) {
+        xlat_new_create_ptr->fixup_table_size = XLAT_FIXUPS_UNKNOWN;
+        return;
+    }
+    for( i=0; i<xlat_host_pointer_count; i++ ) {
+        if( xlat_is_self_pointer(xlat_host_pointers[i]) ) {
+            fixups[count].xlat_offset = xlat_host_pointers[i];
+            fixups[count].type = XLAT_FIXUP_SELF_PTR;
+            count++;
+        }
+    }
+    for( i=0; i<xlat_link_site_count; i++ ) {
+        fixups[count].xlat_offset = xlat_link_sites[i];
+        fixups[count].type = XLAT_FIXUP_LINK;
+        count++;
+    }
+    xlat_new_create_ptr->fixup_table_size = count;
+}
+
+void xlat_add_block_range( sh4addr_t startpc, sh4addr_t endpc )
+{
+    void **entry = xlat_get_lut_entry(startpc);
+
+    for( sh4addr_t pc = startpc; pc < endpc; pc += 2 ) {
         if( XLAT_LUT_ENTRY(pc) == 0 )
             entry = xlat_get_lut_entry(pc);
         *((uintptr_t *)entry) |= (uintptr_t)XLAT_LUT_ENTRY_USED;
         entry++;
     }
+}
+
+void xlat_commit_block( uint32_t destsize, sh4addr_t startpc, sh4addr_t endpc )
+{
+    /* assume main entry has already been set at this point */
+    xlat_add_block_range( startpc+2, endpc );
 
     xlat_new_cache_ptr = xlat_cut_block( xlat_new_create_ptr, destsize );
+    xlat_perf_commit_block( xlat_new_create_ptr->code, xlat_get_code_size(xlat_new_create_ptr->code),
+                            startpc, endpc );
 }
 
 void xlat_check_cache_integrity( xlat_cache_block_t cache, xlat_cache_block_t ptr, int size )
@@ -573,17 +921,17 @@ gboolean xlat_is_code_pointer( void *p )
     uintptr_t region_size;
 
     xlat_cache_block_t block = XLAT_BLOCK_FOR_CODE(p);
-    if( (((char *)block) - (char *)xlat_new_cache) < XLAT_NEW_CACHE_SIZE ) {
+    if( (uintptr_t)(((char *)block) - (char *)xlat_new_cache) < XLAT_NEW_CACHE_SIZE ) {
          /* Pointer is in new cache */
         region = (char *)xlat_new_cache;
         region_size = XLAT_NEW_CACHE_SIZE;
     }
 #ifdef XLAT_GENERATIONAL_CACHE
-    else if( (((char *)block) - (char *)xlat_temp_cache) < XLAT_TEMP_CACHE_SIZE ) {
+    else if( (uintptr_t)(((char *)block) - (char *)xlat_temp_cache) < XLAT_TEMP_CACHE_SIZE ) {
          /* Pointer is in temp cache */
         region = (char *)xlat_temp_cache;
         region_size = XLAT_TEMP_CACHE_SIZE;
-    } else if( (((char *)block) - (char *)xlat_odl_cache) < XLAT_OLD_CACHE_SIZE ) {
+    } else if( (uintptr_t)(((char *)block) - (char *)xlat_old_cache) < XLAT_OLD_CACHE_SIZE ) {
         /* Pointer is in old cache */
         region = (char *)xlat_old_cache;
         region_size = XLAT_OLD_CACHE_SIZE;
@@ -595,8 +943,8 @@ gboolean xlat_is_code_pointer( void *p )
     }
 
     /* Make sure the whole block is in the region */
-    if( (((char *)p) - region) >= region_size ||
-        (((char *)(NEXT(block))) - region) >= region_size )
+    if( (uintptr_t)(((char *)p) - region) >= region_size ||
+        (uintptr_t)(((char *)(NEXT(block))) - region) >= region_size )
         return FALSE;
     return TRUE;
 }
@@ -610,36 +958,74 @@ void xlat_check_integrity( )
 #endif
 }
 
-unsigned int xlat_get_active_block_count()
+/**
+ * Count the active blocks in the given cache space, and the total space they
+ * occupy (including headers).
+ */
+static unsigned int xlat_get_space_usage( xlat_cache_block_t ptr, uint32_t *bytes )
 {
     unsigned int count = 0;
-    xlat_cache_block_t ptr = xlat_new_cache;
+    uint32_t size = 0;
     while( ptr->size != 0 ) {
         if( ptr->active != 0 ) {
             count++;
+            size += ptr->size + sizeof(struct xlat_cache_block);
         }
         ptr = NEXT(ptr);
     }
+    if( bytes != NULL ) {
+        *bytes = size;
+    }
     return count;
 }
 
-unsigned int xlat_get_active_blocks( struct xlat_block_ref *blocks, unsigned int size )
+unsigned int xlat_get_active_block_count()
+{
+    unsigned int count = xlat_get_space_usage( xlat_new_cache, NULL );
+#ifdef XLAT_GENERATIONAL_CACHE
+    count += xlat_get_space_usage( xlat_temp_cache, NULL );
+    count += xlat_get_space_usage( xlat_old_cache, NULL );
+#endif
+    return count;
+}
+
+static unsigned int xlat_get_space_active_blocks( xlat_cache_block_t ptr, struct xlat_block_ref *blocks, unsigned int size )
 {
     unsigned int count = 0;
-    xlat_cache_block_t ptr = xlat_new_cache;
-    while( ptr->size != 0 ) {
+    while( ptr->size != 0 && count < size ) {
         if( ptr->active != 0 ) {
             blocks[count].block = ptr;
             blocks[count].pc = 0;
             count++;
         }
-        if( count >= size )
-            break;
         ptr = NEXT(ptr);
     }
     return count;
 }
 
+unsigned int xlat_get_active_blocks( struct xlat_block_ref *blocks, unsigned int size )
+{
+    unsigned int count = xlat_get_space_active_blocks( xlat_new_cache, blocks, size );
+#ifdef XLAT_GENERATIONAL_CACHE
+    count += xlat_get_space_active_blocks( xlat_temp_cache, blocks+count, size-count );
+    count += xlat_get_space_active_blocks( xlat_old_cache, blocks+count, size-count );
+#endif
+    return count;
+}
+
+void xlat_get_cache_stats( xlat_cache_stats_t stats )
+{
+    *stats = xlat_stats;
+    stats->new_blocks = xlat_get_space_usage( xlat_new_cache, &stats->new_bytes );
+#ifdef XLAT_GENERATIONAL_CACHE
+    stats->temp_blocks = xlat_get_space_usage( xlat_temp_cache, &stats->temp_bytes );
+    stats->old_blocks = xlat_get_space_usage( xlat_old_cache, &stats->old_bytes );
+#else
+    stats->temp_blocks = stats->old_blocks = 0;
+    stats->temp_bytes = stats->old_bytes = 0;
+#endif
+}
+
 static void xlat_get_block_pcs( struct xlat_block_ref *blocks, unsigned int size )
 {
     unsigned i;
@@ -30,11 +30,17 @@
  *
  * The recovery table contains (at least) one entry per abortable instruction,
  * 
+ * Note that the instruction count and the pc offset are only directly related
+ * (pc_offset == 2*icount) for linear blocks - superblocks which follow branches
+ * within the page can have arbitrary pc offsets (including negative ones).
  */
 typedef struct xlat_recovery_record {
     uint32_t xlat_offset;    // native (translated) pc 
     uint32_t sh4_icount;     // instruction number of the corresponding SH4 instruction
                              // (0 = first instruction, 1 = second instruction, ... )
+    int32_t sh4_pc_offset;   // Offset in bytes of the SH4 instruction from the block start
+    uint32_t sh4_cycles;     // cycles charged for the block up to the SH4 instruction
+                             // (see sh4_translate_get_cycles)
 } *xlat_recovery_record_t;
 
 struct xlat_cache_block {
@@ -46,11 +52,38 @@ struct xlat_cache_block {
     uint32_t xlat_sh4_mode; /* comparison with sh4r.xlat_sh4_mode */
     uint32_t recover_table_offset; // Offset from code[0] of the recovery table;
     uint32_t recover_table_size;
+    uint32_t fixup_table_offset; // Offset from code[0] of the fixup table
+    uint32_t fixup_table_size; // Number of fixup records, or XLAT_FIXUPS_UNKNOWN
     unsigned char code[0];
 } __attribute__((packed));
 
+/**
+ * The fixup table identifies everything in a block that depends on the
+ * block's address, so that it can be moved to another part of the cache.
+ * This is either an absolute pointer into the block itself, or a link site
+ * (which the target may patch to jump directly to another block).
+ */
+typedef struct xlat_fixup_record {
+    uint32_t xlat_offset;    // native offset from code[0] of the pointer or link site
+    uint32_t type;           // XLAT_FIXUP_SELF_PTR or XLAT_FIXUP_LINK
+} *xlat_fixup_record_t;
+
+#define XLAT_FIXUP_SELF_PTR 0
+#define XLAT_FIXUP_LINK 1
+
+/* fixup_table_size for a block that can't be moved (too many fixups to track) */
+#define XLAT_FIXUPS_UNKNOWN 0xFFFFFFFF
+
 typedef struct xlat_target_fns {
+    /**
+     * Given a block's use_list, remove all direct links to the block.
+     */
     void (*unlink_block)(void *use_list);
+    /**
+     * Restore a link site to its unlinked state. If the site was linked, it's
+     * also removed from the use_list of the block it links to.
+     */
+    void (*unlink_site)(void *site);
 } *xlat_target_fns_t;
 
 typedef struct xlat_cache_block *xlat_cache_block_t;
@@ -60,6 +93,7 @@ typedef struct xlat_cache_block *xlat_cache_block_t;
 #define XLAT_BLOCK_MODE(code) (XLAT_BLOCK_FOR_CODE(code)->xlat_sh4_mode)
 #define XLAT_BLOCK_CHAIN(code) (XLAT_BLOCK_FOR_CODE(code)->chain)
 #define XLAT_RECOVERY_TABLE(code) ((xlat_recovery_record_t)(((char *)code) + XLAT_BLOCK_FOR_CODE(code)->recover_table_offset))
+#define XLAT_FIXUP_TABLE(code) ((xlat_fixup_record_t)(((char *)code) + XLAT_BLOCK_FOR_CODE(code)->fixup_table_offset))
 
 /**
  * Initialize the translation cache
@@ -93,6 +127,98 @@ xlat_cache_block_t xlat_extend_block( uint32_t newSize );
  */
 void xlat_commit_block( uint32_t destsize, sh4addr_t startpc, sh4addr_t endpc );
 
+/**
+ * Enable/disable staging mode. While staging, xlat_start_block() and
+ * xlat_extend_block() create the block in memory outside of the cache,
+ * without touching the cache or the lookup table, so that a translation can
+ * run concurrently with the translated code (provided that nothing else
+ * creates a block at the same time). A staged block isn't committed, but is
+ * installed later with xlat_install_block().
+ */
+void xlat_set_staging( gboolean flag );
+
+/**
+ * Start a new block in the cache for the given address, and move the staged
+ * block into it (the block must have a fixup table). The new block becomes
+ * the current block, and must be committed with xlat_commit_block() as usual.
+ * The staged block is left untouched.
+ * @param size size of the staged block, as would be passed to xlat_commit_block()
+ * @return the new block, or NULL if the staged block couldn't be relocated.
+ */
+xlat_cache_block_t xlat_install_block( xlat_cache_block_t staged, sh4addr_t address, uint32_t size );
+
+/**
+ * Release a staged block. NULL is ignored.
+ */
+void xlat_free_staged_block( xlat_cache_block_t staged );
+
+/**
+ * Return the number of times the cache has been flushed. Any blocks staged
+ * before a flush should be discarded.
+ */
+uint32_t xlat_get_flush_count( void );
+
+/**
+ * Return a count that changes whenever any block is removed from the cache,
+ * whether it's invalidated, evicted, or flushed with the rest of the cache.
+ */
+uint32_t xlat_get_discard_count( void );
+
+/**
+ * Mark an additional range of SH4 addresses as being part of the current
+ * translation block (only valid between calls to xlat_start_block() and
+ * xlat_commit_block()), so that writes to the range will invalidate the block.
+ * This is used for superblocks, where the block covers several discontiguous
+ * address ranges.
+ * @param startpc first address of the range (inclusive)
+ * @param endpc end of the range (exclusive)
+ */
+void xlat_add_block_range( sh4addr_t startpc, sh4addr_t endpc );
+
+/**
+ * Record that the translator has written a host pointer at ptr, which may be
+ * within the current translation block (only valid between calls to 
+ * xlat_start_block() and xlat_commit_block()). Pointers outside the block 
+ * are ignored. This is used to relocate blocks from the persistent cache.
+ */
+void xlat_note_host_pointer( unsigned char *ptr );
+
+/**
+ * Record that the translator has emitted a link site at ptr (see
+ * xlat_target_fns.unlink_site). As for xlat_note_host_pointer(), sites outside
+ * the current block are ignored.
+ */
+void xlat_note_link_site( unsigned char *ptr );
+
+/**
+ * Return the size in bytes of the fixup table for the current block, based on
+ * the host pointers and link sites recorded so far. Pointers are only treated as
+ * self-pointers if they currently point into the block, so this should be called
+ * once the code is complete.
+ */
+uint32_t xlat_get_fixup_table_size( void );
+
+/**
+ * Write the fixup table for the current block at the given offset from the
+ * start of the block code, and record it in the block header. The block must
+ * be large enough to hold the table (see xlat_get_fixup_table_size()).
+ */
+void xlat_write_fixup_table( uint32_t offset );
+
+/**
+ * Retrieve the host pointers recorded for the most recently created block.
+ * @param offsets set to the array of offsets from the start of the block code
+ * @return the number of pointers, or -1 if there were too many to record.
+ */
+int xlat_get_host_pointers( uint32_t **offsets );
+
+/**
+ * Replace the host pointers recorded for the most recently created block, eg
+ * with the ones recorded for a staged block when it's installed.
+ * @param count number of offsets, or -1 if unknown.
+ */
+void xlat_set_host_pointers( const uint32_t *offsets, int count );
+
 /**
  * Delete (deactivate) the specified block from the cache. Caller is responsible
  * for ensuring that there really is a block there.
@@ -130,6 +256,28 @@ void * FASTCALL xlat_get_code_by_vma( sh4vma_t address );
  */
 void ** FASTCALL xlat_get_lut_entry( sh4addr_t address );
 
+/**
+ * Find the SH4 address corresponding to a lookup table entry, ie the reverse
+ * of xlat_get_lut_entry().
+ * @return TRUE if entry is in the lookup table, otherwise FALSE.
+ */
+gboolean xlat_get_lut_address( void **entry, sh4addr_t *address );
+
+/**
+ * The lookup table is allocated in 8K pages, indexed by
+ * (address >> XLAT_LUT_PAGE_SHIFT) & XLAT_LUT_PAGE_MASK. A page is NULL until
+ * the first time code is translated from within it.
+ */
+#define XLAT_LUT_PAGE_SHIFT 13
+#define XLAT_LUT_PAGE_MASK 0xFFFF
+
+/**
+ * Retrieve the base of the lookup table page index. This is used by
+ * translated code to skip the invalidation check for writes to pages
+ * that have never contained any translated code.
+ */
+void ***xlat_get_lut_base( void );
+
 /**
  * Retrieve the current host address of the running translated code block.
  * @return the host PC, or null if there is no currently executing translated
@@ -202,4 +350,23 @@ unsigned int xlat_get_cache_blocks_by_activity( xlat_block_ref_t records, size_t
 
 void xlat_dump_cache_by_activity( unsigned int topN );
 
+/**
+ * Translation cache statistics. Counters are cumulative since the cache was
+ * initialized, sizes are the current totals for active blocks.
+ */
+typedef struct xlat_cache_stats {
+    uint32_t temp_promotions; /* blocks moved from new space to temp space */
+    uint32_t old_promotions;  /* blocks moved from temp space to old space */
+    uint32_t evictions;       /* blocks discarded to make room for other blocks */
+    uint32_t invalidations;   /* blocks discarded due to writes to their source code */
+    uint32_t flushes;         /* full cache flushes */
+    uint32_t new_blocks, temp_blocks, old_blocks;
+    uint32_t new_bytes, temp_bytes, old_bytes;
+} *xlat_cache_stats_t;
+
+/**
+ * Retrieve the current cache statistics
+ */
+void xlat_get_cache_stats( xlat_cache_stats_t stats );
+
 #endif /* lxdream_xltcache_H */
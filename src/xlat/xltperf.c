@@ -0,0 +1,335 @@
+/**
+ * $Id$
+ *
+ * Linux perf support for translated code - perf map and jitdump output.
+ * See tools/perf/Documentation/jitdump-specification.txt in the Linux source
+ * for the jitdump format.
+ *
+ * Copyright (c) 2005 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "dream.h"
+#include "xlat/xltperf.h"
+
+#define JITDUMP_MAGIC 0x4A695444
+#define JITDUMP_VERSION 1
+
+#define JIT_CODE_LOAD 0
+#define JIT_CODE_MOVE 1
+#define JIT_CODE_CLOSE 3
+
+#if defined(__x86_64__)
+#define JITDUMP_ELF_MACH 62  /* EM_X86_64 */
+#elif defined(__i386__)
+#define JITDUMP_ELF_MACH 3   /* EM_386 */
+#else
+#define JITDUMP_ELF_MACH 0
+#endif
+
+struct jitdump_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+};
+
+struct jitdump_record_header {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+};
+
+struct jitdump_code_load {
+    struct jitdump_record_header header;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+    /* Followed by the null-terminated name, and the code */
+};
+
+struct jitdump_code_move {
+    struct jitdump_record_header header;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t old_code_addr;
+    uint64_t new_code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+};
+
+/**
+ * Record of a block that's been reported, so that it can be found again if
+ * moved. Entries for discarded blocks are kept (with size = 0) until the slot
+ * is reused by another block at the same address, so the table never holds
+ * more than one entry per block address in the cache.
+ */
+struct xlat_perf_block {
+    void *code;
+    uint32_t size;
+    sh4addr_t startpc;
+    sh4addr_t endpc;
+    uint64_t index;
+};
+
+static FILE *xlat_perf_map_file = NULL;
+static FILE *xlat_perf_jitdump_file = NULL;
+static void *xlat_perf_jitdump_marker = NULL;
+static uint64_t xlat_perf_next_index = 0;
+
+/* Open-addressed hash table of reported blocks, keyed by code (NULL = empty) */
+static struct xlat_perf_block *xlat_perf_blocks = NULL;
+static uint32_t xlat_perf_blocks_size = 0;
+static uint32_t xlat_perf_blocks_count = 0;
+
+static uint64_t xlat_perf_timestamp( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ((uint64_t)ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static inline uint32_t xlat_perf_hash( void *code )
+{
+    return (uint32_t)((((uintptr_t)code) >> 2) * 2654435761U) & (xlat_perf_blocks_size - 1);
+}
+
+static struct xlat_perf_block *xlat_perf_find_block( void *code )
+{
+    uint32_t i;
+    if( xlat_perf_blocks_size == 0 ) {
+        return NULL;
+    }
+    for( i = xlat_perf_hash(code); xlat_perf_blocks[i].code != NULL;
+         i = (i+1) & (xlat_perf_blocks_size-1) ) {
+        if( xlat_perf_blocks[i].code == code ) {
+            return &xlat_perf_blocks[i];
+        }
+    }
+    return NULL;
+}
+
+static void xlat_perf_insert_block( struct xlat_perf_block *block )
+{
+    uint32_t i;
+
+    if( (xlat_perf_blocks_count+1)*2 > xlat_perf_blocks_size ) {
+        struct xlat_perf_block *old = xlat_perf_blocks;
+        uint32_t oldsize = xlat_perf_blocks_size;
+        xlat_perf_blocks_size = oldsize == 0 ? 4096 : oldsize*2;
+        xlat_perf_blocks = g_malloc0( xlat_perf_blocks_size * sizeof(struct xlat_perf_block) );
+        xlat_perf_blocks_count = 0;
+        for( i=0; i<oldsize; i++ ) {
+            if( old[i].code != NULL ) {
+                xlat_perf_insert_block( &old[i] );
+            }
+        }
+        g_free(old);
+    }
+
+    for( i = xlat_perf_hash(block->code); xlat_perf_blocks[i].code != NULL;
+         i = (i+1) & (xlat_perf_blocks_size-1) ) {
+        if( xlat_perf_blocks[i].code == block->code ) {
+            xlat_perf_blocks[i] = *block;
+            return;
+        }
+    }
+    xlat_perf_blocks[i] = *block;
+    xlat_perf_blocks_count++;
+}
+
+static void xlat_perf_write_map_entry( struct xlat_perf_block *block )
+{
+    fprintf( xlat_perf_map_file, "%lx %x sh4:%08X-%08X\n", (unsigned long)(uintptr_t)block->code,
+             block->size, block->startpc, block->endpc );
+    fflush( xlat_perf_map_file );
+}
+
+static gboolean xlat_perf_open_jitdump( void )
+{
+    struct jitdump_header header;
+    const char *dir = getenv("JITDUMPDIR");
+    gchar *filename = g_strdup_printf( "%s/jit-%d.dump", dir == NULL ? "." : dir, (int)getpid() );
+
+    xlat_perf_jitdump_file = fopen( filename, "w+b" );
+    if( xlat_perf_jitdump_file == NULL ) {
+        WARN( "Unable to create jitdump file %s: %s", filename, strerror(errno) );
+        g_free( filename );
+        return FALSE;
+    }
+
+    /* perf finds the file by the executable mapping of it in the recording */
+    xlat_perf_jitdump_marker = mmap( NULL, sysconf(_SC_PAGESIZE), PROT_READ|PROT_EXEC, MAP_PRIVATE,
+                                     fileno(xlat_perf_jitdump_file), 0 );
+    if( xlat_perf_jitdump_marker == MAP_FAILED ) {
+        WARN( "Unable to map jitdump file %s: %s", filename, strerror(errno) );
+        xlat_perf_jitdump_marker = NULL;
+        fclose( xlat_perf_jitdump_file );
+        xlat_perf_jitdump_file = NULL;
+        g_free( filename );
+        return FALSE;
+    }
+
+    memset( &header, 0, sizeof(header) );
+    header.magic = JITDUMP_MAGIC;
+    header.version = JITDUMP_VERSION;
+    header.total_size = sizeof(header);
+    header.elf_mach = JITDUMP_ELF_MACH;
+    header.pid = getpid();
+    header.timestamp = xlat_perf_timestamp();
+    fwrite( &header, sizeof(header), 1, xlat_perf_jitdump_file );
+    fflush( xlat_perf_jitdump_file );
+    INFO( "Writing jitdump to %s", filename );
+    g_free( filename );
+    return TRUE;
+}
+
+gboolean xlat_perf_open( int flags )
+{
+    gboolean result = TRUE;
+
+    xlat_perf_close();
+    if( flags & XLAT_PERF_MAP ) {
+        gchar *filename = g_strdup_printf( "/tmp/perf-%d.map", (int)getpid() );
+        xlat_perf_map_file = fopen( filename, "w" );
+        if( xlat_perf_map_file == NULL ) {
+            WARN( "Unable to create perf map %s: %s", filename, strerror(errno) );
+            result = FALSE;
+        }
+        g_free( filename );
+    }
+    if( flags & XLAT_PERF_JITDUMP ) {
+        result = xlat_perf_open_jitdump() && result;
+    }
+    return result;
+}
+
+void xlat_perf_close( void )
+{
+    if( xlat_perf_map_file != NULL ) {
+        fclose( xlat_perf_map_file );
+        xlat_perf_map_file = NULL;
+    }
+    if( xlat_perf_jitdump_file != NULL ) {
+        struct jitdump_record_header rec;
+        rec.id = JIT_CODE_CLOSE;
+        rec.total_size = sizeof(rec);
+        rec.timestamp = xlat_perf_timestamp();
+        fwrite( &rec, sizeof(rec), 1, xlat_perf_jitdump_file );
+        munmap( xlat_perf_jitdump_marker, sysconf(_SC_PAGESIZE) );
+        xlat_perf_jitdump_marker = NULL;
+        fclose( xlat_perf_jitdump_file );
+        xlat_perf_jitdump_file = NULL;
+    }
+    xlat_perf_flush();
+}
+
+void xlat_perf_commit_block( void *code, uint32_t size, sh4addr_t startpc, sh4addr_t endpc )
+{
+    struct xlat_perf_block block;
+
+    if( xlat_perf_map_file == NULL && xlat_perf_jitdump_file == NULL ) {
+        return;
+    }
+
+    block.code = code;
+    block.size = size;
+    block.startpc = startpc;
+    block.endpc = endpc;
+    block.index = xlat_perf_next_index++;
+    xlat_perf_insert_block( &block );
+
+    if( xlat_perf_map_file != NULL ) {
+        xlat_perf_write_map_entry( &block );
+    }
+    if( xlat_perf_jitdump_file != NULL ) {
+        struct jitdump_code_load rec;
+        char name[32];
+        int namelen = snprintf( name, sizeof(name), "sh4:%08X-%08X", startpc, endpc ) + 1;
+        rec.header.id = JIT_CODE_LOAD;
+        rec.header.total_size = sizeof(rec) + namelen + size;
+        rec.header.timestamp = xlat_perf_timestamp();
+        rec.pid = getpid();
+        rec.tid = rec.pid;
+        rec.vma = rec.code_addr = (uintptr_t)code;
+        rec.code_size = size;
+        rec.code_index = block.index;
+        fwrite( &rec, sizeof(rec), 1, xlat_perf_jitdump_file );
+        fwrite( name, namelen, 1, xlat_perf_jitdump_file );
+        fwrite( code, size, 1, xlat_perf_jitdump_file );
+        fflush( xlat_perf_jitdump_file );
+    }
+}
+
+void xlat_perf_move_block( void *old_code, void *new_code )
+{
+    struct xlat_perf_block *old = xlat_perf_find_block( old_code );
+    struct xlat_perf_block block;
+
+    if( old == NULL || old->size == 0 ) {
+        return;
+    }
+    block = *old;
+    block.code = new_code;
+    old->size = 0;
+    xlat_perf_insert_block( &block );
+
+    if( xlat_perf_map_file != NULL ) {
+        xlat_perf_write_map_entry( &block );
+    }
+    if( xlat_perf_jitdump_file != NULL ) {
+        struct jitdump_code_move rec;
+        rec.header.id = JIT_CODE_MOVE;
+        rec.header.total_size = sizeof(rec);
+        rec.header.timestamp = xlat_perf_timestamp();
+        rec.pid = getpid();
+        rec.tid = rec.pid;
+        rec.vma = (uintptr_t)new_code;
+        rec.old_code_addr = (uintptr_t)old_code;
+        rec.new_code_addr = (uintptr_t)new_code;
+        rec.code_size = block.size;
+        rec.code_index = block.index;
+        fwrite( &rec, sizeof(rec), 1, xlat_perf_jitdump_file );
+        fflush( xlat_perf_jitdump_file );
+    }
+}
+
+void xlat_perf_delete_block( void *code )
+{
+    struct xlat_perf_block *block = xlat_perf_find_block( code );
+    if( block != NULL ) {
+        block->size = 0;
+    }
+}
+
+void xlat_perf_flush( void )
+{
+    g_free( xlat_perf_blocks );
+    xlat_perf_blocks = NULL;
+    xlat_perf_blocks_size = 0;
+    xlat_perf_blocks_count = 0;
+}
@@ -0,0 +1,76 @@
+/**
+ * $Id$
+ *
+ * Linux perf support for translated code (architecture independent)
+ *
+ * Translated blocks are reported to perf as they're committed, either through
+ * a perf map (/tmp/perf-PID.map, which perf report reads directly), or a
+ * jitdump file (jit-PID.dump, which is merged into a recording with
+ * "perf inject --jit"). The jitdump also includes the code itself so that
+ * perf annotate works, and records blocks moving between cache generations.
+ * Recordings using the jitdump must be made with "perf record -k mono".
+ *
+ * Neither format can describe code being discarded - perf resolves reused
+ * addresses to the most recent block loaded there.
+ *
+ * Copyright (c) 2005 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef lxdream_xltperf_H
+#define lxdream_xltperf_H 1
+
+#include "dream.h"
+
+#define XLAT_PERF_MAP 1      /* Write /tmp/perf-PID.map */
+#define XLAT_PERF_JITDUMP 2  /* Write jit-PID.dump in the jitdump directory */
+
+/**
+ * Start reporting translated blocks to perf. The jitdump file is created in
+ * $JITDUMPDIR if set, otherwise in the current directory. Any previous output
+ * is closed first.
+ * @param flags combination of XLAT_PERF_MAP and XLAT_PERF_JITDUMP, or 0 to
+ * just close the existing output.
+ * @return TRUE on success, FALSE if any of the files couldn't be created.
+ */
+gboolean xlat_perf_open( int flags );
+
+/**
+ * Stop reporting translated blocks, and close the output files.
+ */
+void xlat_perf_close( void );
+
+/**
+ * Report a newly committed block.
+ * @param code the block code
+ * @param size size of the code in bytes (excluding the recovery table)
+ * @param startpc SH4 address of the start of the block
+ * @param endpc SH4 address of the end of the block (exclusive)
+ */
+void xlat_perf_commit_block( void *code, uint32_t size, sh4addr_t startpc, sh4addr_t endpc );
+
+/**
+ * Report a block that's been moved to a different part of the cache.
+ */
+void xlat_perf_move_block( void *old_code, void *new_code );
+
+/**
+ * Report a block that's been discarded.
+ */
+void xlat_perf_delete_block( void *code );
+
+/**
+ * Report that the entire cache has been discarded.
+ */
+void xlat_perf_flush( void );
+
+#endif /* !lxdream_xltperf_H */
@@ -0,0 +1,481 @@
+/**
+ * $Id$
+ *
+ * Persistent (on-disk) translation cache.
+ *
+ * The file consists of a header followed by a sequence of records, each of
+ * which is
+ *     struct xlat_persist_record
+ *     key (key_size bytes)
+ *     data (data_size bytes)
+ *     struct xlat_persist_reloc[reloc_count]
+ *     code (code_size bytes)
+ * New records are appended to the end of the file. On open, the file is
+ * scanned to build an index from key hash to record offset (later records
+ * for the same key replacing earlier ones). Truncated records at the end of
+ * the file (eg from a crash) are discarded.
+ *
+ * Copyright (c) 2005 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include "dream.h"
+#include "xlat/xltpersist.h"
+
+#define XLAT_PERSIST_MAGIC "LXDXLAT"
+#define XLAT_PERSIST_VERSION 4
+
+/* Maximum sizes accepted when reading the file */
+#define XLAT_PERSIST_MAX_KEY 256
+#define XLAT_PERSIST_MAX_CODE (1024*1024)
+
+#define XLAT_RELOC_SELF  0   /* Offset from the start of the block code */
+#define XLAT_RELOC_IMAGE 1   /* Offset from the start of the executable image */
+#define XLAT_RELOC_LUT   2   /* Lookup table entry for the SH4 address */
+#define XLAT_RELOC_ANCHOR 3  /* Offset from anchor (kind - XLAT_RELOC_ANCHOR) */
+
+struct xlat_persist_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t pointer_size;
+    uint64_t image_hash;
+};
+
+struct xlat_persist_record {
+    uint32_t key_size;
+    uint32_t data_size;
+    uint32_t reloc_count;
+    uint32_t code_size;
+    uint32_t recover_table_offset;
+    uint32_t recover_table_size;
+    uint32_t fixup_table_offset;
+    uint32_t fixup_table_size;
+    uint32_t xlat_sh4_mode;
+    uint32_t checksum;  /* Checksum of everything following the record header */
+};
+
+struct xlat_persist_reloc {
+    uint32_t offset;
+    uint32_t kind;
+    uint64_t value;
+};
+
+struct xlat_persist_index_entry {
+    uint64_t hash;
+    long offset;
+};
+
+static FILE *xlat_persist_file = NULL;
+static struct { uintptr_t base; size_t size; } xlat_persist_anchors[XLAT_PERSIST_MAX_ANCHORS];
+
+/* Open-addressed hash table of records, keyed by key hash (0 = empty) */
+static struct xlat_persist_index_entry *xlat_persist_index = NULL;
+static uint32_t xlat_persist_index_size = 0;
+static uint32_t xlat_persist_index_count = 0;
+
+static uint32_t xlat_persist_loaded = 0;
+static uint32_t xlat_persist_stored = 0;
+
+#if SIZEOF_VOID_P == 8 && defined(__linux__)
+/* Executable image bounds, as provided by the GNU linker */
+extern char __executable_start[], etext[], _end[];
+#define IMAGE_START ((uintptr_t)__executable_start)
+#define IMAGE_END ((uintptr_t)_end)
+#define HAVE_IMAGE_BOUNDS 1
+#endif
+
+static uint64_t xlat_persist_hash( const void *p, size_t len )
+{
+    const unsigned char *s = (const unsigned char *)p;
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    size_t i;
+    for( i=0; i<len; i++ ) {
+        hash = (hash ^ s[i]) * 0x100000001B3ULL;
+    }
+    return hash == 0 ? 1 : hash;
+}
+
+static void xlat_persist_index_insert( uint64_t hash, long offset )
+{
+    uint32_t i;
+
+    if( (xlat_persist_index_count+1)*2 > xlat_persist_index_size ) {
+        struct xlat_persist_index_entry *old = xlat_persist_index;
+        uint32_t oldsize = xlat_persist_index_size;
+        xlat_persist_index_size = oldsize == 0 ? 4096 : oldsize*2;
+        xlat_persist_index = g_malloc0( xlat_persist_index_size * sizeof(struct xlat_persist_index_entry) );
+        xlat_persist_index_count = 0;
+        for( i=0; i<oldsize; i++ ) {
+            if( old[i].hash != 0 ) {
+                xlat_persist_index_insert( old[i].hash, old[i].offset );
+            }
+        }
+        g_free(old);
+    }
+
+    for( i = hash & (xlat_persist_index_size-1); xlat_persist_index[i].hash != 0;
+         i = (i+1) & (xlat_persist_index_size-1) ) {
+        if( xlat_persist_index[i].hash == hash ) {
+            xlat_persist_index[i].offset = offset;
+            return;
+        }
+    }
+    xlat_persist_index[i].hash = hash;
+    xlat_persist_index[i].offset = offset;
+    xlat_persist_index_count++;
+}
+
+static long xlat_persist_index_lookup( uint64_t hash )
+{
+    uint32_t i;
+    if( xlat_persist_index_size == 0 ) {
+        return -1;
+    }
+    for( i = hash & (xlat_persist_index_size-1); xlat_persist_index[i].hash != 0;
+         i = (i+1) & (xlat_persist_index_size-1) ) {
+        if( xlat_persist_index[i].hash == hash ) {
+            return xlat_persist_index[i].offset;
+        }
+    }
+    return -1;
+}
+
+static uint32_t xlat_persist_record_length( struct xlat_persist_record *rec )
+{
+    return rec->key_size + rec->data_size +
+        rec->reloc_count * sizeof(struct xlat_persist_reloc) + rec->code_size;
+}
+
+/**
+ * Read the record at the current file position into a newly allocated buffer
+ * (everything following the record header).
+ * @return the buffer, or NULL if the record is invalid or truncated.
+ */
+static char *xlat_persist_read_record( struct xlat_persist_record *rec )
+{
+    char *buf;
+    uint32_t len;
+
+    if( fread( rec, sizeof(*rec), 1, xlat_persist_file ) != 1 ||
+        rec->key_size > XLAT_PERSIST_MAX_KEY || rec->code_size > XLAT_PERSIST_MAX_CODE ||
+        rec->data_size > XLAT_PERSIST_MAX_KEY ||
+        rec->reloc_count > XLAT_PERSIST_MAX_CODE / sizeof(void *) ||
+        rec->recover_table_offset > rec->code_size ||
+        (rec->fixup_table_size != XLAT_FIXUPS_UNKNOWN &&
+         (rec->fixup_table_offset > rec->code_size ||
+          rec->fixup_table_size > (rec->code_size - rec->fixup_table_offset) / sizeof(struct xlat_fixup_record))) ) {
+        return NULL;
+    }
+    len = xlat_persist_record_length(rec);
+    buf = g_malloc(len);
+    if( fread( buf, len, 1, xlat_persist_file ) != 1 ||
+        (uint32_t)xlat_persist_hash( buf, len ) != rec->checksum ) {
+        g_free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+static gboolean xlat_persist_get_header( struct xlat_persist_header *header )
+{
+#ifdef HAVE_IMAGE_BOUNDS
+    memset( header, 0, sizeof(struct xlat_persist_header) );
+    memcpy( header->magic, XLAT_PERSIST_MAGIC, sizeof(XLAT_PERSIST_MAGIC) );
+    header->version = XLAT_PERSIST_VERSION;
+    header->pointer_size = sizeof(void *);
+    header->image_hash = xlat_persist_hash( __executable_start, etext - __executable_start );
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+gboolean xlat_persist_open( const gchar *filename )
+{
+    struct xlat_persist_header header, file_header;
+    struct xlat_persist_record rec;
+    long posn;
+    char *buf;
+
+    xlat_persist_close();
+    if( !xlat_persist_get_header( &header ) ) {
+        WARN( "Persistent translation cache is not supported on this platform" );
+        return FALSE;
+    }
+
+    xlat_persist_file = fopen( filename, "r+b" );
+    if( xlat_persist_file != NULL ) {
+        if( fread( &file_header, sizeof(file_header), 1, xlat_persist_file ) != 1 ||
+            memcmp( &header, &file_header, sizeof(header) ) != 0 ) {
+            INFO( "Discarding translation cache %s (from a different build)", filename );
+            fclose( xlat_persist_file );
+            xlat_persist_file = NULL;
+        }
+    }
+    if( xlat_persist_file == NULL ) {
+        xlat_persist_file = fopen( filename, "w+b" );
+        if( xlat_persist_file == NULL ) {
+            WARN( "Unable to open translation cache %s: %s", filename, strerror(errno) );
+            return FALSE;
+        }
+        if( fwrite( &header, sizeof(header), 1, xlat_persist_file ) != 1 ) {
+            WARN( "Unable to write translation cache %s: %s", filename, strerror(errno) );
+            fclose( xlat_persist_file );
+            xlat_persist_file = NULL;
+            return FALSE;
+        }
+        fflush( xlat_persist_file );
+        return TRUE;
+    }
+
+    /* Build the index */
+    posn = ftell( xlat_persist_file );
+    while( (buf = xlat_persist_read_record( &rec )) != NULL ) {
+        xlat_persist_index_insert( xlat_persist_hash( buf, rec.key_size ), posn );
+        g_free( buf );
+        posn = ftell( xlat_persist_file );
+    }
+    /* Drop anything after the last good record */
+    fflush( xlat_persist_file );
+    if( ftruncate( fileno(xlat_persist_file), posn ) != 0 ) {
+        WARN( "Unable to truncate translation cache %s", filename );
+    }
+    INFO( "Opened translation cache %s (%d blocks)", filename, xlat_persist_index_count );
+    return TRUE;
+}
+
+void xlat_persist_close( void )
+{
+    if( xlat_persist_file != NULL ) {
+        INFO( "Translation cache: %d blocks loaded, %d stored", xlat_persist_loaded, xlat_persist_stored );
+        fclose( xlat_persist_file );
+        xlat_persist_file = NULL;
+    }
+    g_free( xlat_persist_index );
+    xlat_persist_index = NULL;
+    xlat_persist_index_size = xlat_persist_index_count = 0;
+    xlat_persist_loaded = xlat_persist_stored = 0;
+}
+
+gboolean xlat_persist_is_open( void )
+{
+    return xlat_persist_file != NULL;
+}
+
+void xlat_persist_set_anchor( int id, void *base, size_t size )
+{
+    assert( id >= 0 && id < XLAT_PERSIST_MAX_ANCHORS );
+    xlat_persist_anchors[id].base = (uintptr_t)base;
+    xlat_persist_anchors[id].size = base == NULL ? 0 : size;
+}
+
+/**
+ * Determine the relocation for the given pointer value
+ * @return TRUE if the pointer can be relocated, otherwise FALSE.
+ */
+static gboolean xlat_persist_classify( uintptr_t value, uintptr_t code, uint32_t size,
+                                       struct xlat_persist_reloc *reloc )
+{
+    sh4addr_t addr;
+    int i;
+    if( value - code < size ) {
+        reloc->kind = XLAT_RELOC_SELF;
+        reloc->value = value - code;
+        return TRUE;
+    }
+#ifdef HAVE_IMAGE_BOUNDS
+    if( value >= IMAGE_START && value < IMAGE_END ) {
+        reloc->kind = XLAT_RELOC_IMAGE;
+        reloc->value = value - IMAGE_START;
+        return TRUE;
+    }
+#endif
+    for( i=0; i<XLAT_PERSIST_MAX_ANCHORS; i++ ) {
+        if( value - xlat_persist_anchors[i].base < xlat_persist_anchors[i].size ) {
+            reloc->kind = XLAT_RELOC_ANCHOR + i;
+            reloc->value = value - xlat_persist_anchors[i].base;
+            return TRUE;
+        }
+    }
+    if( xlat_get_lut_address( (void **)value, &addr ) ) {
+        reloc->kind = XLAT_RELOC_LUT;
+        reloc->value = addr;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/**
+ * Check that the relocation can be applied to a block of the given size in
+ * the current process.
+ */
+static gboolean xlat_persist_check_reloc( struct xlat_persist_reloc *reloc, uint32_t size )
+{
+    if( reloc->offset > size - sizeof(void *) || size < sizeof(void *) ) {
+        return FALSE;
+    }
+    switch( reloc->kind ) {
+    case XLAT_RELOC_SELF:
+        return reloc->value < size;
+#ifdef HAVE_IMAGE_BOUNDS
+    case XLAT_RELOC_IMAGE:
+        return reloc->value < IMAGE_END - IMAGE_START;
+#endif
+    case XLAT_RELOC_LUT:
+        return reloc->value <= 0xFFFFFFFF;
+    default:
+        return reloc->kind >= XLAT_RELOC_ANCHOR &&
+            reloc->kind - XLAT_RELOC_ANCHOR < XLAT_PERSIST_MAX_ANCHORS &&
+            reloc->value < xlat_persist_anchors[reloc->kind - XLAT_RELOC_ANCHOR].size;
+    }
+}
+
+gboolean xlat_persist_store( const void *key, uint32_t key_size,
+                             const void *data, uint32_t data_size,
+                             void *code, uint32_t size )
+{
+    xlat_cache_block_t block = XLAT_BLOCK_FOR_CODE(code);
+    struct xlat_persist_record rec;
+    struct xlat_persist_reloc *relocs;
+    uint32_t *offsets;
+    int count = xlat_get_host_pointers( &offsets );
+    int i, nrelocs = 0;
+    char *buf;
+    long posn;
+
+    if( xlat_persist_file == NULL || count < 0 ||
+        key_size > XLAT_PERSIST_MAX_KEY || data_size > XLAT_PERSIST_MAX_KEY ) {
+        return FALSE;
+    }
+
+    rec.key_size = key_size;
+    rec.data_size = data_size;
+    rec.code_size = size;
+    rec.recover_table_offset = block->recover_table_offset;
+    rec.recover_table_size = block->recover_table_size;
+    rec.fixup_table_offset = block->fixup_table_offset;
+    rec.fixup_table_size = block->fixup_table_size;
+    rec.xlat_sh4_mode = block->xlat_sh4_mode;
+    buf = g_malloc( key_size + data_size + count * sizeof(struct xlat_persist_reloc) + size );
+    memcpy( buf, key, key_size );
+    memcpy( buf + key_size, data, data_size );
+    relocs = (struct xlat_persist_reloc *)(buf + key_size + data_size);
+    for( i=0; i<count; i++ ) {
+        uintptr_t value;
+        if( offsets[i] + sizeof(void *) > size ) {
+            continue;
+        }
+        value = *((uintptr_t *)(((uint8_t *)code) + offsets[i]));
+        if( value == 0 ) {
+            continue; /* Unused placeholder */
+        }
+        relocs[nrelocs].offset = offsets[i];
+        if( !xlat_persist_classify( value, (uintptr_t)code, size, &relocs[nrelocs] ) ) {
+            g_free( buf );
+            return FALSE;
+        }
+        nrelocs++;
+    }
+    rec.reloc_count = nrelocs;
+    memcpy( &relocs[nrelocs], code, size );
+    rec.checksum = (uint32_t)xlat_persist_hash( buf, xlat_persist_record_length(&rec) );
+
+    fseek( xlat_persist_file, 0, SEEK_END );
+    posn = ftell( xlat_persist_file );
+    if( fwrite( &rec, sizeof(rec), 1, xlat_persist_file ) != 1 ||
+        fwrite( buf, xlat_persist_record_length(&rec), 1, xlat_persist_file ) != 1 ) {
+        WARN( "Error writing translation cache, disabling" );
+        g_free( buf );
+        xlat_persist_close();
+        return FALSE;
+    }
+    xlat_persist_index_insert( xlat_persist_hash( key, key_size ), posn );
+    xlat_persist_stored++;
+    g_free( buf );
+    return TRUE;
+}
+
+xlat_cache_block_t xlat_persist_load( const void *key, uint32_t key_size,
+                                      void *data, uint32_t data_size,
+                                      sh4addr_t address )
+{
+    struct xlat_persist_record rec;
+    struct xlat_persist_reloc *relocs;
+    xlat_cache_block_t block;
+    char *buf;
+    uint8_t *code;
+    long posn;
+    int i;
+
+    if( xlat_persist_file == NULL ) {
+        return NULL;
+    }
+    posn = xlat_persist_index_lookup( xlat_persist_hash( key, key_size ) );
+    if( posn == -1 ) {
+        return NULL;
+    }
+    fseek( xlat_persist_file, posn, SEEK_SET );
+    buf = xlat_persist_read_record( &rec );
+    if( buf == NULL ) {
+        return NULL;
+    }
+    relocs = (struct xlat_persist_reloc *)(buf + rec.key_size + rec.data_size);
+    if( rec.key_size != key_size || memcmp( buf, key, key_size ) != 0 ||
+        rec.data_size != data_size ) {
+        g_free( buf );
+        return NULL;
+    }
+    for( i=0; i<rec.reloc_count; i++ ) {
+        if( !xlat_persist_check_reloc( &relocs[i], rec.code_size ) ) {
+            g_free( buf );
+            return NULL;
+        }
+    }
+    memcpy( data, buf + rec.key_size, data_size );
+
+    block = xlat_start_block( address );
+    if( block->size < rec.code_size ) {
+        block = xlat_extend_block( rec.code_size );
+    }
+    code = block->code;
+    memcpy( code, &relocs[rec.reloc_count], rec.code_size );
+    for( i=0; i<rec.reloc_count; i++ ) {
+        uintptr_t base;
+        if( relocs[i].kind == XLAT_RELOC_SELF ) {
+            base = (uintptr_t)code;
+#ifdef HAVE_IMAGE_BOUNDS
+        } else if( relocs[i].kind == XLAT_RELOC_IMAGE ) {
+            base = IMAGE_START;
+#endif
+        } else if( relocs[i].kind == XLAT_RELOC_LUT ) {
+            *((void ***)(code + relocs[i].offset)) = xlat_get_lut_entry( (sh4addr_t)relocs[i].value );
+            continue;
+        } else {
+            base = xlat_persist_anchors[relocs[i].kind - XLAT_RELOC_ANCHOR].base;
+        }
+        *((uintptr_t *)(code + relocs[i].offset)) = base + relocs[i].value;
+    }
+    block->recover_table_offset = rec.recover_table_offset;
+    block->recover_table_size = rec.recover_table_size;
+    block->fixup_table_offset = rec.fixup_table_offset;
+    block->fixup_table_size = rec.fixup_table_size;
+    block->xlat_sh4_mode = rec.xlat_sh4_mode;
+    xlat_persist_loaded++;
+    g_free( buf );
+    return block;
+}
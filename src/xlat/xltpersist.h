@@ -0,0 +1,92 @@
+/**
+ * $Id$
+ *
+ * Persistent (on-disk) translation cache (architecture independent)
+ *
+ * Committed translation blocks are written to the cache file together with
+ * a caller-supplied key (which must identify the source code and everything
+ * else that the translation depends on) and the locations of any host
+ * pointers embedded in the code (see xlat_note_host_pointer()). Each pointer
+ * is stored relative to the block itself, the executable image, or one of the
+ * registered anchors, or as the SH4 address of a lookup table entry, so that
+ * the block can be reloaded into a different process. Blocks containing any
+ * other pointers are not stored.
+ *
+ * The file is only valid for the exact executable that created it - it's
+ * discarded if the executable changes.
+ *
+ * Copyright (c) 2005 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef lxdream_xltpersist_H
+#define lxdream_xltpersist_H 1
+
+#include "dream.h"
+#include "xlat/xltcache.h"
+
+#define XLAT_PERSIST_MAX_ANCHORS 8
+
+/**
+ * Open (or create) the cache file. Any existing file is discarded if it was
+ * written by a different executable.
+ * @return TRUE on success, FALSE if the file couldn't be opened or
+ * persistence isn't supported on this host.
+ */
+gboolean xlat_persist_open( const gchar *filename );
+
+/**
+ * Close the cache file, if open.
+ */
+void xlat_persist_close( void );
+
+/**
+ * Test if the cache file is open
+ */
+gboolean xlat_persist_is_open( void );
+
+/**
+ * Register a host memory region that translated code may refer to, which
+ * isn't part of the executable image. The same id must refer to the
+ * equivalent region in every process using the cache file.
+ * @param id anchor number, 0..XLAT_PERSIST_MAX_ANCHORS-1
+ * @param base start of the region, or NULL to clear the anchor
+ * @param size size of the region in bytes
+ */
+void xlat_persist_set_anchor( int id, void *base, size_t size );
+
+/**
+ * Write the most recently committed block to the cache file.
+ * @param key identifies the block
+ * @param data additional caller data to store with the block (eg to allow
+ * the caller to re-commit it)
+ * @param code the block code
+ * @param size size of the committed block (including the recovery table)
+ * @return TRUE if the block was written, FALSE if it couldn't be (eg because
+ * it contains a pointer that can't be relocated).
+ */
+gboolean xlat_persist_store( const void *key, uint32_t key_size,
+                             const void *data, uint32_t data_size,
+                             void *code, uint32_t size );
+
+/**
+ * Load the block with the given key from the cache file into a new block,
+ * started at the given address as per xlat_start_block(). The caller is
+ * responsible for committing the block.
+ * @param data buffer to receive the data supplied to xlat_persist_store()
+ * @return the new block, or NULL if there is no block with the key.
+ */
+xlat_cache_block_t xlat_persist_load( const void *key, uint32_t key_size,
+                                      void *data, uint32_t data_size,
+                                      sh4addr_t address );
+
+#endif /* !lxdream_xltpersist_H */